@@ -23,6 +23,7 @@
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_qrng.h>
@@ -106,6 +107,9 @@ string canonicalize(const string& i_key) {
     else if (key == "qmc iterations" || key == "quasi iterations") {
         return "quasi_iterations";
     }
+    else if (key == "qmc replicas" || key == "quasi replicas") {
+        return "quasi_replicas";
+    }
     else if (key == "qmc absolute error" || key == "quasi absolute error" || key == "absolute error") {
         return "abserr";
     }
@@ -219,6 +223,9 @@ integration_strategy parse_strategy(pair<multimap<string, string>::iterator, mul
     else if (val == "quasi") {
         return MC_QUASI;
     }
+    else if (val == "cubature") {
+        return CUBATURE;
+    }
     else {
         GSL_ERROR_VAL("unknown method", GSL_EINVAL, MC_VEGAS);
     }
@@ -294,24 +301,87 @@ struct PT2x4Mu2Strategy {
 };
 
 
-ContextCollection::ContextCollection(const Configuration& conf) :
+GluonDistributionPool::~GluonDistributionPool() {
+    for (map<string, GluonDistribution*>::iterator it = gdists.begin(); it != gdists.end(); it++) {
+        delete it->second;
+    }
+    gdists.clear();
+}
+
+ContextCollection::ContextCollection(const Configuration& conf, GluonDistributionPool* gdist_pool) :
+  trace_gdist(false),
   m_config(conf),
   m_gdist(NULL),
   m_cpl(NULL),
   m_fs(NULL),
-  trace_gdist(false) {
+  m_gdist_pool(gdist_pool) {
+    // the trace wrapper deletes the distribution it wraps, so it can't wrap a pooled one
+    if (trace_gdist) {
+        m_gdist_pool = NULL;
+    }
     create_contexts();
 }
 
 ContextCollection::~ContextCollection() {
-    delete m_gdist;
+    if (m_gdist_pool == NULL) {
+        delete m_gdist;
+        for (vector<GluonDistribution*>::iterator it = m_gdist_variants.begin(); it != m_gdist_variants.end(); it++) {
+            delete *it;
+        }
+    }
     m_gdist = NULL;
+    m_gdist_variants.clear();
     delete m_cpl;
     m_cpl = NULL;
+    delete m_fs;
+    m_fs = NULL;
+    for (vector<Coupling*>::iterator it = m_cpl_variants.begin(); it != m_cpl_variants.end(); it++) {
+        delete *it;
+    }
+    m_cpl_variants.clear();
+    for (vector<FactorizationScale*>::iterator it = m_fs_variants.begin(); it != m_fs_variants.end(); it++) {
+        delete *it;
+    }
+    m_fs_variants.clear();
+}
+
+void ContextCollection::start_gdist_key(ostringstream& key, const char* type) const {
+    key.precision(17);
+    // the grid interpolation method is fixed when a distribution is constructed
+    key << type << ' ' << GluonDistribution::get_grid_interpolation();
+}
+
+template<class T>
+T* ContextCollection::pooled_gluon_distribution(const string& key) const {
+    if (m_gdist_pool == NULL) {
+        return NULL;
+    }
+    map<string, GluonDistribution*>::const_iterator it = m_gdist_pool->gdists.find(key);
+    if (it == m_gdist_pool->gdists.end()) {
+        return NULL;
+    }
+    logger << "Reusing gluon distribution " << key << endl;
+    // the key starts with the type, so the one found has the right type
+    return static_cast<T*>(it->second);
+}
+
+template<class T>
+T* ContextCollection::pool_gluon_distribution(const string& key, T* gdist) {
+    if (m_gdist_pool != NULL) {
+        m_gdist_pool->gdists[key] = gdist;
+    }
+    return gdist;
 }
 
 GBWGluonDistribution* ContextCollection::create_gbw_gluon_distribution() {
-    return new GBWGluonDistribution(Q02, x0, lambda);
+    ostringstream key;
+    start_gdist_key(key, "gbw");
+    key << ' ' << Q02 << ' ' << x0 << ' ' << lambda;
+    GBWGluonDistribution* pooled = pooled_gluon_distribution<GBWGluonDistribution>(key.str());
+    if (pooled != NULL) {
+        return pooled;
+    }
+    return pool_gluon_distribution(key.str(), new GBWGluonDistribution(Q02, x0, lambda));
 }
 
 MVGluonDistribution* ContextCollection::create_mv_gluon_distribution() {
@@ -334,8 +404,15 @@ MVGluonDistribution* ContextCollection::create_mv_gluon_distribution() {
     check_property_default(YminMV, double, parse_double, 2 * Ymin)
     check_property_default(YmaxMV, double, parse_double, Ymax - log(pTmin) + log(sqs))
     check_property_default(gdist_subinterval_limit, size_t, parse_size, 10000)
+    ostringstream key;
+    start_gdist_key(key, "mv");
+    key << ' ' << lambdaMV << ' ' << gammaMV << ' ' << q2minMV << ' ' << q2maxMV << ' ' << YminMV << ' ' << YmaxMV << ' ' << Q02 << ' ' << x0 << ' ' << lambda << ' ' << gdist_subinterval_limit;
+    MVGluonDistribution* pooled = pooled_gluon_distribution<MVGluonDistribution>(key.str());
+    if (pooled != NULL) {
+        return pooled;
+    }
     logger << "Creating MV gluon distribution with " << q2minMV << " < k2 < " << q2maxMV << ", " << YminMV << " < Y < " << YmaxMV << endl;
-    return new MVGluonDistribution(lambdaMV, gammaMV, q2minMV, q2maxMV, YminMV, YmaxMV, Q02, x0, lambda, gdist_subinterval_limit);
+    return pool_gluon_distribution(key.str(), new MVGluonDistribution(lambdaMV, gammaMV, q2minMV, q2maxMV, YminMV, YmaxMV, Q02, x0, lambda, gdist_subinterval_limit));
 }
 
 FixedSaturationMVGluonDistribution* ContextCollection::create_fmv_gluon_distribution() {
@@ -347,9 +424,16 @@ FixedSaturationMVGluonDistribution* ContextCollection::create_fmv_gluon_distribu
     // q2max = (2 qxmax + sqrt(smax) / exp(Ymin))^2 + (2 qymax)^2
     check_property_default(q2maxMV,  double, parse_double, gsl_pow_2(2 * inf + sqs / exp(Ymin)) + gsl_pow_2(2 * inf))
     check_property(YMV, double, parse_double)
-    logger << "Creating fMV gluon distribution with " << q2minMV << " < k2 < " << q2maxMV << ", Y = " << YMV << endl;
     check_property_default(gdist_subinterval_limit, size_t, parse_size, 10000)
-    return new FixedSaturationMVGluonDistribution(lambdaMV, gammaMV, q2minMV, q2maxMV, YMV, Q02, x0, lambda, gdist_subinterval_limit);
+    ostringstream key;
+    start_gdist_key(key, "fmv");
+    key << ' ' << lambdaMV << ' ' << gammaMV << ' ' << q2minMV << ' ' << q2maxMV << ' ' << YMV << ' ' << Q02 << ' ' << x0 << ' ' << lambda << ' ' << gdist_subinterval_limit;
+    FixedSaturationMVGluonDistribution* pooled = pooled_gluon_distribution<FixedSaturationMVGluonDistribution>(key.str());
+    if (pooled != NULL) {
+        return pooled;
+    }
+    logger << "Creating fMV gluon distribution with " << q2minMV << " < k2 < " << q2maxMV << ", Y = " << YMV << endl;
+    return pool_gluon_distribution(key.str(), new FixedSaturationMVGluonDistribution(lambdaMV, gammaMV, q2minMV, q2maxMV, YMV, Q02, x0, lambda, gdist_subinterval_limit));
 }
 
 PlateauPowerGluonDistribution* ContextCollection::create_pp_gluon_distribution() {
@@ -363,8 +447,49 @@ PlateauPowerGluonDistribution* ContextCollection::create_pp_gluon_distribution()
     check_property_default(YminPP,  double, parse_double, 2 * Ymin)
     check_property_default(YmaxPP,  double, parse_double, Ymax - log(pTmin) + log(sqs))
     check_property_default(gdist_subinterval_limit, size_t, parse_size, 10000)
+    ostringstream key;
+    start_gdist_key(key, "pp");
+    key << ' ' << gammaPP << ' ' << r2minPP << ' ' << r2maxPP << ' ' << YminPP << ' ' << YmaxPP << ' ' << Q02 << ' ' << x0 << ' ' << lambda << ' ' << gdist_subinterval_limit;
+    PlateauPowerGluonDistribution* pooled = pooled_gluon_distribution<PlateauPowerGluonDistribution>(key.str());
+    if (pooled != NULL) {
+        return pooled;
+    }
     logger << "Creating plateau-power gluon distribution with " << r2minPP << " < r2 < " << r2maxPP << ", " << YminPP << " < Y < " << YmaxPP << endl;
-    return new PlateauPowerGluonDistribution(gammaPP, r2minPP, r2maxPP, YminPP, YmaxPP, Q02, x0, lambda, gdist_subinterval_limit);
+    return pool_gluon_distribution(key.str(), new PlateauPowerGluonDistribution(gammaPP, r2minPP, r2maxPP, YminPP, YmaxPP, Q02, x0, lambda, gdist_subinterval_limit));
+}
+
+BKGluonDistribution* ContextCollection::create_bk_gluon_distribution() {
+    pair<multimap<string, string>::iterator, multimap<string, string>::iterator> itit;
+    double Ymin = min(Y);
+    double Ymax = max(Y);
+    double pTmin = min(pT);
+    check_property_default(q2minBK,  double, parse_double, 1e-6)
+    // the same default as q2maxMV
+    check_property_default(q2maxBK,  double, parse_double, min(gsl_pow_2(2 * inf + sqs / exp(Ymin)) + gsl_pow_2(2 * inf), 1.e4))
+    check_property_default(YminBK, double, parse_double, 2 * Ymin)
+    check_property_default(YmaxBK, double, parse_double, Ymax - log(pTmin) + log(sqs))
+    check_property_default(xinit, double, parse_double, 0.01)
+    check_property_default(satscale_source, string, parse_string, "analytic")
+    double satscale_threshold_value = 0;
+    if (satscale_source == "extract from position") {
+        check_property(satscale_threshold, double, parse_double)
+        satscale_threshold_value = satscale_threshold;
+    }
+    else if (satscale_source != "analytic") {
+        throw InvalidPropertyValueException<string>("satscale_source", satscale_source);
+    }
+    check_property_default(bk_table_megabytes, double, parse_double, 0)
+    check_property_default(bk_step_tolerance, double, parse_double, 0)
+    check_property_default(gdist_subinterval_limit, size_t, parse_size, 10000)
+    ostringstream key;
+    start_gdist_key(key, "bk");
+    key << ' ' << q2minBK << ' ' << q2maxBK << ' ' << YminBK << ' ' << YmaxBK << ' ' << xinit << ' ' << Q02 << ' ' << x0 << ' ' << lambda << ' ' << satscale_threshold_value << ' ' << bk_table_megabytes << ' ' << bk_step_tolerance << ' ' << gdist_subinterval_limit;
+    BKGluonDistribution* pooled = pooled_gluon_distribution<BKGluonDistribution>(key.str());
+    if (pooled != NULL) {
+        return pooled;
+    }
+    logger << "Creating BK gluon distribution evolved from xinit = " << xinit << " with " << q2minBK << " < k2 < " << q2maxBK << ", " << YminBK << " < Y < " << YmaxBK << endl;
+    return pool_gluon_distribution(key.str(), new BKGluonDistribution(q2minBK, q2maxBK, YminBK, YmaxBK, xinit, Q02, x0, lambda, satscale_threshold_value, bk_table_megabytes, bk_step_tolerance, gdist_subinterval_limit));
 }
 
 FileDataGluonDistribution* ContextCollection::create_file_gluon_distribution(GluonDistribution* lower_dist = NULL, GluonDistribution* upper_dist = NULL, const bool extended = false) {
@@ -378,19 +503,37 @@ FileDataGluonDistribution* ContextCollection::create_file_gluon_distribution(Glu
     check_property(gdist_momentum_filename, string, parse_string)
     check_property_default(satscale_source, string, parse_string, "analytic")
     check_property_default(xinit, double, parse_double, 0.01)
+    // the lower and upper distributions are pooled too, so the same
+    // parameters give the same pointers
+    ostringstream key;
+    start_gdist_key(key, extended ? "efile" : "file");
+    key << ' ' << gdist_position_filename << '\n' << gdist_momentum_filename << '\n' << satscale_source << ' ' << xinit << ' ' << lower_dist << ' ' << upper_dist;
+    if (satscale_source == "analytic") {
+        key << ' ' << Q02 << ' ' << x0 << ' ' << lambda;
+    }
+    else {
+        itit = m_config.equal_range(canonicalize("satscale_threshold"));
+        if (itit.first != itit.second) {
+            key << ' ' << itit.first->second;
+        }
+    }
+    FileDataGluonDistribution* pooled = pooled_gluon_distribution<FileDataGluonDistribution>(key.str());
+    if (pooled != NULL) {
+        return pooled;
+    }
     logger << "Reading gluon distribution from " << gdist_position_filename << " (pos) and " << gdist_momentum_filename << " (mom)" << endl;
 
     if (satscale_source == "analytic") {
         if (extended) {
-            return new ExtendedFileDataGluonDistribution(
+            return pool_gluon_distribution<FileDataGluonDistribution>(key.str(), new ExtendedFileDataGluonDistribution(
              gdist_position_filename, gdist_momentum_filename,
              Q02, x0, lambda, xinit,
-             lower_dist, upper_dist);
+             lower_dist, upper_dist));
         }
         else {
-            return new FileDataGluonDistribution(
+            return pool_gluon_distribution(key.str(), new FileDataGluonDistribution(
              gdist_position_filename, gdist_momentum_filename,
-             Q02, x0, lambda, xinit);
+             Q02, x0, lambda, xinit));
         }
     }
     else if (satscale_source == "extract from momentum" || satscale_source == "extract from position") {
@@ -406,15 +549,15 @@ FileDataGluonDistribution* ContextCollection::create_file_gluon_distribution(Glu
             assert(false);
         }
         if (extended) {
-            return new ExtendedFileDataGluonDistribution(
+            return pool_gluon_distribution<FileDataGluonDistribution>(key.str(), new ExtendedFileDataGluonDistribution(
              gdist_position_filename, gdist_momentum_filename,
              xinit, satscale_source_constant, satscale_threshold,
-             lower_dist, upper_dist);
+             lower_dist, upper_dist));
         }
         else {
-            return new FileDataGluonDistribution(
+            return pool_gluon_distribution(key.str(), new FileDataGluonDistribution(
              gdist_position_filename, gdist_momentum_filename,
-             xinit, satscale_source_constant, satscale_threshold);
+             xinit, satscale_source_constant, satscale_threshold));
         }
     }
     else {
@@ -435,6 +578,9 @@ GluonDistribution* ContextCollection::create_gluon_distribution(const string& gd
     else if (gdist_type == "plateau-power" || gdist_type == "pp") {
         return create_pp_gluon_distribution();
     }
+    else if (gdist_type == "bk") {
+        return create_bk_gluon_distribution();
+    }
     else if (gdist_type == "file") {
         return create_file_gluon_distribution();
     }
@@ -506,10 +652,20 @@ void ContextCollection::create_contexts() {
     check_property_default( ff_filename,  string, parse_string, "PINLO.DAT")
     check_property_default( integration_strategy, integration_strategy, parse_strategy, MC_VEGAS)
     check_property_default( cubature_iterations, size_t, parse_size, 1000000)
+    check_property_default( cubature_regions_per_step, size_t, parse_size, 0)
+    check_property_default( cubature_max_dimensions, size_t, parse_size, 2)
     check_property_default( miser_iterations, size_t, parse_size, 1000000)
     check_property_default( vegas_initial_iterations, size_t, parse_size, 100000)
     check_property_default( vegas_incremental_iterations, size_t, parse_size, 100000)
+    check_property_default( vegas_warm_initial_iterations, size_t, parse_size, 0)
+    check_property_default( vegas_max_refinements, size_t, parse_size, 0)
     check_property_default( quasi_iterations, size_t, parse_size, 1000000)
+    check_property_default( quasi_replicas, size_t, parse_size, 0)
+    check_property_default( global_error_budget, bool, parse_boolean, false)
+    check_property_default( error_budget_pilot_fraction, double, parse_double, 0.1)
+    if (!(error_budget_pilot_fraction > 0 && error_budget_pilot_fraction <= 1)) {
+        throw InvalidPropertyValueException<double>("error_budget_pilot_fraction", error_budget_pilot_fraction);
+    }
     check_property_default( abserr, double, parse_double, 1e-20)
     check_property_default( relerr, double, parse_double, 0)
     check_property_default( css_r_regularization, bool, parse_boolean, false)
@@ -518,6 +674,10 @@ void ContextCollection::create_contexts() {
     check_property_default( xif, double, parse_double, 0)
     check_property_default( X0ev, double, parse_double, 1)
     check_property_default( exact_kinematics, bool, parse_boolean, false)
+    check_property_default( parton_function_table_points, size_t, parse_size, 0)
+    if (parton_function_table_points == 1) {
+        throw InvalidPropertyValueException<size_t>("parton_function_table_points", parton_function_table_points, "a table needs at least 2 points");
+    }
 
     // Adapted from the GSL source code - basically this reimplements gsl_rng_env_setup
     if (!m_config.contains("quasirandom_generator_type")) {
@@ -562,6 +722,24 @@ void ContextCollection::create_contexts() {
 
     // create gluon distribution
     assert (m_gdist == NULL);
+    check_property_default(gdist_cache_directory, string, parse_string, "")
+    check_property_default(gdist_setup_threads, size_t, parse_size, 0)
+    AbstractTransformGluonDistribution::set_cache_directory(gdist_cache_directory);
+    AbstractTransformGluonDistribution::set_setup_threads(gdist_setup_threads);
+    check_property_default(gdist_interpolation, string, parse_string, "bilinear")
+    gdist_interpolation = trim_lower(gdist_interpolation);
+    if (gdist_interpolation == "bilinear") {
+        GluonDistribution::set_grid_interpolation(UniformGridInterpolator::BILINEAR);
+    }
+    else if (gdist_interpolation == "bicubic") {
+        GluonDistribution::set_grid_interpolation(UniformGridInterpolator::BICUBIC);
+    }
+    else if (gdist_interpolation == "interp2d") {
+        GluonDistribution::set_grid_interpolation(UniformGridInterpolator::NONE);
+    }
+    else {
+        throw InvalidPropertyValueException<string>("gdist_interpolation", gdist_interpolation);
+    }
     check_property(gdist_type, string, parse_string)
     gdist_type = trim_lower(gdist_type);
     m_gdist = create_gluon_distribution(gdist_type);
@@ -572,12 +750,91 @@ void ContextCollection::create_contexts() {
     }
     assert(m_gdist != NULL);
 
+    // create the variants, each from the settings of one value of gdist_variants
+    assert(m_gdist_variants.empty());
+    itit = m_config.equal_range(canonicalize("gdist_variants"));
+    const vector<string> gdist_variants = parse_string_vector(itit);
+    for (vector<string>::const_iterator it = gdist_variants.begin(); it != gdist_variants.end(); it++) {
+        logger << "Creating gluon distribution variant " << m_gdist_variants.size() + 1 << ": " << *it << endl;
+        GluonDistribution* variant = create_gluon_distribution_variant(*it);
+        assert(variant != NULL);
+        if (trace_gdist) {
+            variant = new GluonDistributionTraceWrapper(variant);
+        }
+        m_gdist_variants.push_back(variant);
+    }
+
     // create coupling
     assert(m_cpl == NULL);
+    m_cpl = create_coupling(Nc, Nf);
+    assert(m_cpl != NULL);
+
+    // create factorization scale strategy
+    assert(m_fs == NULL);
+    m_fs = create_factorization_scale(_c0r_optimization);
+    assert(m_fs != NULL);
+
+    // create the scale variants, each from the settings of one value of scale_variants
+    assert(m_cpl_variants.empty() && m_fs_variants.empty());
+    itit = m_config.equal_range(canonicalize("scale_variants"));
+    const vector<string> scale_variants = parse_string_vector(itit);
+    for (vector<string>::const_iterator it = scale_variants.begin(); it != scale_variants.end(); it++) {
+        logger << "Creating scale variant " << m_cpl_variants.size() + 1 << ": " << *it << endl;
+        Coupling* cpl = NULL;
+        FactorizationScale* fs = NULL;
+        create_scale_variant(*it, Nc, Nf, &cpl, &fs);
+        assert(cpl != NULL && fs != NULL);
+        m_cpl_variants.push_back(cpl);
+        m_fs_variants.push_back(fs);
+    }
+
+    // create contexts
+    for (vector<double>::iterator pTit = pT.begin(); pTit != pT.end(); pTit++) {
+        for (vector<double>::iterator Yit = Y.begin(); Yit != Y.end(); Yit++) {
+            for (vector<unsigned long int>::iterator seedit = pseudorandom_generator_seed.begin(); seedit != pseudorandom_generator_seed.end(); seedit++) {
+                double pT = *pTit;
+                double Y = *Yit;
+                unsigned long int seed = *seedit;
+                try {
+                    const Context c = {
+                      x0, mass_number, centrality, lambda, Nc, Nf, CF, TR, Sperp,
+                      gsl_pow_2(pT), sqs, Y,
+                      hardfactor_definitions, pdf_filename, ff_filename,
+                      quasirandom_generator_type, pseudorandom_generator_type, seed,
+                      m_gdist, m_gdist_variants, m_cpl, m_fs, m_cpl_variants, m_fs_variants, _c0r_optimization, css_r_regularization, css_r2_max,
+                      resummation_constant,
+                      xif,
+                      X0ev,
+                      exact_kinematics,
+                      parton_function_table_points,
+                      projectile, hadron,
+                      integration_strategy,
+                      abserr, relerr,
+                      cubature_iterations, cubature_regions_per_step, cubature_max_dimensions, miser_iterations,
+                      vegas_initial_iterations, vegas_incremental_iterations,
+                      vegas_warm_initial_iterations, vegas_max_refinements, quasi_iterations, quasi_replicas,
+                      global_error_budget, error_budget_pilot_fraction,
+                      inf, cutoff,
+                      Context::compute_Q02x0lambda(centrality, mass_number, x0, lambda),
+                      Context::compute_tau(pT, sqs, Y)
+                    };
+                    c.check_kinematics();
+                    push_back(c);
+                }
+                catch (const InvalidKinematicsException& e) {
+                    logger << "Failed to create context at pT = " << pT << ", Y = " << Y << ": " << e.what() << endl;
+                }
+            }
+        }
+    }
+}
+
+Coupling* ContextCollection::create_coupling(const double Nc, const double Nf) {
+    pair<multimap<string, string>::iterator, multimap<string, string>::iterator> itit;
     check_property(coupling_type, string, parse_string)
     if (coupling_type == "fixed") {
         check_property_default(alphas, double, parse_double, 0.2)
-        m_cpl = new FixedCoupling(alphas);
+        return new FixedCoupling(alphas);
     }
     else if (coupling_type == "running" || coupling_type == "running kT" || coupling_type == "running pT") {
         check_property_default(lambdaQCD, double, parse_double, sqrt(0.0588))
@@ -590,15 +847,13 @@ void ContextCollection::create_contexts() {
         else if (coupling_type == "running pT") {
             scale_scheme = PT;
         }
-        m_cpl = new LORunningCoupling(lambdaQCD, Ncbeta, regulator, scale_scheme);
-    }
-    else {
-        throw InvalidPropertyValueException<string>("coupling_type", coupling_type);
+        return new LORunningCoupling(lambdaQCD, Ncbeta, regulator, scale_scheme);
     }
-    assert(m_cpl != NULL);
+    throw InvalidPropertyValueException<string>("coupling_type", coupling_type);
+}
 
-    // create factorization scale strategy
-    assert(m_fs == NULL);
+FactorizationScale* ContextCollection::create_factorization_scale(bool& use_c0r_optimization) {
+    pair<multimap<string, string>::iterator, multimap<string, string>::iterator> itit;
     check_property_default(factorization_scale, string, parse_string, "fixed")
     factorization_scale = trim_lower(factorization_scale);
     if (factorization_scale == "fixed") {
@@ -609,66 +864,122 @@ void ContextCollection::create_contexts() {
          */
         itit = m_config.equal_range(canonicalize("mu2"));
         if (trim_lower(itit.first->second) == "4pt2") {
-            m_fs = new PTProportionalFactorizationScale(4);
+            return new PTProportionalFactorizationScale(4);
         }
         else {
             // this is the normal case
             check_property_default(mu2, double, parse_double, 10)
-            m_fs = new FixedFactorizationScale(mu2);
+            return new FixedFactorizationScale(mu2);
         }
     }
     else if (factorization_scale == "4pt2") {
-        m_fs = new PTProportionalFactorizationScale(4);
+        return new PTProportionalFactorizationScale(4);
     }
     else if (factorization_scale == "cpt2") {
         check_property(factorization_scale_coefficient, double, parse_double)
-        m_fs = new PTProportionalFactorizationScale(factorization_scale_coefficient);
+        return new PTProportionalFactorizationScale(factorization_scale_coefficient);
     }
     else if (factorization_scale == "c0r") {
         check_property_default(c0r_optimization, bool, parse_boolean, true)
-        _c0r_optimization = c0r_optimization;
-        m_fs = new RPerpFactorizationScale(4 * exp(-2*M_EULER)); // this value is c_0^2, with c_0 defined in the long paper
+        use_c0r_optimization = c0r_optimization;
+        return new RPerpFactorizationScale(4 * exp(-2*M_EULER)); // this value is c_0^2, with c_0 defined in the long paper
     }
-    assert(m_fs != NULL);
+    throw InvalidPropertyValueException<string>("factorization_scale", factorization_scale);
+}
 
-    // create contexts
-    for (vector<double>::iterator pTit = pT.begin(); pTit != pT.end(); pTit++) {
-        for (vector<double>::iterator Yit = Y.begin(); Yit != Y.end(); Yit++) {
-            for (vector<unsigned long int>::iterator seedit = pseudorandom_generator_seed.begin(); seedit != pseudorandom_generator_seed.end(); seedit++) {
-                double pT = *pTit;
-                double Y = *Yit;
-                unsigned long int seed = *seedit;
-                try {
-                    const Context c = {
-                      x0, mass_number, centrality, lambda, Nc, Nf, CF, TR, Sperp,
-                      gsl_pow_2(pT), sqs, Y,
-                      hardfactor_definitions, pdf_filename, ff_filename,
-                      quasirandom_generator_type, pseudorandom_generator_type, seed,
-                      m_gdist, m_cpl, m_fs, _c0r_optimization, css_r_regularization, css_r2_max,
-                      resummation_constant,
-                      xif,
-                      X0ev,
-                      exact_kinematics,
-                      projectile, hadron,
-                      integration_strategy,
-                      abserr, relerr,
-                      cubature_iterations, miser_iterations,
-                      vegas_initial_iterations, vegas_incremental_iterations, quasi_iterations,
-                      inf, cutoff,
-                      Context::compute_Q02x0lambda(centrality, mass_number, x0, lambda),
-                      Context::compute_tau(pT, sqs, Y)
-                    };
-                    c.check_kinematics();
-                    push_back(c);
-                }
-                catch (const InvalidKinematicsException& e) {
-                    logger << "Failed to create context at pT = " << pT << ", Y = " << Y << ": " << e.what() << endl;
-                }
-            }
+void ContextCollection::apply_variant_settings(const char* key, const string& spec) {
+    vector<string> settings = split(spec, ";");
+    for (vector<string>::const_iterator it = settings.begin(); it != settings.end(); it++) {
+        vector<string> kv = split(*it, "=", 2);
+        if (kv.size() != 2) {
+            throw InvalidPropertyValueException<string>(key, spec, " Each setting should be key=value.");
         }
+        m_config.set(canonicalize(kv[0]), trim(kv[1]));
     }
 }
 
+GluonDistribution* ContextCollection::create_gluon_distribution_variant(const string& spec) {
+    pair<multimap<string, string>::iterator, multimap<string, string>::iterator> itit;
+    // the variant's settings replace the configured ones only while it is created
+    const Configuration base_config = m_config;
+    const double base_Q02 = Q02, base_x0 = x0, base_lambda = lambda;
+    GluonDistribution* variant = NULL;
+    try {
+        apply_variant_settings("gdist_variants", spec);
+        // the saturation scale parameters are passed to the distribution directly
+        check_property(x0,          double, parse_double)
+        check_property(mass_number, double, parse_double)
+        check_property(centrality,  double, parse_double)
+        check_property(lambda,      double, parse_double)
+        this->Q02 = centrality * pow(mass_number, 1./3.);
+        this->x0 = x0;
+        this->lambda = lambda;
+        check_property(gdist_type, string, parse_string)
+        variant = create_gluon_distribution(trim_lower(gdist_type));
+    }
+    catch (...) {
+        m_config = base_config;
+        Q02 = base_Q02;
+        x0 = base_x0;
+        lambda = base_lambda;
+        throw;
+    }
+    m_config = base_config;
+    Q02 = base_Q02;
+    x0 = base_x0;
+    lambda = base_lambda;
+    return variant;
+}
+
+void ContextCollection::create_scale_variant(const string& spec, const double Nc, const double Nf, Coupling** cpl, FactorizationScale** fs) {
+    // the variant's settings replace the configured ones only while it is created
+    const Configuration base_config = m_config;
+    // the c0r optimization is a property of the calculation, not the scale
+    bool unused_c0r_optimization = false;
+    *cpl = NULL;
+    *fs = NULL;
+    try {
+        apply_variant_settings("scale_variants", spec);
+        *cpl = create_coupling(Nc, Nf);
+        *fs = create_factorization_scale(unused_c0r_optimization);
+    }
+    catch (...) {
+        delete *cpl;
+        *cpl = NULL;
+        m_config = base_config;
+        throw;
+    }
+    m_config = base_config;
+}
+
+size_t ContextCollection::add_contexts(const double pT, const double Y) {
+    assert(!empty());
+    // the seeds are the same at every point, so take them from the first one
+    const Context first = front();
+    vector<unsigned long int> seeds;
+    for (const_iterator it = begin(); it != end() && it->pT2 == first.pT2 && it->Y == first.Y; it++) {
+        seeds.push_back(it->pseudorandom_generator_seed);
+    }
+    size_t added = 0;
+    for (vector<unsigned long int>::const_iterator seedit = seeds.begin(); seedit != seeds.end(); seedit++) {
+        Context c = first;
+        c.pT2 = gsl_pow_2(pT);
+        c.Y = Y;
+        c.tau = Context::compute_tau(pT, c.sqs, Y);
+        c.pseudorandom_generator_seed = *seedit;
+        try {
+            c.check_kinematics();
+            push_back(c);
+            added++;
+        }
+        catch (const InvalidKinematicsException& e) {
+            logger << "Failed to create context at pT = " << pT << ", Y = " << Y << ": " << e.what() << endl;
+            break;
+        }
+    }
+    return added;
+}
+
 const Configuration& ContextCollection::config() const {
     return m_config;
 }
@@ -687,6 +998,9 @@ std::ostream& operator<<(std::ostream& out, const integration_strategy& strategy
         case MC_QUASI:
             out << "quasi";
             break;
+        case CUBATURE:
+            out << "cubature";
+            break;
     }
     return out;
 }
@@ -749,23 +1063,37 @@ std::ostream& operator<<(std::ostream& out, const Context& ctx) {
     out << "hadron\t= " << ctx.hadron << endl;
     out << "integration_strategy\t= " << ctx.strategy << endl;
     out << "cubature_iterations\t= " << ctx.cubature_iterations << endl;
+    out << "cubature_regions_per_step\t= " << ctx.cubature_regions_per_step << endl;
+    out << "cubature_max_dimensions\t= " << ctx.cubature_max_dimensions << endl;
     out << "miser_iterations\t= " << ctx.miser_iterations << endl;
     out << "vegas_initial_iterations\t= " << ctx.vegas_initial_iterations << endl;
     out << "vegas_incremental_iterations\t= " << ctx.vegas_incremental_iterations << endl;
+    out << "vegas_warm_initial_iterations\t= " << ctx.vegas_warm_initial_iterations << endl;
+    out << "vegas_max_refinements\t= " << ctx.vegas_max_refinements << endl;
     out << "quasi_iterations\t= " << ctx.quasi_iterations << endl;
+    out << "quasi_replicas\t= " << ctx.quasi_replicas << endl;
+    out << "global_error_budget\t= " << ctx.global_error_budget << endl;
+    out << "error_budget_pilot_fraction\t= " << ctx.error_budget_pilot_fraction << endl;
     out << "abserr\t= " << ctx.abserr << endl;
     out << "relerr\t= " << ctx.relerr << endl;
     out << "inf\t= " << ctx.inf << endl;
     out << "cutoff\t= " << ctx.cutoff << endl;
-    out << "gluon distribution\t = " << ctx.gdist << endl;
-    out << "coupling\t = " << ctx.cpl << endl;
-    out << "factorization scale\t = " << ctx.fs << endl;
+    out << "gluon distribution\t = " << *ctx.gdist << endl;
+    for (size_t i = 0; i < ctx.gdist_variants.size(); i++) {
+        out << "gluon distribution variant " << i + 1 << "\t = " << *ctx.gdist_variants[i] << endl;
+    }
+    out << "coupling\t = " << *ctx.cpl << endl;
+    out << "factorization scale\t = " << *ctx.fs << endl;
+    for (size_t i = 0; i < ctx.cpl_variants.size(); i++) {
+        out << "scale variant " << i + 1 << "\t = " << *ctx.cpl_variants[i] << ", " << *ctx.fs_variants[i] << endl;
+    }
     out << "c0r optimization\t = " << ctx.c0r_optimization << endl;
     out << "CSS r regularization\t = " << ctx.css_r_regularization << endl;
     out << "CSS r_max\t = " << ctx.css_r2_max << endl;
     out << "resummation constant\t = " << ctx.resummation_constant << endl;
     out << "rapidity factorization scale\t = " << ctx.xif << endl;
     out << "exact kinematics\t = " << ctx.exact_kinematics << endl;
+    out << "parton function table points\t = " << ctx.parton_function_table_points << endl;
     out << "quasirandom generator type: " <<  ctx.quasirandom_generator_type->name << endl;
     out << "pseudorandom generator type: " <<  ctx.pseudorandom_generator_type->name << endl;
     out << "pseudorandom generator seed: " << ctx.pseudorandom_generator_seed << endl;
@@ -790,6 +1118,7 @@ void Context::check_kinematics() const {
 ThreadLocalContext::ThreadLocalContext(const Context& ctx) :
   pdf_object(new c_mstwpdf(ctx.pdf_filename.c_str())),
   ff_object(new DSSpiNLO(ctx.ff_filename.c_str())) {
+    ff_object->select_hadron(ctx.hadron);
 }
 
 ThreadLocalContext::ThreadLocalContext(const ContextCollection& cc) :
@@ -804,9 +1133,68 @@ ThreadLocalContext::ThreadLocalContext(const ContextCollection& cc) :
         throw "no FF filename";
     }
     ff_object = new DSSpiNLO(it->second.c_str());
+    // all the contexts in a collection share the same hadron
+    if (!cc.empty()) {
+        ff_object->select_hadron(cc[0].hadron);
+    }
 }
 
 ThreadLocalContext::~ThreadLocalContext() {
     delete pdf_object;
     delete ff_object;
 }
+
+ThreadLocalContextPool::ThreadLocalContextPool() {
+    pthread_mutex_init(&mutex, NULL);
+}
+
+ThreadLocalContextPool::~ThreadLocalContextPool() {
+    for (map<ThreadLocalContext*, string>::iterator it = keys.begin(); it != keys.end(); it++) {
+        delete it->first;
+    }
+    keys.clear();
+    idle.clear();
+    pthread_mutex_destroy(&mutex);
+}
+
+ThreadLocalContext* ThreadLocalContextPool::acquire(const ContextCollection& cc) {
+    multimap<string,string>::const_iterator it = cc.config().find("pdf_filename");
+    if (it == cc.config().end()) {
+        throw "no PDF filename";
+    }
+    string key = it->second;
+    it = cc.config().find("ff_filename");
+    if (it == cc.config().end()) {
+        throw "no FF filename";
+    }
+    key += "\n" + it->second;
+
+    ThreadLocalContext* tlctx = NULL;
+    pthread_mutex_lock(&mutex);
+    multimap<string, ThreadLocalContext*>::iterator idle_it = idle.find(key);
+    if (idle_it != idle.end()) {
+        tlctx = idle_it->second;
+        idle.erase(idle_it);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (tlctx == NULL) {
+        // reading the files takes a while, so it happens outside the lock
+        tlctx = new ThreadLocalContext(cc);
+        pthread_mutex_lock(&mutex);
+        keys[tlctx] = key;
+        pthread_mutex_unlock(&mutex);
+    }
+    else if (!cc.empty()) {
+        tlctx->ff_object->select_hadron(cc[0].hadron);
+    }
+    return tlctx;
+}
+
+void ThreadLocalContextPool::release(ThreadLocalContext* tlctx) {
+    pthread_mutex_lock(&mutex);
+    map<ThreadLocalContext*, string>::const_iterator it = keys.find(tlctx);
+    assert(it != keys.end());
+    idle.insert(pair<string, ThreadLocalContext*>(it->second, tlctx));
+    pthread_mutex_unlock(&mutex);
+}
@@ -26,6 +26,7 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <pthread.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_qrng.h>
 #include "../mstwpdf.h"
@@ -38,7 +39,7 @@
 /**
  * Enumerates the types of Monte Carlo integration available
  */
-typedef enum {MC_PLAIN, MC_MISER, MC_VEGAS, MC_QUASI} integration_strategy;
+typedef enum {MC_PLAIN, MC_MISER, MC_VEGAS, MC_QUASI, CUBATURE} integration_strategy;
 
 /**
  * Enumerates the types of projectile available
@@ -200,10 +201,22 @@ public:
 
     /** The gluon distribution */
     GluonDistribution* gdist;
+    /**
+     * The additional gluon distributions given by gdist_variants, which are
+     * evaluated at the same points as `gdist` and each get their own results
+     */
+    std::vector<GluonDistribution*> gdist_variants;
     /** The coupling */
     Coupling* cpl;
     /** The factorization scale */
     FactorizationScale* fs;
+    /**
+     * The additional couplings and factorization scales given by
+     * scale_variants, in pairs with the same index, which are evaluated at
+     * the same points as `cpl` and `fs` and each get their own results
+     */
+    std::vector<Coupling*> cpl_variants;
+    std::vector<FactorizationScale*> fs_variants;
     /** Whether to apply the optimization that sets ln(c_0^2/(r^2 mu^2)) to zero */
     bool c0r_optimization;
     /**
@@ -234,6 +247,13 @@ public:
     /** Whether to use exact (or approximate) kinematic expressions */
     bool exact_kinematics;
 
+    /**
+     * The number of points along each axis of the tables of parton factors
+     * (see PartonFunctionTable), or 0 to evaluate the PDFs and FFs directly
+     * at every point
+     */
+    size_t parton_function_table_points;
+
     /** Projectile type */
     projectile_type projectile;
     /** Product hadron */
@@ -248,6 +268,13 @@ public:
 
     /** Number of iterations for cubature */
     size_t cubature_iterations;
+    /** The smallest number of regions for cubature to subdivide at each
+     * step, or 0 to choose it from the number of integration threads */
+    size_t cubature_regions_per_step;
+    /** The largest number of dimensions for which terms are integrated by
+     * cubature rather than by the integration strategy, unless the strategy
+     * is CUBATURE, which uses cubature for all of them */
+    size_t cubature_max_dimensions;
     /** Number of MISER iterations
      * (unused unless integration strategy is MISER) */
     size_t miser_iterations;
@@ -257,9 +284,26 @@ public:
     /** Number of VEGAS iterations when actually integrating
      * (unused unless integration strategy is VEGAS) */
     size_t vegas_incremental_iterations;
+    /** Number of VEGAS iterations when tuning a grid left by a previous
+     * integration, or 0 to start every integration from a uniform grid
+     * (unused unless integration strategy is VEGAS) */
+    size_t vegas_warm_initial_iterations;
+    /** The largest number of VEGAS steps after the first, or 0 for no limit
+     * (unused unless integration strategy is VEGAS) */
+    size_t vegas_max_refinements;
     /** Number of iterations in quasi Monte Carlo
      * (unusued unless integration strategy is QUASI) */
     size_t quasi_iterations;
+    /** Number of randomly shifted copies of the quasirandom sequence to
+     * average, from whose spread the error is estimated, or 0 to use the
+     * unshifted sequence alone (unused unless integration strategy is QUASI) */
+    size_t quasi_replicas;
+    /** Whether to aim for the error target on the sum of all the integrals
+     * rather than on each one, sharing out the iterations accordingly */
+    bool global_error_budget;
+    /** The fraction of the iterations used for the pilot pass when
+     * global_error_budget is set */
+    double error_budget_pilot_fraction;
 
     /** The limit of integration over infinite regions */
     double inf;
@@ -281,6 +325,28 @@ public:
     void check_kinematics() const;
 };
 
+/**
+ * The gluon distributions created by the ContextCollections that use it,
+ * each under a key made of its type and all its constructor arguments, so
+ * that a later collection whose gluon distribution has the same parameters
+ * reuses the one already set up instead of creating it again. This is for
+ * running several configurations in one process; see --batch.
+ *
+ * The pool owns the gluon distributions and has to outlive the collections.
+ */
+class GluonDistributionPool {
+public:
+    GluonDistributionPool() {}
+    ~GluonDistributionPool();
+private:
+    friend class ContextCollection;
+    std::map<std::string, GluonDistribution*> gdists;
+
+    // not copyable
+    GluonDistributionPool(const GluonDistributionPool&);
+    GluonDistributionPool& operator=(const GluonDistributionPool&);
+};
+
 /**
  * The "context factory" and a repository for all settings.
  *
@@ -306,8 +372,12 @@ public:
     /**
      * Construct a ContextCollection and initialize it with settings
      * read from the named file.
+     *
+     * If `gdist_pool` is not NULL, the gluon distributions are taken from
+     * it when it has one with the same parameters, and added to it
+     * otherwise, and the pool keeps them when the collection is destroyed.
      */
-    ContextCollection(const Configuration& conf);
+    ContextCollection(const Configuration& conf, GluonDistributionPool* gdist_pool = NULL);
 
     ~ContextCollection();
 
@@ -322,6 +392,16 @@ public:
      */
     bool trace_gdist;
 
+    /**
+     * Adds a Context at the given pT and Y for each seed, identical to the
+     * ones created from the configuration apart from the kinematics, and
+     * returns the number added, which is 0 if the kinematics are invalid.
+     *
+     * The gluon distribution is set up for the range of the configured
+     * values of pT and Y, so the new point should lie within that range.
+     */
+    size_t add_contexts(const double pT, const double Y);
+
     friend class ThreadLocalContext;
 
 protected:
@@ -337,8 +417,39 @@ protected:
     MVGluonDistribution* create_mv_gluon_distribution();
     FixedSaturationMVGluonDistribution* create_fmv_gluon_distribution();
     PlateauPowerGluonDistribution* create_pp_gluon_distribution();
+    BKGluonDistribution* create_bk_gluon_distribution();
     FileDataGluonDistribution* create_file_gluon_distribution(GluonDistribution* lower_dist, GluonDistribution* upper_dist, const bool extended);
     GluonDistribution* create_gluon_distribution(const string&);
+    /**
+     * Creates the gluon distribution with the settings of one value of
+     * gdist_variants in place of the configured ones
+     */
+    GluonDistribution* create_gluon_distribution_variant(const string& spec);
+    Coupling* create_coupling(const double Nc, const double Nf);
+    /**
+     * Creates the factorization scale, setting `use_c0r_optimization` if it
+     * is c0r and the optimization is enabled
+     */
+    FactorizationScale* create_factorization_scale(bool& use_c0r_optimization);
+    /**
+     * Creates the coupling and factorization scale with the settings of one
+     * value of scale_variants in place of the configured ones
+     */
+    void create_scale_variant(const string& spec, const double Nc, const double Nf, Coupling** cpl, FactorizationScale** fs);
+    /**
+     * Replaces the configured settings with the semicolon-separated
+     * key=value settings in `spec`, a value of the configuration key `key`
+     */
+    void apply_variant_settings(const char* key, const string& spec);
+    /**
+     * Starts the key under which a gluon distribution of type `type` is
+     * pooled, which the caller completes with the constructor arguments
+     */
+    void start_gdist_key(std::ostringstream& key, const char* type) const;
+    /** The gluon distribution pooled under `key`, or NULL if there is none */
+    template<class T> T* pooled_gluon_distribution(const std::string& key) const;
+    /** Adds `gdist` to the pool, if there is one, under `key`, and returns it */
+    template<class T> T* pool_gluon_distribution(const std::string& key, T* gdist);
 
 private:
     /**
@@ -349,6 +460,10 @@ private:
      * The gluon distribution. NULL until contexts are created.
      */
     GluonDistribution* m_gdist;
+    /**
+     * The variant gluon distributions. Empty until contexts are created.
+     */
+    vector<GluonDistribution*> m_gdist_variants;
     /**
      * The coupling. NULL until contexts are created.
      */
@@ -357,6 +472,14 @@ private:
      * The factorization scale strategy. NULL until contexts are created.
      */
     FactorizationScale* m_fs;
+    /**
+     * The couplings and factorization scales of the scale variants. Empty
+     * until contexts are created.
+     */
+    vector<Coupling*> m_cpl_variants;
+    vector<FactorizationScale*> m_fs_variants;
+    /** The pool the gluon distributions belong to, or NULL if they belong to this collection */
+    GluonDistributionPool* m_gdist_pool;
 
     /* Disallow copying, because the memory management in this class is terrible.
      * If you want to implement reference-counting or something, no reason this
@@ -394,11 +517,45 @@ private:
      */
     DSSpiNLO* ff_object;
 
+    friend class ThreadLocalContextPool;
+
 public:
     ThreadLocalContext(const Context& ctx);
     ThreadLocalContext(const ContextCollection& cc);
     ~ThreadLocalContext();
 };
 
+/**
+ * The ThreadLocalContext objects that have been used for ContextCollections
+ * with given PDF and FF files, kept so that when one is needed again for
+ * the same files, the data doesn't have to be read in again. This is for
+ * running several configurations in one process; see --batch.
+ *
+ * Unlike the other pools, this one is thread safe, because the worker
+ * threads of a calculation each take their own ThreadLocalContext.
+ */
+class ThreadLocalContextPool {
+public:
+    ThreadLocalContextPool();
+    ~ThreadLocalContextPool();
+    /**
+     * Returns a ThreadLocalContext for the PDF and FF files and the hadron of
+     * `cc` that no one else is using, creating one if necessary
+     */
+    ThreadLocalContext* acquire(const ContextCollection& cc);
+    /** Returns `tlctx`, from acquire(), to the pool */
+    void release(ThreadLocalContext* tlctx);
+private:
+    /** The contexts not in use, keyed by their PDF and FF files */
+    std::multimap<std::string, ThreadLocalContext*> idle;
+    /** The key of each context, including the ones in use */
+    std::map<ThreadLocalContext*, std::string> keys;
+    pthread_mutex_t mutex;
+
+    // not copyable
+    ThreadLocalContextPool(const ThreadLocalContextPool&);
+    ThreadLocalContextPool& operator=(const ThreadLocalContextPool&);
+};
+
 
 #endif // _CONTEXT_H_
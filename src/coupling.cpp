@@ -24,34 +24,6 @@
 using namespace std;
 
 
-static inline double square(double x, double y) {
-    return x * x + y * y;
-}
-
-static inline double scale(const IntegrationContext& ictx, const CouplingScale scale) {
-    switch (scale) {
-        case KT:
-            return ictx.kT2;
-        case PT:
-            return ictx.ctx.pT2;
-        case Q1:
-            return ictx.q12;
-        case Q2:
-            return ictx.q22;
-        case Q3:
-            return ictx.q32;
-        case KQ1:
-            return square(ictx.kT - ictx.q1x, ictx.q1y);
-        case KQ2:
-            return square(ictx.kT - ictx.q2x, ictx.q2y);
-        case KQ3:
-            return square(ictx.kT - ictx.q3x, ictx.q3y);
-        default:
-            assert(false);
-    }
-}
-
-
 FixedCoupling::FixedCoupling(const double alphas) : value(alphas) {
     ostringstream s;
     s << "Fixed(alphas = " << value << ")";
@@ -74,8 +46,7 @@ LORunningCoupling::LORunningCoupling(const double LambdaQCD, const double Ncbeta
     _name = s.str();
 }
 double LORunningCoupling::alphas(const IntegrationContext& ictx) const {
-    double l_scale = scale(ictx, m_scale_scheme);
-    return coefficient / (log(l_scale + regulator) - log_LambdaQCD);
+    return alphas_at(ictx.coupling_scale2(m_scale_scheme));
 }
 const string& LORunningCoupling::name() const {
     return _name;
@@ -44,6 +44,8 @@ private:
 public:
     FixedCoupling(const double alphas);
     double alphas(const IntegrationContext& ictx) const;
+    /** The value of the coupling, which doesn't depend on anything */
+    double value_alphas() const { return value; }
     const std::string& name() const;
 };
 
@@ -57,6 +59,11 @@ private:
 public:
     LORunningCoupling(const double LambdaQCD, const double Ncbeta, const double regulator, const CouplingScale scale_scheme);
     double alphas(const IntegrationContext& ictx) const;
+    /** The value of the coupling at the squared scale `scale2` */
+    double alphas_at(const double scale2) const {
+        return coefficient / (log(scale2 + regulator) - log_LambdaQCD);
+    }
+    CouplingScale scale_scheme() const { return m_scale_scheme; }
     const std::string& name() const;
 };
 
@@ -22,15 +22,87 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <set>
+#include <string>
+#include <pthread.h>
 #include <gsl/gsl_interp.h>
 #include "dss_pinlo.h"
 #include "interp2d.h"
 
-DSSpiNLO::DSSpiNLO(const char* filename) :
+/**
+ * The grids of fragmentation functions read from one data file. These are
+ * only changed while the table is being constructed, so the DSSpiNLO objects
+ * sharing it can read it from any thread.
+ */
+struct DSSpiNLO::Table {
+    Table(const char* filename);
+    ~Table();
+
+    size_t number_of_lnz_values;
+    size_t number_of_lnqs2_values;
+
+    double* lnz_array;
+    double* lnqs2_array;
+    /** The pi+ fragmentation function of each flavor at the grid points */
+    double* ff_arrays[number_of_flavors];
+    /** There's one interpolator for each FF */
+    interp2d* interpolators[number_of_flavors];
+    /**
+     * The fragmentation functions of each hadron at the grid points, one
+     * array for each flavor, laid out like `ff_arrays`, for select_hadron()
+     */
+    double* hadron_arrays[3][number_of_flavors];
+
+    /** The number of DSSpiNLO objects using the table, protected by tables_mutex */
+    size_t references;
+
+    /** The table for `filename`, which is read if no other object is using it */
+    static const Table* acquire(const char* filename);
+    /** Stops using `table`, freeing it if no other object is using it */
+    static void release(const Table* table);
+
+    /** The tables that have been read, by filename */
+    static std::map<std::string, Table*> tables;
+    /** Protects `tables` and the reference counts of the tables in it */
+    static pthread_mutex_t tables_mutex;
+};
+
+std::map<std::string, DSSpiNLO::Table*> DSSpiNLO::Table::tables;
+pthread_mutex_t DSSpiNLO::Table::tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The flavor whose pi+ fragmentation function is the pi- fragmentation
+ * function of `f`, by charge conjugation
+ */
+static DSSpiNLO::flavor conjugate(const DSSpiNLO::flavor f) {
+    switch (f) {
+        case DSSpiNLO::up:          return DSSpiNLO::up_bar;
+        case DSSpiNLO::up_bar:      return DSSpiNLO::up;
+        case DSSpiNLO::down:        return DSSpiNLO::down_bar;
+        case DSSpiNLO::down_bar:    return DSSpiNLO::down;
+        case DSSpiNLO::strange:     return DSSpiNLO::strange_bar;
+        case DSSpiNLO::strange_bar: return DSSpiNLO::strange;
+        case DSSpiNLO::charm:       return DSSpiNLO::charm_bar;
+        case DSSpiNLO::charm_bar:   return DSSpiNLO::charm;
+        case DSSpiNLO::gluon:       return DSSpiNLO::gluon;
+        default:
+            assert(false);
+            return f;
+    }
+}
+
+DSSpiNLO::Table::Table(const char* filename) :
  number_of_lnz_values(0), number_of_lnqs2_values(0),
- lnz_array(NULL), lnqs2_array(NULL), ff_arrays(NULL),
- m_filename(filename) {
+ lnz_array(NULL), lnqs2_array(NULL),
+ references(0) {
+    for (size_t i = 0; i < number_of_flavors; i++) {
+        ff_arrays[i] = NULL;
+        interpolators[i] = NULL;
+        for (size_t h = 0; h < 3; h++) {
+            hadron_arrays[h][i] = NULL;
+        }
+    }
     std::cerr << "Reading FF data from file " << filename << std::endl;
     double lnz;
     double lnqs2;
@@ -66,11 +138,11 @@ DSSpiNLO::DSSpiNLO(const char* filename) :
         exit(1);
     }
 
+    const size_t grid_size = number_of_lnz_values * number_of_lnqs2_values;
     lnz_array = new double[number_of_lnz_values];
     lnqs2_array = new double[number_of_lnqs2_values];
-    ff_arrays = new double*[number_of_flavors];
     for (size_t i = 0; i < number_of_flavors; i++) {
-        ff_arrays[i] = new double[number_of_lnz_values * number_of_lnqs2_values];
+        ff_arrays[i] = new double[grid_size];
     }
 
     input.clear(); // have to clear the EOF bit before seeking
@@ -102,50 +174,161 @@ DSSpiNLO::DSSpiNLO(const char* filename) :
 
     // construct interpolation objects
     for (size_t i = 0; i < number_of_flavors; i++) {
-        lnz_accel[i] = gsl_interp_accel_alloc();
-        lnqs2_accel[i] = gsl_interp_accel_alloc();
         // TODO: change to bicubic once it's tested
         interpolators[i] = interp2d_alloc(interp2d_bilinear, number_of_lnz_values, number_of_lnqs2_values);
         interp2d_init(interpolators[i], lnz_array, lnqs2_array, ff_arrays[i], number_of_lnz_values, number_of_lnqs2_values);
     }
 
+    // the grids of each hadron for select_hadron()
+    for (size_t i = 0; i < number_of_flavors; i++) {
+        const double* ff = ff_arrays[i];
+        const double* ff_conjugate = ff_arrays[conjugate(static_cast<flavor>(i))];
+        double* plus = hadron_arrays[pi_plus][i] = new double[grid_size];
+        double* minus = hadron_arrays[pi_minus][i] = new double[grid_size];
+        double* zero = hadron_arrays[pi_zero][i] = new double[grid_size];
+        for (size_t j = 0; j < grid_size; j++) {
+            plus[j] = ff[j];
+            minus[j] = ff_conjugate[j];
+            zero[j] = 0.5 * (ff[j] + ff_conjugate[j]);
+        }
+    }
+
     std::cerr << "Done initializing DSSpiNLO" << std::endl;
 }
 
-DSSpiNLO::~DSSpiNLO() {
+DSSpiNLO::Table::~Table() {
     for (size_t i = 0; i < number_of_flavors; i++) {
-        gsl_interp_accel_free(lnz_accel[i]);
-        lnz_accel[i] = NULL;
-        gsl_interp_accel_free(lnqs2_accel[i]);
-        lnqs2_accel[i] = NULL;
         interp2d_free(interpolators[i]);
         interpolators[i] = NULL;
         delete[] ff_arrays[i];
         ff_arrays[i] = NULL;
+        for (size_t h = 0; h < 3; h++) {
+            delete[] hadron_arrays[h][i];
+            hadron_arrays[h][i] = NULL;
+        }
     }
-    delete[] ff_arrays;
-    ff_arrays = NULL;
     delete[] lnz_array;
     lnz_array = NULL;
     delete[] lnqs2_array;
     lnqs2_array = NULL;
 }
 
+const DSSpiNLO::Table* DSSpiNLO::Table::acquire(const char* filename) {
+    pthread_mutex_lock(&tables_mutex);
+    Table*& table = tables[filename];
+    if (table == NULL) {
+        try {
+            table = new Table(filename);
+        }
+        catch (...) {
+            tables.erase(filename);
+            pthread_mutex_unlock(&tables_mutex);
+            throw;
+        }
+    }
+    table->references++;
+    pthread_mutex_unlock(&tables_mutex);
+    return table;
+}
+
+void DSSpiNLO::Table::release(const Table* table) {
+    pthread_mutex_lock(&tables_mutex);
+    for (std::map<std::string, Table*>::iterator it = tables.begin(); it != tables.end(); it++) {
+        if (it->second == table) {
+            if (--it->second->references == 0) {
+                delete it->second;
+                tables.erase(it);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tables_mutex);
+}
+
+DSSpiNLO::DSSpiNLO(const char* filename) :
+ table(Table::acquire(filename)),
+ m_filename(filename),
+ m_fused(false), m_selected_hadron(pi_plus),
+ fused_arrays(NULL),
+ fused_lnz_accel(NULL), fused_lnqs2_accel(NULL) {
+    for (size_t i = 0; i < number_of_flavors; i++) {
+        lnz_accel[i] = gsl_interp_accel_alloc();
+        lnqs2_accel[i] = gsl_interp_accel_alloc();
+    }
+}
+
+DSSpiNLO::~DSSpiNLO() {
+    for (size_t i = 0; i < number_of_flavors; i++) {
+        gsl_interp_accel_free(lnz_accel[i]);
+        lnz_accel[i] = NULL;
+        gsl_interp_accel_free(lnqs2_accel[i]);
+        lnqs2_accel[i] = NULL;
+    }
+    if (fused_lnz_accel != NULL) {
+        gsl_interp_accel_free(fused_lnz_accel);
+        fused_lnz_accel = NULL;
+    }
+    if (fused_lnqs2_accel != NULL) {
+        gsl_interp_accel_free(fused_lnqs2_accel);
+        fused_lnqs2_accel = NULL;
+    }
+    Table::release(table);
+    table = NULL;
+}
+
 const char* DSSpiNLO::filename() {
     return m_filename;
 }
 
 
+void DSSpiNLO::select_hadron(hadron h) {
+    assert(h == pi_plus || h == pi_zero || h == pi_minus);
+    fused_arrays = table->hadron_arrays[h];
+    if (fused_lnz_accel == NULL) {
+        fused_lnz_accel = gsl_interp_accel_alloc();
+        fused_lnqs2_accel = gsl_interp_accel_alloc();
+    }
+    m_selected_hadron = h;
+    m_fused = true;
+}
+
 void DSSpiNLO::update(double z, double qs2) {
     lnz = log(z);
     lnqs2 = log(qs2);
+    if (m_fused) {
+        const double* lnz_array = table->lnz_array;
+        const double* lnqs2_array = table->lnqs2_array;
+        const size_t number_of_lnz_values = table->number_of_lnz_values;
+        const size_t number_of_lnqs2_values = table->number_of_lnqs2_values;
+        if (lnz < lnz_array[0] || lnz > lnz_array[number_of_lnz_values-1] || lnqs2 < lnqs2_array[0] || lnqs2 > lnqs2_array[number_of_lnqs2_values-1]) {
+            throw FragmentationFunctionRangeException(z, qs2);
+        }
+        // the same bilinear interpolation as interp2d_bilinear, sharing the cell lookup among the flavors
+        size_t iz = gsl_interp_accel_find(fused_lnz_accel, lnz_array, number_of_lnz_values, lnz);
+        size_t iq = gsl_interp_accel_find(fused_lnqs2_accel, lnqs2_array, number_of_lnqs2_values, lnqs2);
+        double t = (lnz - lnz_array[iz]) / (lnz_array[iz + 1] - lnz_array[iz]);
+        double u = (lnqs2 - lnqs2_array[iq]) / (lnqs2_array[iq + 1] - lnqs2_array[iq]);
+        double w00 = (1 - t) * (1 - u) / z;
+        double w10 = t * (1 - u) / z;
+        double w11 = t * u / z;
+        double w01 = (1 - t) * u / z;
+        size_t i00 = INDEX_2D(iz, iq, number_of_lnz_values, number_of_lnqs2_values);
+        size_t i10 = INDEX_2D(iz + 1, iq, number_of_lnz_values, number_of_lnqs2_values);
+        size_t i11 = INDEX_2D(iz + 1, iq + 1, number_of_lnz_values, number_of_lnqs2_values);
+        size_t i01 = INDEX_2D(iz, iq + 1, number_of_lnz_values, number_of_lnqs2_values);
+        for (size_t i = 0; i < number_of_flavors; i++) {
+            const double* ff = fused_arrays[i];
+            selected_ff[i] = w00 * ff[i00] + w10 * ff[i10] + w11 * ff[i11] + w01 * ff[i01];
+        }
+        return;
+    }
     // loop takes care of u, ubar, d, dbar, s, sbar, c??, cbar??, gluons
     // all fragmenting to pi+
     for (size_t i = 0; i < number_of_flavors; i++) {
-        if (lnz < lnz_array[0] || lnz > lnz_array[number_of_lnz_values-1] || lnqs2 < lnqs2_array[0] || lnqs2 > lnqs2_array[number_of_lnqs2_values-1]) {
+        if (lnz < table->lnz_array[0] || lnz > table->lnz_array[table->number_of_lnz_values-1] || lnqs2 < table->lnqs2_array[0] || lnqs2 > table->lnqs2_array[table->number_of_lnqs2_values-1]) {
             throw FragmentationFunctionRangeException(z, qs2);
         }
-        pi_plus_ff[i] = interp2d_eval(interpolators[i], lnz_array, lnqs2_array, ff_arrays[i], lnz, lnqs2, lnz_accel[i], lnqs2_accel[i]) / z;
+        pi_plus_ff[i] = interp2d_eval(table->interpolators[i], table->lnz_array, table->lnqs2_array, table->ff_arrays[i], lnz, lnqs2, lnz_accel[i], lnqs2_accel[i]) / z;
     }
     pi_minus_ff[up] = pi_plus_ff[up_bar];
     pi_minus_ff[up_bar] = pi_plus_ff[up];
@@ -163,6 +346,10 @@ void DSSpiNLO::update(double z, double qs2) {
 
 // charge is +1, -1, 0 to indicate pion charge
 double DSSpiNLO::fragmentation(flavor f, hadron h) {
+    if (m_fused) {
+        assert(h == m_selected_hadron);
+        return selected_ff[f];
+    }
     switch(h) {
         case pi_plus:
             return pi_plus_ff[f];
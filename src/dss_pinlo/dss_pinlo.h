@@ -66,25 +66,33 @@ public:
  * set the values of z and Q_s^2, and then fragmentation() to read out
  * the value of the desired fragmentation function for the desired pion
  * at the current values of z and Q_s^2.
+ *
+ * If only one kind of pion will be needed, call select_hadron() after
+ * constructing the object. Each call to update() then evaluates just the
+ * fragmentation functions of that pion, locating the (ln z, ln Q_s^2)
+ * grid cell once and interpolating all the flavors from it, instead of
+ * running a separate interpolation for each flavor.
+ *
+ * The grids read from a data file never change, so all the objects in the
+ * process constructed with the same filename share one copy of them, which
+ * is read when the first of those objects is constructed and freed when the
+ * last one is destroyed. Each object only has its own interpolation
+ * accelerators and current values, so objects can be used on different
+ * threads at once, but each object by only one thread at a time.
  */
 class DSSpiNLO {
 private:
     /** The number of parton flavors there are fragmentation functions for. */
     const static size_t number_of_flavors = 9;
 
-    // for the interpolation
-    size_t number_of_lnz_values;
-    size_t number_of_lnqs2_values;
-
-    double* lnz_array;
-    double* lnqs2_array;
-    double** ff_arrays;
+    /** The shared grids read from a data file */
+    struct Table;
+    const Table* table;
 
     /** The name of the file data was read from */
     const char* m_filename;
 
-    // Also for the interpolation. There's one interpolator for each FF.
-    interp2d* interpolators[number_of_flavors];
+    // The accelerators for the interpolation of each FF
     gsl_interp_accel* lnz_accel[number_of_flavors];
     gsl_interp_accel* lnqs2_accel[number_of_flavors];
 
@@ -99,6 +107,21 @@ private:
     /** The value of the pi0 fragmentation functions at the current z and Q_s^2. */
     double pi_zero_ff[number_of_flavors];
 
+    /** Whether select_hadron() has been called */
+    bool m_fused;
+    /** The hadron given to select_hadron() */
+    int m_selected_hadron;
+    /**
+     * The fragmentation functions of the selected hadron at the grid points,
+     * one array for each flavor, from the table
+     */
+    const double* const* fused_arrays;
+    /** The accelerators for the cell lookup in update() after select_hadron() */
+    gsl_interp_accel* fused_lnz_accel;
+    gsl_interp_accel* fused_lnqs2_accel;
+    /** The value of the selected hadron's fragmentation functions at the current z and Q_s^2. */
+    double selected_ff[number_of_flavors];
+
 public:
     /** Constants representing the parton flavors. */
     enum flavor {gluon, up, up_bar, down, down_bar, strange, strange_bar, charm, charm_bar};
@@ -110,6 +133,15 @@ public:
     ~DSSpiNLO();
     /** Give the filename the object was constructed with. */
     const char* filename();
+    /**
+     * Set up the object to evaluate only the fragmentation functions of the
+     * hadron `h`. After this, fragmentation() may only be called with `h`.
+     *
+     * This relies on the interpolation being bilinear, so that interpolating
+     * combinations of the pi+ grids is the same (up to roundoff) as combining
+     * the interpolated pi+ values.
+     */
+    void select_hadron(hadron h);
     /** Set the current values of z and Q_s^2. */
     void update(double z, double qs2);
     /** Get the value of a fragmentation function at the current z and Q_s^2. */
@@ -21,5 +21,24 @@ int main(int argc, char** argv) {
             cout << "f_g/p+(" << z << "," << qs2 << ") = " << ffs.fragmentation(DSSpiNLO::gluon, DSSpiNLO::pi_plus) << endl;
         }
     }
+
+    // the single-hadron mode should give the same values
+    DSSpiNLO::hadron hadrons[] = {DSSpiNLO::pi_plus, DSSpiNLO::pi_zero, DSSpiNLO::pi_minus};
+    for (size_t ih = 0; ih < sizeof(hadrons) / sizeof(hadrons[0]); ih++) {
+        DSSpiNLO selected("PINLO.DAT");
+        selected.select_hadron(hadrons[ih]);
+        for (size_t iz = 0; iz < sizeof(zlist) / sizeof(zlist[0]); iz++) {
+            for (size_t iq = 0; iq < sizeof(qs2list) / sizeof(qs2list[0]); iq++) {
+                ffs.update(zlist[iz], qs2list[iq]);
+                selected.update(zlist[iz], qs2list[iq]);
+                for (int f = DSSpiNLO::gluon; f <= DSSpiNLO::charm_bar; f++) {
+                    double expected = ffs.fragmentation(static_cast<DSSpiNLO::flavor>(f), hadrons[ih]);
+                    double actual = selected.fragmentation(static_cast<DSSpiNLO::flavor>(f), hadrons[ih]);
+                    assert(fabs(actual - expected) <= 1e-12 * fabs(expected));
+                }
+            }
+        }
+    }
+    cout << "single-hadron mode agrees" << endl;
     return 0;
 }
\ No newline at end of file
@@ -31,6 +31,7 @@ class IntegrationContext;
 
 class FactorizationScale {
 public:
+    virtual ~FactorizationScale() {}
     virtual double mu2(const IntegrationContext& ictx) = 0;
     virtual const char* name() = 0;
 };
@@ -42,6 +43,7 @@ private:
 public:
     FixedFactorizationScale(double mu2);
     double mu2(const IntegrationContext& ictx);
+    double value_mu2() const { return value; }
     const char* name();
 };
 
@@ -52,6 +54,8 @@ private:
 public:
     PTProportionalFactorizationScale(double coefficient);
     double mu2(const IntegrationContext& ictx);
+    /** The ratio of mu2 to pT2 */
+    double pT2_coefficient() const { return coefficient; }
     const char* name();
 };
 
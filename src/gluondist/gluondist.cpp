@@ -19,8 +19,11 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <set>
 #include <vector>
@@ -29,8 +32,15 @@
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_roots.h>
 #include <gsl/gsl_sf_bessel.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "gluondist.h"
 #include "interp2d.h"
+#include "../kov-position/bkevolution.h"
 
 // debugging
 #include <iostream>
@@ -39,6 +49,12 @@ using namespace std;
 
 static NoGridException nogrid;
 
+UniformGridInterpolator::method_type GluonDistribution::grid_interpolation = UniformGridInterpolator::BILINEAR;
+
+void GluonDistribution::set_grid_interpolation(const UniformGridInterpolator::method_type method) {
+    grid_interpolation = method;
+}
+
 void GluonDistribution::write_pspace_grid(ostream& out) {
     throw nogrid;
 }
@@ -51,6 +67,259 @@ void GluonDistribution::write_satscale_grid(ostream& out) {
     throw nogrid;
 }
 
+void GluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = S2(r2[i], Y);
+    }
+}
+
+void GluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = F(q2[i], Y);
+    }
+}
+
+void GluonDistribution::S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst) {
+    *S2r = S2(r2, Y);
+    *S4rst = S4(r2, s2, t2, Y);
+}
+
+GluonDistributionSlice* GluonDistribution::create_slice() {
+    return new GluonDistributionSlice(this);
+}
+
+/**
+ * A slice of an AbstractTransformGluonDistribution, which keeps the row of
+ * the uniform grid and the series coefficients of the transformed dipole
+ * distribution. That is F if `transformed_F` is true, for distributions
+ * defined in position space, and S2 otherwise; the other one is passed
+ * along to the distribution. If `power_tail` is true, F above `u2max` is
+ * extrapolated as 1/q^4, as MVGluonDistribution::F does.
+ */
+class TransformGluonDistributionSlice : public GluonDistributionSlice {
+public:
+    TransformGluonDistributionSlice(AbstractTransformGluonDistribution* gdist, const bool transformed_F, const bool power_tail) :
+      GluonDistributionSlice(gdist),
+      transform(gdist),
+      transformed_F(transformed_F),
+      power_tail(power_tail),
+      have_row(false),
+      have_series(false),
+      have_tail(false),
+      c0(0), c2(0), tail(0) {}
+
+    double S2(double r2) {
+        return transformed_F ? GluonDistributionSlice::S2(r2) : dipole(r2);
+    }
+    double F(double q2) {
+        return transformed_F ? dipole(q2) : GluonDistributionSlice::F(q2);
+    }
+    void S2_batch(const double* r2, const size_t n, double* out) {
+        if (transformed_F) {
+            GluonDistributionSlice::S2_batch(r2, n, out);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            out[i] = dipole(r2[i]);
+        }
+    }
+    void F_batch(const double* q2, const size_t n, double* out) {
+        if (!transformed_F) {
+            GluonDistributionSlice::F_batch(q2, n, out);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            out[i] = dipole(q2[i]);
+        }
+    }
+    void S2_and_S4(double r2, double s2, double t2, double* S2r, double* S4rst) {
+        if (transformed_F) {
+            GluonDistributionSlice::S2_and_S4(r2, s2, t2, S2r, S4rst);
+            return;
+        }
+        // as in AbstractTransformGluonDistribution::S4()
+        *S2r = dipole(r2);
+        *S4rst = dipole(s2) * dipole(t2);
+    }
+
+protected:
+    void update() {
+        const UniformGridInterpolator* uniform = transform->uniform_dist_2D;
+        have_row = transform->Y_dimension != 1 && uniform != NULL && uniform->contains_y(Y);
+        if (have_row) {
+            row = uniform->row(Y);
+        }
+        // the series coefficients and the tail are only computed if some point needs them
+        have_series = false;
+        have_tail = false;
+    }
+
+private:
+    /** The value of dipole_distribution() at the current rapidity */
+    double dipole(const double u2) {
+        if (power_tail && u2 > transform->u2max) {
+            if (!have_tail) {
+                tail = transform->dipole_distribution(transform->u2max, Y) * gsl_pow_2(transform->u2max);
+                have_tail = true;
+            }
+            return tail / gsl_pow_2(u2);
+        }
+        else if (!have_row) {
+            return transform->dipole_distribution(u2, Y);
+        }
+        else if (u2 > transform->u2min) {
+            const double log_u2 = log(u2);
+            const UniformGridInterpolator* uniform = transform->uniform_dist_2D;
+            // this reports points outside the grid
+            return uniform->contains_x(log_u2) ? uniform->eval(row, log_u2) : transform->dipole_distribution(u2, Y);
+        }
+        else {
+            if (!have_series) {
+                c0 = gsl_interp_eval(transform->interp_dist_leading_u2, transform->Y_values, transform->G_dist_leading_u2, Y, NULL);
+                c2 = gsl_interp_eval(transform->interp_dist_subleading_u2, transform->Y_values, transform->G_dist_subleading_u2, Y, NULL);
+                have_series = true;
+            }
+            return c0 + c2 * u2;
+        }
+    }
+
+    AbstractTransformGluonDistribution* const transform;
+    const bool transformed_F;
+    const bool power_tail;
+    bool have_row;
+    UniformGridInterpolator::Row row;
+    bool have_series, have_tail;
+    double c0, c2, tail;
+};
+
+/**
+ * A slice of a FileDataGluonDistribution, or, if `extended` is true, of an
+ * ExtendedFileDataGluonDistribution, which keeps the rows of the uniform
+ * grids. Rapidities off the grids are passed along to the distribution.
+ */
+class FileDataGluonDistributionSlice : public GluonDistributionSlice {
+public:
+    FileDataGluonDistributionSlice(FileDataGluonDistribution* gdist, const bool extended) :
+      GluonDistributionSlice(gdist),
+      file(gdist),
+      extended(extended),
+      have_position_row(false),
+      have_momentum_row(false) {}
+
+    double S2(double r2) {
+        if (!have_position_row) {
+            return GluonDistributionSlice::S2(r2);
+        }
+        // the extended distribution extrapolates instead
+        if (!extended && (r2 < file->r2min || r2 > file->r2max)) {
+            throw GluonDistributionS2RangeException(r2, Y);
+        }
+        return file->uniform_dist_position_2D->eval(position_row, r2);
+    }
+    double F(double q2) {
+        if (!have_momentum_row) {
+            return GluonDistributionSlice::F(q2);
+        }
+        if (!extended && (q2 < file->q2min || q2 > file->q2max)) {
+            throw GluonDistributionFRangeException(q2, Y);
+        }
+        return file->uniform_dist_momentum_2D->eval(momentum_row, q2);
+    }
+    void S2_batch(const double* r2, const size_t n, double* out) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = S2(r2[i]);
+        }
+    }
+    void F_batch(const double* q2, const size_t n, double* out) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = F(q2[i]);
+        }
+    }
+    void S2_and_S4(double r2, double s2, double t2, double* S2r, double* S4rst) {
+        if (!have_position_row) {
+            *S2r = gdist->S2(r2, Y);
+            *S4rst = gdist->S4(r2, s2, t2, Y);
+            return;
+        }
+        // the same checks as S2() and S4()
+        *S2r = S2(r2);
+        if (!extended && (s2 < file->r2min || s2 > file->r2max || t2 < file->r2min || t2 > file->r2max)) {
+            throw GluonDistributionS4RangeException(r2, s2, t2, Y);
+        }
+        *S4rst = S2(s2) * S2(t2);
+    }
+
+protected:
+    void update() {
+        const UniformGridInterpolator* position = file->uniform_dist_position_2D;
+        const UniformGridInterpolator* momentum = file->uniform_dist_momentum_2D;
+        have_position_row = Y >= file->Yminr && Y <= file->Ymaxr
+            && file->Y_dimension_r != 1 && position != NULL && position->contains_y(Y);
+        if (have_position_row) {
+            position_row = position->row(Y);
+        }
+        // FileDataGluonDistribution::F() checks the position space range
+        have_momentum_row = (extended ? Y >= file->Yminp && Y <= file->Ymaxp : Y >= file->Yminr && Y <= file->Ymaxr)
+            && file->Y_dimension_p != 1 && momentum != NULL && momentum->contains_y(Y);
+        if (have_momentum_row) {
+            momentum_row = momentum->row(Y);
+        }
+    }
+
+private:
+    FileDataGluonDistribution* const file;
+    const bool extended;
+    bool have_position_row, have_momentum_row;
+    UniformGridInterpolator::Row position_row, momentum_row;
+};
+
+/**
+ * A slice of a BKGluonDistribution, which keeps the row of the uniform grid
+ * of the evolution as well as everything a TransformGluonDistributionSlice
+ * keeps for F.
+ */
+class BKGluonDistributionSlice : public TransformGluonDistributionSlice {
+public:
+    BKGluonDistributionSlice(BKGluonDistribution* gdist) :
+      TransformGluonDistributionSlice(gdist, true, true),
+      bk(gdist),
+      have_position_row(false) {}
+
+    double S2(double r2) {
+        if (!have_position_row) {
+            return gdist->S2(r2, Y);
+        }
+        // clamped to the grid as in BKGluonDistribution::S2()
+        const double log_r2 = max(bk->log_r2_values[0], min(bk->log_r2_values[bk->r2_dimension - 1], log(r2)));
+        return bk->uniform_dist_position_2D->eval(position_row, log_r2);
+    }
+    void S2_batch(const double* r2, const size_t n, double* out) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = S2(r2[i]);
+        }
+    }
+    void S2_and_S4(double r2, double s2, double t2, double* S2r, double* S4rst) {
+        *S2r = S2(r2);
+        *S4rst = S2(s2) * S2(t2);
+    }
+
+protected:
+    void update() {
+        TransformGluonDistributionSlice::update();
+        const UniformGridInterpolator* position = bk->uniform_dist_position_2D;
+        // rapidities above the grid throw an exception from S2()
+        have_position_row = position != NULL && Y <= bk->Y_values_rspace[bk->Y_dimension_r - 1];
+        if (have_position_row) {
+            position_row = position->row(max(bk->Y_values_rspace[0], Y));
+        }
+    }
+
+private:
+    BKGluonDistribution* const bk;
+    bool have_position_row;
+    UniformGridInterpolator::Row position_row;
+};
+
 GBWGluonDistribution::GBWGluonDistribution(double Q02, double x0, double lambda) : GluonDistribution(), Q02x0lambda(Q02 * pow(x0, lambda)), lambda(lambda) {
     ostringstream s;
     s << "GBW(Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
@@ -67,6 +336,54 @@ double GBWGluonDistribution::F(double q2, double Y) {
     double _Qs2 = Qs2(Y);
     return M_1_PI * exp(-q2/_Qs2) / _Qs2;
 }
+void GBWGluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    const double _Qs2 = Qs2(Y);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = exp(-0.25 * r2[i] * _Qs2);
+    }
+}
+void GBWGluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    const double _Qs2 = Qs2(Y);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = M_1_PI * exp(-q2[i]/_Qs2) / _Qs2;
+    }
+}
+
+/**
+ * A slice of a GBWGluonDistribution, which evaluates the formulas without
+ * calling through the distribution
+ */
+class GBWGluonDistributionSlice : public GluonDistributionSlice {
+public:
+    GBWGluonDistributionSlice(GBWGluonDistribution* gdist) : GluonDistributionSlice(gdist) {}
+
+    double S2(double r2) {
+        return exp(-0.25 * r2 * Qs2());
+    }
+    double F(double q2) {
+        const double _Qs2 = Qs2();
+        return M_1_PI * exp(-q2/_Qs2) / _Qs2;
+    }
+    void S2_batch(const double* r2, const size_t n, double* out) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = S2(r2[i]);
+        }
+    }
+    void F_batch(const double* q2, const size_t n, double* out) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = F(q2[i]);
+        }
+    }
+    void S2_and_S4(double r2, double s2, double t2, double* S2r, double* S4rst) {
+        *S2r = S2(r2);
+        *S4rst = exp(-0.25 * Qs2() * (s2 + t2));
+    }
+};
+
+GluonDistributionSlice* GBWGluonDistribution::create_slice() {
+    return new GBWGluonDistributionSlice(this);
+}
+
 double GBWGluonDistribution::Qs2(const double Y) const {
     return Q02x0lambda * exp(lambda * Y);
 }
@@ -85,6 +402,17 @@ public:
     GDistIntegrationParameters(AbstractTransformGluonDistribution* gdist) : gdist(gdist), u(0), Y(0), n(0) {}
 };
 
+std::string AbstractTransformGluonDistribution::cache_directory;
+size_t AbstractTransformGluonDistribution::setup_threads = 0;
+
+void AbstractTransformGluonDistribution::set_cache_directory(const std::string& directory) {
+    cache_directory = directory;
+}
+
+void AbstractTransformGluonDistribution::set_setup_threads(const size_t threads) {
+    setup_threads = threads;
+}
+
 AbstractTransformGluonDistribution::AbstractTransformGluonDistribution(
     double u2min, double u2max,
     double Ymin, double Ymax,
@@ -93,20 +421,223 @@ AbstractTransformGluonDistribution::AbstractTransformGluonDistribution(
     double (*gdist_series_term_integrand)(double, void*)) :
  GluonDistribution(),
  u2min(u2min), u2max(u2max), Ymin(Ymin), Ymax(Ymax),
+ log_u2_values(NULL), Y_values(NULL),
  G_dist_leading_u2(NULL), G_dist_subleading_u2(NULL), G_dist(NULL),
  gdist_integrand(gdist_integrand), gdist_series_term_integrand(gdist_series_term_integrand),
- interp_dist_leading_u2(NULL), interp_dist_subleading_u2(NULL), interp_dist_1D(NULL), interp_dist_2D(NULL),
- u2_accel(NULL), Y_accel(NULL),
+ interp_dist_leading_u2(NULL), interp_dist_subleading_u2(NULL), interp_dist_1D(NULL), interp_dist_2D(NULL), uniform_dist_2D(NULL),
  u2_dimension(1), Y_dimension(1),
- subinterval_limit(subinterval_limit) {
+ subinterval_limit(subinterval_limit),
+ cache_mapping(NULL), cache_mapping_length(0) {
 }
 
-void AbstractTransformGluonDistribution::setup() {
-    double step = 1.05;
+/** The relative tolerance of the integrals giving the grid values */
+static const double grid_relerr = 0.0001;
+
+/**
+ * The layout of a cache file is this header, then the key padded with zeros
+ * to a multiple of 8 bytes, then the arrays log_u2_values, Y_values,
+ * G_dist_leading_u2, G_dist_subleading_u2, and G_dist, in that order.
+ */
+struct GridCacheHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t key_length;
+    uint64_t u2_dimension;
+    uint64_t Y_dimension;
+};
+
+static const char grid_cache_magic[8] = {'S', 'O', 'L', 'O', 'G', 'R', 'I', 'D'};
+static const uint64_t grid_cache_version = 1;
+
+static size_t padded_key_length(const size_t key_length) {
+    return (key_length + 7) & ~static_cast<size_t>(7);
+}
+
+static size_t grid_cache_length(const size_t key_length, const size_t u2_dimension, const size_t Y_dimension) {
+    return sizeof(GridCacheHeader) + padded_key_length(key_length)
+      + sizeof(double) * (u2_dimension + 3 * Y_dimension + u2_dimension * Y_dimension);
+}
+
+/** The 64-bit FNV-1a hash of `s` */
+static uint64_t fnv1a_hash(const string& s) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (string::const_iterator it = s.begin(); it != s.end(); it++) {
+        hash ^= static_cast<unsigned char>(*it);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool AbstractTransformGluonDistribution::load_grid(const string& filename, const string& key) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != grid_cache_length(key.size(), u2_dimension, Y_dimension)) {
+        close(fd);
+        return false;
+    }
+    size_t length = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const GridCacheHeader* header = static_cast<const GridCacheHeader*>(mapping);
+    const char* stored_key = static_cast<const char*>(mapping) + sizeof(GridCacheHeader);
+    if (memcmp(header->magic, grid_cache_magic, sizeof(grid_cache_magic)) != 0
+      || header->version != grid_cache_version
+      || header->key_length != key.size()
+      || header->u2_dimension != u2_dimension
+      || header->Y_dimension != Y_dimension
+      || key.compare(0, key.size(), stored_key, key.size()) != 0) {
+        // a stale file or a hash collision
+        munmap(mapping, length);
+        return false;
+    }
+
+    // nothing ever writes to the arrays after setup(), so a read-only mapping is fine
+    double* data = reinterpret_cast<double*>(const_cast<char*>(stored_key) + padded_key_length(key.size()));
+    log_u2_values = data;
+    Y_values = log_u2_values + u2_dimension;
+    G_dist_leading_u2 = Y_values + Y_dimension;
+    G_dist_subleading_u2 = G_dist_leading_u2 + Y_dimension;
+    G_dist = G_dist_subleading_u2 + Y_dimension;
+    cache_mapping = mapping;
+    cache_mapping_length = length;
+    return true;
+}
+
+void AbstractTransformGluonDistribution::save_grid(const string& filename, const string& key) const {
+    ostringstream s;
+    s << filename << ".tmp" << getpid();
+    string temporary_filename = s.str();
+
+    GridCacheHeader header;
+    memcpy(header.magic, grid_cache_magic, sizeof(grid_cache_magic));
+    header.version = grid_cache_version;
+    header.key_length = key.size();
+    header.u2_dimension = u2_dimension;
+    header.Y_dimension = Y_dimension;
+    vector<char> padded_key(padded_key_length(key.size()), '\0');
+    copy(key.begin(), key.end(), padded_key.begin());
+
+    ofstream out(temporary_filename.c_str(), ios_base::out | ios_base::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(&padded_key[0], padded_key.size());
+    out.write(reinterpret_cast<const char*>(log_u2_values), sizeof(double) * u2_dimension);
+    out.write(reinterpret_cast<const char*>(Y_values), sizeof(double) * Y_dimension);
+    out.write(reinterpret_cast<const char*>(G_dist_leading_u2), sizeof(double) * Y_dimension);
+    out.write(reinterpret_cast<const char*>(G_dist_subleading_u2), sizeof(double) * Y_dimension);
+    out.write(reinterpret_cast<const char*>(G_dist), sizeof(double) * u2_dimension * Y_dimension);
+    out.close();
+    if (!out || rename(temporary_filename.c_str(), filename.c_str()) != 0) {
+        cerr << "Unable to write gluon distribution grid cache file " << filename << endl;
+        remove(temporary_filename.c_str());
+    }
+}
+
+/**
+ * Rows of the grid are numbered so that the first Y_dimension rows are the
+ * series coefficients at each value of Y, and the remaining u2_dimension rows
+ * are the values of G_dist at each value of u2.
+ */
+struct AbstractTransformGluonDistribution::GridSetupJobs {
+    AbstractTransformGluonDistribution* gdist;
+    pthread_mutex_t mutex;
+    size_t next_row;
+    size_t rows;
+    /** The message of the first exception thrown on a helper thread */
+    string failure;
+    bool failed;
+
+    GridSetupJobs(AbstractTransformGluonDistribution* gdist, const size_t rows) :
+      gdist(gdist), next_row(0), rows(rows), failed(false) {
+        pthread_mutex_init(&mutex, NULL);
+    }
+    ~GridSetupJobs() {
+        pthread_mutex_destroy(&mutex);
+    }
+};
+
+void AbstractTransformGluonDistribution::compute_grid_rows(GridSetupJobs& jobs) {
     GDistIntegrationParameters params(this);
     gsl_function func;
     func.params = &params;
     gsl_integration_workspace* workspace = gsl_integration_workspace_alloc(subinterval_limit);
+    double error; // throwaway
+
+    try {
+        while (true) {
+            pthread_mutex_lock(&jobs.mutex);
+            size_t row = jobs.next_row++;
+            bool done = jobs.failed || row >= jobs.rows;
+            pthread_mutex_unlock(&jobs.mutex);
+            if (done) {
+                break;
+            }
+
+            if (row < Y_dimension) {
+                // calculate the coefficients for the series approximation
+                size_t i_Y = row;
+                func.function = gdist_series_term_integrand;
+                params.Y = Y_values[i_Y];
+
+                params.n = 0;
+                gsl_integration_qagiu(&func, 0, 0, grid_relerr, subinterval_limit, workspace, G_dist_leading_u2 + i_Y, &error);
+
+                params.n = 2;
+                gsl_integration_qagiu(&func, 0, 0, grid_relerr, subinterval_limit, workspace, G_dist_subleading_u2 + i_Y, &error);
+            }
+            else {
+                // calculate the values for the 2D interpolation
+                size_t i_u2 = row - Y_dimension;
+                func.function = gdist_integrand;
+                params.u = exp(0.5 * log_u2_values[i_u2]);
+                for (size_t i_Y = 0; i_Y < Y_dimension; i_Y++) {
+                    params.Y = Y_values[i_Y];
+                    size_t index = INDEX_2D(i_u2, i_Y, u2_dimension, Y_dimension);
+                    gsl_integration_qagiu(&func, 0, 0, grid_relerr, subinterval_limit, workspace, G_dist + index, &error);
+                }
+            }
+        }
+    }
+    catch (...) {
+        gsl_integration_workspace_free(workspace);
+        throw;
+    }
+    gsl_integration_workspace_free(workspace);
+}
+
+void* grid_setup_worker(void* closure) {
+    AbstractTransformGluonDistribution::GridSetupJobs* jobs = static_cast<AbstractTransformGluonDistribution::GridSetupJobs*>(closure);
+    string failure;
+    try {
+        jobs->gdist->compute_grid_rows(*jobs);
+        return NULL;
+    }
+    catch (const exception& e) {
+        failure = e.what();
+    }
+    catch (const char* e) {
+        failure = e;
+    }
+    catch (...) {
+        failure = "Unknown error computing the gluon distribution grid";
+    }
+    pthread_mutex_lock(&jobs->mutex);
+    if (!jobs->failed) {
+        jobs->failed = true;
+        jobs->failure = failure;
+    }
+    pthread_mutex_unlock(&jobs->mutex);
+    return NULL;
+}
+
+void AbstractTransformGluonDistribution::setup(const string& parameters) {
+    double step = 1.05;
 
     if (u2min > u2max || Ymin > Ymax) {
         throw InvalidGridRegionException(u2min, u2max, Ymin, Ymax);
@@ -117,6 +648,13 @@ void AbstractTransformGluonDistribution::setup() {
     double log_u2max = log(u2max);
     assert(log_step > 0);
 
+    // the key identifies the grid by the bounds as given, before adjustment
+    ostringstream key_stream;
+    key_stream.precision(17);
+    key_stream << parameters << "; u2min = " << u2min << ", u2max = " << u2max << ", Ymin = " << Ymin << ", Ymax = " << Ymax
+      << ", step = " << step << ", relerr = " << grid_relerr << ", subinterval_limit = " << subinterval_limit;
+    string key = key_stream.str();
+
     u2_dimension = static_cast<size_t>(((log_u2max - log_u2min) / log_step) + 2); // subtracting logs rather than dividing may help accuracy
     while (u2_dimension < 4) { // 4 points needed for bicubic interpolation
         u2min /= step;
@@ -132,35 +670,64 @@ void AbstractTransformGluonDistribution::setup() {
         }
     }
 
-    log_u2_values = new double[u2_dimension];
-    Y_values = new double[Y_dimension];
-
-    double error; // throwaway
-
-    // calculate the coefficients for the series approximation
-    func.function = gdist_series_term_integrand;
-    G_dist_leading_u2 = new double[Y_dimension]; // zeroth order term in series around u2 = 0
-    G_dist_subleading_u2 = new double[Y_dimension]; // second order term in series around u2 = 0
-    for (size_t i_Y = 0; i_Y < Y_dimension; i_Y++) {
-        params.Y = Y_values[i_Y] = Ymin + i_Y * log_step;
-
-        params.n = 0;
-        gsl_integration_qagiu(&func, 0, 0, 0.0001, subinterval_limit, workspace, G_dist_leading_u2 + i_Y, &error);
-
-        params.n = 2;
-        gsl_integration_qagiu(&func, 0, 0, 0.0001, subinterval_limit, workspace, G_dist_subleading_u2 + i_Y, &error);
+    string cache_filename;
+    if (!cache_directory.empty() && !parameters.empty()) {
+        ostringstream s;
+        s << cache_directory << "/gdist-" << hex << setfill('0') << setw(16) << fnv1a_hash(key) << ".grid";
+        cache_filename = s.str();
     }
 
-    // calculate the values for the 2D interpolation
-    func.function = gdist_integrand;
-    G_dist = new double[u2_dimension * Y_dimension];
-    for (size_t i_u2 = 0; i_u2 < u2_dimension; i_u2++) {
-        log_u2_values[i_u2] = log_u2min + i_u2 * log_step;
-        params.u = exp(0.5 * log_u2_values[i_u2]);
+    if (cache_filename.empty() || !load_grid(cache_filename, key)) {
+        log_u2_values = new double[u2_dimension];
+        Y_values = new double[Y_dimension];
+        G_dist_leading_u2 = new double[Y_dimension]; // zeroth order term in series around u2 = 0
+        G_dist_subleading_u2 = new double[Y_dimension]; // second order term in series around u2 = 0
+        G_dist = new double[u2_dimension * Y_dimension];
+        for (size_t i_u2 = 0; i_u2 < u2_dimension; i_u2++) {
+            log_u2_values[i_u2] = log_u2min + i_u2 * log_step;
+        }
         for (size_t i_Y = 0; i_Y < Y_dimension; i_Y++) {
-            params.Y = Y_values[i_Y];
-            size_t index = INDEX_2D(i_u2, i_Y, u2_dimension, Y_dimension);
-            gsl_integration_qagiu(&func, 0, 0, 0.0001, subinterval_limit, workspace, G_dist + index, &error);
+            Y_values[i_Y] = Ymin + i_Y * log_step;
+        }
+
+        // each grid value comes from its own integral, so the rows can be
+        // computed in any order and the results don't depend on the number of threads
+        GridSetupJobs jobs(this, Y_dimension + u2_dimension);
+        size_t nthreads = setup_threads;
+        if (nthreads == 0) {
+            long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+            nthreads = nprocs > 0 ? static_cast<size_t>(nprocs) : 1;
+        }
+        nthreads = min(nthreads, jobs.rows);
+        // this thread does its share too, so exceptions from it propagate normally
+        vector<pthread_t> threads(nthreads - 1);
+        size_t started = 0;
+        for (; started < threads.size(); started++) {
+            if (pthread_create(&threads[started], NULL, grid_setup_worker, &jobs) != 0) {
+                break;
+            }
+        }
+        try {
+            compute_grid_rows(jobs);
+        }
+        catch (...) {
+            pthread_mutex_lock(&jobs.mutex);
+            jobs.failed = true;
+            pthread_mutex_unlock(&jobs.mutex);
+            for (size_t i = 0; i < started; i++) {
+                pthread_join(threads[i], NULL);
+            }
+            throw;
+        }
+        for (size_t i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        if (jobs.failed) {
+            throw GridSetupException(jobs.failure);
+        }
+
+        if (!cache_filename.empty()) {
+            save_grid(cache_filename, key);
         }
     }
 
@@ -169,15 +736,11 @@ void AbstractTransformGluonDistribution::setup() {
     assert(Y_values[0] <= Ymin);
     assert(Y_values[Y_dimension - 1] >= Ymax);
 
-    u2_accel = gsl_interp_accel_alloc();
-
     if (Y_dimension == 1) {
         interp_dist_1D = gsl_interp_alloc(gsl_interp_cspline, u2_dimension);
         gsl_interp_init(interp_dist_1D, log_u2_values, G_dist, u2_dimension);
     }
     else {
-        Y_accel = gsl_interp_accel_alloc();
-
         interp_dist_leading_u2 = gsl_interp_alloc(gsl_interp_cspline, Y_dimension);
         gsl_interp_init(interp_dist_leading_u2, Y_values, G_dist_leading_u2, Y_dimension);
 
@@ -186,39 +749,58 @@ void AbstractTransformGluonDistribution::setup() {
 
         interp_dist_2D = interp2d_alloc(interp2d_bilinear, u2_dimension, Y_dimension);
         interp2d_init(interp_dist_2D, log_u2_values, Y_values, G_dist, u2_dimension, Y_dimension);
+        uniform_dist_2D = UniformGridInterpolator::create(grid_interpolation, log_u2_values, Y_values, G_dist, u2_dimension, Y_dimension);
     }
 }
 
 AbstractTransformGluonDistribution::~AbstractTransformGluonDistribution() {
-    delete[] G_dist;
+    if (cache_mapping == NULL) {
+        delete[] log_u2_values;
+        delete[] Y_values;
+        delete[] G_dist;
+        delete[] G_dist_leading_u2;
+        delete[] G_dist_subleading_u2;
+    }
+    else {
+        munmap(cache_mapping, cache_mapping_length);
+        cache_mapping = NULL;
+    }
+    log_u2_values = NULL;
+    Y_values = NULL;
     G_dist = NULL;
-    delete[] G_dist_leading_u2;
     G_dist_leading_u2 = NULL;
-    delete[] G_dist_subleading_u2;
     G_dist_subleading_u2 = NULL;
     interp2d_free(interp_dist_2D);
     interp_dist_2D = NULL;
+    delete uniform_dist_2D;
+    uniform_dist_2D = NULL;
+    gsl_interp_free(interp_dist_1D);
+    interp_dist_1D = NULL;
     gsl_interp_free(interp_dist_leading_u2);
     interp_dist_leading_u2 = NULL;
     gsl_interp_free(interp_dist_subleading_u2);
     interp_dist_subleading_u2 = NULL;
-    gsl_interp_accel_free(u2_accel);
-    u2_accel = NULL;
-    gsl_interp_accel_free(Y_accel);
-    Y_accel = NULL;
 }
 
 double AbstractTransformGluonDistribution::S4(double r2, double s2, double t2, double Y) {
     return S2(s2, Y) * S2(t2, Y);
 }
 
+void AbstractTransformGluonDistribution::S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst) {
+    const double u2[3] = {r2, s2, t2};
+    double values[3];
+    S2_batch(u2, 3, Y, values);
+    *S2r = values[0];
+    *S4rst = values[1] * values[2];
+}
+
 double AbstractTransformGluonDistribution::dipole_distribution(double u2, double Y) {
     if (Y_dimension == 1) {
         if (u2 > u2min) {
             if (u2 > u2max || Y < Ymin || Y > Ymax) {
                 throw GluonDistributionFRangeException(u2, Y);
             }
-            return gsl_interp_eval(interp_dist_1D, log_u2_values, G_dist, log(u2), u2_accel);
+            return gsl_interp_eval(interp_dist_1D, log_u2_values, G_dist, log(u2), NULL);
         }
         else {
             double c0 = G_dist_leading_u2[0];
@@ -228,11 +810,16 @@ double AbstractTransformGluonDistribution::dipole_distribution(double u2, double
     }
     else {
         if (u2 > u2min) {
-            return interp2d_eval(interp_dist_2D, log_u2_values, Y_values, G_dist, log(u2), Y, u2_accel, Y_accel);
+            const double log_u2 = log(u2);
+            if (uniform_dist_2D != NULL && uniform_dist_2D->contains(log_u2, Y)) {
+                return uniform_dist_2D->eval(log_u2, Y);
+            }
+            // this reports points outside the grid
+            return interp2d_eval(interp_dist_2D, log_u2_values, Y_values, G_dist, log_u2, Y, NULL, NULL);
         }
         else {
-            double c0 = gsl_interp_eval(interp_dist_leading_u2, Y_values, G_dist_leading_u2, Y, Y_accel);
-            double c2 = gsl_interp_eval(interp_dist_subleading_u2, Y_values, G_dist_subleading_u2, Y, Y_accel);
+            double c0 = gsl_interp_eval(interp_dist_leading_u2, Y_values, G_dist_leading_u2, Y, NULL);
+            double c2 = gsl_interp_eval(interp_dist_subleading_u2, Y_values, G_dist_subleading_u2, Y, NULL);
             return c0 + c2 * u2;
         }
     }
@@ -281,6 +868,16 @@ double AbstractPositionGluonDistribution::F(double q2, double Y) {
     return AbstractTransformGluonDistribution::dipole_distribution(q2, Y);
 }
 
+void AbstractPositionGluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    TransformGluonDistributionSlice slice(this, true, false);
+    slice.set_rapidity(Y);
+    slice.F_batch(q2, n, out);
+}
+
+GluonDistributionSlice* AbstractPositionGluonDistribution::create_slice() {
+    return new TransformGluonDistributionSlice(this, true, false);
+}
+
 void AbstractPositionGluonDistribution::write_pspace_grid(ostream& out) {
     out << "q2\tY\tx\tQs2\tF" << endl;
     AbstractTransformGluonDistribution::write_grid(out);
@@ -319,6 +916,16 @@ double AbstractMomentumGluonDistribution::S2(double r2, double Y) {
     return AbstractTransformGluonDistribution::dipole_distribution(r2, Y);
 }
 
+void AbstractMomentumGluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    TransformGluonDistributionSlice slice(this, false, false);
+    slice.set_rapidity(Y);
+    slice.S2_batch(r2, n, out);
+}
+
+GluonDistributionSlice* AbstractMomentumGluonDistribution::create_slice() {
+    return new TransformGluonDistributionSlice(this, false, false);
+}
+
 void AbstractMomentumGluonDistribution::write_rspace_grid(ostream& out) {
     out << "r2\tY\tx\tQs2\tS2" << endl;
     AbstractTransformGluonDistribution::write_grid(out);
@@ -329,7 +936,10 @@ MVGluonDistribution::MVGluonDistribution(double LambdaMV, double gammaMV, double
     ostringstream s;
     s << "MV(LambdaMV = " << LambdaMV << ", gammaMV = " << gammaMV << ", q2min = " << q2min << ", q2max = " << q2max << ", Ymin = " << Ymin << ", Ymax = " << Ymax << ", Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
     _name = s.str();
-    setup();
+    ostringstream p;
+    p.precision(17);
+    p << "MV(LambdaMV = " << LambdaMV << ", gammaMV = " << gammaMV << ", Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
+    setup(p.str());
 }
 
 double MVGluonDistribution::S2(double r2, double Y) {
@@ -346,6 +956,24 @@ double MVGluonDistribution::F(double q2, double Y) {
     }
 }
 
+void MVGluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    const double _Qs2 = Qs2(Y);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = pow(M_E + 1.0 / (sqrt(r2[i]) * LambdaMV), -0.25 * pow(r2[i] * _Qs2, gammaMV));
+    }
+}
+
+void MVGluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    // with the 1/q^4 extrapolation, as in F()
+    TransformGluonDistributionSlice slice(this, true, true);
+    slice.set_rapidity(Y);
+    slice.F_batch(q2, n, out);
+}
+
+GluonDistributionSlice* MVGluonDistribution::create_slice() {
+    return new TransformGluonDistributionSlice(this, true, true);
+}
+
 double MVGluonDistribution::Qs2(const double Y) const {
     return Q02x0lambda * exp(lambda * Y);
 }
@@ -365,6 +993,10 @@ double FixedSaturationMVGluonDistribution::S2(double r2, double Y) {
     return MVGluonDistribution::S2(r2, YMV);
 }
 
+void FixedSaturationMVGluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    MVGluonDistribution::S2_batch(r2, n, YMV, out);
+}
+
 PlateauPowerGluonDistribution::PlateauPowerGluonDistribution(
     double gamma,
     double r2min, double r2max,
@@ -378,7 +1010,10 @@ PlateauPowerGluonDistribution::PlateauPowerGluonDistribution(
     ostringstream s;
     s << "PlateauPower(gammaPP = " << gamma << ", r2min = " << r2min << ", r2max = " << r2max << ", Ymin = " << Ymin << ", Ymax = " << Ymax << ", Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
     _name = s.str();
-    setup();
+    ostringstream p;
+    p.precision(17);
+    p << "PlateauPower(gammaPP = " << gamma << ", Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
+    setup(p.str());
 }
 
 PlateauPowerGluonDistribution::~PlateauPowerGluonDistribution() {}
@@ -392,6 +1027,17 @@ double PlateauPowerGluonDistribution::F(double q2, double Y) {
     return F;
 }
 
+void PlateauPowerGluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    const double _Qs2 = Qs2(Y);
+    for (size_t i = 0; i < n; i++) {
+        double F = M_1_PI * _Qs2;
+        if (q2[i] > _Qs2) {
+            F *= pow(q2[i] / _Qs2, -0.5*gammaPP);
+        }
+        out[i] = F;
+    }
+}
+
 double PlateauPowerGluonDistribution::Qs2(const double Y) const {
     return Q02x0lambda * exp(lambda * Y);
 }
@@ -470,8 +1116,133 @@ void read_from_file(const string filename, size_t& x_dimension, size_t& y_dimens
     }
 }
 
+struct GridFileHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t x_dimension;
+    uint64_t y_dimension;
+};
+
+static const char grid_file_magic[8] = {'S', 'O', 'L', 'O', 'G', 'D', 'A', 'T'};
+static const uint64_t grid_file_version = 1;
+
+/**
+ * Writes a grid in the binary format read by map_grid_file()
+ */
+static void write_grid_file(const string& filename, const size_t x_dimension, const size_t y_dimension, const double* x_values, const double* y_values, const double* z_values) {
+    GridFileHeader header;
+    memcpy(header.magic, grid_file_magic, sizeof(grid_file_magic));
+    header.version = grid_file_version;
+    header.x_dimension = x_dimension;
+    header.y_dimension = y_dimension;
+
+    ofstream out(filename.c_str(), ios_base::out | ios_base::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(x_values), sizeof(double) * x_dimension);
+    out.write(reinterpret_cast<const char*>(y_values), sizeof(double) * y_dimension);
+    out.write(reinterpret_cast<const char*>(z_values), sizeof(double) * x_dimension * y_dimension);
+    out.close();
+    if (!out) {
+        throw ios_base::failure("Unable to write file " + filename);
+    }
+}
+
+void convert_grid_file(const string& text_filename, const string& binary_filename) {
+    size_t x_dimension, y_dimension;
+    double* x_values;
+    double* y_values;
+    double* z_values;
+    read_from_file(text_filename, x_dimension, y_dimension, x_values, y_values, z_values);
+
+    try {
+        write_grid_file(binary_filename, x_dimension, y_dimension, x_values, y_values, z_values);
+    }
+    catch (...) {
+        delete[] x_values;
+        delete[] y_values;
+        delete[] z_values;
+        throw;
+    }
+    delete[] x_values;
+    delete[] y_values;
+    delete[] z_values;
+}
+
+/**
+ * Maps a binary grid file, as written by convert_grid_file(), and sets the
+ * arrays to point into the mapping. Returns false, without mapping anything,
+ * if the file doesn't start with the binary header (i.e. it's a text file).
+ *
+ * The mapping is private and writable so that the Y values can be offset in
+ * place; only the pages actually modified are copied.
+ */
+static bool map_grid_file(const string& filename, size_t& x_dimension, size_t& y_dimension, double*& x_values, double*& y_values, double*& z_values, void*& mapping, size_t& length) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw ios_base::failure("Unable to read file " + filename);
+    }
+    GridFileHeader header;
+    struct stat st;
+    if (fstat(fd, &st) != 0
+      || static_cast<size_t>(st.st_size) < sizeof(header)
+      || read(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))
+      || memcmp(header.magic, grid_file_magic, sizeof(grid_file_magic)) != 0) {
+        close(fd);
+        return false;
+    }
+    if (header.version != grid_file_version) {
+        close(fd);
+        throw ios_base::failure("Unsupported binary format version in file " + filename);
+    }
+    length = static_cast<size_t>(st.st_size);
+    if (header.x_dimension == 0 || header.y_dimension == 0
+      || length != sizeof(header) + sizeof(double) * (header.x_dimension + header.y_dimension + header.x_dimension * header.y_dimension)) {
+        close(fd);
+        throw ios_base::failure("Wrong size for binary grid file " + filename);
+    }
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        throw ios_base::failure("Unable to map file " + filename);
+    }
+
+    x_dimension = header.x_dimension;
+    y_dimension = header.y_dimension;
+    x_values = reinterpret_cast<double*>(static_cast<char*>(mapping) + sizeof(header));
+    y_values = x_values + x_dimension;
+    z_values = y_values + y_dimension;
+    // the text reader guarantees sorted axes, so check that much here; it's cheap
+    bool sorted = true;
+    for (size_t i = 1; sorted && i < x_dimension; i++) {
+        sorted = x_values[i - 1] < x_values[i];
+    }
+    for (size_t i = 1; sorted && i < y_dimension; i++) {
+        sorted = y_values[i - 1] < y_values[i];
+    }
+    if (!sorted) {
+        // thrown like the other errors, so that a bad BK cache file is evolved again
+        munmap(mapping, length);
+        mapping = NULL;
+        throw ios_base::failure("Points out of order in binary grid file " + filename);
+    }
+    return true;
+}
+
+/**
+ * Reads a grid file in either the binary or the text format
+ */
+static void load_grid_file(const string& filename, size_t& x_dimension, size_t& y_dimension, double*& x_values, double*& y_values, double*& z_values, void*& mapping, size_t& length) {
+    if (!map_grid_file(filename, x_dimension, y_dimension, x_values, y_values, z_values, mapping, length)) {
+        mapping = NULL;
+        length = 0;
+        read_from_file(filename, x_dimension, y_dimension, x_values, y_values, z_values);
+    }
+}
+
 FileDataGluonDistribution::FileDataGluonDistribution(string pos_filename, string mom_filename, double xinit, enum satscale_source satscale_source, double satscale_threshold) :
-  GluonDistribution(), Q02x0lambda(0), lambda(0), Qs2_values(NULL), satscale_source(satscale_source) {
+  GluonDistribution(), Q02x0lambda(0), lambda(0), Qs2_values(NULL), satscale_source(satscale_source),
+  pos_mapping(NULL), pos_mapping_length(0), mom_mapping(NULL), mom_mapping_length(0) {
     setup(pos_filename, mom_filename, xinit);
     ostringstream s;
     s << "file(pos_filename = " << pos_filename << ", mom_filename = " << mom_filename << ", xinit = " << xinit;
@@ -504,18 +1275,20 @@ FileDataGluonDistribution::FileDataGluonDistribution(string pos_filename, string
   interp_dist_momentum_2D(NULL),
   interp_dist_position_1D(NULL),
   interp_dist_position_2D(NULL),
+  uniform_dist_momentum_2D(NULL),
+  uniform_dist_position_2D(NULL),
   Qs2_values(NULL),
   interp_Qs2_1D(NULL),
-  r2_accel(NULL),
-  q2_accel(NULL),
-  Y_accel_r(NULL),
-  Y_accel_p(NULL),
   r2_dimension(0),
   q2_dimension(0),
   Y_dimension_r(0),
   Y_dimension_p(0),
   Q02x0lambda(Q02 * pow(x0, lambda)),
-  lambda(lambda)
+  lambda(lambda),
+  pos_mapping(NULL),
+  pos_mapping_length(0),
+  mom_mapping(NULL),
+  mom_mapping_length(0)
    {
     setup(pos_filename, mom_filename, xinit);
     ostringstream s;
@@ -524,17 +1297,23 @@ FileDataGluonDistribution::FileDataGluonDistribution(string pos_filename, string
 }
 
 FileDataGluonDistribution::~FileDataGluonDistribution() {
-    delete[] r2_values;
-    delete[] q2_values;
-    delete[] Y_values_rspace;
-    delete[] Y_values_pspace;
-    delete[] S_dist;
-    delete[] F_dist;
+    if (pos_mapping == NULL) {
+        delete[] r2_values;
+        delete[] Y_values_rspace;
+        delete[] S_dist;
+    }
+    else {
+        munmap(pos_mapping, pos_mapping_length);
+    }
+    if (mom_mapping == NULL) {
+        delete[] q2_values;
+        delete[] Y_values_pspace;
+        delete[] F_dist;
+    }
+    else {
+        munmap(mom_mapping, mom_mapping_length);
+    }
     delete[] Qs2_values;
-    gsl_interp_accel_free(r2_accel);
-    gsl_interp_accel_free(q2_accel);
-    gsl_interp_accel_free(Y_accel_r);
-    gsl_interp_accel_free(Y_accel_p);
     // This may still have some memory leaks
     if (Y_dimension_r == 1) {
         gsl_interp_free(interp_dist_position_1D);
@@ -543,6 +1322,8 @@ FileDataGluonDistribution::~FileDataGluonDistribution() {
     else {
         interp2d_free(interp_dist_position_2D);
         interp2d_free(interp_dist_momentum_2D);
+        delete uniform_dist_position_2D;
+        delete uniform_dist_momentum_2D;
         gsl_interp_free(interp_Qs2_1D);
     }
 }
@@ -550,8 +1331,8 @@ FileDataGluonDistribution::~FileDataGluonDistribution() {
 void FileDataGluonDistribution::setup(string pos_filename, string mom_filename, double xinit) {
     // the rapidity values we read from the file are considered values of ΔY
     // relative to some initial rapidity, Yinit.
-    read_from_file(pos_filename, r2_dimension, Y_dimension_r, r2_values, Y_values_rspace, S_dist);
-    read_from_file(mom_filename, q2_dimension, Y_dimension_p, q2_values, Y_values_pspace, F_dist);
+    load_grid_file(pos_filename, r2_dimension, Y_dimension_r, r2_values, Y_values_rspace, S_dist, pos_mapping, pos_mapping_length);
+    load_grid_file(mom_filename, q2_dimension, Y_dimension_p, q2_values, Y_values_pspace, F_dist, mom_mapping, mom_mapping_length);
 
     // apply the offset
     if (xinit != 1) {
@@ -573,9 +1354,9 @@ void FileDataGluonDistribution::setup(string pos_filename, string mom_filename,
     Yminp = Y_values_pspace[0];
     Ymaxp = Y_values_pspace[Y_dimension_p-1];
 
-    r2_accel = gsl_interp_accel_alloc();
-    q2_accel = gsl_interp_accel_alloc();
-
+    // the first constructor doesn't initialize these
+    uniform_dist_position_2D = NULL;
+    uniform_dist_momentum_2D = NULL;
     if (Y_dimension_r == 1) {
         assert(Y_dimension_p == 1);
         assert(Yminr == Ymaxr);
@@ -587,19 +1368,19 @@ void FileDataGluonDistribution::setup(string pos_filename, string mom_filename,
     }
     else {
         assert(Y_dimension_p > 1);
-        Y_accel_r = gsl_interp_accel_alloc();
-        Y_accel_p = gsl_interp_accel_alloc();
-
         interp_dist_position_2D = interp2d_alloc(interp2d_bilinear, r2_dimension, Y_dimension_r);
         interp2d_init(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2_dimension, Y_dimension_r);
 
         interp_dist_momentum_2D = interp2d_alloc(interp2d_bilinear, q2_dimension, Y_dimension_p);
         interp2d_init(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2_dimension, Y_dimension_p);
+
+        uniform_dist_position_2D = UniformGridInterpolator::create(grid_interpolation, r2_values, Y_values_rspace, S_dist, r2_dimension, Y_dimension_r);
+        uniform_dist_momentum_2D = UniformGridInterpolator::create(grid_interpolation, q2_values, Y_values_pspace, F_dist, q2_dimension, Y_dimension_p);
     }
 }
 
 struct EvaluationParameters {
-    FileDataGluonDistribution* gdist;
+    GluonDistribution* gdist;
     double Y;
     double threshold;
 };
@@ -649,21 +1430,30 @@ double evaluate_rspace_threshold_criterion(double r2, void* params) {
     return p->gdist->S2(r2, p->Y) - p->threshold;
 }
 
-void FileDataGluonDistribution::initialize_saturation_scale_from_position_space(double satscale_threshold) {
+/**
+ * Finds the saturation scale of `gdist` at each of the `Y_dimension` values
+ * of Y, as 1/r2 where S2(r2, Y) = `satscale_threshold`, searching between
+ * `r2min` and `r2max`.
+ */
+static void extract_saturation_scale_from_position_space(GluonDistribution* gdist, const double* Y_values, const size_t Y_dimension, const double r2min, const double r2max, const double satscale_threshold, double* Qs2_values) {
     // strategy: search for the point where S(r,Y) = T
-    assert(Y_dimension_r >= 1);
-
     double last_Rs2;
     EvaluationParameters p;
-    p.gdist = this;
+    p.gdist = gdist;
     p.threshold = satscale_threshold;
 
-    Qs2_values = new double[Y_dimension_r];
-    for (size_t i = 0; i < Y_dimension_r; i++) {
-        p.Y = Y_values_rspace[i];
+    for (size_t i = 0; i < Y_dimension; i++) {
+        p.Y = Y_values[i];
         last_Rs2 = bracket_root(evaluate_rspace_threshold_criterion, &p, r2min, r2max);
         Qs2_values[i] = 1.0 / last_Rs2;
     }
+}
+
+void FileDataGluonDistribution::initialize_saturation_scale_from_position_space(double satscale_threshold) {
+    assert(Y_dimension_r >= 1);
+
+    Qs2_values = new double[Y_dimension_r];
+    extract_saturation_scale_from_position_space(this, Y_values_rspace, Y_dimension_r, r2min, r2max, satscale_threshold, Qs2_values);
     if (Y_dimension_r > 1) {
         interp_Qs2_1D = gsl_interp_alloc(gsl_interp_cspline, Y_dimension_r);
         gsl_interp_init(interp_Qs2_1D, Y_values_rspace, Qs2_values, Y_dimension_r);
@@ -701,13 +1491,32 @@ double FileDataGluonDistribution::S2(double r2, double Y) {
         throw GluonDistributionS2RangeException(r2, Y);
     }
     if (Y_dimension_r == 1) {
-        return gsl_interp_eval(interp_dist_position_1D, r2_values, S_dist, r2, r2_accel);
+        return gsl_interp_eval(interp_dist_position_1D, r2_values, S_dist, r2, NULL);
+    }
+    else if (uniform_dist_position_2D != NULL && uniform_dist_position_2D->contains(r2, Y)) {
+        return uniform_dist_position_2D->eval(r2, Y);
     }
     else {
-        return interp2d_eval(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, r2_accel, Y_accel_r);
+        return interp2d_eval(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, NULL, NULL);
     }
 }
 
+void FileDataGluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    FileDataGluonDistributionSlice slice(this, false);
+    slice.set_rapidity(Y);
+    slice.S2_batch(r2, n, out);
+}
+
+void FileDataGluonDistribution::S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst) {
+    FileDataGluonDistributionSlice slice(this, false);
+    slice.set_rapidity(Y);
+    slice.S2_and_S4(r2, s2, t2, S2r, S4rst);
+}
+
+GluonDistributionSlice* FileDataGluonDistribution::create_slice() {
+    return new FileDataGluonDistributionSlice(this, false);
+}
+
 double FileDataGluonDistribution::S4(double r2, double s2, double t2, double Y) {
     if (s2 < r2min || s2 > r2max || t2 < r2min || t2 > r2max || Y < Yminr || Y > Ymaxr) {
         throw GluonDistributionS4RangeException(r2, s2, t2, Y);
@@ -720,22 +1529,31 @@ double FileDataGluonDistribution::F(double q2, double Y) {
         throw GluonDistributionFRangeException(q2, Y);
     }
     if (Y_dimension_p == 1) {
-        return gsl_interp_eval(interp_dist_momentum_1D, q2_values, F_dist, q2, q2_accel);
+        return gsl_interp_eval(interp_dist_momentum_1D, q2_values, F_dist, q2, NULL);
+    }
+    else if (uniform_dist_momentum_2D != NULL && uniform_dist_momentum_2D->contains(q2, Y)) {
+        return uniform_dist_momentum_2D->eval(q2, Y);
     }
     else {
-        return interp2d_eval(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, q2_accel, Y_accel_p);
+        return interp2d_eval(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, NULL, NULL);
     }
 }
 
+void FileDataGluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    FileDataGluonDistributionSlice slice(this, false);
+    slice.set_rapidity(Y);
+    slice.F_batch(q2, n, out);
+}
+
 double FileDataGluonDistribution::Fprime(double q2, double Y) {
     if (q2 < q2min || q2 > q2max || Y < Yminr || Y > Ymaxr) {
         throw GluonDistributionFRangeException(q2, Y);
     }
     if (Y_dimension_p == 1) {
-        return gsl_interp_eval_deriv(interp_dist_momentum_1D, q2_values, F_dist, q2, q2_accel);
+        return gsl_interp_eval_deriv(interp_dist_momentum_1D, q2_values, F_dist, q2, NULL);
     }
     else {
-        return interp2d_eval_deriv_x(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, q2_accel, Y_accel_p);
+        return interp2d_eval_deriv_x(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, NULL, NULL);
     }
 }
 
@@ -744,10 +1562,10 @@ double FileDataGluonDistribution::Fpprime(double q2, double Y) {
         throw GluonDistributionFRangeException(q2, Y);
     }
     if (Y_dimension_p == 1) {
-        return gsl_interp_eval_deriv2(interp_dist_momentum_1D, q2_values, F_dist, q2, q2_accel);
+        return gsl_interp_eval_deriv2(interp_dist_momentum_1D, q2_values, F_dist, q2, NULL);
     }
     else {
-        return interp2d_eval_deriv_xx(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, q2_accel, Y_accel_p);
+        return interp2d_eval_deriv_xx(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, NULL, NULL);
     }
 }
 
@@ -756,10 +1574,10 @@ double FileDataGluonDistribution::S2prime(double r2, double Y) {
         throw GluonDistributionS2RangeException(r2, Y);
     }
     if (Y_dimension_r == 1) {
-        return gsl_interp_eval_deriv(interp_dist_position_1D, r2_values, S_dist, r2, r2_accel);
+        return gsl_interp_eval_deriv(interp_dist_position_1D, r2_values, S_dist, r2, NULL);
     }
     else {
-        return interp2d_eval_deriv_x(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, r2_accel, Y_accel_r);
+        return interp2d_eval_deriv_x(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, NULL, NULL);
     }
 }
 
@@ -768,10 +1586,10 @@ double FileDataGluonDistribution::S2pprime(double r2, double Y) {
         throw GluonDistributionS2RangeException(r2, Y);
     }
     if (Y_dimension_r == 1) {
-        return gsl_interp_eval_deriv2(interp_dist_position_1D, r2_values, S_dist, r2, r2_accel);
+        return gsl_interp_eval_deriv2(interp_dist_position_1D, r2_values, S_dist, r2, NULL);
     }
     else {
-        return interp2d_eval_deriv_xx(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, r2_accel, Y_accel_r);
+        return interp2d_eval_deriv_xx(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, NULL, NULL);
     }
 }
 
@@ -788,9 +1606,9 @@ double FileDataGluonDistribution::Qs2(const double Y) const {
     else {
         switch (satscale_source) {
             case MOMENTUM_THRESHOLD:
-                return gsl_interp_eval(interp_Qs2_1D, Y_values_pspace, Qs2_values, Y, Y_accel_p);
+                return gsl_interp_eval(interp_Qs2_1D, Y_values_pspace, Qs2_values, Y, NULL);
             case POSITION_THRESHOLD:
-                return gsl_interp_eval(interp_Qs2_1D, Y_values_rspace, Qs2_values, Y, Y_accel_r);
+                return gsl_interp_eval(interp_Qs2_1D, Y_values_rspace, Qs2_values, Y, NULL);
             default:
                 assert(false);
         }
@@ -895,14 +1713,33 @@ double ExtendedFileDataGluonDistribution::S2(double r2, double Y) {
     }
     else {
         if (Y_dimension_r == 1) {
-            return gsl_interp_eval_no_boundary_check(interp_dist_position_1D, r2_values, S_dist, r2, r2_accel);
+            return gsl_interp_eval_no_boundary_check(interp_dist_position_1D, r2_values, S_dist, r2, NULL);
+        }
+        else if (uniform_dist_position_2D != NULL) {
+            return uniform_dist_position_2D->eval(r2, Y);
         }
         else {
-            return interp2d_eval_no_boundary_check(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, r2_accel, Y_accel_r);
+            return interp2d_eval_no_boundary_check(interp_dist_position_2D, r2_values, Y_values_rspace, S_dist, r2, Y, NULL, NULL);
         }
     }
 }
 
+void ExtendedFileDataGluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    FileDataGluonDistributionSlice slice(this, true);
+    slice.set_rapidity(Y);
+    slice.S2_batch(r2, n, out);
+}
+
+void ExtendedFileDataGluonDistribution::S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst) {
+    FileDataGluonDistributionSlice slice(this, true);
+    slice.set_rapidity(Y);
+    slice.S2_and_S4(r2, s2, t2, S2r, S4rst);
+}
+
+GluonDistributionSlice* ExtendedFileDataGluonDistribution::create_slice() {
+    return new FileDataGluonDistributionSlice(this, true);
+}
+
 double ExtendedFileDataGluonDistribution::S4(double r2, double s2, double t2, double Y) {
     if (Y < Yminr) {
         return lower_dist->S4(r2, s2, t2, Y);
@@ -924,14 +1761,23 @@ double ExtendedFileDataGluonDistribution::F(double q2, double Y) {
     }
     else {
         if (Y_dimension_p == 1) {
-            return gsl_interp_eval_no_boundary_check(interp_dist_momentum_1D, q2_values, F_dist, q2, q2_accel);
+            return gsl_interp_eval_no_boundary_check(interp_dist_momentum_1D, q2_values, F_dist, q2, NULL);
+        }
+        else if (uniform_dist_momentum_2D != NULL) {
+            return uniform_dist_momentum_2D->eval(q2, Y);
         }
         else {
-            return interp2d_eval_no_boundary_check(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, q2_accel, Y_accel_p);
+            return interp2d_eval_no_boundary_check(interp_dist_momentum_2D, q2_values, Y_values_pspace, F_dist, q2, Y, NULL, NULL);
         }
     }
 }
 
+void ExtendedFileDataGluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    FileDataGluonDistributionSlice slice(this, true);
+    slice.set_rapidity(Y);
+    slice.F_batch(q2, n, out);
+}
+
 double ExtendedFileDataGluonDistribution::Qs2(const double Y) const {
     if (satscale_source == POSITION_THRESHOLD) {
         if (Y < Yminr) {
@@ -952,6 +1798,241 @@ double ExtendedFileDataGluonDistribution::Qs2(const double Y) const {
     return FileDataGluonDistribution::Qs2(Y);
 }
 
+BKGluonDistribution::BKGluonDistribution(
+    double q2min, double q2max,
+    double Ymin, double Ymax,
+    double xinit,
+    double Q02, double x0, double lambda,
+    double satscale_threshold,
+    double table_megabytes,
+    double step_tolerance,
+    size_t subinterval_limit) :
+ AbstractPositionGluonDistribution(q2min, q2max, Ymin, Ymax, subinterval_limit),
+ log_r2_values(NULL),
+ Y_values_rspace(NULL),
+ S_dist(NULL),
+ r2_dimension(0),
+ Y_dimension_r(0),
+ interp_dist_position_2D(NULL),
+ uniform_dist_position_2D(NULL),
+ Qs2_values(NULL),
+ interp_Qs2_1D(NULL),
+ Q02x0lambda(Q02 * pow(x0, lambda)),
+ lambda(lambda),
+ pos_mapping(NULL),
+ pos_mapping_length(0) {
+    int nr;
+    double logrmin, logrmax, deltay;
+    BKGridParameters(&nr, &logrmin, &logrmax, &deltay);
+    double Yinit = -log(xinit);
+    // setup() may extend the momentum space grid by up to one of its steps,
+    // ln(1.05), beyond Ymax
+    double Yneeded = Ymax + log(1.05) - Yinit;
+    size_t steps = Yneeded > deltay ? static_cast<size_t>(ceil(Yneeded / deltay)) : 1;
+
+    evolve(steps, table_megabytes, step_tolerance, xinit, Q02, x0, lambda);
+    for (size_t i_Y = 0; i_Y < Y_dimension_r; i_Y++) {
+        Y_values_rspace[i_Y] += Yinit;
+    }
+    interp_dist_position_2D = interp2d_alloc(interp2d_bilinear, r2_dimension, Y_dimension_r);
+    interp2d_init(interp_dist_position_2D, log_r2_values, Y_values_rspace, S_dist, r2_dimension, Y_dimension_r);
+    uniform_dist_position_2D = UniformGridInterpolator::create(grid_interpolation, log_r2_values, Y_values_rspace, S_dist, r2_dimension, Y_dimension_r);
+
+    ostringstream s;
+    s << "BK(q2min = " << q2min << ", q2max = " << q2max << ", Ymin = " << Ymin << ", Ymax = " << Ymax << ", xinit = " << xinit << ", steps = " << steps;
+    if (step_tolerance > 0) {
+        s << ", step tolerance = " << step_tolerance;
+    }
+    if (satscale_threshold > 0) {
+        Qs2_values = new double[Y_dimension_r];
+        extract_saturation_scale_from_position_space(this, Y_values_rspace, Y_dimension_r, exp(log_r2_values[0]), exp(log_r2_values[r2_dimension - 1]), satscale_threshold, Qs2_values);
+        interp_Qs2_1D = gsl_interp_alloc(gsl_interp_cspline, Y_dimension_r);
+        gsl_interp_init(interp_Qs2_1D, Y_values_rspace, Qs2_values, Y_dimension_r);
+        s << ", extracted saturation scale from position)";
+    }
+    else {
+        s << ", Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
+    }
+    _name = s.str();
+
+    ostringstream p;
+    p.precision(17);
+    p << "BK(xinit = " << xinit << ", steps = " << steps << ", nr = " << nr << ", logrmin = " << logrmin << ", logrmax = " << logrmax << ", deltay = " << deltay;
+    // the fixed steps keep the keys they had before adaptive steps existed
+    if (step_tolerance > 0) {
+        p << ", step tolerance = " << step_tolerance;
+    }
+    p << ", Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
+    setup(p.str());
+}
+
+void BKGluonDistribution::evolve(const size_t steps, const double table_megabytes, const double step_tolerance,
+                                 const double xinit, const double Q02, const double x0, const double lambda) {
+    int nr;
+    double logrmin, logrmax, deltay;
+    BKGridParameters(&nr, &logrmin, &logrmax, &deltay);
+    r2_dimension = nr;
+    Y_dimension_r = steps + 1;
+
+    string cache_filename;
+    if (!cache_directory.empty()) {
+        ostringstream key;
+        key.precision(17);
+        key << "BK(steps = " << steps << ", nr = " << nr << ", logrmin = " << logrmin << ", logrmax = " << logrmax << ", deltay = " << deltay;
+        if (step_tolerance > 0) {
+            key << ", step tolerance = " << step_tolerance;
+        }
+        key << ", xinit = " << xinit << ", Q02 = " << Q02 << ", x0 = " << x0 << ", lambda = " << lambda << ")";
+        ostringstream s;
+        s << cache_directory << "/bk-" << hex << setfill('0') << setw(16) << fnv1a_hash(key.str()) << ".gdat";
+        cache_filename = s.str();
+
+        struct stat st;
+        size_t x_dimension, y_dimension;
+        // a cache file that can't be used is evolved again and replaced
+        try {
+            if (stat(cache_filename.c_str(), &st) == 0
+             && map_grid_file(cache_filename, x_dimension, y_dimension, log_r2_values, Y_values_rspace, S_dist, pos_mapping, pos_mapping_length)) {
+                if (x_dimension == r2_dimension && y_dimension == Y_dimension_r) {
+                    return;
+                }
+            }
+        }
+        catch (const ios_base::failure& e) {
+            cerr << "Ignoring BK evolution cache file: " << e.what() << endl;
+        }
+        if (pos_mapping != NULL) {
+            munmap(pos_mapping, pos_mapping_length);
+            pos_mapping = NULL;
+        }
+        pos_mapping_length = 0;
+    }
+
+    log_r2_values = new double[r2_dimension];
+    Y_values_rspace = new double[Y_dimension_r];
+    S_dist = new double[r2_dimension * Y_dimension_r];
+    for (size_t i_r2 = 0; i_r2 < r2_dimension; i_r2++) {
+        log_r2_values[i_r2] = 2 * (logrmin + i_r2 * (logrmax - logrmin) / (nr - 1));
+    }
+    for (size_t i_Y = 0; i_Y < Y_dimension_r; i_Y++) {
+        Y_values_rspace[i_Y] = i_Y * deltay;
+    }
+    // kovr fills in N = 1 - S2 at each step, in the same layout as INDEX_2D
+    assert(INDEX_2D(1, 0, r2_dimension, Y_dimension_r) == 1);
+    BKEvolve(steps, setup_threads, table_megabytes, step_tolerance, xinit, Q02, x0, lambda, S_dist);
+    for (size_t i = 0; i < r2_dimension * Y_dimension_r; i++) {
+        S_dist[i] = 1 - S_dist[i];
+    }
+
+    if (!cache_filename.empty()) {
+        ostringstream s;
+        s << cache_filename << ".tmp" << getpid();
+        string temporary_filename = s.str();
+        try {
+            write_grid_file(temporary_filename, r2_dimension, Y_dimension_r, log_r2_values, Y_values_rspace, S_dist);
+            if (rename(temporary_filename.c_str(), cache_filename.c_str()) != 0) {
+                throw ios_base::failure("Unable to rename " + temporary_filename);
+            }
+        }
+        catch (const ios_base::failure&) {
+            cerr << "Unable to write BK evolution cache file " << cache_filename << endl;
+            remove(temporary_filename.c_str());
+        }
+    }
+}
+
+BKGluonDistribution::~BKGluonDistribution() {
+    if (pos_mapping == NULL) {
+        delete[] log_r2_values;
+        delete[] Y_values_rspace;
+        delete[] S_dist;
+    }
+    else {
+        munmap(pos_mapping, pos_mapping_length);
+    }
+    delete[] Qs2_values;
+    interp2d_free(interp_dist_position_2D);
+    delete uniform_dist_position_2D;
+    gsl_interp_free(interp_Qs2_1D);
+}
+
+double BKGluonDistribution::S2(double r2, double Y) {
+    if (Y > Y_values_rspace[Y_dimension_r - 1]) {
+        throw GluonDistributionS2RangeException(r2, Y);
+    }
+    double log_r2 = log(r2);
+    log_r2 = max(log_r2_values[0], min(log_r2_values[r2_dimension - 1], log_r2));
+    Y = max(Y_values_rspace[0], Y);
+    if (uniform_dist_position_2D != NULL) {
+        return uniform_dist_position_2D->eval(log_r2, Y);
+    }
+    return interp2d_eval(interp_dist_position_2D, log_r2_values, Y_values_rspace, S_dist, log_r2, Y, NULL, NULL);
+}
+
+void BKGluonDistribution::S2_batch(const double* r2, const size_t n, const double Y, double* out) {
+    BKGluonDistributionSlice slice(this);
+    slice.set_rapidity(Y);
+    slice.S2_batch(r2, n, out);
+}
+
+void BKGluonDistribution::F_batch(const double* q2, const size_t n, const double Y, double* out) {
+    // with the 1/q^4 extrapolation, as in F()
+    TransformGluonDistributionSlice slice(this, true, true);
+    slice.set_rapidity(Y);
+    slice.F_batch(q2, n, out);
+}
+
+GluonDistributionSlice* BKGluonDistribution::create_slice() {
+    return new BKGluonDistributionSlice(this);
+}
+
+double BKGluonDistribution::F(double q2, double Y) {
+    if (q2 > u2max) {
+        // use the 1/q^4 extrapolation
+        return AbstractPositionGluonDistribution::F(u2max, Y) * gsl_pow_2(u2max) / gsl_pow_2(q2);
+    }
+    else {
+        return AbstractPositionGluonDistribution::F(q2, Y);
+    }
+}
+
+double BKGluonDistribution::Qs2(const double Y) const {
+    if (Qs2_values == NULL) {
+        return Q02x0lambda * exp(lambda * Y);
+    }
+    else {
+        double Yclamped = max(Y_values_rspace[0], min(Y_values_rspace[Y_dimension_r - 1], Y));
+        return gsl_interp_eval(interp_Qs2_1D, Y_values_rspace, Qs2_values, Yclamped, NULL);
+    }
+}
+
+const char* BKGluonDistribution::name() {
+    return _name.c_str();
+}
+
+void BKGluonDistribution::write_rspace_grid(ostream& out) {
+    out << "r2\tY\tS" << endl;
+    for (size_t i_r2 = 0; i_r2 < r2_dimension; i_r2++) {
+        for (size_t i_Y = 0; i_Y < Y_dimension_r; i_Y++) {
+            out << exp(log_r2_values[i_r2]) << "\t"
+                << Y_values_rspace[i_Y] << "\t"
+                << S_dist[INDEX_2D(i_r2, i_Y, r2_dimension, Y_dimension_r)] << endl;
+        }
+    }
+}
+
+void BKGluonDistribution::write_satscale_grid(ostream& out) {
+    if (Qs2_values == NULL) {
+        throw nogrid;
+    }
+    out << "Y\tx\tQs2" << endl;
+    for (size_t i_Y = 0; i_Y < Y_dimension_r; i_Y++) {
+        out << Y_values_rspace[i_Y] << "\t"
+            << exp(-Y_values_rspace[i_Y]) << "\t"
+            << Qs2_values[i_Y] << endl;
+    }
+}
+
 ostream& operator<<(ostream& out, GluonDistribution& gdist) {
     out << gdist.name();
     return out;
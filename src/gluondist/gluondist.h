@@ -20,9 +20,11 @@
 #ifndef _GLUONDIST_H_
 #define _GLUONDIST_H_
 
+#include <cmath>
 #include <exception>
 #include <string>
 #include "interp2d.h"
+#include "uniformgrid.h"
 
 /**
  * An exception to be thrown when a method that requires a grid
@@ -135,6 +137,25 @@ public:
     }
 };
 
+/**
+ * An exception to be thrown when computing the interpolation grid of an
+ * AbstractTransformGluonDistribution fails on one of the setup threads.
+ * The original exception can't be carried across threads, so this just
+ * preserves its message.
+ */
+class GridSetupException : public std::exception {
+private:
+    std::string _message;
+public:
+    GridSetupException(const std::string& message) throw() : _message(message) {}
+    virtual ~GridSetupException() throw() {}
+    const char* what() const throw() {
+        return _message.c_str();
+    }
+};
+
+class GluonDistributionSlice;
+
 /**
  * A gluon distribution.
  */
@@ -166,6 +187,30 @@ public:
      * Return the saturation scale corresponding to the given value of Y.
      */
     virtual double Qs2(const double Y) const = 0;
+    /**
+     * Sets `out[i]` to S2(`r2[i]`, `Y`) for each of the `n` values in `r2`.
+     * Distributions that can do the part of the work which depends only on
+     * `Y` once for all the values override this; by default it just calls
+     * S2() for each one.
+     */
+    virtual void S2_batch(const double* r2, const size_t n, const double Y, double* out);
+    /**
+     * Sets `out[i]` to F(`q2[i]`, `Y`) for each of the `n` values in `q2`,
+     * like S2_batch().
+     */
+    virtual void F_batch(const double* q2, const size_t n, const double Y, double* out);
+    /**
+     * Sets `*S2r` to S2(`r2`, `Y`) and `*S4rst` to S4(`r2`, `s2`, `t2`, `Y`).
+     * Distributions whose S4 is a product of two S2s override this to get
+     * all three values from one call to S2_batch().
+     */
+    virtual void S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst);
+    /**
+     * Returns a new GluonDistributionSlice of this distribution, which the
+     * caller is responsible for deleting. The default slice just passes its
+     * rapidity along to this object.
+     */
+    virtual GluonDistributionSlice* create_slice();
     /**
      * Returns a human-readable name for the gluon distribution.
      */
@@ -189,6 +234,78 @@ public:
      * Only used for testing.
      */
     virtual void write_satscale_grid(std::ostream& out);
+
+    /**
+     * Sets how distributions interpolated on a 2D grid evaluate it when the
+     * grid is uniformly spaced: BILINEAR (the default) and BICUBIC use a
+     * UniformGridInterpolator, and NONE always uses interp2d. Grids which
+     * are not uniform always use interp2d. This affects distributions
+     * constructed after the call.
+     */
+    static void set_grid_interpolation(const UniformGridInterpolator::method_type method);
+    /** The method set by set_grid_interpolation() */
+    static UniformGridInterpolator::method_type get_grid_interpolation() { return grid_interpolation; }
+
+protected:
+    /** The method set by set_grid_interpolation() */
+    static UniformGridInterpolator::method_type grid_interpolation;
+};
+
+/**
+ * A gluon distribution evaluated at one rapidity at a time, for callers
+ * that evaluate it at many transverse arguments before the rapidity changes,
+ * like an IntegrationContext in the fixed xtarget scheme, where Yg depends
+ * only on z.
+ *
+ * Distributions which are interpolated on a grid return slices that look up
+ * the row of the grid, and anything else that depends only on the rapidity,
+ * when set_rapidity() is called rather than on every evaluation, so each
+ * evaluation is a 1D interpolation. The values are exactly the same as those
+ * of the distribution, including the exceptions thrown out of range.
+ *
+ * A slice is used by one thread at a time, and must not outlive its
+ * distribution.
+ */
+class GluonDistributionSlice {
+public:
+    GluonDistributionSlice(GluonDistribution* gdist) : gdist(gdist), Y(NAN), have_Qs2(false), Qs2_value(0) {}
+    virtual ~GluonDistributionSlice() {};
+
+    /** The rapidity of the slice, which is NaN until it is first set */
+    double rapidity() const { return Y; }
+    /** Moves the slice to the rapidity `Y`, if it isn't already there */
+    void set_rapidity(const double Y) {
+        if (Y != this->Y) {
+            this->Y = Y;
+            have_Qs2 = false;
+            update();
+        }
+    }
+
+    /** The saturation scale at the current rapidity */
+    double Qs2() {
+        if (!have_Qs2) {
+            Qs2_value = gdist->Qs2(Y);
+            have_Qs2 = true;
+        }
+        return Qs2_value;
+    }
+    virtual double S2(double r2) { return gdist->S2(r2, Y); }
+    virtual double F(double q2) { return gdist->F(q2, Y); }
+    virtual void S2_batch(const double* r2, const size_t n, double* out) { gdist->S2_batch(r2, n, Y, out); }
+    virtual void F_batch(const double* q2, const size_t n, double* out) { gdist->F_batch(q2, n, Y, out); }
+    virtual void S2_and_S4(double r2, double s2, double t2, double* S2r, double* S4rst) { gdist->S2_and_S4(r2, s2, t2, Y, S2r, S4rst); }
+
+protected:
+    /** Called when the rapidity changes, to recompute whatever depends on it */
+    virtual void update() {}
+
+    GluonDistribution* const gdist;
+    double Y;
+
+private:
+    bool have_Qs2;
+    double Qs2_value;
 };
 
 /**
@@ -214,6 +331,13 @@ public:
      * distribution, exp(-q2 / Qs2) / (pi * Qs2)
      */
     double F(double q2, double Y);
+    void S2_batch(const double* r2, const size_t n, const double Y, double* out);
+    void F_batch(const double* q2, const size_t n, const double Y, double* out);
+    /**
+     * Returns a slice which evaluates the formulas above directly, with the
+     * saturation scale computed once per rapidity.
+     */
+    GluonDistributionSlice* create_slice();
     /**
      * Returns the standard saturation scale, Q0^2(x0/x)^λ
      */
@@ -244,6 +368,12 @@ private:
  * is smaller than the lower boundary of the grid, then the value of the gluon
  * distribution is computed from a series expansion around u2 = 0. The series
  * coefficients are interpolated in Qs2 only.
+ *
+ * Computing the grid takes one numerical integral per grid point, so it is
+ * spread over several threads, and if a cache directory has been set, the
+ * finished grid is saved there in a binary file. A later distribution with
+ * identical parameters and grid bounds maps that file into memory instead
+ * of computing the grid again.
  */
 class AbstractTransformGluonDistribution : public GluonDistribution {
 public:
@@ -274,6 +404,7 @@ public:
      * limit.
      */
     virtual double S4(double r2, double s2, double t2, double Y);
+    virtual void S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst);
 
     /**
      * Returns the name of the distribution, which should incorporate
@@ -281,13 +412,30 @@ public:
      */
     virtual const char* name() = 0;
 
+    /**
+     * Sets the directory in which computed grids are cached. An empty string,
+     * the default, disables the cache. The directory has to exist already.
+     * This affects distributions constructed after the call.
+     */
+    static void set_cache_directory(const std::string& directory);
+    /**
+     * Sets the number of threads used to compute a grid which is not found
+     * in the cache. Zero, the default, means one per online processor.
+     */
+    static void set_setup_threads(const size_t threads);
+
 protected:
     /**
      * Handles the actual calculation of the points to use for interpolation.
      * This should be called from the constructor of each subclass that
      * implements F or S2.
+     *
+     * `parameters` should identify the distribution and give the values of
+     * all the parameters it depends on, apart from the grid bounds, at full
+     * precision. It is used to find the grid in the cache; if it is empty,
+     * the cache is not used.
      */
-    void setup();
+    void setup(const std::string& parameters);
 
     /**
      * Returns the value of the dipole distribution, F or S2.
@@ -305,6 +453,11 @@ protected:
      */
     double u2min, u2max, Ymin, Ymax;
 
+    /** The directory set by set_cache_directory() */
+    static std::string cache_directory;
+    /** The number of threads set by set_setup_threads() */
+    static size_t setup_threads;
+
 private:
     /** Values of ln(u2) for the interpolation. */
     double* log_u2_values;
@@ -331,14 +484,45 @@ private:
     // just a single one
     gsl_interp* interp_dist_1D;
     interp2d* interp_dist_2D;
+    /** Used instead of interp_dist_2D within the grid, if it is uniform */
+    UniformGridInterpolator* uniform_dist_2D;
 
-    gsl_interp_accel* u2_accel;
-    gsl_interp_accel* Y_accel;
+    // No gsl_interp_accel objects here: one gluon distribution is shared by
+    // all worker threads, and an accelerator is written to on every lookup.
 
     size_t u2_dimension;
     size_t Y_dimension;
 
     size_t subinterval_limit;
+
+    /**
+     * The mapped cache file that the arrays above point into, or NULL if
+     * they were allocated by setup()
+     */
+    void* cache_mapping;
+    size_t cache_mapping_length;
+
+    /**
+     * Tries to map the cached grid stored under `key` in `filename`, setting
+     * the arrays to point into it. Returns false if there is no such file or
+     * it holds a different grid.
+     */
+    bool load_grid(const std::string& filename, const std::string& key);
+    /**
+     * Writes the grid to `filename` under `key`, by way of a temporary file
+     * so that other processes never see a partial grid.
+     */
+    void save_grid(const std::string& filename, const std::string& key) const;
+
+    /** The shared state of the threads computing the grid */
+    struct GridSetupJobs;
+    /**
+     * Computes grid rows, taken one at a time from `jobs`, until there
+     * are none left.
+     */
+    void compute_grid_rows(GridSetupJobs& jobs);
+    friend void* grid_setup_worker(void* closure);
+    friend class TransformGluonDistributionSlice;
 };
 
 /**
@@ -371,6 +555,8 @@ public:
      * in `Y`. Otherwise, this throws a GluonDistributionFRangeException.
      */
     double F(double q2, double Y);
+    void F_batch(const double* q2, const size_t n, const double Y, double* out);
+    GluonDistributionSlice* create_slice();
     /**
      * Write a representation of the internal momentum space grid to the
      * given output stream.
@@ -408,6 +594,8 @@ public:
      * in `Y`. Otherwise, this throws a GluonDistributionS2RangeException.
      */
     double S2(double r2, double Y);
+    void S2_batch(const double* r2, const size_t n, const double Y, double* out);
+    GluonDistributionSlice* create_slice();
 
     /**
      * Write a representation of the internal position space grid to the
@@ -468,6 +656,9 @@ public:
      * an exception for `q2 > q2max`.
      */
     double F(double q2, double Y);
+    void S2_batch(const double* r2, const size_t n, const double Y, double* out);
+    void F_batch(const double* q2, const size_t n, const double Y, double* out);
+    GluonDistributionSlice* create_slice();
     /**
      * Returns the standard saturation scale, Q0^2(x0/x)^λ
      */
@@ -506,6 +697,7 @@ public:
      * The parameter Y is not used.
      */
     double S2(double r2, double Y);
+    void S2_batch(const double* r2, const size_t n, const double Y, double* out);
 protected:
     double YMV;
 };
@@ -532,6 +724,7 @@ public:
      * exp(-(r2 Qs02MV)^gammaMV ln(e + 1 / (LambdaMV r)) / 4)
      */
     double F(double q2, double Y);
+    void F_batch(const double* q2, const size_t n, const double Y, double* out);
     /**
      * Returns the standard saturation scale, Q0^2(x0/x)^λ
      */
@@ -575,6 +768,11 @@ public:
 
     double F(double q2, double Y);
 
+    void S2_batch(const double* r2, const size_t n, const double Y, double* out);
+    void F_batch(const double* q2, const size_t n, const double Y, double* out);
+    void S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst);
+    GluonDistributionSlice* create_slice();
+
     /**
      * Returns the derivative of F with respect to q2 at the given
      * values of q2 and Y.
@@ -647,15 +845,16 @@ private:
     // same for position
     gsl_interp* interp_dist_position_1D;
     interp2d* interp_dist_position_2D;
+    // used instead of the interp2d objects for S2 and F if the grids are uniform
+    UniformGridInterpolator* uniform_dist_momentum_2D;
+    UniformGridInterpolator* uniform_dist_position_2D;
 
     // this will be used if we are extracting the saturation scale
     double* Qs2_values;
     gsl_interp* interp_Qs2_1D;
 
-    gsl_interp_accel* r2_accel;
-    gsl_interp_accel* q2_accel;
-    gsl_interp_accel* Y_accel_r;
-    gsl_interp_accel* Y_accel_p;
+    // no interpolation accelerators, for the same reason as in
+    // AbstractTransformGluonDistribution
 
     size_t r2_dimension;
     size_t q2_dimension;
@@ -665,11 +864,36 @@ private:
     double Q02x0lambda;
     double lambda;
 
+    /**
+     * The mapped binary files that the position and momentum arrays point
+     * into, or NULL for data read from a text file, which is allocated
+     */
+    void* pos_mapping;
+    size_t pos_mapping_length;
+    void* mom_mapping;
+    size_t mom_mapping_length;
+
     std::string _name;
 
     friend class ExtendedFileDataGluonDistribution;
+    friend class FileDataGluonDistributionSlice;
 };
 
+/**
+ * Converts a gluon distribution grid from the text format, lines of
+ * whitespace-separated `u2 Y value` covering a complete grid in any order,
+ * to the binary format.
+ *
+ * A binary grid file consists of a header, the 8 bytes "SOLOGDAT" followed
+ * by a format version and the dimensions in u2 and Y as 64-bit integers,
+ * then the u2 values, the Y values, and the grid values at index
+ * INDEX_2D(i_u2, i_Y, ...), all as native doubles. FileDataGluonDistribution
+ * recognizes a binary file by the header and maps it into memory directly,
+ * instead of parsing and sorting the text. The byte order is that of the
+ * machine which did the conversion.
+ */
+void convert_grid_file(const std::string& text_filename, const std::string& binary_filename);
+
 /**
  * A variant of FileDataGluonDistribution that works outside the bounds of the
  * grid given in the file.
@@ -706,11 +930,129 @@ public:
     double S4(double r2, double s2, double t2, double Y);
     double Qs2(const double Y) const;
     double F(double q2, double Y);
+    void S2_batch(const double* r2, const size_t n, const double Y, double* out);
+    void F_batch(const double* q2, const size_t n, const double Y, double* out);
+    void S2_and_S4(double r2, double s2, double t2, double Y, double* S2r, double* S4rst);
+    GluonDistributionSlice* create_slice();
 private:
     GluonDistribution* lower_dist;
     GluonDistribution* upper_dist;
 };
 
+/**
+ * A gluon distribution evolved in rapidity with the Balitsky-Kovchegov
+ * equation, by running the evolution of kovr in this process.
+ *
+ * The evolution starts from kovr's initial condition, the MV model with
+ * kovr's own lambdaMV, at Y = -ln(xinit), with the saturation scale given by the Q02, x0, and lambda passed to the
+ * constructor, and takes as many steps as it needs to cover the momentum
+ * space grid. The
+ * position space distribution, S2 = 1 - N, is interpolated in ln(r2) and Y
+ * directly from the arrays kovr fills in, and the momentum space
+ * distribution is computed from it as for any other
+ * AbstractPositionGluonDistribution. Below the initial rapidity, S2 is the
+ * initial condition, and outside kovr's r grid, it takes the value at the
+ * nearest edge.
+ *
+ * If a cache directory has been set with set_cache_directory(), the evolved
+ * grid is saved there in the binary format described at convert_grid_file(),
+ * with ln(r2) and the rapidity relative to the initial rapidity as the
+ * coordinates, and later distributions that need the same number of steps
+ * map that file instead of running the evolution again, as long as the
+ * initial condition has the same parameters. A cache file that can't be
+ * read is ignored and replaced. The cache doesn't know about the choices
+ * compiled into kovr (the equation, the coupling, and the form of the
+ * initial condition), so it should be emptied when they change.
+ */
+class BKGluonDistribution : public AbstractPositionGluonDistribution {
+public:
+    /**
+     * Constructs a new BK gluon distribution, running the evolution or
+     * loading it from the cache.
+     *
+     * `q2min`, `q2max`, `Ymin`, and `Ymax` specify the boundaries of the
+     * momentum space grid, as for AbstractPositionGluonDistribution. If
+     * `satscale_threshold` is positive, the saturation scale is taken to be
+     * 1/r2 where S2(r2, Y) = `satscale_threshold`; otherwise it is the
+     * standard Q0^2(x0/x)^λ. The evolution may use up to `table_megabytes`
+     * MB for its table of the kernel, and the threads set by
+     * set_setup_threads(). If `step_tolerance` is positive, it takes
+     * adaptive steps with that tolerance on N instead of kovr's fixed steps.
+     */
+    BKGluonDistribution(
+        double q2min,
+        double q2max,
+        double Ymin,
+        double Ymax,
+        double xinit,
+        double Q02,
+        double x0,
+        double lambda,
+        double satscale_threshold,
+        double table_megabytes,
+        double step_tolerance,
+        size_t subinterval_limit = 10000);
+    virtual ~BKGluonDistribution();
+
+    /**
+     * Returns the interpolated value of the evolved dipole gluon distribution.
+     */
+    double S2(double r2, double Y);
+    /**
+     * Returns the value of the momentum space dipole gluon distribution,
+     * using the 1/q^4 extrapolation above `q2max` as MVGluonDistribution does.
+     */
+    double F(double q2, double Y);
+    void S2_batch(const double* r2, const size_t n, const double Y, double* out);
+    void F_batch(const double* q2, const size_t n, const double Y, double* out);
+    GluonDistributionSlice* create_slice();
+    double Qs2(const double Y) const;
+    /**
+     * Returns the name of the distribution, which incorporates
+     * the values of the parameters.
+     */
+    const char* name();
+
+    void write_rspace_grid(std::ostream& out);
+    void write_satscale_grid(std::ostream& out);
+private:
+    /** Values of ln(r2) on the grid of the evolution */
+    double* log_r2_values;
+    /** Values of Y after each step of the evolution */
+    double* Y_values_rspace;
+    /** Values of S2 at INDEX_2D(i_r2, i_Y, r2_dimension, Y_dimension_r) */
+    double* S_dist;
+    size_t r2_dimension;
+    size_t Y_dimension_r;
+    interp2d* interp_dist_position_2D;
+    /** Used instead of interp_dist_position_2D, if the grid is uniform */
+    UniformGridInterpolator* uniform_dist_position_2D;
+    friend class BKGluonDistributionSlice;
+
+    /** Values of the saturation scale at each Y, if it was extracted */
+    double* Qs2_values;
+    gsl_interp* interp_Qs2_1D;
+    double Q02x0lambda;
+    double lambda;
+
+    /**
+     * The mapped cache file that the arrays above point into, or NULL if
+     * they were allocated for the evolution
+     */
+    void* pos_mapping;
+    size_t pos_mapping_length;
+
+    std::string _name;
+
+    /**
+     * Sets up the evolved grid with `steps` steps from the initial condition
+     * at `xinit` with saturation scale `Q02` (`x0`/x)^`lambda`, from the cache
+     * if it's there and can be read, and otherwise by running the evolution
+     */
+    void evolve(const size_t steps, const double table_megabytes, const double step_tolerance,
+                const double xinit, const double Q02, const double x0, const double lambda);
+};
+
 /** Prints the name of the gluon distribution to the given output stream. */
 std::ostream& operator<<(std::ostream& out, GluonDistribution& gdist);
 
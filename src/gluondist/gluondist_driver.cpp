@@ -1,7 +1,12 @@
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <pthread.h>
 #include "../configuration/configuration.h"
 #include "../configuration/context.h"
+#include "../utils/profile.h"
+#include "../utils/utils.h"
 #include "gluondist.h"
 
 ostream& logger = cerr;
@@ -40,7 +45,209 @@ void satscale_query(GluonDistribution* gdist) {
     }
 }
 
-#define usage() cerr << "Usage: " << argv[0] << " <query|printgrid> <S2|F|Qs2> <filename.cfg>" << endl; return 1;
+/** The number of points read, evaluated, and written at a time in batch mode */
+static const size_t batch_block_points = 1 << 20;
+/** The number of points each thread takes at a time from a block */
+static const size_t batch_chunk_points = 4096;
+
+/** Where the points of a batch query come from */
+class PointSource {
+public:
+    virtual ~PointSource() {}
+    /** Fills `x` and `Y` with up to `n` points, returning how many there were */
+    virtual size_t read(double* x, double* Y, const size_t n) = 0;
+};
+
+/** Points read from a file of native-endian doubles, x and Y alternating */
+class FilePointSource : public PointSource {
+public:
+    FilePointSource(FILE* file) : file(file), buffer(2 * batch_block_points) {}
+    size_t read(double* x, double* Y, const size_t n) {
+        const size_t count = fread(&buffer[0], 2 * sizeof(double), min(n, batch_block_points), file);
+        for (size_t i = 0; i < count; i++) {
+            x[i] = buffer[2 * i];
+            Y[i] = buffer[2 * i + 1];
+        }
+        return count;
+    }
+private:
+    FILE* file;
+    vector<double> buffer;
+};
+
+/**
+ * The points of a grid, Y in the outer loop and x in the inner loop, each
+ * evenly spaced including both ends, or for x optionally evenly spaced in
+ * log(x)
+ */
+class GridPointSource : public PointSource {
+public:
+    GridPointSource(const double xmin, const double xmax, const size_t nx, const double Ymin, const double Ymax, const size_t nY, const bool log_x) :
+      xmin(xmin), xmax(xmax), nx(nx), Ymin(Ymin), Ymax(Ymax), nY(nY), log_x(log_x), next(0) {}
+    size_t read(double* x, double* Y, const size_t n) {
+        size_t count = 0;
+        for (; count < n && next < nx * nY; count++, next++) {
+            x[count] = point(xmin, xmax, nx, next % nx, log_x);
+            Y[count] = point(Ymin, Ymax, nY, next / nx, false);
+        }
+        return count;
+    }
+private:
+    static double point(const double min, const double max, const size_t n, const size_t i, const bool log_spaced) {
+        if (n == 1) {
+            return min;
+        }
+        const double t = static_cast<double>(i) / (n - 1);
+        return log_spaced ? min * pow(max / min, t) : min + (max - min) * t;
+    }
+    const double xmin, xmax;
+    const size_t nx;
+    const double Ymin, Ymax;
+    const size_t nY;
+    const bool log_x;
+    size_t next;
+};
+
+/** A block of points being evaluated by the worker threads of batch mode */
+struct BatchBlock {
+    GluonDistribution* gdist;
+    bool momentum;
+    const double* x;
+    const double* Y;
+    double* out;
+    size_t n;
+    /** The start of the next chunk to be taken, updated atomically */
+    size_t next_chunk;
+};
+
+/**
+ * Evaluates the `n` points at `x` and the rapidity of `slice` into `out`.
+ * Points out of the range of the distribution get NaN.
+ */
+static void evaluate_run(GluonDistributionSlice* slice, const bool momentum, const double* x, const size_t n, double* out) {
+    try {
+        if (momentum) {
+            slice->F_batch(x, n, out);
+        }
+        else {
+            slice->S2_batch(x, n, out);
+        }
+    }
+    catch (const exception&) {
+        // find the points that are out of range one at a time
+        for (size_t i = 0; i < n; i++) {
+            try {
+                out[i] = momentum ? slice->F(x[i]) : slice->S2(x[i]);
+            }
+            catch (const exception&) {
+                out[i] = NAN;
+            }
+        }
+    }
+}
+
+/**
+ * The entry point for the worker threads of batch mode. Each takes chunks
+ * of the block until there are none left, and evaluates each run of points
+ * with the same Y in a chunk with one batch call on its own slice.
+ */
+void* batch_worker(void* closure) {
+    BatchBlock* block = static_cast<BatchBlock*>(closure);
+    GluonDistributionSlice* slice = block->gdist->create_slice();
+    while (true) {
+        const size_t start = __sync_fetch_and_add(&block->next_chunk, batch_chunk_points);
+        if (start >= block->n) {
+            break;
+        }
+        const size_t end = min(start + batch_chunk_points, block->n);
+        for (size_t i = start; i < end;) {
+            size_t j = i + 1;
+            while (j < end && block->Y[j] == block->Y[i]) {
+                j++;
+            }
+            slice->set_rapidity(block->Y[i]);
+            evaluate_run(slice, block->momentum, block->x + i, j - i, block->out + i);
+            i = j;
+        }
+    }
+    delete slice;
+    return NULL;
+}
+
+/**
+ * Evaluates S2 or F at all the points from `source` on `threads` threads,
+ * writing the values to `output` as native-endian doubles, or as text lines
+ * of x, Y, and the value if `binary` is false, or not at all if `output`
+ * is NULL. Returns the time spent evaluating, not counting input and output.
+ */
+double batch_query(GluonDistribution* gdist, const bool momentum, PointSource& source, FILE* output, const bool binary, const size_t threads, size_t* total) {
+    vector<double> x(batch_block_points), Y(batch_block_points), out(batch_block_points);
+    vector<pthread_t> workers(threads);
+    double seconds = 0;
+    *total = 0;
+    if (output != NULL && !binary) {
+        fprintf(output, momentum ? "q2\tY\tF\n" : "r2\tY\tS\n");
+    }
+    size_t n;
+    while ((n = source.read(&x[0], &Y[0], batch_block_points)) > 0) {
+        BatchBlock block = {gdist, momentum, &x[0], &Y[0], &out[0], n, 0};
+        const double start = profile::now();
+        size_t started = 0;
+        for (; started < threads; started++) {
+            if (pthread_create(&workers[started], NULL, batch_worker, &block) != 0) {
+                break;
+            }
+        }
+        if (started == 0) {
+            // couldn't start any threads, so do the work here
+            batch_worker(&block);
+        }
+        for (size_t i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        seconds += profile::now() - start;
+        *total += n;
+        if (output == NULL) {
+            continue;
+        }
+        if (binary) {
+            fwrite(&out[0], sizeof(double), n, output);
+        }
+        else {
+            for (size_t i = 0; i < n; i++) {
+                fprintf(output, "%.17g\t%.17g\t%.17g\n", x[i], Y[i], out[i]);
+            }
+        }
+    }
+    return seconds;
+}
+
+/**
+ * Parses a grid specification `xmin:xmax:nx,Ymin:Ymax:nY` into a new
+ * GridPointSource, or returns NULL if it is invalid
+ */
+GridPointSource* parse_grid(const string& spec, const bool log_x) {
+    vector<string> axes = split(spec, ",", 2);
+    if (axes.size() != 2) {
+        return NULL;
+    }
+    vector<string> xs = split(axes[0], ":", 3);
+    vector<string> Ys = split(axes[1], ":", 3);
+    if (xs.size() != 3 || Ys.size() != 3) {
+        return NULL;
+    }
+    const double xmin = atof(xs[0].c_str()), xmax = atof(xs[1].c_str());
+    const long nx = strtol(xs[2].c_str(), NULL, 0), nY = strtol(Ys[2].c_str(), NULL, 0);
+    if (nx <= 0 || nY <= 0 || (log_x && !(xmin > 0 && xmax > 0))) {
+        return NULL;
+    }
+    return new GridPointSource(xmin, xmax, nx, atof(Ys[0].c_str()), atof(Ys[1].c_str()), nY, log_x);
+}
+
+#define usage() cerr << "Usage: " << argv[0] << " <query|printgrid> <S2|F|Qs2> <filename.cfg>" << endl\
+                   << "       " << argv[0] << " batch <S2|F> <filename.cfg> [--input=FILE|--grid=XMIN:XMAX:NX,YMIN:YMAX:NY [--log]]" << endl\
+                   << "             [--output=FILE] [--text] [--threads=N] [--benchmark]" << endl\
+                   << "       " << argv[0] << " convert <input.dat> <output.gdat>" << endl; return 1;
 
 
 /**
@@ -52,6 +259,16 @@ int main(int argc, char** argv) {
         usage();
     }
     string mode(argv[1]);
+    if (mode == "convert") {
+        try {
+            convert_grid_file(argv[2], argv[3]);
+        }
+        catch (const exception& e) {
+            cerr << "Error in converting: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
     string quantity(argv[2]);
     string filename(argv[3]);
     
@@ -84,6 +301,93 @@ int main(int argc, char** argv) {
         }
         return 0;
     }
+    else if (mode == "batch") {
+        if (quantity != "F" && quantity != "S2") {
+            usage();
+        }
+        string input_filename, output_filename, grid_spec;
+        bool log_x = false, text = false, benchmark = false;
+        size_t threads = 1;
+        for (int i = 4; i < argc; i++) {
+            string a(argv[i]);
+            if (a.compare(0, 8, "--input=") == 0) {
+                input_filename = a.substr(8);
+            }
+            else if (a.compare(0, 7, "--grid=") == 0) {
+                grid_spec = a.substr(7);
+            }
+            else if (a.compare(0, 9, "--output=") == 0) {
+                output_filename = a.substr(9);
+            }
+            else if (a.compare(0, 10, "--threads=") == 0) {
+                long n = strtol(a.substr(10).c_str(), NULL, 0);
+                if (n <= 0) {
+                    cerr << "invalid number of threads: " << a << endl;
+                    return 1;
+                }
+                threads = static_cast<size_t>(n);
+            }
+            else if (a == "--log") {
+                log_x = true;
+            }
+            else if (a == "--text") {
+                text = true;
+            }
+            else if (a == "--benchmark") {
+                benchmark = true;
+            }
+            else {
+                usage();
+            }
+        }
+
+        PointSource* source = NULL;
+        FILE* input = NULL;
+        if (!grid_spec.empty()) {
+            source = parse_grid(grid_spec, log_x);
+            if (source == NULL) {
+                cerr << "invalid grid specification: " << grid_spec << endl;
+                return 1;
+            }
+        }
+        else {
+            input = input_filename.empty() || input_filename == "-" ? stdin : fopen(input_filename.c_str(), "rb");
+            if (input == NULL) {
+                cerr << "Unable to open input file " << input_filename << endl;
+                return 1;
+            }
+            source = new FilePointSource(input);
+        }
+        // with --benchmark, the values are only written if asked for
+        FILE* output = NULL;
+        if (!output_filename.empty() && output_filename != "-") {
+            output = fopen(output_filename.c_str(), text ? "w" : "wb");
+            if (output == NULL) {
+                cerr << "Unable to open output file " << output_filename << endl;
+                delete source;
+                return 1;
+            }
+        }
+        else if (!benchmark || output_filename == "-") {
+            output = stdout;
+        }
+
+        size_t total;
+        double seconds = batch_query(gdist, quantity == "F", *source, output, !text, threads, &total);
+        if (benchmark) {
+            cerr << gdist->name() << " " << quantity << ": " << total << " points in " << seconds << " s on " << threads << " threads, "
+                 << (total > 0 ? 1e9 * seconds * threads / total : 0) << " ns/call per thread, "
+                 << (seconds > 0 ? total / seconds : 0) << " calls/s" << endl;
+        }
+        delete source;
+        if (input != NULL && input != stdin) {
+            fclose(input);
+        }
+        if (output != NULL && output != stdout) {
+            fclose(output);
+        }
+        return 0;
+    }
     else if (mode == "query") {
         if (quantity == "F") {
             momentum_space_query(gdist);
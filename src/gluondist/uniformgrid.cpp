@@ -0,0 +1,165 @@
+/*
+ * Part of oneloopcalc
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cmath>
+#include "interp2d.h"
+#include "uniformgrid.h"
+
+/**
+ * The largest deviation of a grid point from its uniformly spaced position,
+ * relative to the size of the coordinates, for the grid to count as uniform.
+ * This only allows for rounding in computing the points; a grid read from a
+ * text file with fewer digits than that is interpolated with interp2d, since
+ * finding its cells by arithmetic would shift them.
+ */
+static const double uniformity_tolerance = 1e-12;
+
+static bool is_uniform(const double* a, const size_t size) {
+    if (size < 2) {
+        return false;
+    }
+    const double step = (a[size - 1] - a[0]) / (size - 1);
+    if (!(step > 0)) {
+        return false;
+    }
+    const double scale = fabs(a[0]) + fabs(a[size - 1]) + step;
+    for (size_t i = 1; i < size - 1; i++) {
+        if (fabs(a[i] - (a[0] + i * step)) > uniformity_tolerance * scale) {
+            return false;
+        }
+    }
+    return true;
+}
+
+UniformGridInterpolator* UniformGridInterpolator::create(const method_type method, const double* xa, const double* ya, const double* za, const size_t xsize, const size_t ysize) {
+    if (method == NONE || !is_uniform(xa, xsize) || !is_uniform(ya, ysize)) {
+        return NULL;
+    }
+    return new UniformGridInterpolator(method, xa, ya, za, xsize, ysize);
+}
+
+/**
+ * The derivative of the grid values along one axis at index `i`, in units
+ * of the grid spacing, by central differences inside the grid and one-sided
+ * differences at its edges. `z(i)` gives the value at index `i` along the axis.
+ */
+template<typename Values>
+static double difference(const Values& z, const size_t i, const size_t size) {
+    if (i == 0) {
+        return z(1) - z(0);
+    }
+    else if (i == size - 1) {
+        return z(size - 1) - z(size - 2);
+    }
+    else {
+        return 0.5 * (z(i + 1) - z(i - 1));
+    }
+}
+
+/** The grid values along x at a fixed y index */
+struct XRow {
+    const double* za;
+    size_t xsize, j;
+    XRow(const double* za, const size_t xsize, const size_t j) : za(za), xsize(xsize), j(j) {}
+    double operator()(const size_t i) const { return za[INDEX_2D(i, j, xsize, 0)]; }
+};
+
+/** The x derivatives along y at a fixed x index */
+struct XDerivativeColumn {
+    const double* za;
+    size_t xsize, i;
+    XDerivativeColumn(const double* za, const size_t xsize, const size_t i) : za(za), xsize(xsize), i(i) {}
+    double operator()(const size_t j) const { return difference(XRow(za, xsize, j), i, xsize); }
+};
+
+/** The grid values along y at a fixed x index */
+struct YColumn {
+    const double* za;
+    size_t xsize, i;
+    YColumn(const double* za, const size_t xsize, const size_t i) : za(za), xsize(xsize), i(i) {}
+    double operator()(const size_t j) const { return za[INDEX_2D(i, j, xsize, 0)]; }
+};
+
+UniformGridInterpolator::UniformGridInterpolator(const method_type method, const double* xa, const double* ya, const double* za, const size_t xsize, const size_t ysize) :
+  method(method),
+  xcells(xsize - 1),
+  ycells(ysize - 1),
+  xmin(xa[0]),
+  xmax(xa[xsize - 1]),
+  ymin(ya[0]),
+  ymax(ya[ysize - 1]),
+  inv_dx((xsize - 1) / (xa[xsize - 1] - xa[0])),
+  inv_dy((ysize - 1) / (ya[ysize - 1] - ya[0])),
+  coefficients(block_size() * xcells * ycells) {
+    assert(method == BILINEAR || method == BICUBIC);
+    size_t xy_size = method == BICUBIC ? xsize * ysize : 0;
+    // values, and for bicubic interpolation the derivatives, at the grid points
+    std::vector<double> fx(xy_size), fy(xy_size), fxy(xy_size);
+    for (size_t j = 0; j < ysize && method == BICUBIC; j++) {
+        for (size_t i = 0; i < xsize; i++) {
+            const size_t index = INDEX_2D(i, j, xsize, ysize);
+            fx[index] = difference(XRow(za, xsize, j), i, xsize);
+            fy[index] = difference(YColumn(za, xsize, i), j, ysize);
+            fxy[index] = difference(XDerivativeColumn(za, xsize, i), j, ysize);
+        }
+    }
+    for (size_t j = 0; j < ycells; j++) {
+        for (size_t i = 0; i < xcells; i++) {
+            double* c = &coefficients[block_size() * (j * xcells + i)];
+            const size_t i00 = INDEX_2D(i, j, xsize, ysize), i01 = INDEX_2D(i, j + 1, xsize, ysize);
+            const size_t i10 = INDEX_2D(i + 1, j, xsize, ysize), i11 = INDEX_2D(i + 1, j + 1, xsize, ysize);
+            if (method == BILINEAR) {
+                c[0] = za[i00];
+                c[1] = za[i01] - za[i00];
+                c[2] = za[i10] - za[i00];
+                c[3] = za[i11] - za[i10] - za[i01] + za[i00];
+            }
+            else {
+                // the coefficients are M F M^T, where F holds the values and
+                // derivatives at the corners
+                static const double M[4][4] = {{1, 0, 0, 0}, {0, 0, 1, 0}, {-3, 3, -2, -1}, {2, -2, 1, 1}};
+                const double F[4][4] = {
+                    {za[i00], za[i01], fy[i00], fy[i01]},
+                    {za[i10], za[i11], fy[i10], fy[i11]},
+                    {fx[i00], fx[i01], fxy[i00], fxy[i01]},
+                    {fx[i10], fx[i11], fxy[i10], fxy[i11]}
+                };
+                double MF[4][4];
+                for (size_t a = 0; a < 4; a++) {
+                    for (size_t b = 0; b < 4; b++) {
+                        MF[a][b] = 0;
+                        for (size_t k = 0; k < 4; k++) {
+                            MF[a][b] += M[a][k] * F[k][b];
+                        }
+                    }
+                }
+                for (size_t a = 0; a < 4; a++) {
+                    for (size_t b = 0; b < 4; b++) {
+                        double sum = 0;
+                        for (size_t k = 0; k < 4; k++) {
+                            sum += MF[a][k] * M[b][k];
+                        }
+                        c[4 * a + b] = sum;
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ * Part of oneloopcalc
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UNIFORMGRID_H_
+#define _UNIFORMGRID_H_
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Interpolation on a 2D grid which is uniformly spaced along both axes,
+ * as the grids of the transform, file data, and BK gluon distributions
+ * usually are.
+ *
+ * The cell containing a point is found by arithmetic rather than by
+ * searching the axes, and the polynomial for each cell is precomputed and
+ * stored in one contiguous block, so an evaluation touches one or two cache
+ * lines. Bilinear interpolation gives the same values as interp2d_bilinear.
+ * Bicubic interpolation uses derivatives estimated by finite differences,
+ * so it matches neither interp2d's bicubic nor its bilinear interpolation
+ * exactly, but it is smooth across cell boundaries.
+ *
+ * Outside the grid, the polynomial of the nearest cell is extrapolated;
+ * callers that need range checks have to do them with contains().
+ */
+class UniformGridInterpolator {
+public:
+    typedef enum {NONE, BILINEAR, BICUBIC} method_type;
+
+    /**
+     * Returns a new interpolator for the grid of `za`, laid out as for
+     * interp2d, at the points `xa` and `ya`, or `NULL` if `method` is
+     * `NONE` or the grid is not uniform.
+     */
+    static UniformGridInterpolator* create(const method_type method, const double* xa, const double* ya, const double* za, const size_t xsize, const size_t ysize);
+
+    /** Whether (x, y) is within the grid */
+    bool contains(const double x, const double y) const {
+        return contains_x(x) && contains_y(y);
+    }
+    bool contains_x(const double x) const { return x >= xmin && x <= xmax; }
+    bool contains_y(const double y) const { return y >= ymin && y <= ymax; }
+
+    /**
+     * The part of an evaluation which depends only on y, so that several
+     * points at the same y can share it
+     */
+    struct Row {
+        /** The coefficients of the first cell in the row */
+        const double* cells;
+        /** The position of y within the row, from 0 to 1 */
+        double u;
+    };
+
+    Row row(const double y) const {
+        double u = (y - ymin) * inv_dy;
+        const size_t j = cell_index(u, ycells);
+        Row r = {&coefficients[block_size() * j * xcells], u - j};
+        return r;
+    }
+
+    /** The interpolated value at x and the y of `r` */
+    double eval(const Row& r, const double x) const {
+        double t = (x - xmin) * inv_dx;
+        const size_t i = cell_index(t, xcells);
+        t -= i;
+        const double u = r.u;
+        const double* c = r.cells + block_size() * i;
+        if (method == BILINEAR) {
+            return c[0] + u * c[1] + t * (c[2] + u * c[3]);
+        }
+        else {
+            // c[4 * a + b] is the coefficient of t^a u^b
+            const double c0 = c[0] + u * (c[1] + u * (c[2] + u * c[3]));
+            const double c1 = c[4] + u * (c[5] + u * (c[6] + u * c[7]));
+            const double c2 = c[8] + u * (c[9] + u * (c[10] + u * c[11]));
+            const double c3 = c[12] + u * (c[13] + u * (c[14] + u * c[15]));
+            return c0 + t * (c1 + t * (c2 + t * c3));
+        }
+    }
+
+    /** The interpolated value at (x, y) */
+    double eval(const double x, const double y) const {
+        return eval(row(y), x);
+    }
+
+    const method_type method;
+
+private:
+    UniformGridInterpolator(const method_type method, const double* xa, const double* ya, const double* za, const size_t xsize, const size_t ysize);
+
+    /** The number of coefficients stored for each cell */
+    size_t block_size() const { return method == BILINEAR ? 4 : 16; }
+
+    /** The index of the cell containing the scaled coordinate `s`, clamped to the grid */
+    static size_t cell_index(const double s, const size_t cells) {
+        if (s <= 0) {
+            return 0;
+        }
+        const size_t i = static_cast<size_t>(s);
+        return i < cells ? i : cells - 1;
+    }
+
+    /** The numbers of cells along each axis */
+    const size_t xcells, ycells;
+    double xmin, xmax, ymin, ymax;
+    /** The reciprocals of the grid spacings */
+    double inv_dx, inv_dy;
+    /** The polynomial coefficients for each cell, row by row in y */
+    std::vector<double> coefficients;
+};
+
+#endif // _UNIFORMGRID_H_
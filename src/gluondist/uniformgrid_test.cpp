@@ -0,0 +1,90 @@
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "interp2d.h"
+#include "uniformgrid.h"
+
+using namespace std;
+
+static const size_t xsize = 21, ysize = 17;
+static const double xmin = -2, dx = 0.25, ymin = 1, dy = 0.5;
+
+/** A quadratic, which the bicubic interpolation reproduces away from the edges */
+static double quadratic(const double x, const double y) {
+    return 0.3 + 1.5 * x - 0.7 * y + 0.25 * x * x - 0.4 * x * y + 0.6 * y * y;
+}
+
+static void fill_grid(vector<double>& xa, vector<double>& ya, vector<double>& za) {
+    xa.resize(xsize);
+    ya.resize(ysize);
+    za.resize(xsize * ysize);
+    for (size_t i = 0; i < xsize; i++) {
+        xa[i] = xmin + i * dx;
+    }
+    for (size_t j = 0; j < ysize; j++) {
+        ya[j] = ymin + j * dy;
+    }
+    for (size_t j = 0; j < ysize; j++) {
+        for (size_t i = 0; i < xsize; i++) {
+            za[INDEX_2D(i, j, xsize, ysize)] = quadratic(xa[i], ya[j]);
+        }
+    }
+}
+
+int main() {
+    vector<double> xa, ya, za;
+    fill_grid(xa, ya, za);
+
+    assert(UniformGridInterpolator::create(UniformGridInterpolator::NONE, &xa[0], &ya[0], &za[0], xsize, ysize) == NULL);
+    UniformGridInterpolator* bilinear = UniformGridInterpolator::create(UniformGridInterpolator::BILINEAR, &xa[0], &ya[0], &za[0], xsize, ysize);
+    UniformGridInterpolator* bicubic = UniformGridInterpolator::create(UniformGridInterpolator::BICUBIC, &xa[0], &ya[0], &za[0], xsize, ysize);
+    assert(bilinear != NULL && bicubic != NULL);
+    assert(bilinear->contains(xa[0], ya[ysize - 1]));
+    assert(!bilinear->contains(xa[0] - dx, ya[0]));
+    assert(!bilinear->contains(xa[0], ya[ysize - 1] + dy));
+
+    // both methods go through the grid points
+    for (size_t j = 0; j < ysize; j++) {
+        for (size_t i = 0; i < xsize; i++) {
+            const double expected = za[INDEX_2D(i, j, xsize, ysize)];
+            assert(fabs(bilinear->eval(xa[i], ya[j]) - expected) <= 1e-12 * fabs(expected) + 1e-13);
+            assert(fabs(bicubic->eval(xa[i], ya[j]) - expected) <= 1e-12 * fabs(expected) + 1e-13);
+        }
+    }
+
+    // bilinear interpolation agrees with interp2d between the grid points
+    interp2d* reference = interp2d_alloc(interp2d_bilinear, xsize, ysize);
+    interp2d_init(reference, &xa[0], &ya[0], &za[0], xsize, ysize);
+    for (double y = ya[0]; y <= ya[ysize - 1]; y += 0.37 * dy) {
+        const UniformGridInterpolator::Row row = bilinear->row(y);
+        for (double x = xa[0]; x <= xa[xsize - 1]; x += 0.41 * dx) {
+            const double expected = interp2d_eval(reference, &xa[0], &ya[0], &za[0], x, y, NULL, NULL);
+            assert(fabs(bilinear->eval(x, y) - expected) <= 1e-12 * fabs(expected) + 1e-13);
+            assert(bilinear->eval(row, x) == bilinear->eval(x, y));
+        }
+    }
+    interp2d_free(reference);
+    cout << "bilinear interpolation agrees with interp2d" << endl;
+
+    // the finite differences are exact for a quadratic in the cells that
+    // don't touch the edges, so the bicubic interpolation is too
+    for (double y = ya[1]; y <= ya[ysize - 2]; y += 0.37 * dy) {
+        for (double x = xa[1]; x <= xa[xsize - 2]; x += 0.41 * dx) {
+            const double expected = quadratic(x, y);
+            assert(fabs(bicubic->eval(x, y) - expected) <= 1e-11 * fabs(expected) + 1e-12);
+        }
+    }
+    cout << "bicubic interpolation reproduces a quadratic" << endl;
+    delete bilinear;
+    delete bicubic;
+
+    // a grid that is only uniform to a few digits, as in a text file, is left to interp2d
+    xa[xsize / 2] += 1e-7 * dx;
+    assert(UniformGridInterpolator::create(UniformGridInterpolator::BILINEAR, &xa[0], &ya[0], &za[0], xsize, ysize) == NULL);
+    xa[xsize / 2] = xmin + (xsize / 2) * dx;
+    ya[1] = ya[0] + 0.9 * dy;
+    assert(UniformGridInterpolator::create(UniformGridInterpolator::BICUBIC, &xa[0], &ya[0], &za[0], xsize, ysize) == NULL);
+    cout << "grids which are not uniform are rejected" << endl;
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <gsl/gsl_math.h>
+#include "compiled_hardfactor.h"
+#include "hardfactor_parser.h"
+
+using std::cerr;
+using std::endl;
+
+/**
+ * The relative difference between the compiled and parsed values of a term
+ * above which CheckedBoundHardFactorTerm reports a mismatch. The two
+ * implementations don't necessarily do the floating point operations in
+ * the same order, so they can't be expected to agree exactly.
+ */
+static const double check_tolerance = 1e-10;
+
+const CompiledHardFactorDefinition* find_compiled_hard_factor(const CompiledHardFactorDefinition* definitions, const ParsedHardFactorTerm& term) {
+    for (const CompiledHardFactorDefinition* d = definitions; d->name != NULL; d++) {
+        if (term.get_name() == string(d->name)
+         && term.get_implementation() == string(d->implementation)
+         && term.Fs_expr() == d->Fs_expr
+         && term.Fn_expr() == d->Fn_expr
+         && term.Fd_expr() == d->Fd_expr) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * A bound compiled term which evaluates the reference parsed term alongside
+ * the compiled code, and complains (once per part of the term) if they
+ * disagree. The compiled values are the ones returned.
+ */
+class CheckedBoundHardFactorTerm : public BoundHardFactorTerm {
+public:
+    CheckedBoundHardFactorTerm(const CompiledHardFactorTerm& term, const IntegrationContext& ictx) :
+      BoundHardFactorTerm(term, ictx),
+      reference(term.reference().bind(ictx)),
+      Fs_mismatch(false), Fn_mismatch(false), Fd_mismatch(false) {
+    }
+    ~CheckedBoundHardFactorTerm() {
+        delete reference;
+    }
+
+    void Fs(double* real, double* imag) const {
+        double ref_real, ref_imag;
+        term.Fs(&ictx, real, imag);
+        reference->Fs(&ref_real, &ref_imag);
+        compare("Fs", Fs_mismatch, *real, *imag, ref_real, ref_imag);
+    }
+    void Fn(double* real, double* imag) const {
+        double ref_real, ref_imag;
+        term.Fn(&ictx, real, imag);
+        reference->Fn(&ref_real, &ref_imag);
+        compare("Fn", Fn_mismatch, *real, *imag, ref_real, ref_imag);
+    }
+    void Fd(double* real, double* imag) const {
+        double ref_real, ref_imag;
+        term.Fd(&ictx, real, imag);
+        reference->Fd(&ref_real, &ref_imag);
+        compare("Fd", Fd_mismatch, *real, *imag, ref_real, ref_imag);
+    }
+
+private:
+    const BoundHardFactorTerm* reference;
+    mutable bool Fs_mismatch, Fn_mismatch, Fd_mismatch;
+
+    static bool agree(const double compiled, const double parsed) {
+        if (compiled == parsed || (gsl_isnan(compiled) && gsl_isnan(parsed))) {
+            return true;
+        }
+        return fabs(compiled - parsed) <= check_tolerance * GSL_MAX_DBL(fabs(compiled), fabs(parsed));
+    }
+
+    void compare(const char* part, bool& reported, const double real, const double imag, const double ref_real, const double ref_imag) const {
+        if (reported || (agree(real, ref_real) && agree(imag, ref_imag))) {
+            return;
+        }
+        reported = true;
+        cerr << "WARNING: compiled " << part << " of " << term.get_name() << "." << term.get_implementation()
+             << " = " << real << " + " << imag << "i, but parsed expression gives "
+             << ref_real << " + " << ref_imag << "i" << endl;
+    }
+
+    // not copyable, because this owns the reference bound term
+    CheckedBoundHardFactorTerm(const CheckedBoundHardFactorTerm&);
+    CheckedBoundHardFactorTerm& operator=(const CheckedBoundHardFactorTerm&);
+};
+
+CompiledHardFactorTerm::CompiledHardFactorTerm(const ParsedHardFactorTerm* reference, const CompiledHardFactorDefinition& definition, const bool check) :
+  p_reference(reference),
+  definition(definition),
+  check(check) {
+    assert(p_reference != NULL);
+}
+
+CompiledHardFactorTerm::~CompiledHardFactorTerm() {
+    delete p_reference;
+}
+
+const char* CompiledHardFactorTerm::get_name() const {
+    return p_reference->get_name();
+}
+
+const char* CompiledHardFactorTerm::get_implementation() const {
+    return p_reference->get_implementation();
+}
+
+const IntegrationRegion* CompiledHardFactorTerm::get_integration() const {
+    return p_reference->get_integration();
+}
+
+HardFactor::HardFactorOrder CompiledHardFactorTerm::get_order() const {
+    return p_reference->get_order();
+}
+
+const Modifiers& CompiledHardFactorTerm::get_modifiers() const {
+    return p_reference->get_modifiers();
+}
+
+bool CompiledHardFactorTerm::has_Fs() const {
+    return p_reference->has_Fs();
+}
+
+bool CompiledHardFactorTerm::has_Fn() const {
+    return p_reference->has_Fn();
+}
+
+bool CompiledHardFactorTerm::has_Fd() const {
+    return p_reference->has_Fd();
+}
+
+BoundHardFactorTerm* CompiledHardFactorTerm::bind(const IntegrationContext& ictx) const {
+    if (check) {
+        return new CheckedBoundHardFactorTerm(*this, ictx);
+    }
+    else {
+        // the generated functions have no state, so the default forwarding is all we need
+        return HardFactorTerm::bind(ictx);
+    }
+}
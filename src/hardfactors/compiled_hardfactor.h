@@ -0,0 +1,117 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COMPILED_HARD_FACTOR_H_
+#define _COMPILED_HARD_FACTOR_H_
+
+#include "hardfactor.h"
+
+class ParsedHardFactorTerm;
+
+/**
+ * The signature of a native function computing one of `Fs`, `Fn`, or `Fd`
+ * for a hard factor term.
+ */
+typedef void (*CompiledHardFactorFunction)(const IntegrationContext* ictx, double* real, double* imag);
+
+/**
+ * One hard factor term from a definition file, translated into C++.
+ *
+ * Tables of these are generated at build time by `hfparser --codegen`
+ * (see write_compiled_hard_factors()). The expressions are stored exactly
+ * as ParsedHardFactorTerm::Fs_expr() and friends report them, so that a
+ * compiled implementation is only ever used for a definition whose text
+ * is identical to the one it was generated from.
+ */
+struct CompiledHardFactorDefinition {
+    const char* name;
+    const char* implementation;
+    const char* Fs_expr;
+    const char* Fn_expr;
+    const char* Fd_expr;
+    CompiledHardFactorFunction Fs;
+    CompiledHardFactorFunction Fn;
+    CompiledHardFactorFunction Fd;
+};
+
+/**
+ * The table of compiled hard factor terms built into the program, terminated
+ * by an entry with a `NULL` name. This is defined in the generated source
+ * file, so it is only available in programs that link that file.
+ */
+extern const CompiledHardFactorDefinition compiled_hard_factor_definitions[];
+
+/**
+ * Finds the entry in a table of compiled definitions which implements
+ * the given parsed term.
+ *
+ * @param[in] definitions a table terminated by an entry with a `NULL` name
+ * @param[in] term the parsed term to look for
+ * @return the matching entry, or `NULL` if there is none (for example if
+ * the definition file has been changed since the program was built)
+ */
+const CompiledHardFactorDefinition* find_compiled_hard_factor(const CompiledHardFactorDefinition* definitions, const ParsedHardFactorTerm& term);
+
+/**
+ * A ::HardFactorTerm which evaluates native code generated from a parsed
+ * definition.
+ *
+ * The name, order, integration region, and modifiers come from the
+ * ParsedHardFactorTerm the code was generated from, which this object
+ * takes ownership of. That term remains available as the reference
+ * implementation: when checking is enabled, every evaluation is also done
+ * with the parsed expressions and any disagreement is reported.
+ */
+class CompiledHardFactorTerm : public HardFactorTerm {
+public:
+    /**
+     * @param[in] reference the parsed term, which will be deleted along with this
+     * @param[in] definition the compiled implementation of `reference`
+     * @param[in] check whether to compare every evaluation against `reference`
+     */
+    CompiledHardFactorTerm(const ParsedHardFactorTerm* reference, const CompiledHardFactorDefinition& definition, const bool check);
+    ~CompiledHardFactorTerm();
+
+    const char* get_name() const;
+    const char* get_implementation() const;
+    const IntegrationRegion* get_integration() const;
+    HardFactorOrder get_order() const;
+    const Modifiers& get_modifiers() const;
+    void Fs(const IntegrationContext* ictx, double* real, double* imag) const { definition.Fs(ictx, real, imag); }
+    void Fn(const IntegrationContext* ictx, double* real, double* imag) const { definition.Fn(ictx, real, imag); }
+    void Fd(const IntegrationContext* ictx, double* real, double* imag) const { definition.Fd(ictx, real, imag); }
+    bool has_Fs() const;
+    bool has_Fn() const;
+    bool has_Fd() const;
+    BoundHardFactorTerm* bind(const IntegrationContext& ictx) const;
+
+    /** The parsed term this was generated from */
+    const ParsedHardFactorTerm& reference() const { return *p_reference; }
+
+private:
+    const ParsedHardFactorTerm* p_reference;
+    const CompiledHardFactorDefinition& definition;
+    const bool check;
+
+    // not copyable, because this owns the reference term
+    CompiledHardFactorTerm(const CompiledHardFactorTerm&);
+    CompiledHardFactorTerm& operator=(const CompiledHardFactorTerm&);
+};
+
+#endif // _COMPILED_HARD_FACTOR_H_
@@ -38,6 +38,10 @@ const HardFactorTerm* const* HardFactorTerm::get_terms() const {
     return &p_this;
 }
 
+BoundHardFactorTerm* HardFactorTerm::bind(const IntegrationContext& ictx) const {
+    return new BoundHardFactorTerm(*this, ictx);
+}
+
 
 HardFactorGroup::HardFactorGroup(const string& label, const HardFactorList& objects, const vector<string>& specifications) :
  label(label), objects(objects), specifications(specifications) {
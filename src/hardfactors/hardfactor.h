@@ -30,6 +30,7 @@
 #include "categorymap.h"
 
 class HardFactorTerm;
+class BoundHardFactorTerm;
 
 /**
  * Something that can be integrated using the program.
@@ -93,6 +94,22 @@ public:
     virtual void Fn(const IntegrationContext* ictx, double* real, double* imag) const { *real = 0; *imag = 0; }
     /** The delta-function part of the term. */
     virtual void Fd(const IntegrationContext* ictx, double* real, double* imag) const { *real = 0; *imag = 0; }
+    /**
+     * Whether Fs can be nonzero. This only returns false for a term which
+     * is known to have no Fs at all, so that the Integrator can skip it.
+     */
+    virtual bool has_Fs() const { return true; }
+    /** @see has_Fs() */
+    virtual bool has_Fn() const { return true; }
+    /** @see has_Fs() */
+    virtual bool has_Fd() const { return true; }
+    /**
+     * Creates an object that evaluates this term using the variables of
+     * the given IntegrationContext. Distinct bound terms share no mutable
+     * state, so each thread can evaluate its own at the same time as the
+     * others. The caller is responsible for deleting the returned object.
+     */
+    virtual BoundHardFactorTerm* bind(const IntegrationContext& ictx) const;
     /**
      * @return 1
      */
@@ -106,8 +123,35 @@ private:
     const HardFactorTerm* p_this;
 };
 
+/**
+ * A ::HardFactorTerm evaluated with the variables of one particular
+ * ::IntegrationContext.
+ *
+ * The default implementation just forwards to the term's own `Fs`, `Fn`,
+ * and `Fd`, which is fine for terms that have no state of their own.
+ * Terms which need per-context state to evaluate, like ParsedHardFactorTerm,
+ * keep it in a subclass of this, which is returned by HardFactorTerm::bind().
+ */
+class BoundHardFactorTerm {
+public:
+    BoundHardFactorTerm(const HardFactorTerm& term, const IntegrationContext& ictx) : term(term), ictx(ictx) {}
+    virtual ~BoundHardFactorTerm() {}
+    /** The plus-regulated ("singular") part of the term. */
+    virtual void Fs(double* real, double* imag) const { term.Fs(&ictx, real, imag); }
+    /** The normal part of the term. */
+    virtual void Fn(double* real, double* imag) const { term.Fn(&ictx, real, imag); }
+    /** The delta-function part of the term. */
+    virtual void Fd(double* real, double* imag) const { term.Fd(&ictx, real, imag); }
+
+    /** The term being evaluated */
+    const HardFactorTerm& term;
+    /** The context that provides the values of the variables */
+    const IntegrationContext& ictx;
+};
+
 typedef std::vector<const HardFactor*> HardFactorList;
 typedef std::vector<const HardFactorTerm*> HardFactorTermList;
+typedef std::vector<const BoundHardFactorTerm*> BoundHardFactorTermList;
 
 /**
  * A group of `HardFactor`s which can be calculated together or separately.
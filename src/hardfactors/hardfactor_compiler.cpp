@@ -0,0 +1,548 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include "hardfactor_compiler.h"
+#include "hardfactor_parser.h"
+
+using std::ostream;
+using std::ostringstream;
+using std::set;
+using std::string;
+using std::vector;
+
+UncompilableExpressionException::UncompilableExpressionException(const string& expr, const string& message) throw() {
+    ostringstream oss;
+    oss << message << " in expression " << expr;
+    _message = oss.str();
+}
+
+const char* UncompilableExpressionException::what() const throw() {
+    return _message.c_str();
+}
+
+/**
+ * Translates one expression from muParser syntax to C++.
+ *
+ * This is a plain recursive descent parser over muParser's grammar, using
+ * muParser's operator precedence (from lowest to highest: `?:`, `||`, `&&`,
+ * comparisons, `+ -`, `* /`, unary `-`, `^`, with `^` right-associative).
+ * Every subexpression it produces is fully parenthesized,
+ * so C++'s own precedence rules never come into play.
+ */
+class ExpressionTranslator {
+public:
+    ExpressionTranslator(const string& expr) : expr(expr), pos(0), uses_ctx(false) {
+        tokenize();
+    }
+
+    string translate();
+
+private:
+    const string expr;
+    vector<string> tokens;
+    size_t pos;
+    /** The auxiliary variables which have been assigned so far */
+    set<string> aux_variables;
+    /** Whether the translated code refers to the Context */
+    bool uses_ctx;
+
+    void tokenize();
+
+    const string& peek() const {
+        static const string end;
+        return pos < tokens.size() ? tokens[pos] : end;
+    }
+    bool at_end() const {
+        return pos >= tokens.size();
+    }
+    string next() {
+        if (at_end()) {
+            fail("unexpected end");
+        }
+        return tokens[pos++];
+    }
+    void expect(const string& token) {
+        if (next() != token) {
+            fail("expected '" + token + "'");
+        }
+    }
+    void fail(const string& message) const {
+        throw UncompilableExpressionException(expr, message);
+    }
+
+    string ternary();
+    string logical_or();
+    string logical_and();
+    string comparison();
+    string sum();
+    string product();
+    string unary();
+    string power();
+    string primary();
+    string function_call(const string& name);
+    string variable(const string& name);
+    vector<string> arguments();
+};
+
+static bool is_identifier_start(const char c) {
+    return isalpha(c) || c == '_';
+}
+
+static bool is_identifier_char(const char c) {
+    return isalnum(c) || c == '_';
+}
+
+void ExpressionTranslator::tokenize() {
+    size_t i = 0;
+    while (i < expr.length()) {
+        char c = expr[i];
+        if (isspace(c)) {
+            i++;
+        }
+        else if (isdigit(c) || (c == '.' && i + 1 < expr.length() && isdigit(expr[i + 1]))) {
+            size_t start = i;
+            while (i < expr.length() && (isdigit(expr[i]) || expr[i] == '.')) {
+                i++;
+            }
+            if (i < expr.length() && (expr[i] == 'e' || expr[i] == 'E')) {
+                i++;
+                if (i < expr.length() && (expr[i] == '+' || expr[i] == '-')) {
+                    i++;
+                }
+                while (i < expr.length() && isdigit(expr[i])) {
+                    i++;
+                }
+            }
+            tokens.push_back(expr.substr(start, i - start));
+        }
+        else if (is_identifier_start(c)) {
+            size_t start = i;
+            while (i < expr.length() && is_identifier_char(expr[i])) {
+                i++;
+            }
+            tokens.push_back(expr.substr(start, i - start));
+        }
+        else {
+            string two = expr.substr(i, 2);
+            if (two == "<=" || two == ">=" || two == "==" || two == "!=" || two == "&&" || two == "||") {
+                tokens.push_back(two);
+                i += 2;
+            }
+            else if (string("+-*/^(),?:<>=").find(c) != string::npos) {
+                tokens.push_back(string(1, c));
+                i++;
+            }
+            else {
+                fail(string("unknown character '") + c + "'");
+            }
+        }
+    }
+}
+
+string ExpressionTranslator::translate() {
+    vector<string> statements;
+    vector<string> values;
+    while (true) {
+        if (pos + 1 < tokens.size() && is_identifier_start(tokens[pos][0]) && tokens[pos + 1] == "=") {
+            string name = next();
+            next();
+            string value = ternary();
+            if (!values.empty()) {
+                // muParser allows this, but it's never meaningful in a hard factor
+                fail("assignment to " + name + " after a value");
+            }
+            if (aux_variables.insert(name).second) {
+                statements.push_back("double aux_" + name + " = " + value + ";");
+            }
+            else {
+                statements.push_back("aux_" + name + " = " + value + ";");
+            }
+        }
+        else {
+            values.push_back(ternary());
+        }
+        if (at_end()) {
+            break;
+        }
+        expect(",");
+    }
+    if (values.size() != 2) {
+        fail("expected exactly two values (real and imaginary parts)");
+    }
+
+    ostringstream oss;
+    if (uses_ctx) {
+        oss << "    const Context& ctx = ictx->ctx;" << std::endl;
+    }
+    else {
+        oss << "    (void)ictx;" << std::endl;
+    }
+    for (vector<string>::const_iterator it = statements.begin(); it != statements.end(); it++) {
+        oss << "    " << *it << std::endl;
+    }
+    oss << "    *real = " << values[0] << ";" << std::endl;
+    oss << "    *imag = " << values[1] << ";" << std::endl;
+    return oss.str();
+}
+
+string ExpressionTranslator::ternary() {
+    string condition = logical_or();
+    if (peek() == "?") {
+        next();
+        string if_true = ternary();
+        expect(":");
+        string if_false = ternary();
+        return "((" + condition + ") ? " + if_true + " : " + if_false + ")";
+    }
+    return condition;
+}
+
+string ExpressionTranslator::logical_or() {
+    string lhs = logical_and();
+    while (peek() == "||") {
+        next();
+        lhs = "static_cast<double>(" + lhs + " || " + logical_and() + ")";
+    }
+    return lhs;
+}
+
+string ExpressionTranslator::logical_and() {
+    string lhs = comparison();
+    while (peek() == "&&") {
+        next();
+        lhs = "static_cast<double>(" + lhs + " && " + comparison() + ")";
+    }
+    return lhs;
+}
+
+string ExpressionTranslator::comparison() {
+    string lhs = sum();
+    while (peek() == "<" || peek() == ">" || peek() == "<=" || peek() == ">=" || peek() == "==" || peek() == "!=") {
+        string op = next();
+        lhs = "static_cast<double>(" + lhs + " " + op + " " + sum() + ")";
+    }
+    return lhs;
+}
+
+string ExpressionTranslator::sum() {
+    string lhs = product();
+    while (peek() == "+" || peek() == "-") {
+        string op = next();
+        lhs = "(" + lhs + " " + op + " " + product() + ")";
+    }
+    return lhs;
+}
+
+string ExpressionTranslator::product() {
+    string lhs = unary();
+    while (peek() == "*" || peek() == "/") {
+        string op = next();
+        lhs = "(" + lhs + " " + op + " " + unary() + ")";
+    }
+    return lhs;
+}
+
+string ExpressionTranslator::unary() {
+    if (peek() == "-") {
+        next();
+        return "(-" + unary() + ")";
+    }
+    else if (peek() == "+") {
+        next();
+        return unary();
+    }
+    return power();
+}
+
+static bool is_small_integer(const string& token) {
+    if (token.empty() || token.length() > 2) {
+        return false;
+    }
+    for (string::const_iterator it = token.begin(); it != token.end(); it++) {
+        if (!isdigit(*it)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+string ExpressionTranslator::power() {
+    string base = primary();
+    if (peek() == "^") {
+        next();
+        // integer powers are much faster with gsl_pow_int than with pow
+        if (is_small_integer(peek()) && (pos + 1 >= tokens.size() || tokens[pos + 1] != "^")) {
+            return "gsl_pow_int(" + base + ", " + next() + ")";
+        }
+        return "pow(" + base + ", " + unary() + ")";
+    }
+    return base;
+}
+
+string ExpressionTranslator::primary() {
+    string token = next();
+    if (token == "(") {
+        string inner = ternary();
+        expect(")");
+        return inner;
+    }
+    else if (isdigit(token[0]) || token[0] == '.') {
+        // make sure integer literals don't turn into integer arithmetic
+        if (token.find_first_of(".eE") == string::npos) {
+            token += ".0";
+        }
+        return token;
+    }
+    else if (is_identifier_start(token[0])) {
+        if (peek() == "(") {
+            return function_call(token);
+        }
+        return variable(token);
+    }
+    fail("unexpected '" + token + "'");
+    return "";
+}
+
+vector<string> ExpressionTranslator::arguments() {
+    vector<string> args;
+    expect("(");
+    if (peek() == ")") {
+        next();
+        return args;
+    }
+    while (true) {
+        args.push_back(ternary());
+        string token = next();
+        if (token == ")") {
+            break;
+        }
+        else if (token != ",") {
+            fail("expected ',' or ')' in argument list");
+        }
+    }
+    return args;
+}
+
+/**
+ * A function which can appear in a hard factor expression and the C++
+ * code that implements it.
+ */
+struct TranslatedFunction {
+    const char* name;
+    size_t arity;
+    /** The name of the C++ function, or code which precedes the arguments */
+    const char* translation;
+    /** Whether the function is a method of the gluon distribution */
+    bool gdist;
+};
+
+static const TranslatedFunction translated_functions[] = {
+    {"F",      2, "F",                       true},
+    {"S2",     2, "S2",                      true},
+    {"S4",     4, "S4",                      true},
+    {"dot",    4, "compiled_dot2",           false},
+    {"square", 2, "compiled_square2",        false},
+    {"norm",   2, "gsl_hypot",               false},
+    {"J",      2, "compiled_bessel_J",       false},
+    {"sin",    1, "sin",                     false},
+    {"cos",    1, "cos",                     false},
+    {"tan",    1, "tan",                     false},
+    {"asin",   1, "asin",                    false},
+    {"acos",   1, "acos",                    false},
+    {"atan",   1, "atan",                    false},
+    {"sinh",   1, "sinh",                    false},
+    {"cosh",   1, "cosh",                    false},
+    {"tanh",   1, "tanh",                    false},
+    {"asinh",  1, "gsl_asinh",               false},
+    {"acosh",  1, "gsl_acosh",               false},
+    {"atanh",  1, "gsl_atanh",               false},
+    {"exp",    1, "exp",                     false},
+    {"sqrt",   1, "sqrt",                    false},
+    {"ln",     1, "log",                     false},
+    {"log",    1, "log",                     false},
+    {"log10",  1, "log10",                   false},
+    {"log2",   1, "compiled_log2",           false},
+    {"abs",    1, "fabs",                    false},
+    {"sign",   1, "compiled_sign",           false},
+    {"rint",   1, "compiled_rint",           false},
+    {"min",    2, "GSL_MIN_DBL",             false},
+    {"max",    2, "GSL_MAX_DBL",             false},
+    {NULL,     0, NULL,                      false}
+};
+
+string ExpressionTranslator::function_call(const string& name) {
+    vector<string> args = arguments();
+    for (const TranslatedFunction* f = translated_functions; f->name != NULL; f++) {
+        if (name != f->name) {
+            continue;
+        }
+        if (args.size() != f->arity) {
+            fail("wrong number of arguments to " + name);
+        }
+        ostringstream oss;
+        if (f->gdist) {
+            // the gluon distribution the IntegrationContext has selected
+            oss << "ictx->gdist->";
+        }
+        oss << f->translation << "(";
+        for (vector<string>::const_iterator it = args.begin(); it != args.end(); it++) {
+            if (it != args.begin()) {
+                oss << ", ";
+            }
+            oss << *it;
+        }
+        oss << ")";
+        return oss.str();
+    }
+    fail("unknown function " + name);
+    return "";
+}
+
+string ExpressionTranslator::variable(const string& name) {
+    if (aux_variables.count(name) > 0) {
+        return "aux_" + name;
+    }
+#define process(var) if (name == #var) { return "ictx->" #var; }
+#include "../integration/ictx_var_list.inc"
+#undef process
+#define process(var) if (name == #var) { uses_ctx = true; return "ctx." #var; }
+#include "../configuration/ctx_var_list.inc"
+#undef process
+    // the same aliases and constants that the parser defines
+    if (name == "A") {
+        uses_ctx = true;
+        return "ctx.mass_number";
+    }
+    else if (name == "c") {
+        uses_ctx = true;
+        return "ctx.centrality";
+    }
+    else if (name == "pi" || name == "_pi") {
+        return "M_PI";
+    }
+    else if (name == "_e") {
+        return "M_E";
+    }
+    else if (name == "euler_gamma") {
+        return "M_EULER";
+    }
+    fail("unknown variable " + name);
+    return "";
+}
+
+string compile_hard_factor_expression(const string& expr) {
+    return ExpressionTranslator(expr).translate();
+}
+
+/**
+ * Writes the string as a C++ string literal.
+ */
+static void write_string_literal(ostream& out, const string& s) {
+    out << '"';
+    for (string::const_iterator it = s.begin(); it != s.end(); it++) {
+        if (*it == '"' || *it == '\\') {
+            out << '\\' << *it;
+        }
+        else if (*it == '\n') {
+            out << "\\n";
+        }
+        else {
+            out << *it;
+        }
+    }
+    out << '"';
+}
+
+static const char* const compiled_source_preamble =
+  "/* Generated by hfparser --codegen. Do not edit. */\n"
+  "\n"
+  "#include <cmath>\n"
+  "#include <gsl/gsl_math.h>\n"
+  "#include <gsl/gsl_sf_bessel.h>\n"
+  "#include \"compiled_hardfactor.h\"\n"
+  "\n"
+  "static inline double compiled_dot2(const double a1, const double a2, const double b1, const double b2) {\n"
+  "    return a1*b1 + a2*b2;\n"
+  "}\n"
+  "static inline double compiled_square2(const double a1, const double a2) {\n"
+  "    return a1*a1 + a2*a2;\n"
+  "}\n"
+  "static inline double compiled_bessel_J(const double n, const double x) {\n"
+  "    return gsl_sf_bessel_Jn(static_cast<int>(n), x);\n"
+  "}\n"
+  "static inline double compiled_log2(const double x) {\n"
+  "    return log(x) / M_LN2;\n"
+  "}\n"
+  "static inline double compiled_sign(const double x) {\n"
+  "    return x > 0 ? 1 : (x < 0 ? -1 : 0);\n"
+  "}\n"
+  "static inline double compiled_rint(const double x) {\n"
+  "    return floor(x + 0.5);\n"
+  "}\n";
+
+size_t write_compiled_hard_factors(ostream& out, const vector<const ParsedHardFactorTerm*>& terms, ostream& log) {
+    vector<const ParsedHardFactorTerm*> compiled;
+    ostringstream functions;
+    for (vector<const ParsedHardFactorTerm*>::const_iterator it = terms.begin(); it != terms.end(); it++) {
+        const ParsedHardFactorTerm& term = **it;
+        const size_t index = compiled.size();
+        string Fs_body, Fn_body, Fd_body;
+        try {
+            Fs_body = compile_hard_factor_expression(term.Fs_expr());
+            Fn_body = compile_hard_factor_expression(term.Fn_expr());
+            Fd_body = compile_hard_factor_expression(term.Fd_expr());
+        }
+        catch (const UncompilableExpressionException& e) {
+            log << "Not compiling " << term.get_name() << "." << term.get_implementation() << ": " << e.what() << std::endl;
+            continue;
+        }
+        functions << std::endl << "// " << term.get_name() << "." << term.get_implementation() << std::endl;
+        functions << "static void compiled_" << index << "_Fs(const IntegrationContext* ictx, double* real, double* imag) {" << std::endl << Fs_body << "}" << std::endl;
+        functions << "static void compiled_" << index << "_Fn(const IntegrationContext* ictx, double* real, double* imag) {" << std::endl << Fn_body << "}" << std::endl;
+        functions << "static void compiled_" << index << "_Fd(const IntegrationContext* ictx, double* real, double* imag) {" << std::endl << Fd_body << "}" << std::endl;
+        compiled.push_back(&term);
+    }
+
+    out << compiled_source_preamble << functions.str() << std::endl;
+    // the declaration in compiled_hardfactor.h gives this external linkage
+    out << "const CompiledHardFactorDefinition compiled_hard_factor_definitions[] = {" << std::endl;
+    for (size_t i = 0; i < compiled.size(); i++) {
+        const ParsedHardFactorTerm& term = *compiled[i];
+        out << "    {";
+        write_string_literal(out, term.get_name());
+        out << ", ";
+        write_string_literal(out, term.get_implementation());
+        out << "," << std::endl << "     ";
+        write_string_literal(out, term.Fs_expr());
+        out << "," << std::endl << "     ";
+        write_string_literal(out, term.Fn_expr());
+        out << "," << std::endl << "     ";
+        write_string_literal(out, term.Fd_expr());
+        out << "," << std::endl << "     ";
+        out << "compiled_" << i << "_Fs, compiled_" << i << "_Fn, compiled_" << i << "_Fd}," << std::endl;
+    }
+    out << "    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL}" << std::endl;
+    out << "};" << std::endl;
+    return compiled.size();
+}
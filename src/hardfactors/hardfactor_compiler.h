@@ -0,0 +1,74 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HARD_FACTOR_COMPILER_H_
+#define _HARD_FACTOR_COMPILER_H_
+
+#include <exception>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class ParsedHardFactorTerm;
+
+/**
+ * Translates the text of a parsed hard factor expression, as returned by
+ * ParsedHardFactorTerm::Fs_expr() and friends, into the body of a C++
+ * function with the signature of ::CompiledHardFactorFunction.
+ *
+ * The expression is a comma-separated list in muParser syntax, in which
+ * all but the last two elements are assignments to auxiliary variables and
+ * the last two are the real and imaginary parts. The translation supports
+ * the variables of ::IntegrationContext and ::Context, the functions and
+ * constants which hard factor definitions actually use (F, S2, S4, dot,
+ * square, norm, J, the elementary functions, pi, euler_gamma), and all of
+ * muParser's operators. Anything else is reported by throwing an
+ * ::UncompilableExpressionException, so that the term can stay parsed.
+ *
+ * @param[in] expr the expression
+ * @return the statements making up the function body
+ */
+std::string compile_hard_factor_expression(const std::string& expr);
+
+/**
+ * Writes a C++ source file defining ::compiled_hard_factor_definitions
+ * with an entry for each of the given terms that can be compiled. A message
+ * is written to `log` for each term that can't be.
+ *
+ * @param[out] out the stream to write the source code to
+ * @param[in] terms the terms to compile
+ * @param[out] log the stream to write messages about skipped terms to
+ * @return the number of terms compiled
+ */
+size_t write_compiled_hard_factors(std::ostream& out, const std::vector<const ParsedHardFactorTerm*>& terms, std::ostream& log);
+
+/**
+ * Exception to throw when a hard factor expression uses something that
+ * ::compile_hard_factor_expression doesn't know how to translate.
+ */
+class UncompilableExpressionException : public std::exception {
+private:
+    std::string _message;
+public:
+    UncompilableExpressionException(const std::string& expr, const std::string& message) throw();
+    ~UncompilableExpressionException() throw() {}
+    const char* what() const throw();
+};
+
+#endif // _HARD_FACTOR_COMPILER_H_
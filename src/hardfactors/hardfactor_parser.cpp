@@ -18,9 +18,14 @@
  */
 
 #include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <istream>
 #include <iostream>
+#include <map>
+#include <set>
 #include <sstream>
 #include <vector>
 #include <muParser.h>
@@ -28,6 +33,7 @@
 #include "gsl_mu.h"
 #include "hardfactor.h"
 #include "hardfactor_parser.h"
+#include "../utils/profile.h"
 #include "../utils/utils.h"
 
 using mu::Parser;
@@ -73,6 +79,19 @@ static const string e0(const string& s) {
     return s.empty() ? "0" : s;
 }
 
+/**
+ * Whether the expression is empty or a literal zero
+ */
+static bool is_zero(const string& s) {
+    const string t = trim(s);
+    if (t.empty()) {
+        return true;
+    }
+    char* end;
+    const double value = strtod(t.c_str(), &end);
+    return *end == '\0' && value == 0;
+}
+
 #ifndef NDEBUG
 // the only way to set this to 1 is through a debugger
 static volatile int deep_debugging = 0;
@@ -96,21 +115,79 @@ void ParsedHardFactorTerm::print_parser_info(const char* message, Parser& parser
 }
 # endif
 
-// until I get a better solution, whether altering muParser
-// or some sort of machine code voodoo
-static GluonDistribution* gdist = NULL;
+/* muParser's API doesn't let us attach any data to a function added to the
+ * Parser lexicon, so there's no direct way for F, S2, and S4 to know which
+ * gluon distribution they should call. Instead, every call to one of them
+ * in an expression is rewritten to take an extra first argument, a variable
+ * called gdist_handle which holds the address of the `gdist` member of the
+ * IntegrationContext that the ParsedBoundHardFactorTerm is bound to, so that
+ * the calls follow IntegrationContext::select_gdist(). User-space addresses fit in the 53-bit
+ * mantissa of a double on all the platforms we run on, and
+ * handle_from_gluon_distribution() checks that.
+ */
+static const char* const gdist_handle_name = "gdist_handle";
 
-value_type gluon_distribution_F(const value_type k2, const value_type Y) {
-    assert(gdist != NULL);
-    return gdist->F(k2, Y);
+static value_type handle_from_gluon_distribution(GluonDistribution* const* gdist) {
+    size_t address = reinterpret_cast<size_t>(gdist);
+    value_type handle = static_cast<value_type>(address);
+    if (static_cast<size_t>(handle) != address) {
+        throw "Gluon distribution address cannot be stored in a parser variable";
+    }
+    return handle;
 }
-value_type gluon_distribution_S2(const value_type r2, const value_type Y) {
+
+static inline GluonDistribution* gluon_distribution_from_handle(const value_type handle) {
+    GluonDistribution* gdist = *reinterpret_cast<GluonDistribution* const*>(static_cast<size_t>(handle));
     assert(gdist != NULL);
-    return gdist->S2(r2, Y);
+    return gdist;
 }
-value_type gluon_distribution_S4(const value_type r2, const value_type s2, const value_type t2, const value_type Y) {
-    assert(gdist != NULL);
-    return gdist->S4(r2, s2, t2, Y);
+
+value_type gluon_distribution_F(const value_type handle, const value_type k2, const value_type Y) {
+    PROFILE_SCOPE(GLUON_DISTRIBUTION);
+    return gluon_distribution_from_handle(handle)->F(k2, Y);
+}
+value_type gluon_distribution_S2(const value_type handle, const value_type r2, const value_type Y) {
+    PROFILE_SCOPE(GLUON_DISTRIBUTION);
+    return gluon_distribution_from_handle(handle)->S2(r2, Y);
+}
+value_type gluon_distribution_S4(const value_type handle, const value_type r2, const value_type s2, const value_type t2, const value_type Y) {
+    PROFILE_SCOPE(GLUON_DISTRIBUTION);
+    return gluon_distribution_from_handle(handle)->S4(r2, s2, t2, Y);
+}
+
+static inline bool is_identifier_char(const char c) {
+    return isalnum(c) || c == '_';
+}
+
+/**
+ * Rewrite every call to F, S2, or S4 in the expression to pass the gluon
+ * distribution handle as an extra first argument, so that for example
+ * `F(k2, Y)` becomes `F(gdist_handle, k2, Y)`.
+ */
+static string bind_gluon_distribution_arguments(const string& expr) {
+    ostringstream oss;
+    size_t i = 0;
+    while (i < expr.length()) {
+        if (!is_identifier_char(expr[i])) {
+            oss << expr[i++];
+            continue;
+        }
+        // read a whole identifier (or number) at once
+        size_t start = i;
+        while (i < expr.length() && is_identifier_char(expr[i])) {
+            i++;
+        }
+        string token = expr.substr(start, i - start);
+        oss << token;
+        if (token == "F" || token == "S2" || token == "S4") {
+            size_t paren = expr.find_first_not_of(" \t", i);
+            if (paren != string::npos && expr[paren] == '(') {
+                oss << expr.substr(i, paren + 1 - i) << gdist_handle_name << ", ";
+                i = paren + 1;
+            }
+        }
+    }
+    return oss.str();
 }
 
 /**
@@ -173,7 +250,6 @@ ParsedHardFactorTerm::ParsedHardFactorTerm(
 }
 
 ParsedHardFactorTerm::~ParsedHardFactorTerm() {
-    delete[] aux_variable_storage;
     if (m_free_region) {
         delete mp_region;
         mp_region = NULL;
@@ -189,59 +265,49 @@ template<> void define_one_variable(Parser& parser, const char* var_name, const
     parser.DefineVar(var_name, const_cast<value_type*>(var));
 }
 
+// the Context fields that aren't doubles (strings, flags, sizes) can't be used
+// in an expression, so they are skipped on purpose
+template<typename T> void define_one_constant(Parser& /*parser*/, const char* /*const_name*/, const T& /*value*/) {
+}
+
+template<> void define_one_constant(Parser& parser, const char* const_name, const double& value) {
+    parser.DefineConst(const_name, value);
+}
+
 void define_variables(Parser& parser, const IntegrationContext* ictx) {
     /* An alternative implementation would be to have an IntegrationContext
-     * instance in ParsedHardFactorTerm itself - not just a pointer, a
-     * concrete instance - and then this function would just copy the
+     * instance in ParsedBoundHardFactorTerm itself - not just a reference,
+     * a concrete instance - and then this function would just copy the
      * passed IntegrationContext to the member IntegrationContext.
      * @code m_ictx = ictx;
      * But then, if the passed IntegrationContext has its values changed
      * elsewhere in the program, those changes won't be reflected in the
      * Parser. That's why I don't do that.
+     *
+     * The Context, on the other hand, never changes, so its variables are
+     * defined as constants with their values. That lets muParser's bytecode
+     * optimizer fold them into the surrounding arithmetic when the expression
+     * is compiled, so that e.g. the Nc*Sperp/(2*pi) in a prefactor becomes a
+     * single number instead of being worked out again at every point.
      */
 #define process(var) define_one_variable(parser, #var, &(ictx->var));
 #include "../integration/ictx_var_list.inc"
 #undef process
-#define process(var) define_one_variable(parser, #var, &(ictx->ctx.var));
+#define process(var) define_one_constant(parser, #var, ictx->ctx.var);
 #include "../configuration/ctx_var_list.inc"
 #undef process
     // and now some aliases
-    parser.DefineVar("A", const_cast<value_type*>(&(ictx->ctx.mass_number)));
-    parser.DefineVar("c", const_cast<value_type*>(&(ictx->ctx.centrality)));
-
-    /* The last "variables" we need on a per-IntegrationContext basis are
-     * the gluon distribution functions. These functions need access to
-     * ictx->gdist so they can call ictx->gdist->F(k2, Y) or the like.
-     * However, when I add a two-argument function to the Parser lexicon,
-     * muParser's API doesn't let me pass &(ictx->gdist) to the underlying
-     * C function. The simplest way to work around this is to use a global
-     * variable to store the gluon distribution, which is fine as long as
-     * there is only ever one gluon distribution used. If the program ever
-     * changes to use more than one gluon distribution per run, then this
-     * static global variable will be insufficient and I'll need to come up
-     * with some more sophisticated plan.
-     */
-    if (gdist == NULL) {
-        gdist = ictx->ctx.gdist;
-    }
-    else {
-        /* I think it's safe to make this an assertion (which gets stripped
-         * in a release build) rather than a simple if statement (which would
-         * still be included in a release build) because in the current version
-         * of the program there's no way this assertion should ever be false.
-         * The program doesn't allow you to define multiple gluon distributions.
-         */
-        assert(gdist == ictx->ctx.gdist);
-    }
-
-    // just in case ictx->ctx->gdist is NULL or something,  I dunno
-    assert(gdist != NULL);
+    parser.DefineConst("A", ictx->ctx.mass_number);
+    parser.DefineConst("c", ictx->ctx.centrality);
 }
 
 void evaluate_hard_factor(Parser& parser, double* real, double* imag) {
     int number_of_values;
     value_type* values;
-    values = parser.Eval(number_of_values);
+    {
+        PROFILE_SCOPE(PARSER);
+        values = parser.Eval(number_of_values);
+    }
     if (number_of_values < 2) {
         throw mu::ParserError("invalid number of values");
         return;
@@ -251,48 +317,31 @@ void evaluate_hard_factor(Parser& parser, double* real, double* imag) {
 }
 
 void ParsedHardFactorTerm::Fs(const IntegrationContext* ictx, double* real, double* imag) const {
-    if (ictx != m_ictx_Fs) {
-        m_ictx_Fs = ictx;
-        define_variables(Fs_parser, ictx);
-    }
-    evaluate_hard_factor(Fs_parser, real, imag);
-#ifndef NDEBUG
-    print_parser_info("Fs", Fs_parser, real, imag);
-# endif
+    ParsedBoundHardFactorTerm(*this, *ictx).Fs(real, imag);
 }
 
 void ParsedHardFactorTerm::Fn(const IntegrationContext* ictx, double* real, double* imag) const {
-    if (ictx != m_ictx_Fn) {
-        m_ictx_Fn = ictx;
-        define_variables(Fn_parser, ictx);
-    }
-    evaluate_hard_factor(Fn_parser, real, imag);
-#ifndef NDEBUG
-    print_parser_info("Fn", Fn_parser, real, imag);
-# endif
+    ParsedBoundHardFactorTerm(*this, *ictx).Fn(real, imag);
 }
 
 void ParsedHardFactorTerm::Fd(const IntegrationContext* ictx, double* real, double* imag) const {
-    if (ictx != m_ictx_Fd) {
-        m_ictx_Fd = ictx;
-        define_variables(Fd_parser, ictx);
-    }
-    evaluate_hard_factor(Fd_parser, real, imag);
-#ifndef NDEBUG
-    print_parser_info("Fd", Fd_parser, real, imag);
-# endif
+    ParsedBoundHardFactorTerm(*this, *ictx).Fd(real, imag);
+}
+
+BoundHardFactorTerm* ParsedHardFactorTerm::bind(const IntegrationContext& ictx) const {
+    return new ParsedBoundHardFactorTerm(*this, ictx);
 }
 
 const string ParsedHardFactorTerm::Fs_expr() const {
-    return Fs_parser.GetExpr();
+    return m_Fs_expr;
 }
 
 const string ParsedHardFactorTerm::Fn_expr() const {
-    return Fn_parser.GetExpr();
+    return m_Fn_expr;
 }
 
 const string ParsedHardFactorTerm::Fd_expr() const {
-    return Fd_parser.GetExpr();
+    return m_Fd_expr;
 }
 
 void ParsedHardFactorTerm::init_term(
@@ -301,7 +350,6 @@ void ParsedHardFactorTerm::init_term(
     const string& Fd_real, const string& Fd_imag,
     const list<pair<string, string> >& variable_list
 ) {
-    aux_variable_count = variable_list.size();
     ostringstream aux_variables_oss;
     for (list<pair<string, string> >::const_iterator vi = variable_list.begin(); vi != variable_list.end(); vi++) {
         string var = vi->first;
@@ -310,23 +358,22 @@ void ParsedHardFactorTerm::init_term(
     }
     string aux_variables = aux_variables_oss.str();
     varmap_type all_used_variables;
-    init_parser(Fs_parser, all_used_variables, aux_variables, Fs_real, Fs_imag, "Fs");
-    init_parser(Fn_parser, all_used_variables, aux_variables, Fn_real, Fn_imag, "Fn");
-    init_parser(Fd_parser, all_used_variables, aux_variables, Fd_real, Fd_imag, "Fd");
+    m_has_Fs = !is_zero(Fs_real) || !is_zero(Fs_imag);
+    m_has_Fn = !is_zero(Fn_real) || !is_zero(Fn_imag);
+    m_has_Fd = !is_zero(Fd_real) || !is_zero(Fd_imag);
+    init_parser(Fs_parser, m_Fs_expr, m_Fs_parser_expr, all_used_variables, aux_variables, Fs_real, Fs_imag, "Fs");
+    init_parser(Fn_parser, m_Fn_expr, m_Fn_parser_expr, all_used_variables, aux_variables, Fn_real, Fn_imag, "Fn");
+    init_parser(Fd_parser, m_Fd_expr, m_Fd_parser_expr, all_used_variables, aux_variables, Fd_real, Fd_imag, "Fd");
 
     // make sure only existing variables are used
 #define process(var) all_used_variables.erase(#var);
 #include "../integration/ictx_var_list.inc"
 #include "../configuration/ctx_var_list.inc"
 #undef process
-    aux_variable_storage = new double[aux_variable_count];
-    size_t i = 0;
-    for (list<pair<string, string> >::const_iterator vi = variable_list.begin(); vi != variable_list.end(); vi++, i++) {
-        const string& varname = vi->first;
-        Fs_parser.DefineVar(varname, &aux_variable_storage[i]);
-        Fn_parser.DefineVar(varname, &aux_variable_storage[i]);
-        Fd_parser.DefineVar(varname, &aux_variable_storage[i]);
-        all_used_variables.erase(varname);
+    all_used_variables.erase(gdist_handle_name);
+    for (list<pair<string, string> >::const_iterator vi = variable_list.begin(); vi != variable_list.end(); vi++) {
+        aux_variable_names.push_back(vi->first);
+        all_used_variables.erase(vi->first);
     }
     if (!all_used_variables.empty()) {
         ostringstream doss;
@@ -334,14 +381,15 @@ void ParsedHardFactorTerm::init_term(
         for (varmap_type::const_iterator it = all_used_variables.begin(); it != all_used_variables.end(); it++) {
             doss << " " << it->first;
         }
-        delete[] aux_variable_storage;
         throw mu::ParserError(doss.str());
     }
 }
 
 
-void ParsedHardFactorTerm::init_parser(Parser& parser, varmap_type& all_used_variables, const string& aux_variables, const string& real_expr, const string& imag_expr, const char* debug_message) {
-    parser.SetExpr(aux_variables + e0(real_expr) + "," + e0(imag_expr));
+/**
+ * Defines the functions that can be used in hard factor expressions
+ */
+static void define_functions(Parser& parser) {
     mu_load_gsl(parser);
     parser.DefineFun("F", gluon_distribution_F);
     parser.DefineFun("S2", gluon_distribution_S2);
@@ -349,6 +397,13 @@ void ParsedHardFactorTerm::init_parser(Parser& parser, varmap_type& all_used_var
     parser.DefineFun("dot", dot2);
     parser.DefineFun("square", square2);
     parser.DefineFun("norm", norm2);
+}
+
+void ParsedHardFactorTerm::init_parser(Parser& parser, string& display_expr, string& parser_expr, varmap_type& all_used_variables, const string& aux_variables, const string& real_expr, const string& imag_expr, const char* debug_message) {
+    display_expr = aux_variables + e0(real_expr) + "," + e0(imag_expr);
+    parser_expr = bind_gluon_distribution_arguments(display_expr);
+    parser.SetExpr(parser_expr);
+    define_functions(parser);
 #ifndef NDEBUG
     print_parser_info(debug_message, parser);
 # endif
@@ -358,6 +413,326 @@ void ParsedHardFactorTerm::init_parser(Parser& parser, varmap_type& all_used_var
     all_used_variables.insert(variables_from_parser.begin(), variables_from_parser.end());
 }
 
+
+ParsedBoundHardFactorTerm::ParsedBoundHardFactorTerm(const ParsedHardFactorTerm& term, const IntegrationContext& ictx, SharedSubexpressions* shared) :
+  BoundHardFactorTerm(term, ictx),
+  parsed_term(term),
+  Fs_parser(term.Fs_parser),
+  Fn_parser(term.Fn_parser),
+  Fd_parser(term.Fd_parser),
+  aux_variable_storage(new double[term.aux_variable_names.size()]),
+  gdist_handle(handle_from_gluon_distribution(&ictx.gdist)) {
+    bind_parser(Fs_parser, term.m_Fs_parser_expr, shared);
+    bind_parser(Fn_parser, term.m_Fn_parser_expr, shared);
+    bind_parser(Fd_parser, term.m_Fd_parser_expr, shared);
+}
+
+ParsedBoundHardFactorTerm::~ParsedBoundHardFactorTerm() {
+    delete[] aux_variable_storage;
+}
+
+void ParsedBoundHardFactorTerm::bind_parser(Parser& parser, const string& parser_expr, SharedSubexpressions* shared) {
+    if (shared != NULL) {
+        parser.SetExpr(shared->rewrite(parser_expr));
+        shared->define_slots(parser);
+    }
+    define_variables(parser, &ictx);
+    for (size_t i = 0; i < parsed_term.aux_variable_names.size(); i++) {
+        parser.DefineVar(parsed_term.aux_variable_names[i], &aux_variable_storage[i]);
+    }
+    parser.DefineVar(gdist_handle_name, &gdist_handle);
+}
+
+void ParsedBoundHardFactorTerm::Fs(double* real, double* imag) const {
+    evaluate_hard_factor(Fs_parser, real, imag);
+#ifndef NDEBUG
+    parsed_term.print_parser_info("Fs", Fs_parser, real, imag);
+# endif
+}
+
+void ParsedBoundHardFactorTerm::Fn(double* real, double* imag) const {
+    evaluate_hard_factor(Fn_parser, real, imag);
+#ifndef NDEBUG
+    parsed_term.print_parser_info("Fn", Fn_parser, real, imag);
+# endif
+}
+
+void ParsedBoundHardFactorTerm::Fd(double* real, double* imag) const {
+    evaluate_hard_factor(Fd_parser, real, imag);
+#ifndef NDEBUG
+    parsed_term.print_parser_info("Fd", Fd_parser, real, imag);
+# endif
+}
+
+/** The prefix of the names of the slot variables of SharedSubexpressions */
+static const char* const shared_slot_prefix = "shared_subexpression_";
+
+static string remove_whitespace(const string& expr) {
+    string result;
+    for (string::const_iterator it = expr.begin(); it != expr.end(); it++) {
+        if (!isspace(*it)) {
+            result += *it;
+        }
+    }
+    return result;
+}
+
+/** Whether an identifier starts at position `i` of `expr` */
+static inline bool identifier_starts_at(const string& expr, const size_t i) {
+    return (isalpha(expr[i]) || expr[i] == '_') && (i == 0 || !is_identifier_char(expr[i - 1]));
+}
+
+/**
+ * Finds which characters of `expr` are in a branch of a `?:` operator. A
+ * branch runs from the `?` to the end of the enclosing parentheses or
+ * comma-separated expression, taking in both alternatives.
+ */
+static vector<bool> conditional_positions(const string& expr) {
+    vector<bool> conditional(expr.length(), false);
+    // for each open parenthesis, whether it is itself in a branch, and
+    // whether a `?` has been seen within it
+    vector<std::pair<bool, bool> > levels(1, std::make_pair(false, false));
+    for (size_t i = 0; i < expr.length(); i++) {
+        std::pair<bool, bool>& level = levels.back();
+        if (expr[i] == '?') {
+            level.second = true;
+        }
+        else if (expr[i] == ',') {
+            level.second = false;
+        }
+        conditional[i] = level.first || level.second;
+        if (expr[i] == '(') {
+            levels.push_back(std::make_pair(conditional[i], false));
+        }
+        else if (expr[i] == ')' && levels.size() > 1) {
+            levels.pop_back();
+        }
+    }
+    return conditional;
+}
+
+/**
+ * Counts each function call, including the ones nested in other calls, in
+ * `expr`, which has no whitespace, leaving out the calls in a branch of a
+ * `?:` operator
+ */
+static void count_calls(const string& expr, std::map<string, size_t>& counts) {
+    const vector<bool> conditional = conditional_positions(expr);
+    for (size_t i = 0; i < expr.length(); i++) {
+        if (conditional[i] || !identifier_starts_at(expr, i)) {
+            continue;
+        }
+        size_t paren = i;
+        while (paren < expr.length() && is_identifier_char(expr[paren])) {
+            paren++;
+        }
+        if (paren == expr.length() || expr[paren] != '(') {
+            continue;
+        }
+        size_t depth = 0, end = paren;
+        for (; end < expr.length(); end++) {
+            if (expr[end] == '(') {
+                depth++;
+            }
+            else if (expr[end] == ')' && --depth == 0) {
+                break;
+            }
+        }
+        if (end < expr.length()) {
+            counts[expr.substr(i, end + 1 - i)]++;
+        }
+    }
+}
+
+/** Whether `call` uses any of the variables in `excluded`, or any slot */
+static bool uses_any(const string& call, const std::set<string>& excluded) {
+    for (size_t i = 0; i < call.length(); i++) {
+        if (!identifier_starts_at(call, i)) {
+            continue;
+        }
+        size_t end = i;
+        while (end < call.length() && is_identifier_char(call[end])) {
+            end++;
+        }
+        const string name = call.substr(i, end - i);
+        if ((end == call.length() || call[end] != '(') && (excluded.count(name) > 0 || name.compare(0, strlen(shared_slot_prefix), shared_slot_prefix) == 0)) {
+            return true;
+        }
+        i = end;
+    }
+    return false;
+}
+
+/**
+ * Replaces each occurrence of the function call `call` in `expr` with
+ * `name`, except in a branch of a `?:` operator
+ */
+static void replace_call(string& expr, const string& call, const string& name) {
+    size_t i = 0;
+    vector<bool> conditional = conditional_positions(expr);
+    while ((i = expr.find(call, i)) != string::npos) {
+        if ((i > 0 && is_identifier_char(expr[i - 1])) || conditional[i]) {
+            i++;
+            continue;
+        }
+        expr.replace(i, call.length(), name);
+        conditional = conditional_positions(expr);
+        i += name.length();
+    }
+}
+
+/** Whether the variable `name` appears in `expr` */
+static bool uses_variable(const string& expr, const string& name) {
+    size_t i = 0;
+    while ((i = expr.find(name, i)) != string::npos) {
+        const size_t end = i + name.length();
+        if ((i == 0 || !is_identifier_char(expr[i - 1])) && (end == expr.length() || !is_identifier_char(expr[end]))) {
+            return true;
+        }
+        i++;
+    }
+    return false;
+}
+
+static string slot_name(const size_t index) {
+    ostringstream s;
+    s << shared_slot_prefix << index;
+    return s.str();
+}
+
+SharedSubexpressions* SharedSubexpressions::create(const HardFactorTermList& terms, const IntegrationContext& ictx) {
+    vector<string> exprs;
+    std::set<string> aux_variable_names;
+    for (HardFactorTermList::const_iterator it = terms.begin(); it != terms.end(); it++) {
+        const ParsedHardFactorTerm* term = dynamic_cast<const ParsedHardFactorTerm*>(*it);
+        if (term == NULL) {
+            continue;
+        }
+        exprs.push_back(remove_whitespace(term->m_Fs_parser_expr));
+        exprs.push_back(remove_whitespace(term->m_Fn_parser_expr));
+        exprs.push_back(remove_whitespace(term->m_Fd_parser_expr));
+        aux_variable_names.insert(term->aux_variable_names.begin(), term->aux_variable_names.end());
+    }
+    vector<string> shared;
+    while (true) {
+        std::map<string, size_t> counts;
+        for (vector<string>::const_iterator it = exprs.begin(); it != exprs.end(); it++) {
+            count_calls(*it, counts);
+        }
+        // the longest repeated call, so that the calls nested in it are only
+        // shared if they also appear elsewhere
+        string best;
+        for (std::map<string, size_t>::const_iterator it = counts.begin(); it != counts.end(); it++) {
+            if (it->second > 1 && it->first.length() > best.length() && !uses_any(it->first, aux_variable_names)) {
+                best = it->first;
+            }
+        }
+        if (best.empty()) {
+            break;
+        }
+        for (vector<string>::iterator it = exprs.begin(); it != exprs.end(); it++) {
+            replace_call(*it, best, slot_name(shared.size()));
+        }
+        shared.push_back(best);
+    }
+    if (shared.empty()) {
+        return NULL;
+    }
+    // exprs holds Fs, Fn, and Fd of each term in turn
+    static const unsigned int functions[] = {FS, FN, FD};
+    vector<unsigned int> slot_functions(shared.size(), 0);
+    for (size_t s = 0; s < shared.size(); s++) {
+        const string name = slot_name(s);
+        for (size_t e = 0; e < exprs.size(); e++) {
+            if (uses_variable(exprs[e], name)) {
+                slot_functions[s] |= functions[e % 3];
+            }
+        }
+    }
+    return new SharedSubexpressions(shared, slot_functions, ictx);
+}
+
+SharedSubexpressions::SharedSubexpressions(const vector<string>& expressions, const vector<unsigned int>& slot_functions, const IntegrationContext& ictx) :
+  ictx(ictx),
+  expressions(expressions),
+  slot_functions(slot_functions),
+  slots(expressions.size(), 0.0),
+  gdist_handle(handle_from_gluon_distribution(&ictx.gdist)) {
+    for (size_t i = 0; i < expressions.size(); i++) {
+        names.push_back(slot_name(i));
+    }
+}
+
+SharedSubexpressions::~SharedSubexpressions() {
+    for (std::map<unsigned int, SlotParser>::iterator it = parsers.begin(); it != parsers.end(); it++) {
+        delete it->second.parser;
+    }
+}
+
+const SharedSubexpressions::SlotParser& SharedSubexpressions::slot_parser(const unsigned int functions) {
+    std::map<unsigned int, SlotParser>::iterator it = parsers.find(functions);
+    if (it != parsers.end()) {
+        return it->second;
+    }
+    SlotParser& p = parsers[functions];
+    p.parser = NULL;
+    ostringstream used;
+    for (size_t i = 0; i < expressions.size(); i++) {
+        if (slot_functions[i] & functions) {
+            used << (p.indices.empty() ? "" : ",") << expressions[i];
+            p.indices.push_back(i);
+        }
+    }
+    if (!p.indices.empty()) {
+        p.parser = new Parser();
+        p.parser->SetExpr(used.str());
+        define_functions(*p.parser);
+        define_variables(*p.parser, &ictx);
+        p.parser->DefineVar(gdist_handle_name, &gdist_handle);
+    }
+    return p;
+}
+
+BoundHardFactorTerm* SharedSubexpressions::bind(const HardFactorTerm& term) {
+    const ParsedHardFactorTerm* parsed = dynamic_cast<const ParsedHardFactorTerm*>(&term);
+    if (parsed == NULL) {
+        return term.bind(ictx);
+    }
+    return new ParsedBoundHardFactorTerm(*parsed, ictx, this);
+}
+
+void SharedSubexpressions::evaluate(const unsigned int functions) {
+    const SlotParser& p = slot_parser(functions);
+    if (p.parser == NULL) {
+        return;
+    }
+    int number_of_values;
+    value_type* values;
+    {
+        PROFILE_SCOPE(PARSER);
+        values = p.parser->Eval(number_of_values);
+    }
+    assert(static_cast<size_t>(number_of_values) == p.indices.size());
+    for (size_t i = 0; i < p.indices.size(); i++) {
+        slots[p.indices[i]] = values[i];
+    }
+}
+
+string SharedSubexpressions::rewrite(const string& expr) const {
+    // the same replacements, in the same order, as in create()
+    string result = remove_whitespace(expr);
+    for (size_t i = 0; i < expressions.size(); i++) {
+        replace_call(result, expressions[i], names[i]);
+    }
+    return result;
+}
+
+void SharedSubexpressions::define_slots(Parser& parser) {
+    for (size_t i = 0; i < names.size(); i++) {
+        parser.DefineVar(names[i], &slots[i]);
+    }
+}
+
 using std::ifstream;
 using std::vector;
 
@@ -369,7 +744,9 @@ HardFactorParser::HardFactorParser(HardFactorRegistry& registry) :
   core(NULL),
   hard_factor_callback(NULL),
   hard_factor_group_callback(NULL),
-  error_handler(NULL) {
+  error_handler(NULL),
+  compiled_definitions(NULL),
+  check_compiled_definitions(false) {
     reset_current_term();
 }
 
@@ -414,6 +791,60 @@ static Q3PolarIntegrationRegion Q3P;
 static Q3RadialIntegrationRegion Q3R;
 static Q3ExactKinematicIntegrationRegion Q3E;
 
+// and of each mapped polar and radial region, for each coordinate
+#define MAPPED_REGIONS(C) \
+static C ## LogPolarIntegrationRegion C ## LP; \
+static C ## LogRadialIntegrationRegion C ## LR; \
+static C ## SaturationScaledPolarIntegrationRegion C ## SP; \
+static C ## SaturationScaledRadialIntegrationRegion C ## SR; \
+static C ## KTScaledPolarIntegrationRegion C ## KP; \
+static C ## KTScaledRadialIntegrationRegion C ## KR;
+MAPPED_REGIONS(R1)
+MAPPED_REGIONS(R2)
+MAPPED_REGIONS(R3)
+MAPPED_REGIONS(Q1)
+MAPPED_REGIONS(Q2)
+MAPPED_REGIONS(Q3)
+#undef MAPPED_REGIONS
+
+/**
+ * Looks up the mapped region for the coordinate `index` (1, 2, or 3)
+ * named by `e`, which is a map ("log", "qs scaled", or "kt scaled"),
+ * a shape ("polar" or "radial"), and "coordinate" or "momentum", as in
+ * "qs scaled radial momentum". Sets `impl` to the implementation the
+ * region implies, as for the unmapped regions.
+ *
+ * @return the region, or NULL if `e` doesn't name a mapped region
+ */
+static const AuxiliaryIntegrationRegion* mapped_subregion(const size_t index, const string& e, string& impl) {
+    static const char* const maps[] = {"log", "qs scaled", "kt scaled"};
+    static const char* const shapes[] = {"polar", "radial"};
+    // indexed by coordinate (R1, R2, R3, Q1, Q2, Q3), then map and shape
+    static const AuxiliaryIntegrationRegion* const regions[6][6] = {
+        {&R1LP, &R1LR, &R1SP, &R1SR, &R1KP, &R1KR},
+        {&R2LP, &R2LR, &R2SP, &R2SR, &R2KP, &R2KR},
+        {&R3LP, &R3LR, &R3SP, &R3SR, &R3KP, &R3KR},
+        {&Q1LP, &Q1LR, &Q1SP, &Q1SR, &Q1KP, &Q1KR},
+        {&Q2LP, &Q2LR, &Q2SP, &Q2SR, &Q2KP, &Q2KR},
+        {&Q3LP, &Q3LR, &Q3SP, &Q3SR, &Q3KP, &Q3KR}
+    };
+    assert(index >= 1 && index <= 3);
+    for (size_t m = 0; m < 3; m++) {
+        for (size_t s = 0; s < 2; s++) {
+            string name = string(maps[m]) + " " + shapes[s] + " ";
+            if (e == name + "coordinate") {
+                impl = "r";
+                return regions[index - 1][2 * m + s];
+            }
+            else if (e == name + "momentum") {
+                impl = "m";
+                return regions[index + 2][2 * m + s];
+            }
+        }
+    }
+    return NULL;
+}
+
 void HardFactorParser::parse_line(const string& line) {
     // an empty line signals the end of a hard factor term definition
     if (line.length() == 0) {
@@ -504,6 +935,7 @@ void HardFactorParser::parse_line(const string& line) {
         }
 
         string impl1, impl2, impl3;
+        const AuxiliaryIntegrationRegion* mapped;
         // first coordinate
         e = trim(elements[1]);
         if (e == "cartesian coordinate") {
@@ -534,6 +966,9 @@ void HardFactorParser::parse_line(const string& line) {
             impl1 = "m";
             subregions.push_back(&Q1E);
         }
+        else if ((mapped = mapped_subregion(1, e, impl1)) != NULL) {
+            subregions.push_back(mapped);
+        }
         else {
             throw InvalidHardFactorDefinitionException(line, key, value, "Unrecognized integration region");
         }
@@ -572,6 +1007,9 @@ void HardFactorParser::parse_line(const string& line) {
             impl2 = "m";
             subregions.push_back(&Q2E);
         }
+        else if ((mapped = mapped_subregion(2, e, impl2)) != NULL) {
+            subregions.push_back(mapped);
+        }
         else {
             throw InvalidHardFactorDefinitionException(line, key, value, "Unrecognized integration region");
         }
@@ -615,6 +1053,9 @@ void HardFactorParser::parse_line(const string& line) {
             impl3 = "m";
             subregions.push_back(&Q3E);
         }
+        else if ((mapped = mapped_subregion(3, e, impl3)) != NULL) {
+            subregions.push_back(mapped);
+        }
         else {
             throw InvalidHardFactorDefinitionException(line, key, value, "Unrecognized integration region");
         }
@@ -901,6 +1342,11 @@ void HardFactorParser::set_hard_factor_group_callback(void (*callback)(const Har
     this->hard_factor_group_callback = callback;
 }
 
+void HardFactorParser::use_compiled_hard_factors(const CompiledHardFactorDefinition* definitions, const bool check) {
+    this->compiled_definitions = definitions;
+    this->check_compiled_definitions = check;
+}
+
 static Modifiers default_modifiers;
 
 bool HardFactorParser::hard_factor_definition_empty() const {
@@ -925,7 +1371,7 @@ bool HardFactorParser::hard_factor_definition_complete() const {
       !name.empty();
 }
 
-const ParsedHardFactorTerm* HardFactorParser::create_hard_factor_term() {
+const HardFactorTerm* HardFactorParser::create_hard_factor_term() {
     if (hard_factor_definition_empty()) {
         return NULL;
     }
@@ -933,7 +1379,7 @@ const ParsedHardFactorTerm* HardFactorParser::create_hard_factor_term() {
         throw IncompleteHardFactorDefinitionException();
     }
 
-    ParsedHardFactorTerm* hf = new ParsedHardFactorTerm(
+    ParsedHardFactorTerm* phf = new ParsedHardFactorTerm(
         name,
         implementation.empty() ? default_implementation : implementation,
         order,
@@ -944,6 +1390,16 @@ const ParsedHardFactorTerm* HardFactorParser::create_hard_factor_term() {
         Fn_real, Fn_imag,
         Fd_real, Fd_imag,
         variable_definitions);
+    const HardFactorTerm* hf = phf;
+    if (compiled_definitions != NULL) {
+        const CompiledHardFactorDefinition* definition = find_compiled_hard_factor(compiled_definitions, *phf);
+        if (definition == NULL) {
+            cerr << "WARNING: no compiled implementation of " << phf->get_name() << "." << phf->get_implementation() << " matches its definition; using the parsed expressions" << endl;
+        }
+        else {
+            hf = new CompiledHardFactorTerm(phf, *definition, check_compiled_definitions);
+        }
+    }
     registry.add_hard_factor(hf, true);
     hard_factors.push_back(hf);
     if (hard_factor_callback != NULL) {
@@ -17,10 +17,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <list>
+#include <map>
 #include <string>
+#include <vector>
 #include <muParser.h>
 #include "hardfactor.h"
+#include "compiled_hardfactor.h"
+
+class SharedSubexpressions;
 
 /**
  * A ::HardFactorTerm subclass which represents formulas parsed from text.
@@ -57,65 +63,56 @@ public:
     const IntegrationRegion* get_integration() const { return mp_region; }
     HardFactorOrder get_order() const { return m_order; }
     const Modifiers& get_modifiers() const { return m_modifiers; }
+    /**
+     * Evaluates the term with a temporary ParsedBoundHardFactorTerm.
+     *
+     * This has to set up fresh parsers on every call, so code which
+     * evaluates the term many times should use bind() instead.
+     */
     void Fs(const IntegrationContext* ictx, double* real, double* imag) const;
+    /** @see Fs() */
     void Fn(const IntegrationContext* ictx, double* real, double* imag) const;
+    /** @see Fs() */
     void Fd(const IntegrationContext* ictx, double* real, double* imag) const;
+    /** False if both the real and imaginary expressions for Fs are empty or zero */
+    bool has_Fs() const { return m_has_Fs; }
+    /** @see has_Fs() */
+    bool has_Fn() const { return m_has_Fn; }
+    /** @see has_Fs() */
+    bool has_Fd() const { return m_has_Fd; }
+    BoundHardFactorTerm* bind(const IntegrationContext& ictx) const;
 
     const std::string Fs_expr() const;
     const std::string Fn_expr() const;
     const std::string Fd_expr() const;
 
 private:
+    friend class ParsedBoundHardFactorTerm;
+    friend class SharedSubexpressions;
+
     /**
-     * A memory of which IntegrationContext currently provides the variables
-     * for Fs_parser.
-     *
-     * In order to use a muParser-parsed expression as the hard factor,
-     * as this class does, we need to give the Parser a pointer corresponding
-     * to each variable that appears in the parsed expression, using
-     * Parser::DefineVar. But configuring a Parser with these name-pointer
-     * mappings is fairly computationally expensive, and it will slow down the
-     * computation a lot if we do it every time Fs() is called.
-     *
-     * Fortunately, we don't have to do that. The name-pointer mappings that
-     * we need to provide to the Parser are properties of the IntegrationContext
-     * begin used. So if we provide the Parser with the pointers from a given
-     * instance of IntegrationContext on one call to Fs(), then if the same
-     * IntegrationContext instance is passed to Fs() the next time, the same
-     * name-pointer mappings are still valid. There's no need to clear out the
-     * Parser's variable table and set it up again. Typically, Fs() will be
-     * called many times in a row with the same IntegrationContext, so it makes
-     * sense to optimize for this case.
-     *
-     * Accordingly, at each call to Fs() we save the IntegrationContext provided
-     * in this variable. Then at the next call, we can check whether the
-     * IntegrationContext passed to Fs() is the same as the one saved. If not,
-     * we clear and recreate the name-pointer mappings using the new
-     * IntegrationContext, otherwise we do nothing.
-     *
-     * This behavior is not really thread-safe, but it will work as long as
-     * all calls to Fs() using a given instance of IntegrationContext complete
-     * before any calls to Fs() using a different IntegrationContext begin.
-     */
-    mutable const IntegrationContext* m_ictx_Fs;
-    /**
-     * A memory of which IntegrationContext currently provides the variables
-     * for Fn_parser.
-     *
-     * This is necessary for the same reason as m_ictx_Fs.
-     */
-    mutable const IntegrationContext* m_ictx_Fn;
-    /**
-     * A memory of which IntegrationContext currently provides the variables
-     * for Fd_parser.
+     * The parsed expressions for Fs, Fn, and Fd.
      *
-     * This is necessary for the same reason as m_ictx_Fs.
+     * These are never evaluated directly. They are only templates for the
+     * parsers in ParsedBoundHardFactorTerm, which copies them and binds the
+     * copies to the variables of its own IntegrationContext. None of the
+     * ictx or ctx variables are defined in these.
      */
-    mutable const IntegrationContext* m_ictx_Fd;
+    mu::Parser Fs_parser;
+    mu::Parser Fn_parser;
+    mu::Parser Fd_parser;
 
-    mutable mu::Parser Fs_parser;
-    mutable mu::Parser Fn_parser;
-    mutable mu::Parser Fd_parser;
+    /** The expressions as written in the definition, for display */
+    std::string m_Fs_expr;
+    std::string m_Fn_expr;
+    std::string m_Fd_expr;
+    /** The expressions given to the parsers, with the gluon distribution handle added */
+    std::string m_Fs_parser_expr;
+    std::string m_Fn_parser_expr;
+    std::string m_Fd_parser_expr;
+    bool m_has_Fs;
+    bool m_has_Fn;
+    bool m_has_Fd;
 
     const std::string m_name;
     const std::string m_implementation;
@@ -125,8 +122,8 @@ private:
     const IntegrationRegion* mp_region;
     const bool m_free_region;
 
-    size_t aux_variable_count;
-    double* aux_variable_storage;
+    /** The names of the auxiliary variables, in order of definition */
+    std::vector<std::string> aux_variable_names;
 
     void init_term(
         const std::string& Fs_real, const std::string& Fs_imag,
@@ -134,13 +131,143 @@ private:
         const std::string& Fd_real, const std::string& Fd_imag,
         const std::list<std::pair<std::string, std::string> >& variable_list
     );
-    void init_parser(mu::Parser& parser, mu::varmap_type& all_used_variables, const string& aux_variables, const string& real_expr, const string& imag_expr, const char* debug_message);
+    void init_parser(mu::Parser& parser, std::string& display_expr, std::string& parser_expr, mu::varmap_type& all_used_variables, const string& aux_variables, const string& real_expr, const string& imag_expr, const char* debug_message);
 #ifndef NDEBUG
     void print_parser_info(const char* message, mu::Parser& parser, const double* real, const double* imag) const;
     void print_parser_info(const char* message, mu::Parser& parser) const;
 # endif
 };
 
+/**
+ * A ParsedHardFactorTerm bound to one IntegrationContext.
+ *
+ * In order to use a muParser-parsed expression as the hard factor, we need
+ * to give the Parser a pointer corresponding to each variable that appears
+ * in the expression, using Parser::DefineVar. Configuring a Parser with these
+ * name-pointer mappings is fairly computationally expensive, so it can't be
+ * done on every evaluation. The mappings are properties of the
+ * IntegrationContext being used, so each instance of this class holds its
+ * own copies of the term's parsers with the mappings set up once, in the
+ * constructor, along with its own storage for the auxiliary variables.
+ *
+ * The gluon distribution functions F, S2, and S4 get the distribution
+ * to use from a hidden variable bound by this class (see
+ * bind_gluon_distribution_arguments() in the implementation), so nothing
+ * here refers to global state, and any number of instances can be
+ * evaluated simultaneously on different threads.
+ */
+class ParsedBoundHardFactorTerm : public BoundHardFactorTerm {
+public:
+    /**
+     * If `shared` is not `NULL`, the subexpressions it holds are read from
+     * its slots instead of being evaluated by this term's parsers
+     */
+    ParsedBoundHardFactorTerm(const ParsedHardFactorTerm& term, const IntegrationContext& ictx, SharedSubexpressions* shared = NULL);
+    ~ParsedBoundHardFactorTerm();
+
+    void Fs(double* real, double* imag) const;
+    void Fn(double* real, double* imag) const;
+    void Fd(double* real, double* imag) const;
+
+private:
+    const ParsedHardFactorTerm& parsed_term;
+
+    mutable mu::Parser Fs_parser;
+    mutable mu::Parser Fn_parser;
+    mutable mu::Parser Fd_parser;
+
+    /** Storage for the values of the auxiliary variables */
+    double* aux_variable_storage;
+    /** The address of the IntegrationContext's gluon distribution pointer, encoded for the parsers */
+    double gdist_handle;
+
+    void bind_parser(mu::Parser& parser, const std::string& parser_expr, SharedSubexpressions* shared);
+
+    // not copyable, because the parsers hold pointers into this object
+    ParsedBoundHardFactorTerm(const ParsedBoundHardFactorTerm&);
+    ParsedBoundHardFactorTerm& operator=(const ParsedBoundHardFactorTerm&);
+};
+
+/**
+ * The subexpressions that the ParsedHardFactorTerms of one type of term
+ * have in common, evaluated once at each point for all of them.
+ *
+ * Definitions often repeat expensive function calls, like
+ * `J(0, kT*sqrt(r2))` or `F(q12, Yg)`, in several terms which are
+ * integrated together. create() looks for every function call that appears
+ * more than once in the expressions of the terms, taking the longest ones
+ * first, and gives each a slot. evaluate() computes the slots used by the
+ * given functions of the terms at the current point with a single parser of
+ * its own, and the terms bound by bind() read the slots in place of the
+ * calls. Calls that use auxiliary variables are left alone, since those are
+ * only defined within a term, and so are calls in a branch of a `?:`
+ * operator, which may not be evaluated at all.
+ */
+class SharedSubexpressions {
+public:
+    /** Flags for the functions of the terms, to choose the slots evaluate() computes */
+    enum Functions { FS = 1, FN = 2, FD = 4 };
+
+    ~SharedSubexpressions();
+
+    /**
+     * Finds the subexpressions shared by the parsed terms among `terms`, to
+     * be evaluated with the variables of `ictx`, or returns `NULL` if there
+     * are none. The caller is responsible for deleting the returned object.
+     */
+    static SharedSubexpressions* create(const HardFactorTermList& terms, const IntegrationContext& ictx);
+
+    /**
+     * Binds `term` to the IntegrationContext of this object, reading the
+     * slots if it is a ParsedHardFactorTerm
+     */
+    BoundHardFactorTerm* bind(const HardFactorTerm& term);
+
+    /**
+     * Computes the values of the slots used by `functions`, a combination of
+     * the Functions flags, at the current point of the IntegrationContext.
+     * The other slots keep their previous values.
+     */
+    void evaluate(const unsigned int functions);
+    /** The number of slots */
+    size_t size() const { return expressions.size(); }
+    /** The current values of the slots */
+    const double* values() const { return &slots[0]; }
+    /** Sets the values of the slots, as saved from values() */
+    void load(const double* values) { std::copy(values, values + slots.size(), slots.begin()); }
+
+    /** `expr`, with whitespace removed, and the subexpressions replaced by their slots */
+    std::string rewrite(const std::string& expr) const;
+    /** Defines the slot variables in `parser` */
+    void define_slots(mu::Parser& parser);
+
+private:
+    SharedSubexpressions(const std::vector<std::string>& expressions, const std::vector<unsigned int>& slot_functions, const IntegrationContext& ictx);
+
+    /** A parser for the slots used by one combination of functions */
+    struct SlotParser {
+        mu::Parser* parser;
+        /** The slots, in the order of the values of the parser */
+        std::vector<size_t> indices;
+    };
+    /** The parser for `functions`, created on first use */
+    const SlotParser& slot_parser(const unsigned int functions);
+
+    const IntegrationContext& ictx;
+    /** The subexpression that each slot holds, in the syntax of rewrite() */
+    const std::vector<std::string> expressions;
+    /** The Functions flags of the functions using each slot */
+    const std::vector<unsigned int> slot_functions;
+    std::vector<std::string> names;
+    std::vector<double> slots;
+    std::map<unsigned int, SlotParser> parsers;
+    double gdist_handle;
+
+    // not copyable, because the parsers hold pointers into this object
+    SharedSubexpressions(const SharedSubexpressions&);
+    SharedSubexpressions& operator=(const SharedSubexpressions&);
+};
+
 /**
  * A ::HardFactor representing a sum of multiple terms, where the specification
  * of which terms has been parsed from text.
@@ -195,6 +322,12 @@ public:
      *   The variables that can be used in the expressions are those stored in
      *   ::IntegrationContext and ::Context.
      *
+     *   Besides the cartesian, polar, and radial coordinates and momenta, the
+     *   integration region can use mapped polar or radial regions, which sample
+     *   the radial variable more densely where the integrand is largest, like
+     *   `log radial momentum`, `qs scaled polar coordinate`, or
+     *   `kt scaled radial momentum`. See ::MappedPolarIntegrationRegion.
+     *
      *   Technically speaking, these correspond to instances of ::HardFactorTerm,
      *   but in most cases they are only used as instances of ::HardFactor.
      * - Composite hard factor specifications, which contain a name, an optional
@@ -324,6 +457,20 @@ public:
     void set_hard_factor_group_callback(void (*callback)(const HardFactorGroup& hfg));
     void set_error_handler(bool (*error_handler)(const std::exception& e, const std::string& filename, const size_t line_number));
 
+    /**
+     * Makes the parser use compiled code in place of the parsed expressions
+     * for every term which has an implementation in the given table (see
+     * ::CompiledHardFactorTerm). Terms which don't have one, for example
+     * because their definitions have been edited since the program was built,
+     * are still evaluated with muParser, with a warning.
+     *
+     * @param[in] definitions a table terminated by an entry with a `NULL` name,
+     * or `NULL` to go back to using only parsed expressions
+     * @param[in] check whether the compiled terms should compare each of their
+     * values with the parsed expressions
+     */
+    void use_compiled_hard_factors(const CompiledHardFactorDefinition* definitions, const bool check);
+
     HardFactorRegistry& registry;
 private:
     // these shouldn't be called
@@ -332,7 +479,7 @@ private:
 
     bool hard_factor_definition_complete() const;
     bool hard_factor_definition_empty() const;
-    const ParsedHardFactorTerm* create_hard_factor_term();
+    const HardFactorTerm* create_hard_factor_term();
     void reset_current_term();
     bool unflushed_groups();
 
@@ -353,6 +500,9 @@ private:
     void (*hard_factor_callback)(const HardFactor& hf);
     void (*hard_factor_group_callback)(const HardFactorGroup& hfg);
     bool (*error_handler)(const std::exception& e, const std::string& filename, const size_t line_number);
+
+    const CompiledHardFactorDefinition* compiled_definitions;
+    bool check_compiled_definitions;
 };
 
 /**
@@ -17,12 +17,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <fstream>
 #include <iostream>
 #include <typeinfo>
 #include <vector>
 #include <muParser.h>
 #include "hardfactor.h"
 #include "hardfactor_parser.h"
+#include "hardfactor_compiler.h"
 
 using std::vector;
 using std::cout;
@@ -60,14 +62,38 @@ void handle_hard_factor_group(const HardFactorGroup& hfg) {
     hgl.push_back(&hfg);
 }
 
-int main(const int argc, char** argv) {
-    if (argc < 2) {
-        cerr << "Usage: " << argv[0] << " filename [filename...]" << endl;
-        return 2;
+/**
+ * Writes the C++ translations of all the parsed terms to the given file,
+ * for the compiled hard factor backend of oneloopcalc.
+ */
+int write_code(const string& filename) {
+    vector<const ParsedHardFactorTerm*> terms;
+    for (HardFactorList::const_iterator it = hl.begin(); it != hl.end(); it++) {
+        const ParsedHardFactorTerm* phft = dynamic_cast<const ParsedHardFactorTerm*>(*it);
+        if (phft != NULL) {
+            terms.push_back(phft);
+        }
+    }
+    std::ofstream out(filename.c_str());
+    if (!out) {
+        cerr << "Error opening " << filename << " for writing" << endl;
+        return 1;
+    }
+    size_t count = write_compiled_hard_factors(out, terms, cerr);
+    out.close();
+    if (!out) {
+        cerr << "Error writing " << filename << endl;
+        return 1;
     }
+    cerr << "Compiled " << count << " of " << terms.size() << " hard factor terms to " << filename << endl;
+    return 0;
+}
+
+int main(const int argc, char** argv) {
     HardFactorRegistry registry;
     HardFactorParser parser(registry);
     vector<string> files;
+    string codegen_filename;
     bool verbose = false;
     encountered_error = false;
     debug = false;
@@ -79,11 +105,19 @@ int main(const int argc, char** argv) {
             else if (s == "--verbose") {
                 verbose = true;
             }
+            else if (s.compare(0, 10, "--codegen=") == 0) {
+                codegen_filename = s.substr(10);
+            }
         }
         else {
             files.push_back(s);
         }
     }
+    // with --codegen, no files is fine; it just makes an empty table
+    if (files.empty() && codegen_filename.empty()) {
+        cerr << "Usage: " << argv[0] << " [--verbose] [--codegen=output.cpp] filename [filename...]" << endl;
+        return 2;
+    }
     parser.set_error_handler(print_err);
     parser.set_hard_factor_callback(handle_hard_factor);
     parser.set_hard_factor_group_callback(handle_hard_factor_group);
@@ -111,6 +145,9 @@ int main(const int argc, char** argv) {
     if (encountered_error) {
         return 1;
     }
+    if (!codegen_filename.empty()) {
+        return write_code(codegen_filename);
+    }
     cout << "Found " << hl.size() << " hard factors and " << hgl.size() << " groups:" << endl;
     size_t wrap = 0;
     for (HardFactorList::const_iterator it = hl.begin(); it != hl.end(); it++) {
@@ -0,0 +1,533 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_sys.h>
+#include "batchmonte.h"
+
+using std::vector;
+
+/**
+ * The largest number of points handed to the integrand at once. Batches
+ * much larger than this don't make the evaluation any more efficient, and
+ * just use up memory.
+ */
+static const size_t max_batch_size = 4096;
+
+/**
+ * Evaluates the `fdim` components of `f` at the `npt` points in `x` and
+ * stores the results in `fval`, component k of point i at fval[k * npt + i].
+ */
+static inline void evaluate(integrand_v f, const size_t dim, const size_t fdim, void* closure, const size_t npt, const double* x, double* fval) {
+    f(static_cast<unsigned int>(dim), static_cast<unsigned int>(npt), x, closure, static_cast<unsigned int>(fdim), fval);
+}
+
+BatchVegasState::BatchVegasState(const size_t dim, const size_t fdim) :
+  alpha(1.5),
+  iterations(5),
+  dim(dim),
+  fdim(fdim),
+  grid((bins + 1) * dim),
+  d(bins * dim),
+  wtd_int_sum(fdim), sum_wgts(fdim),
+  total_wtd_int_sum(0), total_sum_wgts(0), chi_sum(0),
+  it_num(0),
+  m_chisq(0),
+  sum(fdim), sum2(fdim),
+  weight(bins),
+  new_grid(bins + 1) {
+    reset_grid();
+}
+
+void BatchVegasState::reset() {
+    alpha = 1.5;
+    iterations = 5;
+    m_chisq = 0;
+    reset_grid();
+}
+
+void BatchVegasState::reset_grid() {
+    for (size_t j = 0; j < dim; j++) {
+        for (size_t k = 0; k <= bins; k++) {
+            grid[j * (bins + 1) + k] = static_cast<double>(k) / bins;
+        }
+    }
+}
+
+/**
+ * Smooths the accumulated bin values and moves the bin boundaries so that
+ * each bin gets an equal share of the (damped) weight, following the
+ * procedure of refine_grid() in GSL's vegas.c.
+ */
+void BatchVegasState::refine_grid() {
+    for (size_t j = 0; j < dim; j++) {
+        double* dj = &d[j * bins];
+        double* gj = &grid[j * (bins + 1)];
+
+        double oldg = dj[0];
+        double newg = dj[1];
+        dj[0] = (oldg + newg) / 2;
+        double grid_tot = dj[0];
+        for (size_t i = 1; i < bins - 1; i++) {
+            double rc = oldg + newg;
+            oldg = newg;
+            newg = dj[i + 1];
+            dj[i] = (rc + newg) / 3;
+            grid_tot += dj[i];
+        }
+        dj[bins - 1] = (newg + oldg) / 2;
+        grid_tot += dj[bins - 1];
+
+        double tot_weight = 0;
+        for (size_t i = 0; i < bins; i++) {
+            weight[i] = 0;
+            if (dj[i] > 0) {
+                double oldg = grid_tot / dj[i];
+                weight[i] = pow((oldg - 1) / oldg / log(oldg), alpha);
+            }
+            tot_weight += weight[i];
+        }
+        if (!(tot_weight > 0) || !gsl_finite(tot_weight)) {
+            // nothing to go on; leave this dimension alone
+            continue;
+        }
+
+        double pts_per_bin = tot_weight / bins;
+        double xold, xnew = 0, dw = 0;
+        size_t i = 1;
+        for (size_t k = 0; k < bins; k++) {
+            dw += weight[k];
+            xold = xnew;
+            xnew = gj[k + 1];
+            for (; dw > pts_per_bin && i < bins; i++) {
+                dw -= pts_per_bin;
+                new_grid[i] = xnew - (xnew - xold) * dw / weight[k];
+            }
+        }
+        for (; i < bins; i++) {
+            // only reachable through roundoff
+            new_grid[i] = 1;
+        }
+        for (size_t k = 1; k < bins; k++) {
+            gj[k] = new_grid[k];
+        }
+        gj[0] = 0;
+        gj[bins] = 1;
+    }
+}
+
+/**
+ * Computes the mean and the variance of the mean from a sum and a sum of
+ * squares of `calls` values.
+ */
+static inline void mean_and_variance(const double sum, const double sum2, const size_t calls, double* mean, double* var) {
+    *mean = sum / calls;
+    *var = calls > 1 ? (sum2 / calls - *mean * *mean) / (calls - 1) : 0;
+    if (*var < 0) {
+        // roundoff for a constant integrand
+        *var = 0;
+    }
+}
+
+void batch_vegas_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                           double* p_result, double* p_abserr, size_t calls, gsl_rng* rng, BatchVegasState* s) {
+    assert(s->dim == dim);
+    assert(s->fdim == fdim);
+    assert(calls > 0);
+    const size_t bins = BatchVegasState::bins;
+    double vol = 1;
+    for (size_t j = 0; j < dim; j++) {
+        vol *= xu[j] - xl[j];
+    }
+
+    // like GSL's stage 1: keep the grid, discard the previous weighted average
+    std::fill(s->wtd_int_sum.begin(), s->wtd_int_sum.end(), 0.0);
+    std::fill(s->sum_wgts.begin(), s->sum_wgts.end(), 0.0);
+    s->total_wtd_int_sum = 0;
+    s->total_sum_wgts = 0;
+    s->chi_sum = 0;
+    s->it_num = 0;
+
+    const size_t batch_size = GSL_MIN(calls, max_batch_size);
+    vector<double>& x = s->x;
+    vector<double>& jacobian = s->jacobian;
+    vector<size_t>& bin = s->bin;
+    vector<double>& fval = s->fval;
+    vector<double>& sum = s->sum;
+    vector<double>& sum2 = s->sum2;
+    x.resize(batch_size * dim);
+    jacobian.resize(batch_size);
+    bin.resize(batch_size * dim);
+    fval.resize(batch_size * fdim);
+
+    std::fill(p_result, p_result + fdim, 0.0);
+    std::fill(p_abserr, p_abserr + fdim, 0.0);
+    double total_result = 0;
+    for (size_t it = 0; it < s->iterations; it++) {
+        std::fill(s->d.begin(), s->d.end(), 0.0);
+        std::fill(sum.begin(), sum.end(), 0.0);
+        std::fill(sum2.begin(), sum2.end(), 0.0);
+        double total_sum = 0, total_sum2 = 0;
+        for (size_t done = 0; done < calls; done += batch_size) {
+            const size_t npt = GSL_MIN(batch_size, calls - done);
+            for (size_t i = 0; i < npt; i++) {
+                jacobian[i] = vol;
+                for (size_t j = 0; j < dim; j++) {
+                    const double* gj = &s->grid[j * (bins + 1)];
+                    double z = gsl_rng_uniform(rng) * bins;
+                    size_t k = static_cast<size_t>(z);
+                    assert(k < bins);
+                    double width = gj[k + 1] - gj[k];
+                    double y = gj[k] + (z - k) * width;
+                    x[i * dim + j] = xl[j] + y * (xu[j] - xl[j]);
+                    jacobian[i] *= width * bins;
+                    bin[i * dim + j] = k;
+                }
+            }
+            evaluate(f, dim, fdim, closure, npt, &x[0], &fval[0]);
+            for (size_t i = 0; i < npt; i++) {
+                double total = 0;
+                for (size_t c = 0; c < fdim; c++) {
+                    double fi = fval[c * npt + i] * jacobian[i];
+                    sum[c] += fi;
+                    sum2[c] += fi * fi;
+                    total += fi;
+                }
+                double total2 = total * total;
+                total_sum += total;
+                total_sum2 += total2;
+                for (size_t j = 0; j < dim; j++) {
+                    s->d[j * bins + bin[i * dim + j]] += total2;
+                }
+            }
+        }
+
+        double intgrl, var;
+        for (size_t c = 0; c < fdim; c++) {
+            mean_and_variance(sum[c], sum2[c], calls, &intgrl, &var);
+            if (var > 0) {
+                double wgt = 1.0 / var;
+                s->wtd_int_sum[c] += intgrl * wgt;
+                s->sum_wgts[c] += wgt;
+                p_result[c] = s->wtd_int_sum[c] / s->sum_wgts[c];
+                p_abserr[c] = sqrt(1.0 / s->sum_wgts[c]);
+            }
+            else if (s->sum_wgts[c] == 0) {
+                // an exact result, as far as we can tell
+                p_result[c] = intgrl;
+                p_abserr[c] = 0;
+            }
+        }
+        mean_and_variance(total_sum, total_sum2, calls, &intgrl, &var);
+        if (var > 0) {
+            double wgt = 1.0 / var;
+            s->total_wtd_int_sum += intgrl * wgt;
+            s->total_sum_wgts += wgt;
+            s->chi_sum += intgrl * intgrl * wgt;
+            s->it_num++;
+            total_result = s->total_wtd_int_sum / s->total_sum_wgts;
+        }
+        s->refine_grid();
+    }
+    s->m_chisq = s->it_num > 1 ? (s->chi_sum - s->total_wtd_int_sum * total_result) / (s->it_num - 1.0) : 0;
+}
+
+/** Parameters of the MISER algorithm, with the same meanings and values as in GSL */
+static const double miser_estimate_frac = 0.1;
+static const double miser_alpha = 2;
+
+/**
+ * Draws `npt` uniformly distributed points in the box and evaluates `f`
+ * at them, in batches. The result for component k of point i is put in
+ * fval[k * npt + i], and the sum of the components in total[i].
+ */
+static void sample_uniform(integrand_v f, const size_t dim, const size_t fdim, void* closure, const double* xl, const double* xu,
+                           const size_t npt, gsl_rng* rng, vector<double>& x, vector<double>& fval, vector<double>& total) {
+    x.resize(npt * dim);
+    fval.resize(npt * fdim);
+    total.assign(npt, 0.0);
+    for (size_t i = 0; i < npt; i++) {
+        for (size_t j = 0; j < dim; j++) {
+            x[i * dim + j] = xl[j] + gsl_rng_uniform_pos(rng) * (xu[j] - xl[j]);
+        }
+    }
+    vector<double> batch(GSL_MIN(npt, max_batch_size) * fdim);
+    for (size_t done = 0; done < npt; done += max_batch_size) {
+        const size_t n = GSL_MIN(max_batch_size, npt - done);
+        evaluate(f, dim, fdim, closure, n, &x[done * dim], &batch[0]);
+        for (size_t c = 0; c < fdim; c++) {
+            for (size_t i = 0; i < n; i++) {
+                fval[c * npt + done + i] = batch[c * n + i];
+                total[done + i] += batch[c * n + i];
+            }
+        }
+    }
+}
+
+/**
+ * The recursive part of the MISER integration. This computes the integral
+ * of each component over the box and the variance of each estimate.
+ */
+static void miser_recurse(integrand_v f, const size_t dim, const size_t fdim, void* closure, const double* xl, const double* xu,
+                          const size_t calls, gsl_rng* rng, double* p_result, double* p_variance) {
+    const size_t min_calls = 16 * dim;
+    const size_t min_calls_per_bisection = 32 * min_calls;
+    vector<double> x, fval, total;
+
+    double vol = 1;
+    for (size_t j = 0; j < dim; j++) {
+        vol *= xu[j] - xl[j];
+    }
+
+    if (calls < min_calls_per_bisection) {
+        // plain Monte Carlo in this box
+        assert(calls >= 2);
+        sample_uniform(f, dim, fdim, closure, xl, xu, calls, rng, x, fval, total);
+        for (size_t c = 0; c < fdim; c++) {
+            double sum = 0, sum2 = 0;
+            for (size_t i = 0; i < calls; i++) {
+                sum += fval[c * calls + i];
+                sum2 += fval[c * calls + i] * fval[c * calls + i];
+            }
+            double mean, var;
+            mean_and_variance(sum, sum2, calls, &mean, &var);
+            p_result[c] = vol * mean;
+            p_variance[c] = vol * vol * var;
+        }
+        return;
+    }
+
+    // sample some points to decide which dimension to bisect
+    size_t estimate_calls = GSL_MAX(min_calls, static_cast<size_t>(calls * miser_estimate_frac));
+    sample_uniform(f, dim, fdim, closure, xl, xu, estimate_calls, rng, x, fval, total);
+
+    const double beta = 2 / (1 + miser_alpha);
+    size_t best_dim = dim;
+    double best_weight = GSL_POSINF, best_sigma_l = 0, best_sigma_r = 0;
+    for (size_t j = 0; j < dim; j++) {
+        const double mid = (xl[j] + xu[j]) / 2;
+        double sum_l = 0, sum2_l = 0, sum_r = 0, sum2_r = 0;
+        size_t hits_l = 0, hits_r = 0;
+        for (size_t i = 0; i < estimate_calls; i++) {
+            double fi = total[i];
+            if (x[i * dim + j] <= mid) {
+                sum_l += fi;
+                sum2_l += fi * fi;
+                hits_l++;
+            }
+            else {
+                sum_r += fi;
+                sum2_r += fi * fi;
+                hits_r++;
+            }
+        }
+        if (hits_l < 2 || hits_r < 2) {
+            continue;
+        }
+        double sigma_l = sqrt(GSL_MAX(sum2_l / hits_l - gsl_pow_2(sum_l / hits_l), 0.0));
+        double sigma_r = sqrt(GSL_MAX(sum2_r / hits_r - gsl_pow_2(sum_r / hits_r), 0.0));
+        double weight = pow(sigma_l, beta) + pow(sigma_r, beta);
+        if (weight < best_weight) {
+            best_dim = j;
+            best_weight = weight;
+            best_sigma_l = sigma_l;
+            best_sigma_r = sigma_r;
+        }
+    }
+    if (best_dim == dim) {
+        // no useful information; bisect the first dimension evenly
+        best_dim = 0;
+        best_sigma_l = best_sigma_r = 1;
+    }
+
+    // split the remaining points between the halves according to their variances
+    const size_t remaining = calls - estimate_calls;
+    double weight_l = pow(best_sigma_l, beta);
+    double weight_r = pow(best_sigma_r, beta);
+    double fraction_l = (weight_l + weight_r) > 0 ? weight_l / (weight_l + weight_r) : 0.5;
+    size_t calls_l = min_calls + static_cast<size_t>((remaining - 2 * min_calls) * fraction_l);
+    size_t calls_r = remaining - calls_l;
+
+    vector<double> xmid(xl, xl + dim);
+    vector<double> xupper(xu, xu + dim);
+    const double mid = (xl[best_dim] + xu[best_dim]) / 2;
+    xupper[best_dim] = mid;
+    xmid[best_dim] = mid;
+
+    vector<double> result_r(fdim), variance_r(fdim);
+    miser_recurse(f, dim, fdim, closure, xl, &xupper[0], calls_l, rng, p_result, p_variance);
+    miser_recurse(f, dim, fdim, closure, &xmid[0], xu, calls_r, rng, &result_r[0], &variance_r[0]);
+    for (size_t c = 0; c < fdim; c++) {
+        p_result[c] += result_r[c];
+        p_variance[c] += variance_r[c];
+    }
+}
+
+void batch_miser_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                           double* p_result, double* p_abserr, size_t calls, gsl_rng* rng) {
+    miser_recurse(f, dim, fdim, closure, xl, xu, GSL_MAX(calls, static_cast<size_t>(2)), rng, p_result, p_abserr);
+    for (size_t c = 0; c < fdim; c++) {
+        p_abserr[c] = sqrt(p_abserr[c]);
+    }
+}
+
+void batch_quasi_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                           double* p_result, double* p_abserr, size_t calls, double relerr, double abserr, gsl_qrng* qrng) {
+    double vol = 1;
+    for (size_t j = 0; j < dim; j++) {
+        vol *= xu[j] - xl[j];
+    }
+    vector<double> u(dim);
+    vector<double> x(max_batch_size * dim);
+    vector<double> fval(max_batch_size * fdim);
+
+    vector<double> sum(fdim, 0.0);
+    vector<double> previous(fdim, 0.0);
+    size_t n = 0;
+    // check for convergence each time the number of points doubles
+    size_t next_check = max_batch_size;
+    std::fill(p_result, p_result + fdim, 0.0);
+    std::fill(p_abserr, p_abserr + fdim, GSL_POSINF);
+    while (n < calls) {
+        const size_t npt = GSL_MIN(max_batch_size, GSL_MIN(calls, next_check) - n);
+        for (size_t i = 0; i < npt; i++) {
+            gsl_qrng_get(qrng, &u[0]);
+            for (size_t j = 0; j < dim; j++) {
+                x[i * dim + j] = xl[j] + u[j] * (xu[j] - xl[j]);
+            }
+        }
+        evaluate(f, dim, fdim, closure, npt, &x[0], &fval[0]);
+        n += npt;
+        for (size_t c = 0; c < fdim; c++) {
+            for (size_t i = 0; i < npt; i++) {
+                sum[c] += fval[c * npt + i];
+            }
+            p_result[c] = vol * sum[c] / n;
+        }
+        if (n == next_check || n == calls) {
+            if (n > max_batch_size) {
+                bool converged = true;
+                for (size_t c = 0; c < fdim; c++) {
+                    p_abserr[c] = fabs(p_result[c] - previous[c]);
+                    converged = converged && p_abserr[c] <= GSL_MAX(abserr, relerr * fabs(p_result[c]));
+                }
+                if (converged) {
+                    break;
+                }
+            }
+            std::copy(p_result, p_result + fdim, previous.begin());
+            next_check *= 2;
+        }
+    }
+}
+
+/** The number of binary digits used for the digital shifts */
+static const double digital_scale = 4294967296.0;
+
+/**
+ * Shifts the coordinate `u`, in [0, 1), by `shift`, either by an exclusive
+ * or of their first 32 binary digits or by addition modulo 1.
+ */
+static inline double shift_coordinate(const double u, const double shift, const bool digital) {
+    if (digital) {
+        const unsigned long bits = (static_cast<unsigned long>(u * digital_scale) ^ static_cast<unsigned long>(shift * digital_scale)) & 0xfffffffful;
+        return (bits + 0.5) / digital_scale;
+    }
+    else {
+        const double shifted = u + shift;
+        return shifted < 1 ? shifted : shifted - 1;
+    }
+}
+
+void batch_rqmc_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                          double* p_result, double* p_abserr, size_t calls, double relerr, double abserr, size_t replicas,
+                          gsl_qrng* qrng, gsl_rng* rng) {
+    assert(replicas >= 2);
+    double vol = 1;
+    for (size_t j = 0; j < dim; j++) {
+        vol *= xu[j] - xl[j];
+    }
+    const bool digital = qrng->type == gsl_qrng_sobol || qrng->type == gsl_qrng_niederreiter_2;
+    vector<double> shifts(replicas * dim);
+    for (size_t k = 0; k < replicas * dim; k++) {
+        shifts[k] = gsl_rng_uniform(rng);
+    }
+    // each block has the same number of points of the sequence for every replica
+    const size_t block = GSL_MAX(max_batch_size / replicas, static_cast<size_t>(1));
+    // at least one point per replica, even when the calls were scaled below the replica count
+    const size_t max_points = GSL_MAX(calls / replicas, static_cast<size_t>(1));
+    vector<double> u(dim);
+    vector<double> x(block * replicas * dim);
+    vector<double> fval(block * replicas * fdim);
+
+    // the sum of the function values of each replica, sum[r * fdim + c]
+    vector<double> sum(replicas * fdim, 0.0);
+    size_t n = 0;
+    // check for convergence each time the number of points doubles
+    size_t next_check = block;
+    std::fill(p_result, p_result + fdim, 0.0);
+    std::fill(p_abserr, p_abserr + fdim, GSL_POSINF);
+    while (n < max_points) {
+        const size_t nbase = GSL_MIN(block, GSL_MIN(max_points, next_check) - n);
+        const size_t npt = nbase * replicas;
+        for (size_t i = 0; i < nbase; i++) {
+            gsl_qrng_get(qrng, &u[0]);
+            for (size_t r = 0; r < replicas; r++) {
+                double* point = &x[(r * nbase + i) * dim];
+                for (size_t j = 0; j < dim; j++) {
+                    point[j] = xl[j] + shift_coordinate(u[j], shifts[r * dim + j], digital) * (xu[j] - xl[j]);
+                }
+            }
+        }
+        evaluate(f, dim, fdim, closure, npt, &x[0], &fval[0]);
+        n += nbase;
+        for (size_t c = 0; c < fdim; c++) {
+            for (size_t r = 0; r < replicas; r++) {
+                for (size_t i = 0; i < nbase; i++) {
+                    sum[r * fdim + c] += fval[c * npt + r * nbase + i];
+                }
+            }
+        }
+        if (n == next_check || n == max_points) {
+            bool converged = true;
+            for (size_t c = 0; c < fdim; c++) {
+                double mean = 0;
+                for (size_t r = 0; r < replicas; r++) {
+                    mean += sum[r * fdim + c];
+                }
+                mean /= replicas;
+                double variance = 0;
+                for (size_t r = 0; r < replicas; r++) {
+                    variance += gsl_pow_2(sum[r * fdim + c] - mean);
+                }
+                variance /= replicas * (replicas - 1);
+                p_result[c] = vol * mean / n;
+                p_abserr[c] = vol * sqrt(variance) / n;
+                converged = converged && p_abserr[c] <= GSL_MAX(abserr, relerr * fabs(p_result[c]));
+            }
+            if (converged) {
+                break;
+            }
+            next_check *= 2;
+        }
+    }
+}
@@ -0,0 +1,200 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BATCHMONTE_H_
+#define _BATCHMONTE_H_
+
+#include <vector>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_qrng.h>
+#include "cubature.h"
+
+/*
+ * Monte Carlo integration routines which hand the integrand many points at
+ * a time, using the same vectorized integrand signature as cubature
+ * (coordinate j of point i at x[i * ndim + j], result k of point i at
+ * fval[k * npt + i]). The integrand may have several components, which are
+ * all estimated from the same sample points; the sampling (the VEGAS grid
+ * and the MISER bisections) adapts to the sum of the components, and
+ * p_result and p_abserr point to arrays with one value for each component.
+ *
+ * The GSL routines call the integrand one point at a time, so there is no
+ * way for the integrand to spread their work over several threads. These
+ * draw all their random numbers on the calling thread in a fixed order and
+ * only then evaluate the batch, so the result for a given seed doesn't
+ * depend on how the integrand divides up the work.
+ *
+ * The algorithms follow the GSL implementations of VEGAS and MISER, but
+ * they are separate implementations, so the results are not identical to
+ * those of gsl_monte_vegas_integrate and gsl_monte_miser_integrate.
+ */
+
+/**
+ * The state of a batched VEGAS integration: the importance sampling grid
+ * and the statistics accumulated in the current call.
+ */
+class BatchVegasState {
+public:
+    BatchVegasState(const size_t dim, const size_t fdim = 1);
+    /**
+     * Puts the state back as it was constructed, with a uniform grid and
+     * the default parameters, so that it can be reused for an unrelated
+     * integration with the same `dim` and `fdim` without reallocating.
+     */
+    void reset();
+    /**
+     * The chi-squared per degree of freedom of the iterations of the last
+     * call to batch_vegas_integrate(), as with gsl_monte_vegas_chisq. With
+     * several components, this is computed for their sum.
+     */
+    double chisq() const { return m_chisq; }
+
+    /** The number of bins in the grid along each dimension */
+    static const size_t bins = 50;
+    /** The grid stiffness parameter, as in GSL */
+    double alpha;
+    /** The number of iterations to do in each call */
+    size_t iterations;
+
+private:
+    friend void batch_vegas_integrate(integrand_v, size_t, size_t, void*, const double*, const double*, double*, double*, size_t, gsl_rng*, BatchVegasState*);
+
+    const size_t dim;
+    const size_t fdim;
+    /** The bin boundaries, (bins + 1) per dimension, in units of the range of each coordinate */
+    std::vector<double> grid;
+    /** The sum of squares of function values in each bin in the current iteration */
+    std::vector<double> d;
+    /** The weighted sums of the iteration results, and of the weights, for each component */
+    std::vector<double> wtd_int_sum, sum_wgts;
+    /** The same for the sum of the components, from which chi-squared is computed */
+    double total_wtd_int_sum, total_sum_wgts, chi_sum;
+    size_t it_num;
+    double m_chisq;
+    /**
+     * Scratch space for batch_vegas_integrate() and refine_grid(), kept
+     * here so that calls on the same state don't allocate
+     */
+    std::vector<double> x, jacobian, fval, sum, sum2, weight, new_grid;
+    std::vector<size_t> bin;
+
+    void reset_grid();
+    void refine_grid();
+};
+
+/**
+ * Does `s->iterations` VEGAS iterations of `calls` points each. The
+ * first call on a given state starts with a uniform grid; later calls
+ * keep refining the grid from where the previous one left off, but
+ * compute the result and chi-squared only from their own iterations, as
+ * GSL does with stage 1.
+ *
+ * @param f the integrand
+ * @param dim the number of dimensions
+ * @param fdim the number of components of the integrand
+ * @param closure passed on to the integrand
+ * @param xl the lower bounds of the integration region
+ * @param xu the upper bounds of the integration region
+ * @param[out] p_result the result
+ * @param[out] p_abserr the error bound
+ * @param calls the number of points per iteration
+ * @param rng the random number generator
+ * @param s the VEGAS state, constructed with the same `dim` and `fdim`
+ */
+void batch_vegas_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                           double* p_result, double* p_abserr, size_t calls, gsl_rng* rng, BatchVegasState* s);
+
+/**
+ * Does a MISER (recursive stratified sampling) integration using `calls`
+ * points in total, with the default GSL parameters.
+ *
+ * @param f the integrand
+ * @param dim the number of dimensions
+ * @param fdim the number of components of the integrand
+ * @param closure passed on to the integrand
+ * @param xl the lower bounds of the integration region
+ * @param xu the upper bounds of the integration region
+ * @param[out] p_result the result
+ * @param[out] p_abserr the error bound
+ * @param calls the number of function evaluations
+ * @param rng the random number generator
+ */
+void batch_miser_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                           double* p_result, double* p_abserr, size_t calls, gsl_rng* rng);
+
+/**
+ * Does a quasi Monte Carlo integration, evaluating the points of `qrng` in
+ * blocks. The error is estimated as the change in the average between
+ * half the points and all of them. The integration stops when that is
+ * within the given tolerances for every component, or after `calls`
+ * evaluations.
+ *
+ * @param f the integrand
+ * @param dim the number of dimensions
+ * @param fdim the number of components of the integrand
+ * @param closure passed on to the integrand
+ * @param xl the lower bounds of the integration region
+ * @param xu the upper bounds of the integration region
+ * @param[out] p_result the result
+ * @param[out] p_abserr the error estimate
+ * @param calls the maximum number of function evaluations
+ * @param relerr the relative error at which to stop
+ * @param abserr the absolute error at which to stop
+ * @param qrng the quasirandom number generator
+ */
+void batch_quasi_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                           double* p_result, double* p_abserr, size_t calls, double relerr, double abserr, gsl_qrng* qrng);
+
+/**
+ * Does a randomized quasi Monte Carlo integration with `replicas` copies of
+ * the points of `qrng`, each shifted by its own random offset drawn from
+ * `rng`. For the base 2 sequences (Sobol and Niederreiter) the offset is
+ * applied as a digital shift, an exclusive or of the binary digits, which
+ * keeps the net structure of the points; for the others it is added modulo
+ * 1. Every block of points is evaluated for all the replicas at once, so an
+ * integrand that spreads its work over several threads evaluates the
+ * replicas in parallel.
+ *
+ * The result is the average of the replicas, and the error is the standard
+ * error of that average estimated from their spread. The integration stops
+ * when that is within the given tolerances for every component, checking
+ * each time the number of points doubles, or after `calls` evaluations in
+ * total.
+ *
+ * @param f the integrand
+ * @param dim the number of dimensions
+ * @param fdim the number of components of the integrand
+ * @param closure passed on to the integrand
+ * @param xl the lower bounds of the integration region
+ * @param xu the upper bounds of the integration region
+ * @param[out] p_result the result
+ * @param[out] p_abserr the error estimate
+ * @param calls the maximum number of function evaluations, over all replicas; each
+ *              replica gets at least one point even if this is smaller
+ * @param relerr the relative error at which to stop
+ * @param abserr the absolute error at which to stop
+ * @param replicas the number of shifted copies of the sequence, at least 2
+ * @param qrng the quasirandom number generator
+ * @param rng the random number generator for the shifts
+ */
+void batch_rqmc_integrate(integrand_v f, size_t dim, size_t fdim, void* closure, const double* xl, const double* xu,
+                          double* p_result, double* p_abserr, size_t calls, double relerr, double abserr, size_t replicas,
+                          gsl_qrng* qrng, gsl_rng* rng);
+
+#endif // _BATCHMONTE_H_
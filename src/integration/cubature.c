@@ -882,7 +882,7 @@ static heap_item heap_pop(heap *h)
 
 /* adaptive integration, analogous to adaptintegrator.cpp in HIntLib */
 
-static int ruleadapt_integrate(rule *r, unsigned fdim, integrand_v f, void *fdata, const hypercube *h, unsigned maxEval, double reqAbsError, double reqRelError, double *val, double *err, int parallel)
+static int ruleadapt_integrate(rule *r, unsigned fdim, integrand_v f, void *fdata, const hypercube *h, unsigned maxEval, double reqAbsError, double reqRelError, double *val, double *err, int parallel, unsigned minRegions)
 {
      unsigned numEval = 0;
      heap regions;
@@ -941,7 +941,13 @@ static int ruleadapt_integrate(rule *r, unsigned fdim, integrand_v f, void *fdat
 		  which case the time to pop K biggest-error regions
 		  out of N is only O(K log N), much better than the
 		  O(N) cost of the Bull and Freeman algorithm if K <<
-		  N, and it is also much simpler.] */
+		  N, and it is also much simpler.]
+
+		  At least minRegions regions are taken at each step
+		  (as long as there are that many), so that a
+		  vectorized integrand which spreads the points over
+		  several threads gets enough of them to keep the
+		  threads busy. */
 	       unsigned nR = 0;
 	       for (j = 0; j < fdim; ++j) ee[j] = regions.ee[j];
 	       do {
@@ -958,7 +964,7 @@ static int ruleadapt_integrate(rule *r, unsigned fdim, integrand_v f, void *fdat
 		    for (j = 0; j < fdim 
 			      && (ee[j].err <= reqAbsError
 				  || relError(ee[j]) <= reqRelError); ++j) ;
-		    if (j == fdim) break; /* other regions have small errs */
+		    if (j == fdim && nR >= 2 * minRegions) break; /* other regions have small errs */
 	       } while (regions.n > 0 && (numEval < maxEval || !maxEval));
 	       if (eval_regions(nR, R, f, fdata, r)
 		   || heap_push_many(&regions, nR, R))
@@ -1000,7 +1006,7 @@ bad:
 static int integrate(unsigned fdim, integrand_v f, void *fdata, 
 		     unsigned dim, const double *xmin, const double *xmax, 
 		     unsigned maxEval, double reqAbsError, double reqRelError, 
-		     double *val, double *err, int parallel)
+		     double *val, double *err, int parallel, unsigned minRegions)
 {
      rule *r;
      hypercube h;
@@ -1026,7 +1032,7 @@ static int integrate(unsigned fdim, integrand_v f, void *fdata,
      status = !h.data ? FAILURE
 	  : ruleadapt_integrate(r, fdim, f, fdata, &h,
 				maxEval, reqAbsError, reqRelError,
-				val, err, parallel);
+				val, err, parallel, minRegions);
      destroy_hypercube(&h);
      destroy_rule(r);
      return status;
@@ -1038,7 +1044,17 @@ int adapt_integrate_v(unsigned fdim, integrand_v f, void *fdata,
 		      double *val, double *err)
 {
      return integrate(fdim, f, fdata, dim, xmin, xmax, 
-		      maxEval, reqAbsError, reqRelError, val, err, 1);
+		      maxEval, reqAbsError, reqRelError, val, err, 1, 1);
+}
+
+int adapt_integrate_v_batch(unsigned fdim, integrand_v f, void *fdata, 
+			    unsigned dim, const double *xmin, const double *xmax, 
+			    unsigned maxEval, double reqAbsError, double reqRelError, 
+			    unsigned minRegions, double *val, double *err)
+{
+     return integrate(fdim, f, fdata, dim, xmin, xmax, 
+		      maxEval, reqAbsError, reqRelError, val, err, 1,
+		      minRegions > 0 ? minRegions : 1);
 }
 
 /* wrapper around non-vectorized integrand */
@@ -1078,7 +1094,7 @@ int adapt_integrate(unsigned fdim, integrand f, void *fdata,
 	  return -2; /* ERROR */
      }
      ret = integrate(fdim, fv, &d, dim, xmin, xmax, 
-		     maxEval, reqAbsError, reqRelError, val, err, 0);
+		     maxEval, reqAbsError, reqRelError, val, err, 0, 1);
      free(d.fval1);
      return ret;
 }
@@ -72,6 +72,15 @@ int adapt_integrate_v(unsigned fdim, integrand_v f, void *fdata,
 		     unsigned maxEval, double reqAbsError, double reqRelError, 
 		      double *val, double *err);
 
+/* as adapt_integrate_v, but subdividing at least minRegions of the
+   regions with the largest errors at each step (or all of them, if
+   there are fewer), so that each call to f gets enough points to be
+   spread over several threads */
+int adapt_integrate_v_batch(unsigned fdim, integrand_v f, void *fdata,
+			    unsigned dim, const double *xmin, const double *xmax, 
+			    unsigned maxEval, double reqAbsError, double reqRelError, 
+			    unsigned minRegions, double *val, double *err);
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif /* __cplusplus */
@@ -23,6 +23,7 @@
 #include "../dss_pinlo/dss_pinlo.h"
 #include "integrationcontext.h"
 #include "../gluondist/gluondist.h"
+#include "../utils/profile.h"
 
 #define checkfinite(d) assert(gsl_finite(d))
 
@@ -92,6 +93,7 @@ void IntegrationContext::recalculate_from_momentum(const size_t dimensions) {
 }
 
 void IntegrationContext::recalculate_longitudinal(const Modifiers::LongitudinalKinematicsScheme xtarget_scheme) {
+    PROFILE_SCOPE(LONGITUDINAL);
     z2 = z*z;
     kT2 = ctx.pT2 / z2;
     kT = sqrt(kT2);
@@ -101,48 +103,112 @@ void IntegrationContext::recalculate_longitudinal(const Modifiers::LongitudinalK
      * as xp / xi, consistent with the notation in e.g. arxiv:1604.00225
      */
     xp = ctx.tau / z;
+    assert(xtarget_scheme != Modifiers::EXACT || q12 > 0);
+    xg = target_x(kT, xtarget_scheme);
+    Yg = -log(xg);
+}
+
+double IntegrationContext::target_x(const double kT, const Modifiers::LongitudinalKinematicsScheme xtarget_scheme) const {
     switch (xtarget_scheme) {
         case Modifiers::EXACT:
-            assert(q12 > 0);
-            xg = exp(-ctx.Y) / ctx.sqs * (kT + ((kT - q1x) * (kT - q1x) + q1y * q1y) / kT * xi / (1 - xi));
-            break;
+            return exp(-ctx.Y) / ctx.sqs * (kT + ((kT - q1x) * (kT - q1x) + q1y * q1y) / kT * xi / (1 - xi));
         case Modifiers::APPROX:
-            xg = kT / ctx.sqs * exp(-ctx.Y) / (1 - xi);
-            break;
+            return kT / ctx.sqs * exp(-ctx.Y) / (1 - xi);
         case Modifiers::FIXED:
-            xg = kT / ctx.sqs * exp(-ctx.Y);
-            break;
+            return kT / ctx.sqs * exp(-ctx.Y);
         default:
             assert(false);
+            return 0;
     }
-    Yg = -log(xg);
+}
+
+IntegrationContext::ScaleStrategies IntegrationContext::choose_strategies(const Coupling* cpl, FactorizationScale* fs) const {
+    ScaleStrategies s;
+    s.cpl = cpl;
+    s.fs = fs;
+    s.coupling_strategy = GENERIC_COUPLING;
+    s.running_coupling = dynamic_cast<const LORunningCoupling*>(cpl);
+    s.fixed_alphas = 0;
+    if (s.running_coupling != NULL) {
+        s.coupling_strategy = LO_RUNNING_COUPLING;
+    }
+    else if (const FixedCoupling* fixed = dynamic_cast<const FixedCoupling*>(cpl)) {
+        s.coupling_strategy = FIXED_COUPLING;
+        s.fixed_alphas = fixed->value_alphas();
+    }
+
+    s.fixed_scale = true;
+    s.fixed_mu2 = 0;
+    if (const FixedFactorizationScale* fixed = dynamic_cast<const FixedFactorizationScale*>(fs)) {
+        s.fixed_mu2 = fixed->value_mu2();
+    }
+    else if (const PTProportionalFactorizationScale* proportional = dynamic_cast<const PTProportionalFactorizationScale*>(fs)) {
+        s.fixed_mu2 = proportional->pT2_coefficient() * ctx.pT2;
+    }
+    else {
+        s.fixed_scale = false;
+    }
+
+    s.parton_table = NULL;
+    if (s.fixed_scale && ctx.parton_function_table_points > 0 && ctx.tau < 1) {
+        s.parton_table = PartonFunctionTable::create(ctx, *tlctx.pdf_object, *tlctx.ff_object, s.fixed_mu2, ctx.parton_function_table_points);
+    }
+    return s;
 }
 
 void IntegrationContext::recalculate_coupling() {
-    alphas = ctx.cpl->alphas(*this);
+    PROFILE_SCOPE(COUPLING);
+    switch (scale->coupling_strategy) {
+        case FIXED_COUPLING:
+            alphas = scale->fixed_alphas;
+            break;
+        case LO_RUNNING_COUPLING:
+            alphas = scale->running_coupling->alphas_at(coupling_scale2(scale->running_coupling->scale_scheme()));
+            break;
+        default:
+            alphas = scale->cpl->alphas(*this);
+    }
     alphas_2pi = alphas * 0.5 * M_1_PI;
 }
 
 void IntegrationContext::recalculate_position_gdist(const bool quadrupole) {
-    S2r = ctx.gdist->S2(r2, Yg);
-    S4rst = quadrupole ? ctx.gdist->S4(r2, s2, t2, Yg) : NAN;
+    PROFILE_SCOPE(GLUON_DISTRIBUTION);
+    gdist_slice->set_rapidity(Yg);
+    if (quadrupole) {
+        gdist_slice->S2_and_S4(r2, s2, t2, &S2r, &S4rst);
+    }
+    else {
+        S2r = gdist_slice->S2(r2);
+        S4rst = NAN;
+    }
 }
 
 void IntegrationContext::recalculate_momentum_gdist(const size_t dimensions) {
-    double Y = Yg;
-    Qs2 = ctx.gdist->Qs2(Y);
+    PROFILE_SCOPE(GLUON_DISTRIBUTION);
+    assert(dimensions <= 3);
+    gdist_slice->set_rapidity(Yg);
+    Qs2 = gdist_slice->Qs2();
+    // all the momenta share Y, so evaluate them in one batch
+    const double q2[] = {
+        kT2,
+        q12, (kT - q1x) * (kT - q1x) + q1y * q1y,
+        q22, (kT - q2x) * (kT - q2x) + q2y * q2y,
+        q32, (kT - q3x) * (kT - q3x) + q3y * q3y
+    };
+    double F[7];
+    gdist_slice->F_batch(q2, 1 + 2 * dimensions, F);
     switch (dimensions) { // intentionally omitting break statements
         case 3:
-            Fq3 = ctx.gdist->F(q32, Y);
-            Fkq3 = ctx.gdist->F((kT - q3x) * (kT - q3x) + q3y * q3y, Y);
+            Fq3 = F[5];
+            Fkq3 = F[6];
         case 2:
-            Fq2 = ctx.gdist->F(q22, Y);
-            Fkq2 = ctx.gdist->F((kT - q2x) * (kT - q2x) + q2y * q2y, Y);
+            Fq2 = F[3];
+            Fkq2 = F[4];
         case 1:
-            Fq1 = ctx.gdist->F(q12, Y);
-            Fkq1 = ctx.gdist->F((kT - q1x) * (kT - q1x) + q1y * q1y, Y);
+            Fq1 = F[1];
+            Fkq1 = F[2];
         case 0:
-            Fk = ctx.gdist->F(kT2, Y);
+            Fk = F[0];
             break;
         default:
             assert(false);
@@ -150,80 +216,29 @@ void IntegrationContext::recalculate_momentum_gdist(const size_t dimensions) {
 }
 
 void IntegrationContext::recalculate_parton_functions(const bool divide_xi) {
+    PROFILE_SCOPE(PARTON_FUNCTIONS);
     // Finally, update the parton functions
-    double qqfactor = 0.0, ggfactor = 0.0, gqfactor = 0.0, qgfactor = 0.0;
-
-    c_mstwpdf* pdf_object = tlctx.pdf_object;
-    DSSpiNLO* ff_object = tlctx.ff_object;
-
-    DSSpiNLO::hadron hadron = ctx.hadron;
-
-    // Calculate the new quark/gluon factors
-    mu2 = ctx.fs->mu2(*this);
-    pdf_object->update(divide_xi ? xp / xi : xp, sqrt(mu2));
-    ff_object->update(z, mu2);
-
-    // Proton contributions:
-    qqfactor += (pdf_object->cont.upv + pdf_object->cont.usea) * ff_object->fragmentation(DSSpiNLO::up, hadron);
-    qqfactor += pdf_object->cont.usea * ff_object->fragmentation(DSSpiNLO::up_bar, hadron);
-    qqfactor += (pdf_object->cont.dnv + pdf_object->cont.dsea) * ff_object->fragmentation(DSSpiNLO::down, hadron);
-    qqfactor += pdf_object->cont.dsea * ff_object->fragmentation(DSSpiNLO::down_bar, hadron);
-    qqfactor += pdf_object->cont.str * ff_object->fragmentation(DSSpiNLO::strange, hadron);
-    qqfactor += pdf_object->cont.sbar * ff_object->fragmentation(DSSpiNLO::strange_bar, hadron);
-
-    if (ctx.projectile == deuteron) {
-        // Neutron contributions (for deuteron collisions), assuming isospin symmetry:
-        qqfactor += (pdf_object->cont.dnv + pdf_object->cont.dsea) * ff_object->fragmentation(DSSpiNLO::up, hadron);
-        qqfactor += pdf_object->cont.dsea * ff_object->fragmentation(DSSpiNLO::up_bar, hadron);
-        qqfactor += (pdf_object->cont.upv + pdf_object->cont.usea) * ff_object->fragmentation(DSSpiNLO::down, hadron);
-        qqfactor += pdf_object->cont.usea * ff_object->fragmentation(DSSpiNLO::down_bar, hadron);
-        qqfactor += pdf_object->cont.str * ff_object->fragmentation(DSSpiNLO::strange, hadron);
-        qqfactor += pdf_object->cont.sbar * ff_object->fragmentation(DSSpiNLO::strange_bar, hadron);
-    }
-
-    this->qqfactor = qqfactor;
-
-
-    // Proton contribution:
-    ggfactor += pdf_object->cont.glu * ff_object->fragmentation(DSSpiNLO::gluon, hadron);
-
-    if (ctx.projectile == deuteron) {
-        // Neutron contribution (for deuteron collisions), assuming isospin symmetry:
-        ggfactor *= 2;
-    }
-
-    this->ggfactor = ggfactor;
-
-
-    // Proton contributions:
-    gqfactor += (  pdf_object->cont.upv + 2*pdf_object->cont.usea
-                 + pdf_object->cont.dnv + 2*pdf_object->cont.dsea
-                 + pdf_object->cont.str
-                 + pdf_object->cont.sbar
-                ) * ff_object->fragmentation(DSSpiNLO::gluon, hadron);
+    mu2 = scale->fixed_scale ? scale->fixed_mu2 : scale->fs->mu2(*this);
+    const double x = divide_xi ? xp / xi : xp;
 
-    if (ctx.projectile == deuteron) {
-        // Neutron contributions (for deuteron collisions), assuming isospin symmetry:
-        gqfactor *= 2;
+    PartonFactors f;
+    if (scale->parton_table != NULL && scale->parton_table->contains(x, z)) {
+        f = scale->parton_table->eval(x, z);
     }
-
-    this->gqfactor = gqfactor;
-
-
-    // Proton contributions:
-    qgfactor += pdf_object->cont.glu * (  ff_object->fragmentation(DSSpiNLO::up, hadron)
-                                        + ff_object->fragmentation(DSSpiNLO::up_bar, hadron)
-                                        + ff_object->fragmentation(DSSpiNLO::down, hadron)
-                                        + ff_object->fragmentation(DSSpiNLO::down_bar, hadron)
-                                        + ff_object->fragmentation(DSSpiNLO::strange, hadron)
-                                        + ff_object->fragmentation(DSSpiNLO::strange_bar, hadron));
-
-    if (ctx.projectile == deuteron) {
-        // Neutron contributions (for deuteron collisions), assuming isospin symmetry:
-        qgfactor *= 2;
+    else {
+        // Calculate the new quark/gluon factors
+        tlctx.pdf_object->update(x, sqrt(mu2));
+        tlctx.ff_object->update(z, mu2);
+        PartonDistributions p;
+        p.load(*tlctx.pdf_object);
+        double d[9];
+        load_fragmentation(*tlctx.ff_object, ctx.hadron, d);
+        f = combine_parton_factors(p, d, ctx.projectile);
     }
-
-    this->qgfactor = qgfactor;
+    qqfactor = f.qq;
+    ggfactor = f.gg;
+    gqfactor = f.gq;
+    qgfactor = f.qg;
 }
 
 void IntegrationContext::recalculate_everything_from_position(const bool quadrupole, const Modifiers& modifiers) {
@@ -232,6 +247,8 @@ void IntegrationContext::recalculate_everything_from_position(const bool quadrup
     recalculate_coupling();
     recalculate_position_gdist(quadrupole);
     recalculate_parton_functions(modifiers.divide_xi);
+    // not everything is recalculated, so recalculate() can't rely on the rest
+    invalidate();
 }
 
 void IntegrationContext::recalculate_everything_from_momentum(const size_t dimensions, const Modifiers& modifiers) {
@@ -240,13 +257,14 @@ void IntegrationContext::recalculate_everything_from_momentum(const size_t dimen
     recalculate_coupling();
     recalculate_momentum_gdist(dimensions);
     recalculate_parton_functions(modifiers.divide_xi);
+    // not everything is recalculated, so recalculate() can't rely on the rest
+    invalidate();
 }
 
-void IntegrationContext::recalculate_everything(const Modifiers& modifiers) {
-    recalculate_from_position(true);
-    recalculate_from_momentum(3);
-    recalculate_longitudinal(modifiers.xtarget_scheme);
-    recalculate_coupling();
+/**
+ * Recalculates the gluon distribution the way recalculate_everything() does
+ */
+void IntegrationContext::recalculate_gdist_heuristically() {
     // use some heuristics to guess whether to compute position or momentum gluon distributions
     if (r2 > 0 || s2 > 0 || t2 > 0) {
         recalculate_position_gdist(s2 > 0 || t2 > 0);
@@ -257,5 +275,97 @@ void IntegrationContext::recalculate_everything(const Modifiers& modifiers) {
     else {
         recalculate_momentum_gdist(0);
     }
+}
+
+void IntegrationContext::recalculate_everything(const Modifiers& modifiers) {
+    recalculate_from_position(true);
+    recalculate_from_momentum(3);
+    recalculate_longitudinal(modifiers.xtarget_scheme);
+    recalculate_coupling();
+    recalculate_gdist_heuristically();
     recalculate_parton_functions(modifiers.divide_xi);
+    remember_inputs(modifiers);
+}
+
+void IntegrationContext::remember_inputs(const Modifiers& modifiers) {
+    last.z = z;
+    last.xi = xi;
+    last.xx = xx;
+    last.xy = xy;
+    last.yx = yx;
+    last.yy = yy;
+    last.bx = bx;
+    last.by = by;
+    last.q1x = q1x;
+    last.q1y = q1y;
+    last.q2x = q2x;
+    last.q2y = q2y;
+    last.q3x = q3x;
+    last.q3y = q3y;
+    last.modifiers = modifiers;
+    last_valid = true;
+}
+
+bool IntegrationContext::transverse_inputs_changed() const {
+    return xx != last.xx || xy != last.xy
+        || yx != last.yx || yy != last.yy
+        || bx != last.bx || by != last.by
+        || q1x != last.q1x || q1y != last.q1y
+        || q2x != last.q2x || q2y != last.q2y
+        || q3x != last.q3x || q3y != last.q3y;
+}
+
+void IntegrationContext::recalculate(const Modifiers& modifiers) {
+    if (!last_valid) {
+        recalculate_everything(modifiers);
+        return;
+    }
+    const bool transverse_changed = transverse_inputs_changed();
+    const bool z_changed = z != last.z;
+    const bool xi_changed = xi != last.xi;
+    const bool modifiers_changed = !(modifiers == last.modifiers);
+    if (!(transverse_changed || z_changed || xi_changed || modifiers_changed)) {
+        return;
+    }
+
+    if (transverse_changed) {
+        recalculate_from_position(true);
+        recalculate_from_momentum(3);
+    }
+    const double old_Yg = Yg;
+    recalculate_longitudinal(modifiers.xtarget_scheme);
+    // the coupling depends on kT and the transverse momenta
+    if (transverse_changed || z_changed) {
+        recalculate_coupling();
+    }
+    // the gluon distribution depends on kT, the transverse variables, and Yg
+    if (transverse_changed || z_changed || Yg != old_Yg) {
+        recalculate_gdist_heuristically();
+    }
+    // the factorization scale depends on r2, and the PDFs on xp / xi if divide_xi is set
+    if (transverse_changed || z_changed || modifiers_changed || (xi_changed && modifiers.divide_xi)) {
+        recalculate_parton_functions(modifiers.divide_xi);
+    }
+    remember_inputs(modifiers);
+}
+
+void IntegrationContextBatch::resize(const size_t npt) {
+#define process(v) v.resize(npt);
+#include "ictx_var_list.inc"
+#undef process
+}
+
+void IntegrationContextBatch::store(const size_t i, const IntegrationContext& ictx) {
+    assert(i < size());
+#define process(v) v[i] = ictx.v;
+#include "ictx_var_list.inc"
+#undef process
+}
+
+void IntegrationContextBatch::load(const size_t i, IntegrationContext& ictx) const {
+    assert(i < size());
+#define process(v) ictx.v = v[i];
+#include "ictx_var_list.inc"
+#undef process
+    ictx.invalidate();
 }
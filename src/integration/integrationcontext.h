@@ -20,7 +20,11 @@
 #ifndef _INTEGRATIONCONTEXT_H_
 #define _INTEGRATIONCONTEXT_H_
 
+#include <cassert>
+#include <cmath>
+#include <vector>
 #include "../configuration/context.h"
+#include "partonfunctiontable.h"
 
 class Modifiers {
 public:
@@ -41,6 +45,11 @@ class IntegrationContext {
 public:
     const Context& ctx;
     const ThreadLocalContext& tlctx;
+    /**
+     * The gluon distribution that the variables below and the hard factor
+     * terms use: ctx.gdist unless select_gdist() picked one of the variants
+     */
+    GluonDistribution* gdist;
     // updated
     double z;
     double xi;
@@ -74,6 +83,7 @@ public:
     IntegrationContext(const Context& ctx, const ThreadLocalContext& tlctx) :
       ctx(ctx),
       tlctx(tlctx),
+      gdist(ctx.gdist),
       z(0), xi(0),
       xx(0), xy(0),
       yx(0), yy(0),
@@ -98,21 +108,229 @@ public:
       S2r(0), S4rst(0),
       Fk(0),
       Fq1(0), Fq2(0), Fq3(0),
-      Fkq1(0), Fkq2(0), Fkq3(0) {
+      Fkq1(0), Fkq2(0), Fkq3(0),
+      last_valid(false),
+      gdist_slice(ctx.gdist == NULL ? NULL : ctx.gdist->create_slice()),
+      scale(NULL) {
+        gdist_slices.push_back(gdist_slice);
+        for (std::vector<GluonDistribution*>::const_iterator it = ctx.gdist_variants.begin(); it != ctx.gdist_variants.end(); it++) {
+            gdist_slices.push_back((*it)->create_slice());
+        }
+        assert(ctx.cpl_variants.size() == ctx.fs_variants.size());
+        scales.push_back(choose_strategies(ctx.cpl, ctx.fs));
+        for (size_t i = 0; i < ctx.cpl_variants.size(); i++) {
+            scales.push_back(choose_strategies(ctx.cpl_variants[i], ctx.fs_variants[i]));
+        }
+        scale = &scales[0];
     };
+    ~IntegrationContext() {
+        for (std::vector<GluonDistributionSlice*>::iterator it = gdist_slices.begin(); it != gdist_slices.end(); it++) {
+            delete *it;
+        }
+        for (std::vector<ScaleStrategies>::iterator it = scales.begin(); it != scales.end(); it++) {
+            delete it->parton_table;
+        }
+    }
 
     void recalculate_everything(const Modifiers& modifiers);
     void recalculate_everything_from_position(const bool quadrupole, const Modifiers& modifiers);
     void recalculate_everything_from_momentum(const size_t dimensions, const Modifiers& modifiers);
+    /**
+     * Brings the calculated variables up to date with the inputs (z, xi,
+     * the transverse coordinates, and the modifiers), giving the same
+     * result as recalculate_everything(), but only redoing the groups of
+     * calculations that depend on inputs which have changed since the last
+     * call to this or recalculate_everything().
+     *
+     * In particular, when only xi changes, as when setting xi = 1 for the
+     * subtraction term, the transverse kinematics and the coupling are
+     * kept; the gluon distribution is kept unless xg changed; and the
+     * parton functions are kept unless the modifiers divide by xi.
+     *
+     * This relies on the couplings and factorization scales depending only
+     * on z and the transverse variables, which is true for all of them
+     * at present.
+     */
+    void recalculate(const Modifiers& modifiers);
+    /**
+     * The xg that the next recalculation will give, computed from z, xi,
+     * and q1 alone, without changing anything. This lets points outside
+     * the xg window be rejected before the rest of the kinematics is done.
+     */
+    double upcoming_xg(const Modifiers::LongitudinalKinematicsScheme xtarget_scheme) const {
+        return target_x(sqrt(ctx.pT2 / (z * z)), xtarget_scheme);
+    }
+    /** The squared momentum that the running coupling uses for the given scale */
+    double coupling_scale2(const CouplingScale scale) const {
+        switch (scale) {
+            case KT:
+                return kT2;
+            case PT:
+                return ctx.pT2;
+            case Q1:
+                return q12;
+            case Q2:
+                return q22;
+            case Q3:
+                return q32;
+            case KQ1:
+                return (kT - q1x) * (kT - q1x) + q1y * q1y;
+            case KQ2:
+                return (kT - q2x) * (kT - q2x) + q2y * q2y;
+            case KQ3:
+                return (kT - q3x) * (kT - q3x) + q3y * q3y;
+            default:
+                assert(false);
+                return 0;
+        }
+    }
+    /**
+     * Marks the calculated variables as not corresponding to the inputs,
+     * so that the next call to recalculate() does everything. This has to be
+     * called after calculated variables are set directly.
+     */
+    void invalidate() { last_valid = false; }
+
+    /** The number of gluon distributions: ctx.gdist and its variants */
+    size_t gdist_count() const { return gdist_slices.size(); }
+    /**
+     * Makes gluon distribution `index` the current one, where 0 is ctx.gdist
+     * and `i` > 0 is ctx.gdist_variants[i - 1]. The variables are left as
+     * they were; recalculate_gdist() brings the ones that depend on the gluon
+     * distribution up to date.
+     */
+    void select_gdist(const size_t index) {
+        assert(index < gdist_slices.size());
+        gdist = index == 0 ? ctx.gdist : ctx.gdist_variants[index - 1];
+        gdist_slice = gdist_slices[index];
+        invalidate();
+    }
+    /**
+     * Recalculates the gluon distribution variables from the current
+     * kinematics, as recalculate_everything() does, leaving the rest alone
+     */
+    void recalculate_gdist() { recalculate_gdist_heuristically(); }
+
+    /** The number of scale settings: ctx.cpl and ctx.fs, and their variants */
+    size_t scale_count() const { return scales.size(); }
+    /**
+     * Makes scale setting `index` the current one, where 0 is ctx.cpl and
+     * ctx.fs and `i` > 0 is ctx.cpl_variants[i - 1] and ctx.fs_variants[i - 1].
+     * The variables are left as they were; recalculate_scale() brings the
+     * ones that depend on the coupling and factorization scale up to date.
+     */
+    void select_scale(const size_t index) {
+        assert(index < scales.size());
+        scale = &scales[index];
+        invalidate();
+    }
+    /**
+     * Recalculates the coupling, the factorization scale, and the parton
+     * factors, which depend on it, from the current kinematics
+     */
+    void recalculate_scale(const Modifiers& modifiers) {
+        recalculate_coupling();
+        recalculate_parton_functions(modifiers.divide_xi);
+    }
 
 private:
+    /** The inputs at the time of the last recalculation */
+    struct Inputs {
+        double z, xi;
+        double xx, xy, yx, yy, bx, by;
+        double q1x, q1y, q2x, q2y, q3x, q3y;
+        Modifiers modifiers;
+    } last;
+    /** Whether `last` corresponds to the current calculated variables */
+    bool last_valid;
+    /**
+     * The gluon distribution at the current Yg. In the fixed xtarget scheme
+     * Yg depends only on z, so the slice stays put while the transverse
+     * variables change.
+     */
+    GluonDistributionSlice* gdist_slice;
+    /** The slices of ctx.gdist and each of its variants, in the order of select_gdist() */
+    std::vector<GluonDistributionSlice*> gdist_slices;
+
+    /**
+     * How recalculate_coupling() gets alphas: the common couplings are
+     * evaluated inline rather than through a virtual call to the coupling
+     */
+    typedef enum {GENERIC_COUPLING, FIXED_COUPLING, LO_RUNNING_COUPLING} CouplingStrategy;
+    /** How to evaluate one coupling and factorization scale */
+    struct ScaleStrategies {
+        const Coupling* cpl;
+        FactorizationScale* fs;
+        CouplingStrategy coupling_strategy;
+        /** cpl, if it is a LORunningCoupling */
+        const LORunningCoupling* running_coupling;
+        /** The value of a fixed coupling */
+        double fixed_alphas;
+        /**
+         * Whether mu2 is the same at every point, as it is for fixed and
+         * pT-proportional factorization scales, and if so its value
+         */
+        bool fixed_scale;
+        double fixed_mu2;
+        /**
+         * The table the parton factors are interpolated from, if
+         * ctx.parton_function_table_points is set and the scale is fixed
+         */
+        PartonFunctionTable* parton_table;
+    };
+    /** The strategies for ctx.cpl and ctx.fs and each of their variants, in the order of select_scale() */
+    std::vector<ScaleStrategies> scales;
+    /** The entry of `scales` for the current scale setting */
+    const ScaleStrategies* scale;
+    /**
+     * Chooses the strategies from the types of `cpl` and `fs`, and makes
+     * the parton function table
+     */
+    ScaleStrategies choose_strategies(const Coupling* cpl, FactorizationScale* fs) const;
+
+    // not copyable, because of gdist_slices and the parton function tables
+    IntegrationContext(const IntegrationContext&);
+    IntegrationContext& operator=(const IntegrationContext&);
+
+    /** Saves the current inputs in `last` */
+    void remember_inputs(const Modifiers& modifiers);
+    /** Whether any of the transverse coordinates differ from the ones in `last` */
+    bool transverse_inputs_changed() const;
+
     void recalculate_from_position(const bool quadrupole);
     void recalculate_from_momentum(const size_t dimensions);
     void recalculate_longitudinal(const Modifiers::LongitudinalKinematicsScheme xtarget_scheme);
+    /** xg for the given kT and the current xi and q1 */
+    double target_x(const double kT, const Modifiers::LongitudinalKinematicsScheme xtarget_scheme) const;
     void recalculate_coupling();
     void recalculate_position_gdist(const bool quadrupole);
     void recalculate_momentum_gdist(const size_t dimensions);
     void recalculate_parton_functions(const bool divide_xi);
+    void recalculate_gdist_heuristically();
+};
+
+/**
+ * The variables of an IntegrationContext for a batch of points, stored
+ * as one array per variable (the same variables as in ictx_var_list.inc).
+ *
+ * This lets the Integrator compute the kinematics for all the points
+ * handed to it at once, and then run each hard factor term over the whole
+ * batch, loading each point back into its IntegrationContext with load().
+ */
+class IntegrationContextBatch {
+public:
+#define process(v) std::vector<double> v;
+#include "ictx_var_list.inc"
+#undef process
+
+    /** The number of points the batch can hold */
+    size_t size() const { return z.size(); }
+    /** Changes the number of points the batch can hold */
+    void resize(const size_t npt);
+    /** Copies the variables of `ictx` into point `i` of the batch */
+    void store(const size_t i, const IntegrationContext& ictx);
+    /** Copies the variables of point `i` of the batch into `ictx` */
+    void load(const size_t i, IntegrationContext& ictx) const;
 };
 
 #endif // _INTEGRATIONCONTEXT_H_
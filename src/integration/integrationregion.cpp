@@ -17,7 +17,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <gsl/gsl_sys.h>
 #include <typeinfo>
 #include "integrationregion.h"
@@ -106,6 +108,12 @@ void IntegrationRegion::fill_max(const Context& ctx, const bool xi_preintegrated
     }
 }
 
+void IntegrationRegion::clip_to_xg_range(const Context& ctx, const bool xi_preintegrated_term, const Modifiers::LongitudinalKinematicsScheme xtarget_scheme,
+                                         const double xg_min, const double xg_max, double* min, double* max) const {
+    // the core region's variables come first
+    m_core_region.clip_to_xg_range(ctx, xi_preintegrated_term, xtarget_scheme, xg_min, xg_max, min, max);
+}
+
 double IntegrationRegion::jacobian(const IntegrationContext &ictx, const bool xi_preintegrated_term) const {
     double jacobian = m_core_region.jacobian(ictx, xi_preintegrated_term);
     for (size_t k = 0; k < m_subregions.size(); k++) {
@@ -171,6 +179,18 @@ CoreIntegrationRegion::CoreIntegrationRegion() {}
 
 CoreIntegrationRegion::~CoreIntegrationRegion() {}
 
+void CoreIntegrationRegion::clip_to_xg_range(const Context& ctx, const bool xi_preintegrated_term, const Modifiers::LongitudinalKinematicsScheme xtarget_scheme,
+                                             const double xg_min, const double xg_max, double* min, double* max) const {
+    // the same formula as IntegrationContext uses for xg, at xi = 0
+    const double kT_z = sqrt(ctx.pT2) / ctx.sqs * exp(-ctx.Y);
+    if (xg_max > 0) {
+        min[0] = std::max(min[0], kT_z / xg_max);
+    }
+    if (xtarget_scheme == Modifiers::FIXED && xg_min > 0) {
+        max[0] = std::min(max[0], kT_z / xg_min);
+    }
+}
+
 bool CoreIntegrationRegion::operator<(const CoreIntegrationRegion& other) const {
     return typeid(*this).before(typeid(other));
 }
@@ -474,3 +494,98 @@ void ExactKinematicIntegrationRegion::center(const IntegrationContext& ictx, dou
     center_point[0] = ictx.kT;
     center_point[1] = 0;
 }
+
+
+/**
+ * Where the radial range of a logarithmic map starts, relative to inf,
+ * when the range would otherwise start at zero
+ */
+static const double log_map_lower_fraction = 1e-8;
+
+MappedPolarIntegrationRegion::MappedPolarIntegrationRegion(const size_t dimensions, const Map map) :
+  PolarIntegrationRegion(dimensions), m_map(map) {
+    assert(dimensions == 1 || dimensions == 2);
+}
+
+void MappedPolarIntegrationRegion::fill_min(const Context& ctx, double* min) const {
+    min[0] = 0;
+    if (m_dimensions == 2) {
+        min[1] = 0;
+    }
+}
+
+void MappedPolarIntegrationRegion::fill_max(const Context& ctx, double* max) const {
+    max[0] = 1;
+    if (m_dimensions == 2) {
+        max[1] = 2 * M_PI;
+    }
+}
+
+double MappedPolarIntegrationRegion::jacobian(const IntegrationContext& ictx) const {
+    double a = lower_limit(ictx.ctx);
+    double b = ictx.ctx.inf;
+    double r = this->r(ictx);
+    double drdu;
+    if (m_map == LOGARITHMIC) {
+        drdu = r * log(b / a);
+    }
+    else {
+        double s = scale(ictx);
+        drdu = (b / (s + b) - a / (s + a)) * (s + r) * (s + r) / s;
+    }
+    double jacobian = PolarIntegrationRegion::jacobian(ictx) * drdu;
+    if (m_dimensions == 1) {
+        jacobian *= 2 * M_PI;
+    }
+    checkfinite(jacobian);
+    return jacobian;
+}
+
+void MappedPolarIntegrationRegion::update(IntegrationContext& ictx, const double* values) const {
+    double a = lower_limit(ictx.ctx);
+    double b = ictx.ctx.inf;
+    double u = values[0];
+    double r_and_theta[2];
+    if (m_map == LOGARITHMIC) {
+        r_and_theta[0] = a * exp(u * log(b / a));
+    }
+    else {
+        double s = scale(ictx);
+        double ta = a / (s + a);
+        double t = ta + u * (b / (s + b) - ta);
+        r_and_theta[0] = s * t / (1 - t);
+    }
+    r_and_theta[1] = m_dimensions == 2 ? values[1] : 0;
+    checkfinite(r_and_theta[0]);
+    PolarIntegrationRegion::update(ictx, r_and_theta);
+}
+
+double MappedPolarIntegrationRegion::lower_limit(const Context& ctx) const {
+    // the same ranges as PolarIntegrationRegion and RadialIntegrationRegion
+    double a = m_dimensions == 2 ? ctx.cutoff : 0;
+    if (m_map == LOGARITHMIC && a <= 0) {
+        a = log_map_lower_fraction * ctx.inf;
+    }
+    return a;
+}
+
+double MappedPolarIntegrationRegion::scale(const IntegrationContext& ictx) const {
+    // like xahat(), this can only rely on z having been updated
+    double kT = sqrt(ictx.ctx.pT2) / ictx.z;
+    double s;
+    if (m_map == SATURATION_SCALED) {
+        assert(ictx.ctx.gdist != NULL);
+        double xg = kT / ictx.ctx.sqs * exp(-ictx.ctx.Y);
+        s = sqrt(ictx.ctx.gdist->Qs2(-log(xg)));
+    }
+    else {
+        assert(m_map == KT_SCALED);
+        s = kT;
+    }
+    if (!momentum()) {
+        s = 1 / s;
+    }
+    checkfinite(s);
+    assert(s > 0);
+    return s;
+}
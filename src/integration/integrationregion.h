@@ -42,6 +42,19 @@ public:
      * `max` using information from the `Context`.
      */
     virtual void fill_max(const Context& ctx, const bool xi_preintegrated_term, double* max) const = 0;
+    /**
+     * Narrows the bounds in `min` and `max`, as written by `fill_min()` and
+     * `fill_max()`, to a part of the region that contains every point with
+     * `xg` in (`xg_min`, `xg_max`] under the given scheme. The integrand is
+     * zero at the points cut out, so this doesn't change the integral.
+     *
+     * The default implementation limits `z`, the first variable, using the
+     * fact that `xg` is at least `pT/(z*sqs)*exp(-y)` in every scheme, and
+     * equal to it in the fixed scheme. Regions whose first variable is not
+     * `z` have to override it.
+     */
+    virtual void clip_to_xg_range(const Context& ctx, const bool xi_preintegrated_term, const Modifiers::LongitudinalKinematicsScheme xtarget_scheme,
+                                  const double xg_min, const double xg_max, double* min, double* max) const;
     /**
      * Calculates the jacobian determinant to convert from the variables being
      * integrated over to the variables involved in the calculation.
@@ -147,6 +160,12 @@ public:
      * `max` using information from the `Context`.
      */
     virtual void fill_max(const Context& ctx, const bool xi_preintegrated_term, double* max) const;
+    /**
+     * Narrows the bounds written by `fill_min()` and `fill_max()` to the part
+     * of the core region where `xg` can be in (`xg_min`, `xg_max`]
+     */
+    virtual void clip_to_xg_range(const Context& ctx, const bool xi_preintegrated_term, const Modifiers::LongitudinalKinematicsScheme xtarget_scheme,
+                                  const double xg_min, const double xg_max, double* min, double* max) const;
     /**
      * Calculates the jacobian determinant to convert from the variables being
      * integrated over to the variables involved in the calculation.
@@ -318,9 +337,82 @@ protected:
     virtual void center(const IntegrationContext& ictx, double* center_point) const;
 };
 
+/**
+ * A superclass for integration subregions parametrized in polar
+ * coordinates, or by the radial coordinate only if constructed with
+ * one dimension, where the radial coordinate covers the same range as
+ * in PolarIntegrationRegion or RadialIntegrationRegion but is reached
+ * through a map from a variable `u` in [0, 1]. The map concentrates the
+ * points where the integrands have most of their weight, so that
+ * uniform sampling in `u` does reasonably well before VEGAS adapts,
+ * and MISER or the quasi-random methods do better overall.
+ *
+ * The `LOGARITHMIC` map spaces the points evenly in `ln(r)`. If the
+ * lower end of the range is zero, it starts at `log_map_lower_fraction`
+ * times `inf` instead.
+ *
+ * The `SATURATION_SCALED` and `KT_SCALED` maps take `u` linearly to
+ * `t = r / (s + r)`, which puts half the points below the scale `s`
+ * and falls off as a power of `r` on either side. `s` is the saturation
+ * scale or `kT` for momenta, and the inverse of that for positions.
+ * The saturation scale is evaluated at `xg = kT exp(-Y) / sqs`, which
+ * only depends on `z`, so it's known in update() before the rest of the
+ * kinematics are recalculated.
+ */
+class MappedPolarIntegrationRegion : public PolarIntegrationRegion {
+public:
+    typedef enum {LOGARITHMIC, SATURATION_SCALED, KT_SCALED} Map;
+    virtual void fill_min(const Context& ctx, double* min) const;
+    virtual void fill_max(const Context& ctx, double* max) const;
+    virtual double jacobian(const IntegrationContext& ictx) const;
+    virtual void update(IntegrationContext& ictx, const double* values) const;
+protected:
+    MappedPolarIntegrationRegion(const size_t dimensions, const Map map);
+    /**
+     * Whether the coordinates of this region are momenta rather than
+     * positions, which determines how the scale of the map is set.
+     */
+    virtual bool momentum() const = 0;
+private:
+    const Map m_map;
+    double lower_limit(const Context& ctx) const;
+    double scale(const IntegrationContext& ictx) const;
+};
+
+class LogPolarIntegrationRegion : public MappedPolarIntegrationRegion {
+public:
+    LogPolarIntegrationRegion() : MappedPolarIntegrationRegion(2, LOGARITHMIC) {}
+};
+
+class LogRadialIntegrationRegion : public MappedPolarIntegrationRegion {
+public:
+    LogRadialIntegrationRegion() : MappedPolarIntegrationRegion(1, LOGARITHMIC) {}
+};
+
+class SaturationScaledPolarIntegrationRegion : public MappedPolarIntegrationRegion {
+public:
+    SaturationScaledPolarIntegrationRegion() : MappedPolarIntegrationRegion(2, SATURATION_SCALED) {}
+};
+
+class SaturationScaledRadialIntegrationRegion : public MappedPolarIntegrationRegion {
+public:
+    SaturationScaledRadialIntegrationRegion() : MappedPolarIntegrationRegion(1, SATURATION_SCALED) {}
+};
+
+class KTScaledPolarIntegrationRegion : public MappedPolarIntegrationRegion {
+public:
+    KTScaledPolarIntegrationRegion() : MappedPolarIntegrationRegion(2, KT_SCALED) {}
+};
+
+class KTScaledRadialIntegrationRegion : public MappedPolarIntegrationRegion {
+public:
+    KTScaledRadialIntegrationRegion() : MappedPolarIntegrationRegion(1, KT_SCALED) {}
+};
+
 /* Now we need versions of the cartesian, polar, and radial integration
  * regions for each of the three position coordinates and each
- * of the three momentum coordinates.
+ * of the three momentum coordinates. momentum() is only used by
+ * the mapped regions.
  */
 template<class T>
 class R1IntegrationRegion : public T {
@@ -329,6 +421,7 @@ protected:
     virtual double& y(IntegrationContext& ictx) const { return ictx.xy; }
     virtual double x(const IntegrationContext& ictx) const { return ictx.xx; }
     virtual double y(const IntegrationContext& ictx) const { return ictx.xy; }
+    virtual bool momentum() const { return false; }
 };
 
 template<class T>
@@ -338,6 +431,7 @@ protected:
     virtual double& y(IntegrationContext& ictx) const { return ictx.yy; }
     virtual double x(const IntegrationContext& ictx) const { return ictx.yx; }
     virtual double y(const IntegrationContext& ictx) const { return ictx.yy; }
+    virtual bool momentum() const { return false; }
 };
 
 template<class T>
@@ -347,6 +441,7 @@ protected:
     virtual double& y(IntegrationContext& ictx) const { return ictx.by; }
     virtual double x(const IntegrationContext& ictx) const { return ictx.bx; }
     virtual double y(const IntegrationContext& ictx) const { return ictx.by; }
+    virtual bool momentum() const { return false; }
 };
 
 template<class T>
@@ -357,6 +452,7 @@ protected:
     virtual double x(const IntegrationContext& ictx) const { return ictx.q1x; }
     virtual double y(const IntegrationContext& ictx) const { return ictx.q1y; }
     virtual double r(const IntegrationContext& ictx) const { return sqrt(ictx.q12); }
+    virtual bool momentum() const { return true; }
 };
 
 template<class T>
@@ -367,6 +463,7 @@ protected:
     virtual double x(const IntegrationContext& ictx) const { return ictx.q2x; }
     virtual double y(const IntegrationContext& ictx) const { return ictx.q2y; }
     virtual double r(const IntegrationContext& ictx) const { return sqrt(ictx.q22); }
+    virtual bool momentum() const { return true; }
 };
 
 template<class T>
@@ -377,6 +474,7 @@ protected:
     virtual double x(const IntegrationContext& ictx) const { return ictx.q3x; }
     virtual double y(const IntegrationContext& ictx) const { return ictx.q3y; }
     virtual double r(const IntegrationContext& ictx) const { return sqrt(ictx.q32); }
+    virtual bool momentum() const { return true; }
 };
 
 /* This creates specific subclasses of e.g. CartesianIntegrationRegion
@@ -400,6 +498,12 @@ MAKE_CLASSES(CartesianIntegrationRegion)
 MAKE_CLASSES(PolarIntegrationRegion)
 MAKE_CLASSES(RadialIntegrationRegion)
 MAKE_CLASSES(ExactKinematicIntegrationRegion)
+MAKE_CLASSES(LogPolarIntegrationRegion)
+MAKE_CLASSES(LogRadialIntegrationRegion)
+MAKE_CLASSES(SaturationScaledPolarIntegrationRegion)
+MAKE_CLASSES(SaturationScaledRadialIntegrationRegion)
+MAKE_CLASSES(KTScaledPolarIntegrationRegion)
+MAKE_CLASSES(KTScaledRadialIntegrationRegion)
 
 #undef MAKE_CLASSES
 
@@ -17,8 +17,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <sstream>
 #include <typeinfo>
+#include <pthread.h>
+#include <gsl/gsl_math.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_sys.h>
 #include <gsl/gsl_monte.h>
@@ -26,8 +30,10 @@
 #include <gsl/gsl_monte_vegas.h>
 #include <gsl/gsl_qrng.h>
 #include "integrator.h"
+#include "../hardfactors/hardfactor_parser.h"
 #include "quasimontecarlo.h"
 #include "cubature.h"
+#include "batchmonte.h"
 
 /*
  * Here's the overall "usage map" of the code in this file:
@@ -74,6 +80,155 @@ bool HardFactorType::operator<(const HardFactorType& other) const {
     return false;
 }
 
+bool VegasGridStore::Key::operator<(const Key& other) const {
+    if (hard_factors != other.hard_factors) {
+        return hard_factors < other.hard_factors;
+    }
+    if (*integration_region < *other.integration_region) {
+        return true;
+    }
+    else if (*other.integration_region < *integration_region) {
+        return false;
+    }
+    if (modifiers < other.modifiers) {
+        return true;
+    }
+    else if (other.modifiers < modifiers) {
+        return false;
+    }
+    if (xi_preintegrated_term != other.xi_preintegrated_term) {
+        return other.xi_preintegrated_term;
+    }
+    return outputs < other.outputs;
+}
+
+VegasGridStore::~VegasGridStore() {
+    for (std::map<Key, gsl_monte_vegas_state*>::iterator it = gsl_states.begin(); it != gsl_states.end(); it++) {
+        gsl_monte_vegas_free(it->second);
+    }
+    for (std::map<Key, BatchVegasState*>::iterator it = batch_states.begin(); it != batch_states.end(); it++) {
+        delete it->second;
+    }
+}
+
+gsl_monte_vegas_state* VegasGridStore::gsl_state(const Key& key, const size_t dim, bool* warm) {
+    std::map<Key, gsl_monte_vegas_state*>::iterator it = gsl_states.find(key);
+    if (it != gsl_states.end()) {
+        *warm = true;
+        return it->second;
+    }
+    *warm = false;
+    gsl_monte_vegas_state* s = gsl_monte_vegas_alloc(dim);
+    gsl_states.insert(std::make_pair(key, s));
+    return s;
+}
+
+BatchVegasState* VegasGridStore::batch_state(const Key& key, const size_t dim, const size_t fdim, bool* warm) {
+    std::map<Key, BatchVegasState*>::iterator it = batch_states.find(key);
+    if (it != batch_states.end()) {
+        *warm = true;
+        return it->second;
+    }
+    *warm = false;
+    BatchVegasState* s = new BatchVegasState(dim, fdim);
+    batch_states.insert(std::make_pair(key, s));
+    return s;
+}
+
+
+IntegratorWorkspace::~IntegratorWorkspace() {
+    delete batch_threads;
+    for (std::map<const gsl_rng_type*, gsl_rng*>::iterator it = rngs.begin(); it != rngs.end(); it++) {
+        gsl_rng_free(it->second);
+    }
+    for (std::map<std::pair<const gsl_qrng_type*, size_t>, gsl_qrng*>::iterator it = qrngs.begin(); it != qrngs.end(); it++) {
+        gsl_qrng_free(it->second);
+    }
+    for (std::map<size_t, gsl_monte_vegas_state*>::iterator it = vegas_states.begin(); it != vegas_states.end(); it++) {
+        gsl_monte_vegas_free(it->second);
+    }
+    for (std::map<size_t, gsl_monte_miser_state*>::iterator it = miser_states.begin(); it != miser_states.end(); it++) {
+        gsl_monte_miser_free(it->second);
+    }
+    for (std::map<size_t, quasi_monte_state*>::iterator it = quasi_states.begin(); it != quasi_states.end(); it++) {
+        quasi_monte_free(it->second);
+    }
+    for (std::map<std::pair<size_t, size_t>, BatchVegasState*>::iterator it = batch_vegas_states.begin(); it != batch_vegas_states.end(); it++) {
+        delete it->second;
+    }
+}
+
+gsl_rng* IntegratorWorkspace::rng(const gsl_rng_type* type, const unsigned long seed) {
+    gsl_rng*& r = rngs[type];
+    if (r == NULL) {
+        r = gsl_rng_alloc(type);
+    }
+    gsl_rng_set(r, seed);
+    return r;
+}
+
+BatchThreadPool* IntegratorWorkspace::thread_pool() {
+    if (batch_threads == NULL) {
+        batch_threads = new BatchThreadPool();
+    }
+    return batch_threads;
+}
+
+gsl_qrng* IntegratorWorkspace::qrng(const gsl_qrng_type* type, const size_t dim) {
+    gsl_qrng*& q = qrngs[std::make_pair(type, dim)];
+    if (q == NULL) {
+        q = gsl_qrng_alloc(type, static_cast<unsigned int>(dim));
+    }
+    else {
+        gsl_qrng_init(q);
+    }
+    return q;
+}
+
+gsl_monte_vegas_state* IntegratorWorkspace::vegas_state(const size_t dim) {
+    gsl_monte_vegas_state*& s = vegas_states[dim];
+    if (s == NULL) {
+        s = gsl_monte_vegas_alloc(dim);
+    }
+    else {
+        gsl_monte_vegas_init(s);
+    }
+    return s;
+}
+
+gsl_monte_miser_state* IntegratorWorkspace::miser_state(const size_t dim) {
+    gsl_monte_miser_state*& s = miser_states[dim];
+    if (s == NULL) {
+        s = gsl_monte_miser_alloc(dim);
+    }
+    else {
+        gsl_monte_miser_init(s);
+    }
+    return s;
+}
+
+quasi_monte_state* IntegratorWorkspace::quasi_state(const size_t dim) {
+    quasi_monte_state*& s = quasi_states[dim];
+    if (s == NULL) {
+        s = quasi_monte_alloc(dim);
+    }
+    else {
+        quasi_monte_init(s);
+    }
+    return s;
+}
+
+BatchVegasState* IntegratorWorkspace::batch_vegas_state(const size_t dim, const size_t fdim) {
+    BatchVegasState*& s = batch_vegas_states[std::make_pair(dim, fdim)];
+    if (s == NULL) {
+        s = new BatchVegasState(dim, fdim);
+    }
+    else {
+        s->reset();
+    }
+    return s;
+}
+
 
 Integrator::Integrator(
     const Context& ctx,
@@ -83,19 +238,40 @@ Integrator::Integrator(
     const double xg_max) :
   ictx(ctx, tlctx),
   current_integration_region(NULL),
+  current_terms(NULL),
+  current_term_hard_factors(NULL),
+  current_shared(NULL),
+  current_plan(NULL),
+  hard_factors(hflist),
+  hard_factor_count(hflist.size()),
+  scale_count(ictx.scale_count()),
+  variant_count(ictx.gdist_count() * ictx.scale_count()),
+  outputs(variant_count),
   xi_preintegrated_term(false),
+  budget_scale(1),
+  budget_abserr(ctx.abserr),
+  budget_relerr(ctx.relerr),
+  budget_round(0),
+  random_estimate(false),
   xg_min(xg_min),
   xg_max(xg_max),
   callback(NULL),
   cubature_callback(NULL),
   miser_callback(NULL),
   vegas_callback(NULL),
-  quasi_callback(NULL) {
+  quasi_callback(NULL),
+  batch_callback(NULL),
+  vegas_grids(NULL),
+  workspace(NULL),
+  batch_threads(NULL),
+  profile_table(NULL),
+  evaluation_counter(NULL) {
     assert(hflist.size() > 0);
 #ifndef NDEBUG
     size_t total1 = 0;
 #endif
     // separate the hard factors provided into dipole and quadrupole etc. terms
+    std::map<HardFactorType, HardFactorTermList> unbound_terms;
     for (HardFactorList::const_iterator it = hflist.begin(); it != hflist.end(); it++) {
         const HardFactor* p_hf = *it;
         const HardFactorTerm* const* l_terms = p_hf->get_terms();
@@ -107,12 +283,39 @@ Integrator::Integrator(
             const IntegrationRegion* region = term->get_integration();
             const Modifiers& modifiers = term->get_modifiers();
             const HardFactorType hrt = {*region, modifiers};
-            terms[hrt].push_back(term);
+            unbound_terms[hrt].push_back(term);
+            term_hard_factors[hrt].push_back(it - hflist.begin());
 #ifndef NDEBUG
             total1++;
 #endif
         }
     }
+    for (std::map<HardFactorType, HardFactorTermList>::const_iterator it = unbound_terms.begin(); it != unbound_terms.end(); it++) {
+        SharedSubexpressions* shared = SharedSubexpressions::create(it->second, ictx);
+        BoundHardFactorTermList& bound = terms[it->first];
+        for (HardFactorTermList::const_iterator tit = it->second.begin(); tit != it->second.end(); tit++) {
+            bound.push_back(shared == NULL ? (*tit)->bind(ictx) : shared->bind(**tit));
+        }
+        if (shared != NULL) {
+            shared_subexpressions[it->first] = shared;
+        }
+        // leading order terms only have Fd
+        TermPlan& plan = plans[it->first];
+        const std::vector<size_t>& indices = term_hard_factors[it->first];
+        for (size_t i = 0; i < bound.size(); i++) {
+            const HardFactorTerm& term = bound[i]->term;
+            const PlannedTerm planned = {bound[i], indices[i]};
+            if (term.get_order() != HardFactor::LO && term.has_Fs()) {
+                plan.Fs.push_back(planned);
+            }
+            if (term.get_order() != HardFactor::LO && term.has_Fn()) {
+                plan.Fn.push_back(planned);
+            }
+            if (term.has_Fd()) {
+                plan.Fd.push_back(planned);
+            }
+        }
+    }
 #ifndef NDEBUG
     size_t total2 = 0;
     for (HardFactorTypeMap::iterator it = terms.begin(); it != terms.end(); it++) {
@@ -123,6 +326,14 @@ Integrator::Integrator(
 }
 
 Integrator::~Integrator() {
+    for (HardFactorTypeMap::iterator it = terms.begin(); it != terms.end(); it++) {
+        for (BoundHardFactorTermList::iterator tit = it->second.begin(); tit != it->second.end(); tit++) {
+            delete *tit;
+        }
+    }
+    for (std::map<HardFactorType, SharedSubexpressions*>::iterator it = shared_subexpressions.begin(); it != shared_subexpressions.end(); it++) {
+        delete it->second;
+    }
 }
 
 static inline bool xg_in_range(const double xg, const double xg_min, const double xg_max) {
@@ -130,15 +341,30 @@ static inline bool xg_in_range(const double xg, const double xg_min, const doubl
     return xg > xg_min && xg <= xg_max;
 }
 
+/**
+ * Adds `factor` times the real and imaginary parts of `f` of each term in `list`
+ * to `real` and `imag`
+ */
+static inline void add_terms(const PlannedTermList& list, const TermFunction f, const double factor, double* real, double* imag) {
+    double t_real, t_imag;             // t for temporary
+    for (PlannedTermList::const_iterator it = list.begin(); it != list.end(); it++) {
+        (it->term->*f)(&t_real, &t_imag);
+        checkfinite(t_real);
+        checkfinite(t_imag);
+        *real += t_real * factor;
+        *imag += t_imag * factor;
+    }
+}
+
 void Integrator::evaluate_integrand(double* real, double* imag) {
     if (!xg_in_range(ictx.xg, xg_min, xg_max)) {
         *real = *imag = 0.0;
         return;
     }
-    double t_real, t_imag;             // t for temporary
-    HardFactorType current_type = {*current_integration_region, current_modifiers};
-    HardFactorTermList& current_terms = terms[current_type];
-    assert(current_terms.size() > 0);
+    assert(current_plan != NULL);
+    if (current_shared != NULL) {
+        current_shared->evaluate(pass_functions());
+    }
     if (xi_preintegrated_term) {
         // This evaluates the [Fs(1) ln(1 - ximin) + Fd(1)] term
         assert(ictx.xi == 1.0);
@@ -146,19 +372,8 @@ void Integrator::evaluate_integrand(double* real, double* imag) {
         double effective_xi_min = current_integration_region->m_core_region.effective_xi_min(ictx);
         double log_factor = effective_xi_min == 0 ? 0 : log(1 - effective_xi_min);
         checkfinite(log_factor);
-        for (HardFactorTermList::const_iterator it = current_terms.begin(); it != current_terms.end(); it++) {
-            const HardFactorTerm* h = (*it);
-            h->Fs(&ictx, &t_real, &t_imag);
-            checkfinite(t_real);
-            checkfinite(t_imag);
-            l_real += t_real * log_factor;
-            l_imag += t_imag * log_factor;
-            h->Fd(&ictx, &t_real, &t_imag);
-            checkfinite(t_real);
-            checkfinite(t_imag);
-            l_real += t_real;
-            l_imag += t_imag;
-        }
+        add_terms(current_plan->Fs, &BoundHardFactorTerm::Fs, log_factor, &l_real, &l_imag);
+        add_terms(current_plan->Fd, &BoundHardFactorTerm::Fd, 1.0, &l_real, &l_imag);
         if (callback) {
             callback(&ictx, l_real, l_imag);
         }
@@ -170,70 +385,20 @@ void Integrator::evaluate_integrand(double* real, double* imag) {
         double s_real = 0.0, s_imag = 0.0; // s for "subtracted"
         double xi_factor = 1.0 / (1 - ictx.xi);
         // This branch evaluates the [Fs(xi) - Fs(1)] / (1 - xi) + Fn(xi) terms
-        for (HardFactorTermList::const_iterator it = current_terms.begin(); it != current_terms.end(); it++) {
-            const HardFactorTerm* h = (*it);
-            if (ictx.ctx.exact_kinematics) {
-                // double check that there are no mixed-order hard factors when using exact kinematics
-                assert(h->get_order() == HardFactor::LO || h->get_order() == HardFactor::NLO);
-            }
-
-            h->Fs(&ictx, &t_real, &t_imag);
-            checkfinite(t_real);
-            checkfinite(t_imag);
-            if (h->get_order() == HardFactor::LO) {
-                /* Leading order hard factors are supposed to only have Fd, not Fs or Fn.
-                * If this assumption is violated, it could break things.
-                */
-                assert(t_real == 0);
-                assert(t_imag == 0);
-            }
-            else {
-                /* For leading order hard factors, Fs and Fn should give zero, so we
-                * just need to multiply by something finite, so that
-                * when multiplied by zero it gives zero rather than nan.
-                */
-                l_real += t_real * xi_factor;
-                l_imag += t_imag * xi_factor;
-            }
-
-            h->Fn(&ictx, &t_real, &t_imag);
-            checkfinite(t_real);
-            checkfinite(t_imag);
-            if (h->get_order() == HardFactor::LO) {
-                assert(t_real == 0);
-                assert(t_imag == 0);
-            }
-            else {
-                l_real += t_real;
-                l_imag += t_imag;
-            }
-        }
+        add_terms(current_plan->Fs, &BoundHardFactorTerm::Fs, xi_factor, &l_real, &l_imag);
+        add_terms(current_plan->Fn, &BoundHardFactorTerm::Fn, 1.0, &l_real, &l_imag);
         if (callback) {
             callback(&ictx, l_real, l_imag);
         }
-        ictx.xi = 1;
-        /* TODO replace this with the same thing used below in cubature_wrapper */
-        ictx.recalculate_everything(current_modifiers);
-        for (HardFactorTermList::const_iterator it = current_terms.begin(); it != current_terms.end(); it++) {
-            const HardFactorTerm* h = (*it);
-            if (h->get_order() == HardFactor::LO) {
-                // as above
-                xi_factor = 1.0;
-            }
-            else {
-                checkfinite(xi_factor);
-            }
-            h->Fs(&ictx, &t_real, &t_imag);
-            checkfinite(t_real);
-            checkfinite(t_imag);
-            if (h->get_order() == HardFactor::LO) {
-                assert(t_real == 0);
-                assert(t_imag == 0);
-            }
-            else {
-                s_real += t_real * xi_factor;
-                s_imag += t_imag * xi_factor;
+        if (!current_plan->Fs.empty()) {
+            checkfinite(xi_factor);
+            ictx.xi = 1;
+            // only the parts that depend on xi are redone
+            ictx.recalculate(current_modifiers);
+            if (current_shared != NULL) {
+                current_shared->evaluate(SharedSubexpressions::FS);
             }
+            add_terms(current_plan->Fs, &BoundHardFactorTerm::Fs, xi_factor, &s_real, &s_imag);
         }
         if (callback) {
             callback(&ictx, -s_real, -s_imag);
@@ -255,7 +420,15 @@ void Integrator::evaluate_integrand(double* real, double* imag) {
 void cubature_wrapper(unsigned int ncoords, const double* coordinates, void* closure, unsigned int nresults, double* results) {
     double real, imag, jacobian;
     Integrator* integrator = static_cast<Integrator*>(closure);
-    integrator->current_integration_region->update(integrator->ictx, integrator->xi_preintegrated_term, coordinates);
+    {
+        PROFILE_SCOPE(REGION_UPDATE);
+        integrator->current_integration_region->update(integrator->ictx, integrator->xi_preintegrated_term, coordinates);
+    }
+    // xg only needs the longitudinal variables, so points outside the window are dropped before the rest of the work
+    if (!xg_in_range(integrator->ictx.upcoming_xg(integrator->current_modifiers.xtarget_scheme), integrator->xg_min, integrator->xg_max)) {
+        std::fill(results, results + nresults, 0.0);
+        return;
+    }
     /* TODO put something here which implements the following pseudocode:
      *
      * if (current_integration_region->position_like) {
@@ -265,7 +438,7 @@ void cubature_wrapper(unsigned int ncoords, const double* coordinates, void* clo
      *     ictx.recalculate_everything_from_momentum(current_integration_region->momentum_dimensions, current_modifiers);
      * }
      */
-    integrator->ictx.recalculate_everything(integrator->current_modifiers);
+    integrator->ictx.recalculate(integrator->current_modifiers);
     // computing the Jacobian here allows the method to access the untransformed coordinates
     jacobian = integrator->current_integration_region->jacobian(integrator->ictx, integrator->xi_preintegrated_term);
     integrator->evaluate_integrand(&real, &imag);
@@ -276,6 +449,379 @@ void cubature_wrapper(unsigned int ncoords, const double* coordinates, void* clo
     }
 }
 
+unsigned int Integrator::pass_functions() const {
+    return SharedSubexpressions::FS | (xi_preintegrated_term ? SharedSubexpressions::FD : SharedSubexpressions::FN);
+}
+
+void Integrator::store_shared(const size_t i, std::vector<double>& storage, const unsigned int functions) {
+    if (current_shared != NULL) {
+        current_shared->evaluate(functions);
+        std::copy(current_shared->values(), current_shared->values() + current_shared->size(), storage.begin() + i * current_shared->size());
+    }
+}
+
+void Integrator::load_shared(const size_t i, const std::vector<double>& storage) {
+    if (current_shared != NULL) {
+        current_shared->load(&storage[i * current_shared->size()]);
+    }
+}
+
+void Integrator::add_terms_batch(const PlannedTermList& list, const TermFunction f, const IntegrationContextBatch& points, const std::vector<double>& shared,
+                                 const double* factor, const size_t npt, const size_t variant_index, double* results, const size_t stride) {
+    double t_real, t_imag;
+    for (PlannedTermList::const_iterator it = list.begin(); it != list.end(); it++) {
+        const size_t output = (outputs == variant_count ? 0 : it->hard_factor) * variant_count + variant_index;
+        assert(output < outputs);
+        double* term_results = results + output * stride;
+        for (size_t i = 0; i < npt; i++) {
+            if (!batch_in_range[i]) {
+                continue;
+            }
+            points.load(i, ictx);
+            load_shared(i, shared);
+            (it->term->*f)(&t_real, &t_imag);
+            checkfinite(t_real);
+            checkfinite(t_imag);
+            term_results[i] += factor == NULL ? t_real : t_real * factor[i];
+        }
+    }
+}
+
+void Integrator::evaluate_batch(const size_t ncoords, const size_t npt, const double* coordinates, double* results, const size_t stride) {
+    assert(current_plan != NULL);
+    assert(stride >= npt);
+    if (batch.size() < npt) {
+        batch.resize(npt);
+        subtraction_batch.resize(npt);
+        batch_jacobian.resize(npt);
+        batch_factor.resize(npt);
+        batch_in_range.resize(npt);
+    }
+    batch_subtraction.assign(outputs * npt, 0.0);
+    const size_t nshared = current_shared == NULL ? 0 : current_shared->size();
+    if (batch_shared.size() < nshared * npt) {
+        batch_shared.resize(nshared * npt);
+        subtraction_batch_shared.resize(nshared * npt);
+    }
+    for (size_t k = 0; k < outputs; k++) {
+        std::fill(results + k * stride, results + k * stride + npt, 0.0);
+    }
+
+    /* First pass: compute the kinematic variables at each point. This does
+     * exactly the same sequence of updates to ictx as calling cubature_wrapper()
+     * at each point in turn, so the results are identical.
+     */
+    for (size_t i = 0; i < npt; i++) {
+        {
+            PROFILE_SCOPE(REGION_UPDATE);
+            current_integration_region->update(ictx, xi_preintegrated_term, coordinates + i * ncoords);
+        }
+        batch_in_range[i] = xg_in_range(ictx.upcoming_xg(current_modifiers.xtarget_scheme), xg_min, xg_max);
+        if (!batch_in_range[i]) {
+            batch_jacobian[i] = 0;
+            continue;
+        }
+        ictx.recalculate(current_modifiers);
+        batch_jacobian[i] = current_integration_region->jacobian(ictx, xi_preintegrated_term);
+        if (xi_preintegrated_term) {
+            assert(ictx.xi == 1.0);
+            double effective_xi_min = current_integration_region->m_core_region.effective_xi_min(ictx);
+            batch_factor[i] = effective_xi_min == 0 ? 0 : log(1 - effective_xi_min);
+            checkfinite(batch_factor[i]);
+            batch.store(i, ictx);
+            store_shared(i, batch_shared, pass_functions());
+        }
+        else {
+            batch_factor[i] = 1.0 / (1 - ictx.xi);
+            batch.store(i, ictx);
+            store_shared(i, batch_shared, pass_functions());
+            if (!current_plan->Fs.empty()) {
+                checkfinite(batch_factor[i]);
+                ictx.xi = 1;
+                ictx.recalculate(current_modifiers);
+                subtraction_batch.store(i, ictx);
+                store_shared(i, subtraction_batch_shared, SharedSubexpressions::FS);
+            }
+        }
+    }
+
+    /* Second pass: evaluate each term at all the points, for each variant
+     * in turn. Only the variables that depend on the gluon distribution or
+     * the scales change from one to the next.
+     */
+    add_plan_batch(npt, 0, results, stride);
+    for (size_t v = 1; v < variant_count; v++) {
+        recalculate_batch_variant(npt, v);
+        add_plan_batch(npt, v, results, stride);
+    }
+    if (variant_count > 1) {
+        ictx.select_gdist(0);
+        ictx.select_scale(0);
+    }
+
+    for (size_t k = 0; k < outputs; k++) {
+        for (size_t i = 0; i < npt; i++) {
+            double real = results[k * stride + i] - batch_subtraction[k * npt + i];
+            checkfinite(real);
+            results[k * stride + i] = real * batch_jacobian[i];
+        }
+    }
+}
+
+void Integrator::add_plan_batch(const size_t npt, const size_t variant_index, double* results, const size_t stride) {
+    // the sums for each point are accumulated in the same order as in evaluate_integrand()
+    if (xi_preintegrated_term) {
+        add_terms_batch(current_plan->Fs, &BoundHardFactorTerm::Fs, batch, batch_shared, &batch_factor[0], npt, variant_index, results, stride);
+        add_terms_batch(current_plan->Fd, &BoundHardFactorTerm::Fd, batch, batch_shared, NULL, npt, variant_index, results, stride);
+    }
+    else {
+        add_terms_batch(current_plan->Fs, &BoundHardFactorTerm::Fs, batch, batch_shared, &batch_factor[0], npt, variant_index, results, stride);
+        add_terms_batch(current_plan->Fn, &BoundHardFactorTerm::Fn, batch, batch_shared, NULL, npt, variant_index, results, stride);
+        add_terms_batch(current_plan->Fs, &BoundHardFactorTerm::Fs, subtraction_batch, subtraction_batch_shared, &batch_factor[0], npt, variant_index, &batch_subtraction[0], npt);
+    }
+}
+
+void Integrator::recalculate_batch_variant(const size_t npt, const size_t variant_index) {
+    assert(variant_index > 0);
+    // the batch holds the variables of the previous variant
+    const size_t gdist_index = variant_index / scale_count, scale_index = variant_index % scale_count;
+    const bool gdist_changed = gdist_index != (variant_index - 1) / scale_count;
+    const bool scale_changed = scale_index != (variant_index - 1) % scale_count;
+    ictx.select_gdist(gdist_index);
+    ictx.select_scale(scale_index);
+    const bool subtraction = !xi_preintegrated_term && !current_plan->Fs.empty();
+    for (size_t i = 0; i < npt; i++) {
+        if (!batch_in_range[i]) {
+            continue;
+        }
+        batch.load(i, ictx);
+        recalculate_variant(gdist_changed, scale_changed);
+        batch.store(i, ictx);
+        store_shared(i, batch_shared, pass_functions());
+        if (subtraction) {
+            subtraction_batch.load(i, ictx);
+            recalculate_variant(gdist_changed, scale_changed);
+            subtraction_batch.store(i, ictx);
+            store_shared(i, subtraction_batch_shared, SharedSubexpressions::FS);
+        }
+    }
+}
+
+void Integrator::recalculate_variant(const bool gdist_changed, const bool scale_changed) {
+    if (gdist_changed) {
+        ictx.recalculate_gdist();
+    }
+    if (scale_changed) {
+        ictx.recalculate_scale(current_modifiers);
+    }
+}
+
+/**
+ * The smallest number of points worth handing to a helper thread; with
+ * fewer than this, waking the thread costs more than it saves.
+ */
+static const size_t min_points_per_slice = 16;
+
+/**
+ * A contiguous part of a batch of points, to be evaluated by one Integrator.
+ */
+struct BatchSlice {
+    Integrator* integrator;
+    size_t ncoords;
+    size_t npt;
+    const double* coordinates;
+    double* results;
+    /** The distance between components in `results` */
+    size_t stride;
+    /** Whether the evaluation threw an exception */
+    bool failed;
+    /** The message of the exception, if any */
+    std::string message;
+    /** The profile counters for the thread evaluating the slice */
+    profile::Counters* counters;
+};
+
+/**
+ * Evaluates one slice of a batch. This is the entry point of the helper
+ * threads, so it can't let any exceptions escape.
+ */
+static void* evaluate_batch_slice(void* closure) {
+    BatchSlice* slice = static_cast<BatchSlice*>(closure);
+    PROFILE_ATTACH(slice->counters);
+    try {
+        slice->integrator->evaluate_batch(slice->ncoords, slice->npt, slice->coordinates, slice->results, slice->stride);
+    }
+    catch (const std::exception& e) {
+        slice->failed = true;
+        slice->message = e.what();
+    }
+    catch (const char* c) {
+        slice->failed = true;
+        slice->message = c;
+    }
+    catch (...) {
+        slice->failed = true;
+        slice->message = "Unknown error while evaluating a batch";
+    }
+    return NULL;
+}
+
+BatchThreadPool::BatchThreadPool() : slices(NULL), nslices(0), generation(0), pending(0), stopping(false) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&batch_posted, NULL);
+    pthread_cond_init(&batch_done, NULL);
+}
+
+BatchThreadPool::~BatchThreadPool() {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&batch_posted);
+    pthread_mutex_unlock(&mutex);
+    for (std::vector<Worker*>::iterator it = workers.begin(); it != workers.end(); it++) {
+        pthread_join((*it)->thread, NULL);
+        delete *it;
+    }
+    pthread_cond_destroy(&batch_done);
+    pthread_cond_destroy(&batch_posted);
+    pthread_mutex_destroy(&mutex);
+}
+
+void* BatchThreadPool::work(void* closure) {
+    Worker* worker = static_cast<Worker*>(closure);
+    BatchThreadPool* pool = worker->pool;
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->stopping && worker->generation == pool->generation) {
+            pthread_cond_wait(&pool->batch_posted, &pool->mutex);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        worker->generation = pool->generation;
+        if (worker->index + 1 >= pool->nslices) {
+            // this batch has fewer slices than there are threads
+            continue;
+        }
+        BatchSlice* slice = &pool->slices[worker->index + 1];
+        pthread_mutex_unlock(&pool->mutex);
+        evaluate_batch_slice(slice);
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->batch_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+void BatchThreadPool::run(BatchSlice* slices, const size_t nslices) {
+    assert(nslices > 0);
+    // the threads are only started here, so none of them is waiting on the mutex yet
+    while (workers.size() + 1 < nslices) {
+        Worker* worker = new Worker;
+        worker->pool = this;
+        worker->index = workers.size();
+        worker->generation = generation;
+        if (pthread_create(&worker->thread, NULL, work, worker) != 0) {
+            delete worker;
+            break;
+        }
+        workers.push_back(worker);
+    }
+    const size_t threaded = std::min(workers.size(), nslices - 1);
+
+    pthread_mutex_lock(&mutex);
+    this->slices = slices;
+    this->nslices = nslices;
+    pending = threaded;
+    generation++;
+    pthread_cond_broadcast(&batch_posted);
+    pthread_mutex_unlock(&mutex);
+
+    evaluate_batch_slice(&slices[0]);
+    for (size_t s = threaded + 1; s < nslices; s++) {
+        // couldn't start a thread for these, so do the work here
+        evaluate_batch_slice(&slices[s]);
+    }
+
+    pthread_mutex_lock(&mutex);
+    while (pending > 0) {
+        pthread_cond_wait(&batch_done, &mutex);
+    }
+    this->slices = NULL;
+    this->nslices = 0;
+    pthread_mutex_unlock(&mutex);
+}
+
+void Integrator::evaluate_batch_parallel(const size_t ncoords, const size_t npt, const double* coordinates, double* results) {
+    const size_t nslices = GSL_MIN(helpers.size() + 1, npt / min_points_per_slice);
+    if (nslices <= 1) {
+        evaluate_batch(ncoords, npt, coordinates, results, npt);
+        return;
+    }
+
+    std::vector<BatchSlice> slices(nslices);
+    // the helpers count into their own counters, which are added to this thread's at the end
+    std::vector<profile::Counters> slice_counters(profile::thread_counters ? nslices : 0);
+    size_t start = 0;
+    for (size_t s = 0; s < nslices; s++) {
+        BatchSlice& slice = slices[s];
+        slice.integrator = s == 0 ? this : helpers[s - 1];
+        slice.ncoords = ncoords;
+        // spread the remainder over the first few slices
+        slice.npt = npt / nslices + (s < npt % nslices ? 1 : 0);
+        slice.coordinates = coordinates + start * ncoords;
+        slice.results = results + start;
+        slice.stride = npt;
+        slice.failed = false;
+        slice.counters = s == 0 ? profile::thread_counters : slice_counters.empty() ? NULL : &slice_counters[s];
+        start += slice.npt;
+    }
+    assert(start == npt);
+
+    if (batch_threads != NULL) {
+        batch_threads->run(&slices[0], nslices);
+    }
+    else {
+        // outside of an integration, the threads only last for this batch
+        BatchThreadPool threads;
+        threads.run(&slices[0], nslices);
+    }
+    for (size_t s = 1; s < slice_counters.size(); s++) {
+        profile::thread_counters->merge(slice_counters[s]);
+    }
+    for (size_t s = 0; s < nslices; s++) {
+        if (slices[s].failed) {
+            throw HelperThreadException(slices[s].message);
+        }
+    }
+}
+
+/**
+ * A vectorized version of cubature_wrapper(), to be passed to adapt_integrate_v()
+ * and the batched Monte Carlo routines.
+ *
+ * This evaluates all the points with Integrator::evaluate_batch_parallel(). If there
+ * is a callback, which expects to see the IntegrationContext at each point
+ * as it is evaluated, it just calls cubature_wrapper() for each point instead,
+ * unless the hard factors are being integrated separately.
+ */
+void cubature_wrapper_v(unsigned int ncoords, unsigned int npt, const double* coordinates, void* closure, unsigned int nresults, double* results) {
+    Integrator* integrator = static_cast<Integrator*>(closure);
+    assert(nresults == integrator->outputs);
+    PROFILE_SCOPE(INTEGRAND);
+    PROFILE_EVALUATIONS(npt);
+    integrator->count_evaluations(npt);
+    if (integrator->callback && integrator->outputs == 1) {
+        for (unsigned int i = 0; i < npt; i++) {
+            cubature_wrapper(ncoords, coordinates + i * ncoords, closure, nresults, results + i);
+        }
+    }
+    else {
+        integrator->evaluate_batch_parallel(ncoords, npt, coordinates, results);
+    }
+}
+
 /**
  * A wrapper function that can be passed to the GSL integration code.
  *
@@ -285,6 +831,9 @@ void cubature_wrapper(unsigned int ncoords, const double* coordinates, void* clo
  */
 double gsl_monte_wrapper(double* coordinates, size_t ncoords, void* closure) {
     double real;
+    PROFILE_SCOPE(INTEGRAND);
+    PROFILE_EVALUATIONS(1);
+    static_cast<Integrator*>(closure)->count_evaluations(1);
     // this does basically the same thing as cubature_wrapper but with a different signature
     cubature_wrapper(static_cast<unsigned int>(ncoords),  coordinates,  closure, 1, &real);
     return real;
@@ -302,24 +851,22 @@ double gsl_monte_wrapper(double* coordinates, size_t ncoords, void* closure) {
  * @param[out] p_abserr the error bound
  * @param iterations the number of function evaluations
  * @param rng the random number generator
+ * @param s the MISER state, with the default parameters
  * @param callback a callback to call when the integration is done
  */
 void miser_integrate(double (*func)(double*, size_t, void*), size_t dim, void* closure, double* min, double* max, double* p_result, double* p_abserr,
-               size_t iterations, gsl_rng* rng, void (*callback)(double*, double*, gsl_monte_miser_state*)) {
+               size_t iterations, gsl_rng* rng, gsl_monte_miser_state* s, void (*callback)(double*, double*, gsl_monte_miser_state*)) {
     gsl_monte_function f;
     f.f = func;
     f.dim = dim;
     f.params = closure;
 
-    gsl_monte_miser_state* s = gsl_monte_miser_alloc(dim);
     gsl_monte_miser_integrate(&f, min, max, dim, iterations, rng, s, p_result, p_abserr);
     checkfinite(*p_result);
     checkfinite(*p_abserr);
     if (callback) {
         (*callback)(p_result, p_abserr, s);
     }
-    gsl_monte_miser_free(s);
-    s = NULL;
 }
 
 /**
@@ -334,17 +881,32 @@ void miser_integrate(double (*func)(double*, size_t, void*), size_t dim, void* c
  * @param[out] p_abserr the error bound
  * @param initial_iterations the number of function evaluations to use when first refining the grid
  * @param incremental_iterations the number of function evaluations to use in subsequent steps
+ * @param max_refinements the largest number of subsequent steps, or 0 for no limit
  * @param rng the random number generator
+ * @param s the VEGAS state, either new or left by a previous integration in the same number of dimensions
+ * @param warm whether `s` was left by a previous integration, whose grid to start from
  * @param callback a callback to call when the integration is done
  */
 void vegas_integrate(double (*func)(double*, size_t, void*), size_t dim, void* closure, double* min, double* max, double* p_result, double* p_abserr,
-               size_t initial_iterations, size_t incremental_iterations, gsl_rng* rng, void (*callback)(double*, double*, gsl_monte_vegas_state*)) {
+               size_t initial_iterations, size_t incremental_iterations, size_t max_refinements, gsl_rng* rng, gsl_monte_vegas_state* s, bool warm,
+               void (*callback)(double*, double*, gsl_monte_vegas_state*)) {
     gsl_monte_function f;
     f.f = func;
     f.dim = dim;
     f.params = closure;
 
-    gsl_monte_vegas_state* s = gsl_monte_vegas_alloc(dim);
+    if (warm) {
+        // GSL only sets the size of the region when it initializes the grid,
+        // which starts from stage 0; at stage 1 it keeps the grid (measured
+        // in units of the size of the region) and discards the old results
+        assert(s->dim == dim);
+        s->stage = 1;
+        s->vol = 1;
+        for (size_t j = 0; j < dim; j++) {
+            s->delx[j] = max[j] - min[j];
+            s->vol *= s->delx[j];
+        }
+    }
     gsl_monte_vegas_integrate(&f, min, max, dim, initial_iterations, rng, s, p_result, p_abserr);
     checkfinite(*p_result);
     checkfinite(*p_abserr);
@@ -352,6 +914,7 @@ void vegas_integrate(double (*func)(double*, size_t, void*), size_t dim, void* c
         (*callback)(p_result, p_abserr, s);
     }
     if (*p_abserr != 0) {
+        size_t refinements = 0;
         do {
             gsl_monte_vegas_integrate(&f, min, max, dim, incremental_iterations, rng, s, p_result, p_abserr);
             checkfinite(*p_result);
@@ -359,10 +922,8 @@ void vegas_integrate(double (*func)(double*, size_t, void*), size_t dim, void* c
             if (callback) {
                 (*callback)(p_result, p_abserr, s);
             }
-        } while (*p_abserr > 0 && fabs(gsl_monte_vegas_chisq(s) - 1.0) > 0.2);
+        } while (*p_abserr > 0 && fabs(gsl_monte_vegas_chisq(s) - 1.0) > 0.2 && (max_refinements == 0 || ++refinements < max_refinements));
     }
-    gsl_monte_vegas_free(s);
-    s = NULL;
 }
 
 /**
@@ -378,38 +939,106 @@ void vegas_integrate(double (*func)(double*, size_t, void*), size_t dim, void* c
  * @param iterations the maximum number of function evaluations
  * @param abserr the absolute error at which to stop
  * @param relerr the relative error at which to stop
- * @param rng the random number generator
+ * @param qrng the quasirandom number generator
+ * @param s the quasi Monte Carlo state, in its initial state
  * @param callback a callback to call when the integration is done
  */
 void quasi_integrate(double (*func)(double*, size_t, void*), size_t dim, void* closure, double* min, double* max, double* p_result, double* p_abserr,
-               size_t iterations, double relerr, double abserr, gsl_qrng* qrng, void (*callback)(double*, double*, quasi_monte_state*)) {
+               size_t iterations, double relerr, double abserr, gsl_qrng* qrng, quasi_monte_state* s, void (*callback)(double*, double*, quasi_monte_state*)) {
     gsl_monte_function f;
     f.f = func;
     f.dim = dim;
     f.params = closure;
 
-    quasi_monte_state* s = quasi_monte_alloc(dim);
     quasi_monte_integrate(&f, min, max, dim, iterations, relerr, abserr, qrng, s, p_result, p_abserr);
     checkfinite(*p_result);
     checkfinite(*p_abserr);
     if (callback) {
         (*callback)(p_result, p_abserr, s);
     }
-    quasi_monte_free(s);
-    s = NULL;
 }
 
-void cubature_integrate(integrand func, size_t dim, void* closure, double* min, double* max, double* p_result, double* p_abserr,
-                        size_t iterations, double relerr, double abserr, void (*callback)(double*, double*)) {
-    adapt_integrate(1, func, closure, static_cast<unsigned int>(dim), min, max, static_cast<unsigned int>(iterations), abserr, relerr, p_result, p_abserr);
-    checkfinite(*p_result);
-    checkfinite(*p_abserr);
-    if (callback) {
-        (*callback)(p_result, p_abserr);
+/**
+ * Checks that each of the `fdim` components of a result is finite, and
+ * passes each to the callback, if there is one.
+ */
+static void check_results(const size_t fdim, double* p_result, double* p_abserr, void (*callback)(double*, double*)) {
+    for (size_t k = 0; k < fdim; k++) {
+        checkfinite(p_result[k]);
+        checkfinite(p_abserr[k]);
+        if (callback) {
+            (*callback)(p_result + k, p_abserr + k);
+        }
+    }
+}
+
+static bool any_nonzero(const size_t n, const double* values) {
+    for (size_t k = 0; k < n; k++) {
+        if (values[k] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * A wrapper function that calls the batched VEGAS routine, with the same
+ * stopping criterion as vegas_integrate().
+ *
+ * @param func the vectorized integrand
+ * @param dim the number of dimensions it's being integrated over
+ * @param fdim the number of components of the integrand
+ * @param closure something to be passed to the integrand as its last argument
+ * @param min the lower bounds of the integration region
+ * @param max the upper bounds of the integration region
+ * @param[out] p_result the result
+ * @param[out] p_abserr the error bound
+ * @param initial_iterations the number of function evaluations to use when first refining the grid
+ * @param incremental_iterations the number of function evaluations to use in subsequent steps
+ * @param max_refinements the largest number of subsequent steps, or 0 for no limit
+ * @param rng the random number generator
+ * @param s the VEGAS state, whose grid to start from
+ * @param callback a callback to call when each step is done
+ */
+void vegas_integrate_v(integrand_v func, size_t dim, size_t fdim, void* closure, double* min, double* max, double* p_result, double* p_abserr,
+               size_t initial_iterations, size_t incremental_iterations, size_t max_refinements, gsl_rng* rng, BatchVegasState* s,
+               void (*callback)(double*, double*)) {
+    batch_vegas_integrate(func, dim, fdim, closure, min, max, p_result, p_abserr, initial_iterations, rng, s);
+    check_results(fdim, p_result, p_abserr, callback);
+    if (any_nonzero(fdim, p_abserr)) {
+        size_t refinements = 0;
+        do {
+            batch_vegas_integrate(func, dim, fdim, closure, min, max, p_result, p_abserr, incremental_iterations, rng, s);
+            check_results(fdim, p_result, p_abserr, callback);
+        } while (any_nonzero(fdim, p_abserr) && fabs(s->chisq() - 1.0) > 0.2 && (max_refinements == 0 || ++refinements < max_refinements));
     }
 }
 
+/**
+ * A wrapper function that calls the adaptive cubature routine.
+ *
+ * @param min_regions the smallest number of regions to subdivide at each step
+ */
+void cubature_integrate(integrand_v func, size_t dim, size_t fdim, void* closure, double* min, double* max, double* p_result, double* p_abserr,
+                        size_t iterations, double relerr, double abserr, size_t min_regions, void (*callback)(double*, double*)) {
+    adapt_integrate_v_batch(static_cast<unsigned int>(fdim), func, closure, static_cast<unsigned int>(dim), min, max, static_cast<unsigned int>(iterations), abserr, relerr,
+                            static_cast<unsigned int>(min_regions), p_result, p_abserr);
+    check_results(fdim, p_result, p_abserr, callback);
+}
+
+/** Sets a pointer for the length of a scope, and clears it at the end, even on an exception */
+struct BatchThreadsScope {
+    BatchThreadPool*& threads;
+    BatchThreadsScope(BatchThreadPool*& threads, BatchThreadPool* value) : threads(threads) {
+        threads = value;
+    }
+    ~BatchThreadsScope() {
+        threads = NULL;
+    }
+};
+
 void Integrator::integrate_impl(double* result, double* error) {
+    PROFILE_SCOPE(INTEGRATION);
     // it should already have been checked that there is at least one term of the appropriate type
     // and the type should be set appropriately
     size_t dimensions = current_integration_region->dimensions(xi_preintegrated_term);
@@ -419,65 +1048,302 @@ void Integrator::integrate_impl(double* result, double* error) {
     assert(sizeof(max) / sizeof(max[0]) >= dimensions);
     current_integration_region->fill_min(ictx.ctx, xi_preintegrated_term, min);
     current_integration_region->fill_max(ictx.ctx, xi_preintegrated_term, max);
-    switch (dimensions) {
-        case 1:
-        case 2:
-            cubature_integrate(cubature_wrapper, dimensions, this, min, max, result, error, ictx.ctx.cubature_iterations, ictx.ctx.relerr, ictx.ctx.abserr, cubature_callback);
-            break;
-        default:
-            if (ictx.ctx.strategy == MC_QUASI) {
-                gsl_qrng* qrng = gsl_qrng_alloc(ictx.ctx.quasirandom_generator_type, static_cast<unsigned int>(dimensions));
-                quasi_integrate(gsl_monte_wrapper, dimensions, this, min, max, result, error, ictx.ctx.quasi_iterations, ictx.ctx.relerr, ictx.ctx.abserr, qrng, quasi_callback);
-                gsl_qrng_free(qrng);
-                qrng = NULL;
-            }
-            else {
-                gsl_rng* rng = gsl_rng_alloc(ictx.ctx.pseudorandom_generator_type);
-                gsl_rng_set(rng, ictx.ctx.pseudorandom_generator_seed);
-                switch (ictx.ctx.strategy) {
-                    case MC_VEGAS:
-                        vegas_integrate(gsl_monte_wrapper, dimensions, this, min, max, result, error, ictx.ctx.vegas_initial_iterations, ictx.ctx.vegas_incremental_iterations, rng, vegas_callback);
-                        break;
-                    case MC_MISER:
-                        miser_integrate(gsl_monte_wrapper, dimensions, this, min, max, result, error, ictx.ctx.miser_iterations, rng, miser_callback);
-                        break;
-                    case MC_PLAIN:
-                        throw "Unsupported integration method PLAIN";
-                    default:
-                        throw "Unknown integration method";
+    current_integration_region->clip_to_xg_range(ictx.ctx, xi_preintegrated_term, current_modifiers.xtarget_scheme, xg_min, xg_max, min, max);
+    if (!(min[0] < max[0])) {
+        // no point of the region has xg in the window
+        std::fill(result, result + outputs, 0.0);
+        std::fill(error, error + outputs, 0.0);
+        return;
+    }
+    synchronize_helpers();
+    // without a workspace, the generators and states only last for this integration
+    IntegratorWorkspace local_workspace;
+    IntegratorWorkspace& ws = workspace != NULL ? *workspace : local_workspace;
+    BatchThreadsScope threads_scope(batch_threads, helpers.empty() ? NULL : ws.thread_pool());
+    // the batched routines can't show the per-point callback each IntegrationContext as it is computed,
+    // but the GSL routines can't integrate more than one component
+    const bool batched = outputs > 1 || (!helpers.empty() && callback == NULL);
+    const unsigned long seed = ictx.ctx.pseudorandom_generator_seed + budget_round;
+    random_estimate = true;
+    // smooth low-dimensional terms converge much faster with a deterministic rule
+    if (dimensions <= ictx.ctx.cubature_max_dimensions || ictx.ctx.strategy == CUBATURE) {
+        random_estimate = false;
+        // a few regions per thread, so each thread gets many points
+        const size_t regions_per_step = ictx.ctx.cubature_regions_per_step > 0 ? ictx.ctx.cubature_regions_per_step
+                                      : helpers.empty() ? 1 : 4 * (helpers.size() + 1);
+        cubature_integrate(cubature_wrapper_v, dimensions, outputs, this, min, max, result, error, scaled_iterations(ictx.ctx.cubature_iterations), budget_relerr, budget_abserr, regions_per_step, cubature_callback);
+    }
+    else if (ictx.ctx.strategy == MC_QUASI) {
+        gsl_qrng* qrng = ws.qrng(ictx.ctx.quasirandom_generator_type, dimensions);
+        if (ictx.ctx.quasi_replicas > 1) {
+            // the batched routine evaluates the replicas together, so they are spread over the helpers
+            gsl_rng* rng = ws.rng(ictx.ctx.pseudorandom_generator_type, seed);
+            batch_rqmc_integrate(cubature_wrapper_v, dimensions, outputs, this, min, max, result, error, scaled_iterations(ictx.ctx.quasi_iterations), budget_relerr, budget_abserr, ictx.ctx.quasi_replicas, qrng, rng);
+            check_results(outputs, result, error, batch_callback);
+        }
+        else if (batched) {
+            random_estimate = false;
+            batch_quasi_integrate(cubature_wrapper_v, dimensions, outputs, this, min, max, result, error, scaled_iterations(ictx.ctx.quasi_iterations), budget_relerr, budget_abserr, qrng);
+            check_results(outputs, result, error, batch_callback);
+        }
+        else {
+            random_estimate = false;
+            quasi_integrate(gsl_monte_wrapper, dimensions, this, min, max, result, error, scaled_iterations(ictx.ctx.quasi_iterations), budget_relerr, budget_abserr, qrng, ws.quasi_state(dimensions), quasi_callback);
+        }
+    }
+    else {
+        gsl_rng* rng = ws.rng(ictx.ctx.pseudorandom_generator_type, seed);
+        switch (ictx.ctx.strategy) {
+            case MC_VEGAS: {
+                // with a grid store, the grids are kept for the next Integrator
+                const bool keep_grids = vegas_grids != NULL && ictx.ctx.vegas_warm_initial_iterations > 0;
+                const VegasGridStore::Key key = {hard_factors, current_integration_region, current_modifiers, xi_preintegrated_term, outputs};
+                bool warm = false;
+                if (batched) {
+                    BatchVegasState* s = keep_grids ? vegas_grids->batch_state(key, dimensions, outputs, &warm) : ws.batch_vegas_state(dimensions, outputs);
+                    vegas_integrate_v(cubature_wrapper_v, dimensions, outputs, this, min, max, result, error,
+                                      scaled_iterations(warm ? ictx.ctx.vegas_warm_initial_iterations : ictx.ctx.vegas_initial_iterations),
+                                      scaled_iterations(ictx.ctx.vegas_incremental_iterations), ictx.ctx.vegas_max_refinements, rng, s, batch_callback);
+                }
+                else {
+                    gsl_monte_vegas_state* s = keep_grids ? vegas_grids->gsl_state(key, dimensions, &warm) : ws.vegas_state(dimensions);
+                    vegas_integrate(gsl_monte_wrapper, dimensions, this, min, max, result, error,
+                                    scaled_iterations(warm ? ictx.ctx.vegas_warm_initial_iterations : ictx.ctx.vegas_initial_iterations),
+                                    scaled_iterations(ictx.ctx.vegas_incremental_iterations), ictx.ctx.vegas_max_refinements, rng, s, warm, vegas_callback);
                 }
-                gsl_rng_free(rng);
-                rng = NULL;
+                break;
             }
+            case MC_MISER:
+                if (batched) {
+                    batch_miser_integrate(cubature_wrapper_v, dimensions, outputs, this, min, max, result, error, scaled_iterations(ictx.ctx.miser_iterations), rng);
+                    check_results(outputs, result, error, batch_callback);
+                }
+                else {
+                    miser_integrate(gsl_monte_wrapper, dimensions, this, min, max, result, error, scaled_iterations(ictx.ctx.miser_iterations), rng, ws.miser_state(dimensions), miser_callback);
+                }
+                break;
+            case MC_PLAIN:
+                throw "Unsupported integration method PLAIN";
+            default:
+                throw "Unknown integration method";
+        }
     }
-    if (callback) {
+    if (callback && outputs == 1) {
         callback(NULL, 0, 0);
     }
 }
 
-void Integrator::integrate(double* real, double* imag, double* error) {
-    double result = 0.0;
-    double abserr = 0.0;
-    double tmp_result, tmp_error;
+void Integrator::synchronize_helpers() {
+    const HardFactorType hrt = {*current_integration_region, current_modifiers};
+    for (std::vector<Integrator*>::iterator it = helpers.begin(); it != helpers.end(); it++) {
+        Integrator* helper = *it;
+        HardFactorTypeMap::iterator tit = helper->terms.find(hrt);
+        assert(tit != helper->terms.end());
+        helper->current_integration_region = &tit->first.integration_region;
+        helper->current_modifiers = tit->first.modifiers;
+        helper->current_terms = &tit->second;
+        helper->current_term_hard_factors = &helper->term_hard_factors[hrt];
+        helper->current_shared = helper->find_shared(hrt);
+        helper->current_plan = &helper->plans[hrt];
+        helper->outputs = outputs;
+        helper->xi_preintegrated_term = xi_preintegrated_term;
+    }
+}
+
+/** The number of rounds integrate_all_budgeted() shares out its iterations over after the pilot pass */
+static const size_t budget_rounds = 2;
+/** The fewest iterations worth giving an integration in integrate_all_budgeted() */
+static const size_t min_budget_iterations = 1000;
+
+size_t Integrator::scaled_iterations(const size_t iterations) const {
+    if (budget_scale == 1) {
+        return iterations;
+    }
+    // a share above the full budget is used, but the floor never goes above it
+    const size_t scaled = static_cast<size_t>(budget_scale * iterations);
+    return std::max(scaled, std::min(iterations, min_budget_iterations));
+}
+
+SharedSubexpressions* Integrator::find_shared(const HardFactorType& hrt) const {
+    std::map<HardFactorType, SharedSubexpressions*>::const_iterator it = shared_subexpressions.find(hrt);
+    return it == shared_subexpressions.end() ? NULL : it->second;
+}
+
+void Integrator::select_type(HardFactorTypeMap::iterator it) {
+    assert(it->second.size() > 0);
+    current_integration_region = &it->first.integration_region;
+    current_modifiers = it->first.modifiers;
+    current_terms = &it->second;
+    current_term_hard_factors = &term_hard_factors[it->first];
+    current_shared = find_shared(it->first);
+    current_plan = &plans[it->first];
+    PROFILE_ATTACH(profile_table ? &(*profile_table)[type_label()] : NULL);
+}
 
+void Integrator::integrate_all(double* result, double* abserr) {
+    budget_scale = 1;
+    budget_round = 0;
+    budget_abserr = ictx.ctx.abserr;
+    budget_relerr = ictx.ctx.relerr;
+    if (ictx.ctx.global_error_budget) {
+        integrate_all_budgeted(result, abserr);
+        return;
+    }
+
+    std::vector<double> tmp_result(outputs), tmp_error(outputs);
+    std::fill(result, result + outputs, 0.0);
+    std::fill(abserr, abserr + outputs, 0.0);
+
+    for (HardFactorTypeMap::iterator it = terms.begin(); it != terms.end(); it++) {
+        select_type(it);
+        for (int pass = 0; pass < 2; pass++) {
+            xi_preintegrated_term = pass == 1;
+            // a pass with no terms that can contribute would only integrate zero
+            if (!current_plan->has_terms(xi_preintegrated_term)) {
+                continue;
+            }
+            integrate_impl(&tmp_result[0], &tmp_error[0]);
+            for (size_t k = 0; k < outputs; k++) {
+                result[k] += tmp_result[k];
+                abserr[k] += tmp_error[k];
+            }
+        }
+    }
+}
+
+/**
+ * Combines the estimate `value` +- `error` of an integral with the previous
+ * estimate `combined` +- `sqrt(variance)`, weighting each by its inverse
+ * variance. An estimate with no error is taken to be exact.
+ */
+static void combine_estimates(const double value, const double error, double* combined, double* variance) {
+    const double v = error * error;
+    if (v == 0 || *variance < 0) {
+        *combined = value;
+        *variance = v;
+    }
+    else if (*variance > 0) {
+        const double w = *variance / (*variance + v);
+        *combined = w * value + (1 - w) * *combined;
+        *variance = *variance * v / (*variance + v);
+    }
+}
+
+void Integrator::integrate_all_budgeted(double* result, double* abserr) {
+    // each type of term is integrated with and without the xi-preintegrated term
+    const size_t n = 2 * terms.size();
+    std::vector<HardFactorTypeMap::iterator> types;
     for (HardFactorTypeMap::iterator it = terms.begin(); it != terms.end(); it++) {
-        assert(it->second.size() > 0);
-        HardFactorType hrt = it->first;
-        current_integration_region = &hrt.integration_region;
-        current_modifiers = hrt.modifiers;
+        types.push_back(it);
+        types.push_back(it);
+    }
+    // the combined estimate and its variance for each output of each
+    // sub-integral, with a negative variance meaning no estimate yet
+    std::vector<double> estimate(n * outputs, 0.0), variance(n * outputs, -1.0);
+    // the fraction of its full iteration budget each sub-integral has used
+    std::vector<double> spent(n, 0.0);
+    std::vector<double> tmp_result(outputs), tmp_error(outputs);
+    const double pilot = ictx.ctx.error_budget_pilot_fraction;
+    // the sub-integrals with no terms that can contribute are exactly zero
+    size_t active = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (plans[types[i]->first].has_terms(i % 2 == 1)) {
+            active++;
+        }
+        else {
+            std::fill(variance.begin() + i * outputs, variance.begin() + (i + 1) * outputs, 0.0);
+        }
+    }
+    // what integrate_all() would use, less the pilot pass
+    double remaining = active * (1 - pilot);
+
+    for (size_t round = 0; round <= budget_rounds; round++) {
+        // the spread of each sub-integral's estimate for the same number of
+        // points, which is what the points of each round are shared out by
+        std::vector<double> spread(n, 0.0);
+        double total_spread = 0, total = 0, total_variance = 0;
+        for (size_t i = 0; i < n; i++) {
+            double v = 0;
+            for (size_t k = 0; k < outputs; k++) {
+                total += estimate[i * outputs + k];
+                v += std::max(variance[i * outputs + k], 0.0);
+            }
+            spread[i] = sqrt(v * spent[i]);
+            total_spread += spread[i];
+            total_variance += v;
+        }
+        const double target = std::max(ictx.ctx.abserr, ictx.ctx.relerr * fabs(total));
+        if (round > 0 && (sqrt(total_variance) <= target || total_spread == 0)) {
+            break;
+        }
+        const double round_budget = round == 0 ? 0 : remaining / (budget_rounds - round + 1);
+        for (size_t i = 0; i < n; i++) {
+            // the pilot pass uses the configured tolerances; later rounds aim
+            // each sub-integral at its share of the overall target
+            const double share = round == 0 ? 1 : spread[i] / total_spread;
+            if (share == 0 || (round == 0 && variance[i * outputs] == 0)) {
+                continue;
+            }
+            select_type(types[i]);
+            xi_preintegrated_term = i % 2 == 1;
+            budget_scale = round == 0 ? pilot : round_budget * share;
+            budget_abserr = round == 0 ? ictx.ctx.abserr : target * sqrt(share);
+            budget_relerr = round == 0 ? ictx.ctx.relerr : 0;
+            budget_round = round;
+            integrate_impl(&tmp_result[0], &tmp_error[0]);
+            if (random_estimate) {
+                for (size_t k = 0; k < outputs; k++) {
+                    combine_estimates(tmp_result[k], tmp_error[k], &estimate[i * outputs + k], &variance[i * outputs + k]);
+                }
+                spent[i] += budget_scale;
+            }
+            else if (budget_scale >= spent[i]) {
+                // a deterministic rule with a larger budget repeats the points
+                // of the smaller ones, so its estimate replaces theirs
+                std::copy(tmp_result.begin(), tmp_result.end(), estimate.begin() + i * outputs);
+                for (size_t k = 0; k < outputs; k++) {
+                    variance[i * outputs + k] = tmp_error[k] * tmp_error[k];
+                }
+                spent[i] = budget_scale;
+            }
+        }
+        remaining -= round_budget;
+    }
+    budget_scale = 1;
+    budget_round = 0;
 
-        xi_preintegrated_term = false;
-        integrate_impl(&tmp_result, &tmp_error);
-        result += tmp_result;
-        abserr += tmp_error;
+    // independent errors, unlike the bounds added up by integrate_all()
+    for (size_t k = 0; k < outputs; k++) {
+        result[k] = 0;
+        double v = 0;
+        for (size_t i = 0; i < n; i++) {
+            result[k] += estimate[i * outputs + k];
+            v += std::max(variance[i * outputs + k], 0.0);
+        }
+        abserr[k] = sqrt(v);
+    }
+}
 
-        xi_preintegrated_term = true;
-        integrate_impl(&tmp_result, &tmp_error);
-        result += tmp_result;
-        abserr += tmp_error;
+std::string Integrator::type_label() const {
+    std::vector<size_t> indices(*current_term_hard_factors);
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    std::ostringstream label;
+    for (std::vector<size_t>::const_iterator it = indices.begin(); it != indices.end(); it++) {
+        label << (it == indices.begin() ? "" : "+") << hard_factors[*it]->get_name();
     }
+    label << " (" << current_integration_region->dimensions(false) << "D)";
+    return label.str();
+}
+
+void Integrator::integrate(double* real, double* imag, double* error) {
+    outputs = variant_count;
+    integrate_all(real, error);
+    std::fill(imag, imag + outputs, 0.0);
+}
 
-    *real = result;
-    *imag = 0;
-    *error = abserr;
+void Integrator::integrate_separately(double* real, double* imag, double* error) {
+    outputs = hard_factor_count * variant_count;
+    integrate_all(real, error);
+    std::fill(imag, imag + outputs, 0.0);
 }
@@ -20,14 +20,20 @@
 #ifndef _INTEGRATOR_H_
 #define _INTEGRATOR_H_
 
+#include <exception>
 #include <map>
+#include <string>
 #include <vector>
+#include <pthread.h>
 #include <gsl/gsl_monte_miser.h>
 #include <gsl/gsl_monte_vegas.h>
+#include <gsl/gsl_qrng.h>
+#include <gsl/gsl_rng.h>
 #include "../configuration/context.h"
 #include "integrationcontext.h"
 #include "integrationregion.h"
 #include "../hardfactors/hardfactor.h"
+#include "../utils/profile.h"
 #include "quasimontecarlo.h"
 
 class HardFactorType {
@@ -38,7 +44,187 @@ public:
     bool operator<(const HardFactorType& other) const;
 };
 
-typedef std::map<HardFactorType, HardFactorTermList> HardFactorTypeMap;
+typedef std::map<HardFactorType, BoundHardFactorTermList> HardFactorTypeMap;
+
+/** One of the functions Fs, Fn, and Fd of a bound hard factor term */
+typedef void (BoundHardFactorTerm::*TermFunction)(double* real, double* imag) const;
+
+/** A term in a TermPlan */
+struct PlannedTerm {
+    const BoundHardFactorTerm* term;
+    /** The index in the Integrator's list of the hard factor the term came from */
+    size_t hard_factor;
+};
+typedef std::vector<PlannedTerm> PlannedTermList;
+
+/**
+ * The terms of one type that need each of their functions evaluated, in
+ * the order of the type's BoundHardFactorTermList. A term is left out of a
+ * list when its function is known to be zero, which includes Fs and Fn of
+ * leading order terms.
+ */
+struct TermPlan {
+    PlannedTermList Fs, Fn, Fd;
+
+    /** Whether any term contributes to the integral with or without the xi-preintegrated term */
+    bool has_terms(const bool xi_preintegrated_term) const {
+        return !Fs.empty() || !(xi_preintegrated_term ? Fd : Fn).empty();
+    }
+};
+/**
+ * For each type, the index in the list of hard factors given to the
+ * Integrator of the hard factor that each term came from
+ */
+typedef std::map<HardFactorType, std::vector<size_t> > HardFactorIndexMap;
+
+class BatchVegasState;
+class SharedSubexpressions;
+
+/**
+ * The VEGAS grids adapted in previous integrations, one for each type of
+ * term, for an Integrator to start from instead of a uniform grid. See
+ * Integrator::set_vegas_grids().
+ *
+ * A VegasGridStore is not thread safe; each thread running integrations
+ * should have its own.
+ */
+class VegasGridStore {
+public:
+    VegasGridStore() {}
+    ~VegasGridStore();
+private:
+    friend class Integrator;
+    /** Identifies the integrations that share a grid */
+    struct Key {
+        /** The hard factors being integrated, which outlive the store */
+        HardFactorList hard_factors;
+        /** This belongs to the hard factors, which outlive the store */
+        const IntegrationRegion* integration_region;
+        /** A copy, since the Integrator's `current_modifiers` doesn't last */
+        Modifiers modifiers;
+        bool xi_preintegrated_term;
+        /** The number of components, which is part of a batched VEGAS state */
+        size_t outputs;
+
+        bool operator<(const Key& other) const;
+    };
+    std::map<Key, gsl_monte_vegas_state*> gsl_states;
+    std::map<Key, BatchVegasState*> batch_states;
+
+    /**
+     * Returns the GSL VEGAS state stored under `key`, setting `warm` to
+     * true, or stores and returns a new state with the given number of
+     * dimensions, setting `warm` to false
+     */
+    gsl_monte_vegas_state* gsl_state(const Key& key, const size_t dim, bool* warm);
+    /** The same as gsl_state(), for the batched VEGAS routine */
+    BatchVegasState* batch_state(const Key& key, const size_t dim, const size_t fdim, bool* warm);
+
+    // not copyable
+    VegasGridStore(const VegasGridStore&);
+    VegasGridStore& operator=(const VegasGridStore&);
+};
+
+struct BatchSlice;
+
+/**
+ * Threads that evaluate the slices of Integrator::evaluate_batch_parallel()
+ * on the helper Integrators. They wait between batches instead of being
+ * started and joined for each one.
+ *
+ * A BatchThreadPool is used by one thread at a time, like the
+ * IntegratorWorkspace that holds it.
+ */
+class BatchThreadPool {
+public:
+    BatchThreadPool();
+    /** Stops and joins the threads */
+    ~BatchThreadPool();
+    /**
+     * Evaluates `slices[0]` on the calling thread and each of the others on
+     * a thread of the pool, starting more threads if needed, and returns
+     * when all of them are done. A slice whose thread couldn't be started is
+     * evaluated on the calling thread.
+     */
+    void run(BatchSlice* slices, const size_t nslices);
+private:
+    struct Worker {
+        BatchThreadPool* pool;
+        pthread_t thread;
+        /** The slice this thread evaluates is slices[index + 1] */
+        size_t index;
+        /** The last batch this thread has seen */
+        unsigned long generation;
+    };
+    static void* work(void* closure);
+
+    std::vector<Worker*> workers;
+    pthread_mutex_t mutex;
+    /** Signaled when a new batch is posted or the pool is stopping */
+    pthread_cond_t batch_posted;
+    /** Signaled when the last thread finishes its slice */
+    pthread_cond_t batch_done;
+    /** The current batch */
+    BatchSlice* slices;
+    size_t nslices;
+    /** Counts the batches, so the threads can tell a new one from the last */
+    unsigned long generation;
+    /** The number of threads still evaluating a slice of the current batch */
+    size_t pending;
+    bool stopping;
+
+    // not copyable
+    BatchThreadPool(const BatchThreadPool&);
+    BatchThreadPool& operator=(const BatchThreadPool&);
+};
+
+/**
+ * The random number generators and integration states that an Integrator
+ * uses for each integration, kept from one integration to the next so that
+ * a thread running many short integrations doesn't allocate and free them
+ * every time. See Integrator::set_workspace().
+ *
+ * There is one of each for each number of dimensions (and, for batched
+ * VEGAS, number of components) that has been used. Each is put back in the
+ * state it was allocated in when it's handed out, so the results don't
+ * depend on what was integrated before.
+ *
+ * An IntegratorWorkspace is not thread safe; each thread running
+ * integrations should have its own.
+ */
+class IntegratorWorkspace {
+public:
+    IntegratorWorkspace() : batch_threads(NULL) {}
+    ~IntegratorWorkspace();
+private:
+    friend class Integrator;
+    std::map<const gsl_rng_type*, gsl_rng*> rngs;
+    std::map<std::pair<const gsl_qrng_type*, size_t>, gsl_qrng*> qrngs;
+    std::map<size_t, gsl_monte_vegas_state*> vegas_states;
+    std::map<size_t, gsl_monte_miser_state*> miser_states;
+    std::map<size_t, quasi_monte_state*> quasi_states;
+    std::map<std::pair<size_t, size_t>, BatchVegasState*> batch_vegas_states;
+    BatchThreadPool* batch_threads;
+
+    /** A random number generator of the given type, seeded with `seed` */
+    gsl_rng* rng(const gsl_rng_type* type, const unsigned long seed);
+    /** A quasirandom generator of the given type, restarted from its first point */
+    gsl_qrng* qrng(const gsl_qrng_type* type, const size_t dim);
+    /** A GSL VEGAS state in its initial state, with a uniform grid */
+    gsl_monte_vegas_state* vegas_state(const size_t dim);
+    /** A GSL MISER state with the default parameters */
+    gsl_monte_miser_state* miser_state(const size_t dim);
+    /** A quasi Monte Carlo state in its initial state */
+    quasi_monte_state* quasi_state(const size_t dim);
+    /** A batched VEGAS state in its initial state, with a uniform grid */
+    BatchVegasState* batch_vegas_state(const size_t dim, const size_t fdim);
+    /** The threads that evaluate batches on the helper Integrators */
+    BatchThreadPool* thread_pool();
+
+    // not copyable
+    IntegratorWorkspace(const IntegratorWorkspace&);
+    IntegratorWorkspace& operator=(const IntegratorWorkspace&);
+};
 
 /**
  * A class to interface with the GSL Monte Carlo integration routines.
@@ -83,9 +269,64 @@ private:
     IntegrationContext ictx;
     /**
      * The hard factors that this Integrator should be integrating, sorted
-     * out by their type.
+     * out by their type. Each term is bound to `ictx`, and the bound terms
+     * are owned by this Integrator.
      */
     HardFactorTypeMap terms;
+    /**
+     * The entry of `terms` for the current integration region and modifiers,
+     * set by integrate() so that it doesn't have to be looked up at every point.
+     */
+    const BoundHardFactorTermList* current_terms;
+    /**
+     * Which hard factor each term in `terms` came from, in the same order
+     */
+    HardFactorIndexMap term_hard_factors;
+    /** The entry of `term_hard_factors` corresponding to `current_terms` */
+    const std::vector<size_t>* current_term_hard_factors;
+    /**
+     * The subexpressions shared by the terms of each type, for the types
+     * which have any. These are owned by this Integrator.
+     */
+    std::map<HardFactorType, SharedSubexpressions*> shared_subexpressions;
+    /** The entry of `shared_subexpressions` for the current type, or NULL */
+    SharedSubexpressions* current_shared;
+    /** The terms of each type to evaluate for each function */
+    std::map<HardFactorType, TermPlan> plans;
+    /** The entry of `plans` for the current type */
+    const TermPlan* current_plan;
+    /** The hard factors this Integrator was constructed with */
+    const HardFactorList hard_factors;
+    /** The number of hard factors this Integrator was constructed with */
+    const size_t hard_factor_count;
+    /** The number of scale settings: the Context's and its variants */
+    const size_t scale_count;
+    /**
+     * The number of variants: every combination of a gluon distribution and
+     * a scale setting, numbered as gluon distribution * scale_count + scale
+     */
+    const size_t variant_count;
+    /**
+     * The number of components of the integrand in the current integration:
+     * `variant_count` for integrate(), where all the terms are added together,
+     * or `hard_factor_count * variant_count` for integrate_separately(). The
+     * components for the variants of each sum are adjacent.
+     */
+    size_t outputs;
+    /** The variables at each point of the batch being evaluated by evaluate_batch() */
+    IntegrationContextBatch batch;
+    /** The same as `batch`, but at xi = 1, for the subtraction terms */
+    IntegrationContextBatch subtraction_batch;
+    /** The Jacobian at each point of the batch */
+    std::vector<double> batch_jacobian;
+    /** The logarithmic factor (or xi factor) at each point of the batch */
+    std::vector<double> batch_factor;
+    /** Whether each point of the batch has xg in the allowed range */
+    std::vector<char> batch_in_range;
+    /** The subtraction term (evaluated at xi = 1) for each component at each point of the batch */
+    std::vector<double> batch_subtraction;
+    /** The values of the shared subexpressions at each point of `batch` and `subtraction_batch` */
+    std::vector<double> batch_shared, subtraction_batch_shared;
     /** A callback function to call each time the function is evaluated */
     void (*callback)(const IntegrationContext*, double, double);
     /** A callback function to call each time a cubature integration finishes */
@@ -96,8 +337,65 @@ private:
     void (*vegas_callback)(double*, double*, gsl_monte_vegas_state*);
     /** A callback function to call each time a quasi Monte Carlo integration finishes */
     void (*quasi_callback)(double*, double*, quasi_monte_state*);
+    /**
+     * A callback function to call each time a batched Monte Carlo integration
+     * (or a step of a batched VEGAS integration) finishes
+     */
+    void (*batch_callback)(double*, double*);
+    /**
+     * Integrators which evaluate parts of each batch of points on other
+     * threads. These are not owned by this Integrator.
+     */
+    std::vector<Integrator*> helpers;
+    /**
+     * The grids to start VEGAS integrations from, and to leave the adapted
+     * grids in, or NULL to start from a uniform grid. Not owned by this
+     * Integrator.
+     */
+    VegasGridStore* vegas_grids;
+    /**
+     * The generators and states to integrate with, or NULL to allocate
+     * them for each integration. Not owned by this Integrator.
+     */
+    IntegratorWorkspace* workspace;
+    /**
+     * The threads for evaluate_batch_parallel(), from the workspace of the
+     * current integration, or NULL outside of one
+     */
+    BatchThreadPool* batch_threads;
+    /** The table of profile counters to add to, or NULL. Not owned by this Integrator. */
+    profile::Profile* profile_table;
+    /** The counter to add the number of integrand evaluations to, or NULL. Not owned by this Integrator. */
+    unsigned long* evaluation_counter;
+    /** Adds `n` to the evaluation counter, if there is one */
+    void count_evaluations(const unsigned long n) {
+        if (evaluation_counter != NULL) {
+            // atomically, because a monitoring thread may be reading it
+            __sync_fetch_and_add(evaluation_counter, n);
+        }
+    }
+
+    /** The label of the current type of term in the profile table */
+    std::string type_label() const;
 
     bool xi_preintegrated_term;
+    /**
+     * The fraction of the configured iterations to use in the current
+     * integration, and its error targets, which are those of the Context
+     * unless integrate_all_budgeted() is sharing them out
+     */
+    double budget_scale, budget_abserr, budget_relerr;
+    /**
+     * The round of integrate_all_budgeted() being integrated, which is added
+     * to the pseudorandom seed so that each round draws its own points
+     */
+    unsigned long budget_round;
+    /**
+     * Whether the last integrate_impl() drew random points, so that another
+     * integration gives an independent estimate, rather than using a
+     * deterministic rule that repeats the points of a smaller budget
+     */
+    bool random_estimate;
 
     double xg_min, xg_max;
 public:
@@ -109,6 +407,43 @@ public:
      * result in the given variables.
      */
     void evaluate_integrand(double* real, double* imag);
+    /**
+     * Evaluates the real part of the integrand, multiplied by the Jacobian,
+     * at each of `npt` points. This is equivalent to calling cubature_wrapper()
+     * for each point, but it is organized in two passes: first the kinematics
+     * (including the gluon distribution and parton factors) are computed for
+     * every point and stored in `batch`, and then each hard factor term is
+     * evaluated at all the points in turn.
+     *
+     * When integrating separately, each hard factor's terms go into their own
+     * component of the result; otherwise there is one component. Either way,
+     * each of those is repeated for each variant, a gluon distribution and a
+     * scale setting: after the first, the terms are evaluated again with
+     * only the gluon distribution variables of each point, or the coupling
+     * and parton factors, recalculated, so the rest of the kinematics is
+     * only computed once.
+     *
+     * @param[in] ncoords the number of coordinates per point
+     * @param[in] npt the number of points
+     * @param[in] coordinates the coordinates, with coordinate `j` of point `i`
+     * at index `i * ncoords + j`
+     * @param[out] results the results, with component `k` of point `i` at
+     * index `k * stride + i`
+     * @param[in] stride the distance between components in `results`, at least `npt`
+     */
+    void evaluate_batch(const size_t ncoords, const size_t npt, const double* coordinates, double* results, const size_t stride);
+    /**
+     * Does the same thing as evaluate_batch(), but splits the points into
+     * contiguous slices and evaluates all but the first on the helper
+     * Integrators, each on a thread of `batch_threads`. Each result depends
+     * only on its own point, so this gives the same results as
+     * evaluate_batch().
+     *
+     * If there are no helpers or only a few points, this just calls
+     * evaluate_batch(). Component `k` of point `i` is put at index
+     * `k * npt + i` of `results`.
+     */
+    void evaluate_batch_parallel(const size_t ncoords, const size_t npt, const double* coordinates, double* results);
     /**
      * Performs the 1D and 2D integrals, and stores the result and error bound
      * in the variables `real` and `error`. The variable `imag` is set to zero
@@ -116,6 +451,11 @@ public:
      * but it's in the function declaration in case we wanted to calculate
      * the imaginary part for some reason.
      *
+     * When the Context has gluon distribution or scale variants, these are
+     * arrays with one element for each combination of a gluon distribution
+     * and a scale setting (see variant_count), starting with the Context's
+     * own, all integrated at the same points.
+     *
      * What is actually integrated by this function is the set of all hard factors
      * whose IntegrationRegion matches the current one. The current IntegrationRegion
      * is set by the method set_current_integration_type(). So the overall workflow
@@ -123,6 +463,21 @@ public:
      * in turn.
      */
     void integrate(double* real, double* imag, double* error);
+    /**
+     * Does the same integrals as integrate(), but keeps the contributions of
+     * the hard factors apart, storing the results for each in the arrays
+     * `real`, `imag`, and `error`, which must have room for as many elements
+     * as there were hard factors in the list this Integrator was constructed
+     * with, times the number of variants. The results for the variants of
+     * each hard factor are adjacent, as in integrate().
+     *
+     * All the hard factors are evaluated at the same points, so this takes
+     * about as long as integrate() rather than as long as integrating each
+     * hard factor on its own. Monte Carlo integrations always use the
+     * batched routines in batchmonte.h, adapting to the sum of the hard
+     * factors. The per-point callback is not invoked.
+     */
+    void integrate_separately(double* real, double* imag, double* error);
     /**
      * Sets the callback to be invoked each time the integrand is evaluated.
      */
@@ -153,15 +508,156 @@ public:
     void set_quasi_callback(void (*quasi_callback)(double*, double*, quasi_monte_state*)) {
         this->quasi_callback = quasi_callback;
     }
+    /**
+     * Sets the callback to be invoked each time a batched Monte Carlo
+     * integration, or a step of a batched VEGAS integration, finishes.
+     */
+    void set_batch_callback(void (*batch_callback)(double*, double*)) {
+        this->batch_callback = batch_callback;
+    }
+    /**
+     * Sets the Integrators which will evaluate points on other threads.
+     *
+     * Each helper has to be constructed from the same Context, hard factors,
+     * and xg limits as this one, but with its own ThreadLocalContext, and it
+     * must not be used for anything else while this one is integrating.
+     * When there are helpers (and no per-point callback), Monte Carlo
+     * integrations use the batched routines in batchmonte.h instead of the
+     * GSL ones, so that each batch of points can be shared among the threads.
+     */
+    void set_helpers(const std::vector<Integrator*>& helpers) {
+        this->helpers = helpers;
+    }
+    /**
+     * Sets the store of VEGAS grids to warm start from.
+     *
+     * When the Context sets `vegas_warm_initial_iterations`, each VEGAS
+     * integration starts from the grid left in `grids` by the last
+     * integration of the same type of term, if there is one, and uses only
+     * that many evaluations for its first step instead of
+     * `vegas_initial_iterations`. In a scan over pT and Y, neighbouring
+     * points have nearly the same integrand, so the grid only needs a little
+     * more adaptation. The store has to outlive the integration.
+     */
+    void set_vegas_grids(VegasGridStore* grids) {
+        this->vegas_grids = grids;
+    }
+    /**
+     * Sets the workspace to take random number generators and integration
+     * states from, instead of allocating new ones for each integration.
+     * The workspace has to outlive the integration.
+     */
+    void set_workspace(IntegratorWorkspace* workspace) {
+        this->workspace = workspace;
+    }
+    /**
+     * Sets the table to add the profile counters of each type of term to,
+     * in a build with SOLO_PROFILE defined. The labels are the names of the
+     * hard factors with terms of each type and the number of dimensions.
+     * The table has to outlive the integration.
+     */
+    void set_profile(profile::Profile* profile_table) {
+        this->profile_table = profile_table;
+    }
+    /**
+     * Sets a counter to add the number of points at which the integrand is
+     * evaluated to, as each point or batch of points is done, so that another
+     * thread can follow the progress of the integration. The counter has to
+     * outlive the integration.
+     */
+    void set_evaluation_counter(unsigned long* evaluation_counter) {
+        this->evaluation_counter = evaluation_counter;
+    }
 private:
     /**
      * Implements the integration
      */
     void integrate_impl(double* result, double* error);
+    /**
+     * Runs integrate_impl() for each type of term and both values of
+     * xi_preintegrated_term, adding up the `outputs` components of the
+     * results and errors, or calls integrate_all_budgeted() if the Context
+     * asks for a global error budget
+     */
+    void integrate_all(double* result, double* error);
+    /**
+     * Does the same integrals as integrate_all(), but aims for the error
+     * target on their sum rather than on each one. After a pilot pass with
+     * a fraction of the usual iterations, the rest of the iterations are
+     * shared out over a few rounds in proportion to the spread of each
+     * integral's estimate (its error times the square root of the iterations
+     * it has used), which minimizes the error of the sum, and each integral
+     * gets the corresponding share of the error target. The estimates from
+     * all the rounds are combined, and their errors added in quadrature.
+     */
+    void integrate_all_budgeted(double* result, double* error);
+    /** Makes the term type at `it` the current one */
+    void select_type(HardFactorTypeMap::iterator it);
+    /** The entry of `shared_subexpressions` for `hrt`, or NULL */
+    SharedSubexpressions* find_shared(const HardFactorType& hrt) const;
+    /**
+     * The SharedSubexpressions::Functions used by the current pass at xi, as
+     * opposed to the subtraction at xi = 1, which only uses Fs
+     */
+    unsigned int pass_functions() const;
+    /**
+     * Evaluates the current shared subexpressions used by `functions`, if
+     * any, and saves them as those of point `i` in `storage`
+     */
+    void store_shared(const size_t i, std::vector<double>& storage, const unsigned int functions);
+    /** Restores the shared subexpressions of point `i` saved by store_shared() */
+    void load_shared(const size_t i, const std::vector<double>& storage);
+    /**
+     * Adds `f` of each term in `list` at each point of `points` in range,
+     * times `factor` at that point unless it is `NULL`, to the component of
+     * `results` for the term's output
+     */
+    void add_terms_batch(const PlannedTermList& list, const TermFunction f, const IntegrationContextBatch& points, const std::vector<double>& shared,
+                         const double* factor, const size_t npt, const size_t variant_index, double* results, const size_t stride);
+    /**
+     * Adds all the terms of the current plan at the points of the batch to
+     * the components of `results` for variant `variant_index`
+     */
+    void add_plan_batch(const size_t npt, const size_t variant_index, double* results, const size_t stride);
+    /**
+     * Selects the gluon distribution and scale setting of variant
+     * `variant_index` and recalculates the variables that depend on them,
+     * and the shared subexpressions, at each point of the batch that is in
+     * range, which holds the variables of the previous variant
+     */
+    void recalculate_batch_variant(const size_t npt, const size_t variant_index);
+    /**
+     * Recalculates the variables of the point in ictx for the gluon
+     * distribution or scale setting that was just selected
+     */
+    void recalculate_variant(const bool gdist_changed, const bool scale_changed);
+    /** The number of iterations to use in place of `iterations` from the Context, scaled by `budget_scale` */
+    size_t scaled_iterations(const size_t iterations) const;
+    /**
+     * Copies the current term type and xi_preintegrated_term to the helpers
+     */
+    void synchronize_helpers();
 
     // the non-member functions that actually implement the integration
     friend void cubature_wrapper(unsigned int ncoords, const double* coordinates, void* closure, unsigned int nresults, double* results);
+    friend void cubature_wrapper_v(unsigned int ncoords, unsigned int npt, const double* coordinates, void* closure, unsigned int nresults, double* results);
     friend double gsl_monte_wrapper(double* coordinates, size_t ncoords, void* closure);
 };
 
+/**
+ * Exception to throw when the evaluation of a slice of a batch on a helper
+ * thread fails. The original exception can't be carried across threads, so
+ * this just preserves its message.
+ */
+class HelperThreadException : public std::exception {
+private:
+    std::string _message;
+public:
+    HelperThreadException(const std::string& message) throw() : _message(message) {}
+    ~HelperThreadException() throw() {}
+    const char* what() const throw() {
+        return _message.c_str();
+    }
+};
+
 #endif // _INTEGRATOR_H_
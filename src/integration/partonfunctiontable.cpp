@@ -0,0 +1,243 @@
+/*
+ * Part of oneloopcalc
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <vector>
+#include "../mstwpdf.h"
+#include "../dss_pinlo/dss_pinlo.h"
+#include "../gluondist/uniformgrid.h"
+#include "interp2d.h"
+#include "partonfunctiontable.h"
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+/** The largest relative difference allowed between the table and direct evaluation */
+static const double table_tolerance = 1e-3;
+/**
+ * The fraction of the largest value of a factor below which its values are
+ * left out of the check, since relative differences among values that small
+ * don't matter to the integral
+ */
+static const double check_threshold = 1e-6;
+
+/** The number of parton flavors there are fragmentation functions for */
+static const size_t number_of_flavors = 9;
+
+/** The factors, in the order the table stores them */
+static double PartonFactors::* const factor_members[4] = {
+    &PartonFactors::qq, &PartonFactors::gg, &PartonFactors::gq, &PartonFactors::qg
+};
+
+void PartonDistributions::load(const c_mstwpdf& pdf_object) {
+    upv = pdf_object.cont.upv;
+    dnv = pdf_object.cont.dnv;
+    usea = pdf_object.cont.usea;
+    dsea = pdf_object.cont.dsea;
+    str = pdf_object.cont.str;
+    sbar = pdf_object.cont.sbar;
+    glu = pdf_object.cont.glu;
+}
+
+void load_fragmentation(DSSpiNLO& ff_object, const DSSpiNLO::hadron hadron, double* d) {
+    for (size_t i = 0; i < number_of_flavors; i++) {
+        d[i] = ff_object.fragmentation(static_cast<DSSpiNLO::flavor>(i), hadron);
+    }
+}
+
+PartonFactors combine_parton_factors(const PartonDistributions& p, const double* d, const projectile_type projectile) {
+    PartonFactors f = {0.0, 0.0, 0.0, 0.0};
+
+    // Proton contributions:
+    f.qq += (p.upv + p.usea) * d[DSSpiNLO::up];
+    f.qq += p.usea * d[DSSpiNLO::up_bar];
+    f.qq += (p.dnv + p.dsea) * d[DSSpiNLO::down];
+    f.qq += p.dsea * d[DSSpiNLO::down_bar];
+    f.qq += p.str * d[DSSpiNLO::strange];
+    f.qq += p.sbar * d[DSSpiNLO::strange_bar];
+
+    if (projectile == deuteron) {
+        // Neutron contributions (for deuteron collisions), assuming isospin symmetry:
+        f.qq += (p.dnv + p.dsea) * d[DSSpiNLO::up];
+        f.qq += p.dsea * d[DSSpiNLO::up_bar];
+        f.qq += (p.upv + p.usea) * d[DSSpiNLO::down];
+        f.qq += p.usea * d[DSSpiNLO::down_bar];
+        f.qq += p.str * d[DSSpiNLO::strange];
+        f.qq += p.sbar * d[DSSpiNLO::strange_bar];
+    }
+
+
+    // Proton contribution:
+    f.gg += p.glu * d[DSSpiNLO::gluon];
+
+    if (projectile == deuteron) {
+        // Neutron contribution (for deuteron collisions), assuming isospin symmetry:
+        f.gg *= 2;
+    }
+
+
+    // Proton contributions:
+    f.gq += (  p.upv + 2*p.usea
+             + p.dnv + 2*p.dsea
+             + p.str
+             + p.sbar
+            ) * d[DSSpiNLO::gluon];
+
+    if (projectile == deuteron) {
+        // Neutron contributions (for deuteron collisions), assuming isospin symmetry:
+        f.gq *= 2;
+    }
+
+
+    // Proton contributions:
+    f.qg += p.glu * (  d[DSSpiNLO::up]
+                     + d[DSSpiNLO::up_bar]
+                     + d[DSSpiNLO::down]
+                     + d[DSSpiNLO::down_bar]
+                     + d[DSSpiNLO::strange]
+                     + d[DSSpiNLO::strange_bar]);
+
+    if (projectile == deuteron) {
+        // Neutron contributions (for deuteron collisions), assuming isospin symmetry:
+        f.qg *= 2;
+    }
+
+    return f;
+}
+
+/**
+ * Sets `pdfs[i]` to the parton distributions at x = exp(lnx[i]) and
+ * `ffs[number_of_flavors * j + k]` to the fragmentation function of flavor
+ * `k` at z = exp(lnz[j]), both at the scale `mu2`
+ */
+static void evaluate_lines(c_mstwpdf& pdf_object, DSSpiNLO& ff_object, const DSSpiNLO::hadron hadron, const double mu2,
+                           const vector<double>& lnx, const vector<double>& lnz, vector<PartonDistributions>& pdfs, vector<double>& ffs) {
+    pdfs.resize(lnx.size());
+    for (size_t i = 0; i < lnx.size(); i++) {
+        pdf_object.update(exp(lnx[i]), sqrt(mu2));
+        pdfs[i].load(pdf_object);
+    }
+    ffs.resize(number_of_flavors * lnz.size());
+    for (size_t j = 0; j < lnz.size(); j++) {
+        ff_object.update(exp(lnz[j]), mu2);
+        load_fragmentation(ff_object, hadron, &ffs[number_of_flavors * j]);
+    }
+}
+
+PartonFunctionTable::PartonFunctionTable() {
+    for (size_t k = 0; k < 4; k++) {
+        interpolators[k] = NULL;
+    }
+}
+
+PartonFunctionTable::~PartonFunctionTable() {
+    for (size_t k = 0; k < 4; k++) {
+        delete interpolators[k];
+        interpolators[k] = NULL;
+    }
+}
+
+PartonFunctionTable* PartonFunctionTable::create(const Context& ctx, c_mstwpdf& pdf_object, DSSpiNLO& ff_object, const double mu2, const size_t points) {
+    assert(points >= 2);
+    assert(ctx.tau > 0 && ctx.tau < 1);
+    const double lnmin = log(ctx.tau);
+    const double step = -lnmin / (points - 1);
+    vector<double> nodes(points), centers(points - 1);
+    for (size_t i = 0; i < points; i++) {
+        nodes[i] = lnmin + i * step;
+    }
+    nodes[points - 1] = 0;
+    for (size_t i = 0; i < points - 1; i++) {
+        centers[i] = lnmin + (i + 0.5) * step;
+    }
+
+    PartonFunctionTable* table = new PartonFunctionTable();
+    vector<PartonDistributions> pdfs;
+    vector<double> ffs;
+    try {
+        evaluate_lines(pdf_object, ff_object, ctx.hadron, mu2, nodes, nodes, pdfs, ffs);
+        vector<double> values[4];
+        double largest[4] = {0, 0, 0, 0};
+        for (size_t k = 0; k < 4; k++) {
+            values[k].resize(points * points);
+        }
+        for (size_t i = 0; i < points; i++) {
+            for (size_t j = 0; j < points; j++) {
+                const PartonFactors f = combine_parton_factors(pdfs[i], &ffs[number_of_flavors * j], ctx.projectile);
+                for (size_t k = 0; k < 4; k++) {
+                    values[k][INDEX_2D(i, j, points, points)] = f.*factor_members[k];
+                    largest[k] = std::max(largest[k], fabs(f.*factor_members[k]));
+                }
+            }
+        }
+        for (size_t k = 0; k < 4; k++) {
+            table->interpolators[k] = UniformGridInterpolator::create(UniformGridInterpolator::BICUBIC, &nodes[0], &nodes[0], &values[k][0], points, points);
+            assert(table->interpolators[k] != NULL);
+        }
+
+        // the cell centers are as far from the grid points as anything gets
+        evaluate_lines(pdf_object, ff_object, ctx.hadron, mu2, centers, centers, pdfs, ffs);
+        double worst = 0;
+        for (size_t i = 0; i < points - 1; i++) {
+            for (size_t j = 0; j < points - 1; j++) {
+                const PartonFactors direct = combine_parton_factors(pdfs[i], &ffs[number_of_flavors * j], ctx.projectile);
+                for (size_t k = 0; k < 4; k++) {
+                    const double expected = direct.*factor_members[k];
+                    if (fabs(expected) <= check_threshold * largest[k]) {
+                        continue;
+                    }
+                    const double actual = table->interpolators[k]->eval(centers[i], centers[j]);
+                    worst = std::max(worst, fabs(actual - expected) / fabs(expected));
+                }
+            }
+        }
+        if (!(worst <= table_tolerance)) {
+            cerr << "WARNING: the parton function table at pT = " << sqrt(ctx.pT2) << ", Y = " << ctx.Y
+                   << " differs from direct evaluation by up to " << worst << " (relative), so it won't be used" << endl;
+            delete table;
+            return NULL;
+        }
+    }
+    catch (const std::exception& e) {
+        cerr << "WARNING: unable to tabulate the parton functions at pT = " << sqrt(ctx.pT2) << ", Y = " << ctx.Y << ": " << e.what() << endl;
+        delete table;
+        return NULL;
+    }
+    return table;
+}
+
+bool PartonFunctionTable::contains(const double x, const double z) const {
+    // every interpolator has the same grid
+    return x > 0 && z > 0 && interpolators[0]->contains(log(x), log(z));
+}
+
+PartonFactors PartonFunctionTable::eval(const double x, const double z) const {
+    const double lnx = log(x);
+    const double lnz = log(z);
+    PartonFactors f;
+    for (size_t k = 0; k < 4; k++) {
+        f.*factor_members[k] = interpolators[k]->eval(lnx, lnz);
+    }
+    return f;
+}
@@ -0,0 +1,103 @@
+/*
+ * Part of oneloopcalc
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PARTONFUNCTIONTABLE_H_
+#define _PARTONFUNCTIONTABLE_H_
+
+#include <cstddef>
+#include "../configuration/context.h"
+
+class UniformGridInterpolator;
+
+/**
+ * The combinations of parton distributions and fragmentation functions
+ * which multiply the hard factors: qqfactor, ggfactor, gqfactor, and
+ * qgfactor in IntegrationContext.
+ */
+struct PartonFactors {
+    double qq, gg, gq, qg;
+};
+
+/**
+ * The parton distributions of the proton that enter the parton factors,
+ * at one value of x and the factorization scale
+ */
+struct PartonDistributions {
+    double upv, dnv, usea, dsea, str, sbar, glu;
+
+    /** Copies the values `pdf_object` was last updated to */
+    void load(const c_mstwpdf& pdf_object);
+};
+
+/**
+ * Sets `d`, indexed by DSSpiNLO::flavor, to the fragmentation functions to
+ * `hadron` that `ff_object` was last updated to
+ */
+void load_fragmentation(DSSpiNLO& ff_object, const DSSpiNLO::hadron hadron, double* d);
+
+/**
+ * Combines the parton distributions `p` and the fragmentation functions `d`
+ * (as set by load_fragmentation()) into the parton factors for the given
+ * projectile.
+ */
+PartonFactors combine_parton_factors(const PartonDistributions& p, const double* d, const projectile_type projectile);
+
+/**
+ * A table of the parton factors of one Context over (x, z), where x is the
+ * momentum fraction the parton distributions are evaluated at, for a
+ * factorization scale that is the same at every point.
+ *
+ * The factors are tabulated at `points` values of ln x and of ln z, evenly
+ * spaced between ln tau and 0, which covers every point the integration
+ * regions can reach, and interpolated bicubically. Constructing the table
+ * needs only one update of the PDF and FF objects for each grid line,
+ * because the parton distributions depend only on x and the fragmentation
+ * functions only on z.
+ */
+class PartonFunctionTable {
+public:
+    /**
+     * Tabulates the parton factors of `ctx` at the scale `mu2`, using the
+     * given PDF and FF objects, and checks the table against direct
+     * evaluation at the center of every cell.
+     *
+     * Returns `NULL`, after logging a warning, if the table can't be
+     * constructed or is off by more than the tolerance anywhere, in which
+     * case the parton factors should be evaluated directly.
+     */
+    static PartonFunctionTable* create(const Context& ctx, c_mstwpdf& pdf_object, DSSpiNLO& ff_object, const double mu2, const size_t points);
+    ~PartonFunctionTable();
+
+    /** Whether (x, z) is within the table */
+    bool contains(const double x, const double z) const;
+    /** The interpolated parton factors at (x, z) */
+    PartonFactors eval(const double x, const double z) const;
+
+private:
+    PartonFunctionTable();
+
+    /** The interpolators of the factors, in the order of `factor_members` */
+    UniformGridInterpolator* interpolators[4];
+
+    // not copyable, because of the interpolators
+    PartonFunctionTable(const PartonFunctionTable&);
+    PartonFunctionTable& operator=(const PartonFunctionTable&);
+};
+
+#endif // _PARTONFUNCTIONTABLE_H_
@@ -0,0 +1,27 @@
+// The Balitsky-Kovchegov evolution of kovr, for use as a library
+// 
+// kovr keeps its state in global variables, so only one evolution can run
+// at a time. The choice of equation, coupling and initial condition is made
+// in InitialiseEvolution() in kovr.cpp, and the grid in comm_constr.h.
+// 
+
+#ifndef _BKEVOLUTION_H_
+#define _BKEVOLUTION_H_
+
+// The r grid has nr points, spaced evenly in log(r) from logrmin to logrmax,
+// and each step moves the rapidity up by deltay
+void BKGridParameters(int *nr,double *logrmin,double *logrmax,double *deltay);
+
+// Run nsteps steps of the evolution from the initial condition at x = x_init
+// on nthreads threads (0 for one per processor), using up to table_megabytes
+// MB for the kernel table. The initial condition has the saturation scale
+// q02 * (x_0 / x)^lambda. The dipole amplitude N at point i of the r grid after iy steps
+// is put in N[iy * nr + i], for 0 <= iy <= nsteps, so N must have room for
+// nr * (nsteps + 1) values.
+// If tolerance is positive, the evolution takes adaptive steps keeping the
+// estimated error of N below it, and N is interpolated at the multiples of
+// deltay; otherwise every step is deltay.
+void BKEvolve(int nsteps,int nthreads,double table_megabytes,double tolerance,
+              double x_init,double q02,double x_0,double lambda,double *N);
+
+#endif
@@ -11,9 +11,12 @@
 #include<ctime>
 #include<cstdlib>
 #include<cstring>
+#include<pthread.h>
+#include<unistd.h>
 #include "comm_constr.h"
 #include "input_funr.h"
 #include "kovr.h"
+#include "bkevolution.h"
 
 using namespace std;
 
@@ -21,20 +24,59 @@ using namespace std;
 double *h_new;	// vector that holds the result of iteration at Y+dY
 double *h0;     // vector that holds the result of iteration at Y
 double *h_old;  // vector that holds the result of itertation at Y+dY (need a second one)
-const double xinit =  0.01; // initial value of x from which the evolution is started. This is the value that
+double xinit =  0.01; // initial value of x from which the evolution is started. This is the value that
 // GBW model is evaluated and set in as the initial condition
 
+// GBW model parametrization of the saturation scale of the initial condition,
+// Q0^2 (x0/x)^lambda; BKEvolve() replaces these and xinit with its arguments
+double InitQ02 = 0.56*pow(208, 1./3.);
+double InitX0 = 0.000304;
+double InitLambda = 0.288;
+
 const double rmin = exp(lrmin);		// the minimum value of r
 const double rmax = exp(lrmax);		// the maximum value of r
 
 double *xwezly;			// these are vectors needed for the Gaussian integration
 double *wwezly;
 
-double rG,logrG,lrsav;   // variables that store r and log(r) as global variables
-double nxy0,nxy1;		// values of the amplitude evaluated at r
-
 int QGWEZLY;			// parameter for Gaussian integration
 
+int NThreads = 1;		// number of threads over which the r grid is divided in SolveOneStep
+
+// Adaptive steps: with StepTolerance > 0, the evolution uses the embedded
+// Bogacki-Shampine 3(2) Runge-Kutta pair instead of the fixed steps of Deltay,
+// choosing each step so that the estimated error of N at every grid point is
+// below StepTolerance, and the results at multiples of Deltay are
+// interpolated with the cubic Hermite polynomial through the ends of the step
+double StepTolerance = 0.0;
+const double StepSafety = 0.9;		// fraction of the optimal step size to take
+const double StepShrinkMin = 0.2;	// limits on the change of the step size from one step to the next
+const double StepGrowMax = 5.0;
+const double StepMax = 2.0;		// the largest step in rapidity
+int KernelEvaluations = 0;		// number of full-grid evaluations of the kernel so far
+
+// The kernel table: the geometry of the kernel integral doesn't depend on
+// rapidity, so optionally it is tabulated once, as a sparse matrix giving the
+// contribution of each quadrature point to each point of the r grid.
+// The quadrature points in log(r') are the "nodes"; for each node and each
+// angle, the table stores the combined quadrature weight times the kernel,
+// and the interpolation stencil (index and fraction) of the second dipole.
+// Pairs of angles phi and 2pi - phi give the same second dipole, so they
+// share one entry.
+struct KernelRow {
+    int size;			// number of entries
+    int *node;			// the node of each entry
+    int *index;			// the grid point below the second dipole
+    double *t;			// the interpolation fraction of the second dipole
+    double *weight;		// quadrature weights times the kernel
+};
+double TableMegabytes = 0.0;	// memory in MB allowed for the kernel table
+int NNodes = 0;			// number of quadrature points in log(r')
+double *NodeLr;			// their values of log(r')
+double *NodeN0, *NodeN1;	// the amplitude at each node from h0 and h_old, set at each iteration
+KernelRow *KernelTable = NULL;
+int TabulatedRows = 0;		// the first TabulatedRows points of the grid are in the table
+
 // switch parameters, explained below
 enum evtype {BK,BFKL};
 enum RegType {CUTOFF,FROZEN};
@@ -47,6 +89,7 @@ evtype eqtype;
 RegType Reg;
 startstatus startup;
 
+#ifndef KOVR_LIBRARY
 int main(int argc, char** argv)
 {
     const int FieldWidth = 18;
@@ -57,70 +100,37 @@ int main(int argc, char** argv)
     // It does not affect the evolution
     const double Rapinitial = 0.0;
     
-    clock_t  start,end;		// variables to measure time
+    time_t  start,end;		// variables to measure time (wall clock, since the steps run on several threads)
     int i,j,k,iy;
     int CheckAccuracy=0;
     double logr;
-    const int n=NR;			// size of the grid in r
     fstream fileout,fileout2;
     
     StartProgram();
     
-    fileout2.open("kovr_fine_grid.dat",ios::out);
-    
-    // alpha strong
-    // FIX fixed
-    // RUNBAL running coupling Balitsky prescription
-    // RUNPAR running coupling parent dipole prescription
-    // RUNMIN running coupling minimum dipole prescription
-    alphas = FIX;
-    // linear or nonlinear equation
-    // BFKL linear evolution
-    // BK nonlinear evolution
-    eqtype = BK;
-    //what kind of initial condition
-    // GBW 
-    // MV
-    // MODEL1 some sample model
-    inpmodel  = MV;
-    
-    // initialisation of the vectors needed for the Gaussian integration
-    
-    double * xtemp = new double[NWEZLY*2];
-    double * wtemp = new double[NWEZLY*2];
-    xwezly = new double[NWEZLY];
-    wwezly = new double[NWEZLY];
-    
-    gauleg(-1.0,1.0,xtemp,wtemp,2*NWEZLY);
-    
-    for(i=0;i<NWEZLY;i++)
-    {
-        xwezly[i] = xtemp[i+NWEZLY+1];
-        wwezly[i] = wtemp[i+NWEZLY+1];
+    // the number of threads can be given as the first argument;
+    // by default there is one per processor
+    if(argc > 1) {
+        NThreads = atoi(argv[1]);
+    }
+    else {
+        NThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(NThreads < 1) NThreads = 1;
+    // the second argument is the memory in MB to use for the kernel table,
+    // by default 0, meaning the kernel is evaluated directly at every step
+    if(argc > 2) {
+        TableMegabytes = atof(argv[2]);
+    }
+    // the third argument is the tolerance for adaptive steps, by default 0,
+    // meaning fixed steps of Deltay with IterMax iterations each
+    if(argc > 3) {
+        StepTolerance = atof(argv[3]);
     }
-    QGWEZLY = NWEZLY;
-    
-    // Booking the matrices
-    Stars();
-    cout << "Booking the matrices ..." << endl;
-    
-    h_new = new double[n];
-    h_old = new double[n];
-    h0 = new double[n];
-    
-    cout << "Done..." << endl;
-    Stars();
-    
-    //Initialise the vectors with the input
-    
-    InitialiseMatrix(h0,NR);
-    InitialiseMatrix(h_old,NR);
     
-    // Print the vector to check 
-    PrintMatrix(h0,NR);
+    fileout2.open("kovr_fine_grid.dat",ios::out);
     
-    //  Zero the vector which will hold the result
-    ZeroMatrix(h_new,NR);
+    InitialiseEvolution(true);
     
     // Print some parameters just to check	
     PrintParameters();
@@ -159,28 +169,27 @@ int main(int argc, char** argv)
         }
     }
     
+    // with adaptive steps, evolve all the way first, and then write out the
+    // interpolated results at each rapidity point as the fixed steps would
+    double *Nadaptive = NULL;
+    if(StepTolerance > 0.0) {
+        start = time(NULL);
+        Nadaptive = new double[(NY+1)*NR];
+        EvolveAdaptive(NY,Nadaptive,true);
+        end = time(NULL);
+        cout << "Adaptive evolution time: " << difftime(end,start) << " seconds" << endl;
+    }
+    
     // Loop over the rapidity points
     for(iy=0;iy<NY;iy++) {
-        start = clock();
+        start = time(NULL);
         
-        // Loop over the iterations
-        for(int iter=0;iter<IterMax;iter++)
-        {
-            if(iter==0&&iy==0) 
-            {
-                startup=NEW;
-            }
-            else
-            {startup=OLD; }
-            
-            // call the function to solve this one step and perform the integrations
-            SolveOneStep(NR);
-            
-            // copy vector h_new into h_old
-            CopyMatrix(h_new,h_old,n);
-            
+        if(Nadaptive != NULL) {
+            CopyMatrix(Nadaptive+(iy+1)*NR,h_new,NR);
+        }
+        else {
+            EvolveOneStep(iy);
         }
-        //      if(CheckAccuracy==1) WriteOutErrors(h_new,h_old,NR);
         
         // write out the results for this rapidity to the file and onto screen
         double yout = Rapinitial+Deltay*(double)(iy+1);
@@ -196,10 +205,8 @@ int main(int argc, char** argv)
             fileout <<  yout << " " << exp(logr) << "  "  
             <<  input(logr,xinit/exp(yout)) << " " << h_new[i]  << endl;
         }
-        // copy the matrix h_new into h0 before starting to move to another point in rapidity
-        CopyMatrix(h_new,h0,NR);
-        end = clock();
-        cout << "Rapidity: " << yout << "    Time: " << (end-start)/CLOCKS_PER_SEC << " seconds "<< endl;
+        end = time(NULL);
+        cout << "Rapidity: " << yout << "    Time: " << difftime(end,start) << " seconds "<< endl;
         
         if ((int(yout)-yout)==0) {
             // for integer values of rapidity, interpolate in r
@@ -217,17 +224,258 @@ int main(int argc, char** argv)
             
     }
     fileout.close();
+    delete [] Nadaptive;
     
     fileout2.close();
     Stars();
     cout << "Finishing the program. Freeing the memory ..." << endl;
     
+    FreeEvolution();
+    Stars();
+    return 0;
+}
+#endif
+//***************************************************************
+// Choose the equation, set up the Gaussian integration and the kernel table,
+// and book the vectors, starting from the input distribution.
+// With verbose set, report on the screen as we go.
+void InitialiseEvolution(bool verbose)
+{
+    const int n=NR;			// size of the grid in r
+    int i;
+    
+    // alpha strong
+    // FIX fixed
+    // RUNBAL running coupling Balitsky prescription
+    // RUNPAR running coupling parent dipole prescription
+    // RUNMIN running coupling minimum dipole prescription
+    alphas = FIX;
+    // linear or nonlinear equation
+    // BFKL linear evolution
+    // BK nonlinear evolution
+    eqtype = BK;
+    //what kind of initial condition
+    // GBW 
+    // MV
+    // MODEL1 some sample model
+    inpmodel  = MV;
+    
+    // initialisation of the vectors needed for the Gaussian integration
+    
+    double * xtemp = new double[NWEZLY*2];
+    double * wtemp = new double[NWEZLY*2];
+    xwezly = new double[NWEZLY];
+    wwezly = new double[NWEZLY];
+    
+    gauleg(-1.0,1.0,xtemp,wtemp,2*NWEZLY);
+    
+    for(i=0;i<NWEZLY;i++)
+    {
+        xwezly[i] = xtemp[i+NWEZLY+1];
+        wwezly[i] = wtemp[i+NWEZLY+1];
+    }
+    QGWEZLY = NWEZLY;
+    delete [] xtemp;
+    delete [] wtemp;
+    
+    if(TableMegabytes > 0.0)
+    {
+        if(verbose) Stars();
+        if(verbose) cout << "Tabulating the kernel ..." << endl;
+        BuildKernelTable(TableMegabytes);
+        if(verbose) cout << "Done: " << TabulatedRows << " of " << NR << " points tabulated" << endl;
+    }
+    
+    // Booking the matrices
+    if(verbose) Stars();
+    if(verbose) cout << "Booking the matrices ..." << endl;
+    
+    h_new = new double[n];
+    h_old = new double[n];
+    h0 = new double[n];
+    
+    if(verbose) cout << "Done..." << endl;
+    if(verbose) Stars();
+    
+    //Initialise the vectors with the input
+    
+    InitialiseMatrix(h0,NR);
+    InitialiseMatrix(h_old,NR);
+    
+    // Print the vector to check 
+    if(verbose) PrintMatrix(h0,NR);
+    
+    //  Zero the vector which will hold the result
+    ZeroMatrix(h_new,NR);
+}
+//***************************************************************
+// Evolve from rapidity point iy to iy+1, leaving the result in h_new and h0
+void EvolveOneStep(int iy)
+{
+    // Loop over the iterations
+    for(int iter=0;iter<IterMax;iter++)
+    {
+        if(iter==0&&iy==0) 
+        {
+            startup=NEW;
+        }
+        else
+        {startup=OLD; }
+        
+        // call the function to solve this one step and perform the integrations
+        SolveOneStep(NR);
+        
+        // copy vector h_new into h_old
+        CopyMatrix(h_new,h_old,NR);
+        
+    }
+    //      if(CheckAccuracy==1) WriteOutErrors(h_new,h_old,NR);
     
+    // copy the matrix h_new into h0 before starting to move to another point in rapidity
+    CopyMatrix(h_new,h0,NR);
+}
+//***************************************************************
+void FreeEvolution()
+{
     delete [] h_new ;
     delete [] h_old;
     delete [] h0 ;
-    Stars();
-    return 0;
+    delete [] xwezly;
+    delete [] wwezly;
+    FreeKernelTable();
+}
+//***************************************************************
+void BKGridParameters(int *nr,double *logrmin,double *logrmax,double *deltay)
+{
+    *nr = NR;
+    *logrmin = lrmin;
+    *logrmax = lrmax;
+    *deltay = Deltay;
+}
+//***************************************************************
+void BKEvolve(int nsteps,int nthreads,double table_megabytes,double tolerance,
+              double x_init,double q02,double x_0,double lambda,double *N)
+{
+    xinit = x_init;
+    InitQ02 = q02;
+    InitX0 = x_0;
+    InitLambda = lambda;
+    NThreads = nthreads;
+    if(NThreads < 1) NThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(NThreads < 1) NThreads = 1;
+    TableMegabytes = table_megabytes;
+    StepTolerance = tolerance;
+    
+    InitialiseEvolution(false);
+    if(StepTolerance > 0.0)
+    {
+        EvolveAdaptive(nsteps,N,false);
+    }
+    else
+    {
+        CopyMatrix(h0,N,NR);
+        for(int iy=0;iy<nsteps;iy++)
+        {
+            EvolveOneStep(iy);
+            CopyMatrix(h_new,N+(iy+1)*NR,NR);
+        }
+    }
+    FreeEvolution();
+}
+//***************************************************************
+// Put dN/dY at the amplitude h into dh, with one full evaluation of the kernel.
+// This is the step SolveOneStep() takes with h at both ends, divided by its length.
+void Derivative(double *h,double *dh)
+{
+    startup=OLD;
+    CopyMatrix(h,h0,NR);
+    CopyMatrix(h,h_old,NR);
+    SolveOneStep(NR);
+    KernelEvaluations++;
+    for(int i=0;i<NR;i++)
+    {
+        dh[i] = (h_new[i] - h[i]) / Deltay;
+    }
+}
+//***************************************************************
+// Evolve nsteps * Deltay in rapidity with adaptive steps, putting N at point i
+// of the grid at rapidity iy * Deltay in N[iy * NR + i], as BKEvolve() does
+void EvolveAdaptive(int nsteps,double *N,bool verbose)
+{
+    double *y = new double[NR];		// the amplitude at the start of the step
+    double *ynew = new double[NR];	// the third order result at the end of the step
+    double *ytmp = new double[NR];
+    double *k1 = new double[NR];	// dN/dY at the stages; k4 at the end is k1 of the next step
+    double *k2 = new double[NR];
+    double *k3 = new double[NR];
+    double *k4 = new double[NR];
+    const double Yend = (double)nsteps * Deltay;
+    double Y = 0.0;
+    double step = Deltay;
+    int out = 1;			// the next rapidity point to write out
+    int accepted = 0, rejected = 0;
+    
+    KernelEvaluations = 0;
+    CopyMatrix(h0,y,NR);
+    CopyMatrix(y,N,NR);
+    Derivative(y,k1);
+    while(out<=nsteps)
+    {
+        if(Y+step>Yend) step = Yend-Y;
+        for(int i=0;i<NR;i++) ytmp[i] = y[i] + 0.5*step*k1[i];
+        Derivative(ytmp,k2);
+        for(int i=0;i<NR;i++) ytmp[i] = y[i] + 0.75*step*k2[i];
+        Derivative(ytmp,k3);
+        for(int i=0;i<NR;i++) ynew[i] = y[i] + step*(2.0/9.0*k1[i] + 1.0/3.0*k2[i] + 4.0/9.0*k3[i]);
+        Derivative(ynew,k4);
+        // the difference from the embedded second order result
+        double error = 0.0;
+        for(int i=0;i<NR;i++)
+        {
+            error = dmax(error,dabs(step*(-5.0/72.0*k1[i] + 1.0/12.0*k2[i] + 1.0/9.0*k3[i] - 1.0/8.0*k4[i])));
+        }
+        error /= StepTolerance;
+        const double factor = error > 0.0 ? dmin(StepGrowMax,dmax(StepShrinkMin,StepSafety*pow(error,-1.0/3.0))) : StepGrowMax;
+        if(error>1.0)
+        {
+            rejected++;
+            step *= factor;
+            continue;
+        }
+        accepted++;
+        // write out the rapidity points in this step
+        while(out<=nsteps&&(double)out*Deltay<=Y+step*(1.0+1.0e-12))
+        {
+            const double theta = dmin(1.0,((double)out*Deltay-Y)/step);
+            const double t2 = theta*theta;
+            const double t3 = t2*theta;
+            double *n = N+out*NR;
+            for(int i=0;i<NR;i++)
+            {
+                n[i] = (2.0*t3-3.0*t2+1.0)*y[i] + (t3-2.0*t2+theta)*step*k1[i]
+                     + (3.0*t2-2.0*t3)*ynew[i] + (t3-t2)*step*k4[i];
+            }
+            out++;
+        }
+        Y += step;
+        CopyMatrix(ynew,y,NR);
+        CopyMatrix(k4,k1,NR);
+        step = dmin(StepMax,step*factor);
+    }
+    CopyMatrix(y,h_new,NR);
+    if(verbose)
+    {
+        cout << "Adaptive steps: " << accepted << " accepted, " << rejected << " rejected, "
+        << KernelEvaluations << " kernel evaluations (fixed steps use " << nsteps*IterMax << ")" << endl;
+    }
+    
+    delete [] y;
+    delete [] ynew;
+    delete [] ytmp;
+    delete [] k1;
+    delete [] k2;
+    delete [] k3;
+    delete [] k4;
 }
 //***************************************************************
 // The input distribution, the initial condition for the Balitsky-Kovchegov equation
@@ -256,11 +504,7 @@ double input(double logr,double x)
 double Qsat2(double x)
 {
     // GBW model parametrization of the saturation scale	
-    double lambda =  0.288;
-    double Q02 = 0.56*pow(208, 1./3.);
-    double x0 = 0.000304;
-    
-    return pow(x0/x,lambda) * Q02;
+    return pow(InitX0/x,InitLambda) * InitQ02;
 }
 //***************************************************************
 // function to initialise the vector with values from the input model
@@ -300,6 +544,9 @@ void PrintParameters()
     cout << " Y_max   = " << Ymax << endl;
     cout << " asb      = " << alphastrong << endl;
     cout << " Number of iterations: " << IterMax << endl;
+    cout << " Adaptive step tolerance: " << StepTolerance << endl;
+    cout << " Number of threads: " << NThreads << endl;
+    cout << " Kernel table memory (MB): " << TableMegabytes << endl;
 }
 //***************************************************************
 // Puts all vector elements to zero
@@ -336,32 +583,280 @@ void WriteOutErrors(double *h1,double *h2,int n)
     }
 }
 //***************************************************************
-// call the integration routine
-void SolveOneStep(int n)
+// the points of the r grid handled by one thread
+struct StepSlice {
+    void (*work)(int,int);
+    int first, last;
+};
+//***************************************************************
+// evolve the points first <= i < last of the r grid
+// they depend only on h0 and h_old, so the points can be done in any order
+void SolveSlice(int first,int last)
 {
     int m = 5;  // this parameter controls the number of divisions of the integral in r
     // can be used to test accuracy of the calculation
     
     double deltam=(lrmax-lrmin)/(double)m;
     double sum = 0.0;
+    KernelPoint p;
     
-    // loop over all points in r grid
-    for(int i=0;i<n;i++)
+    for(int i=first;i<last;i++)
     {	
-        logrG = lrmin + (double)i * Deltar;
-        rG = exp(logrG);		
-        nxy1 = h_old[i];
-        nxy0 = h0[i];		
+        // the first step uses the input function directly, not the grid
+        if(i<TabulatedRows&&startup==OLD)
+        {
+            h_new[i] = h0[i] + KERCOFF * TabulatedIntegral(i);
+            continue;
+        }
+        p.logr = lrmin + (double)i * Deltar;
+        p.r = exp(p.logr);		
+        p.nxy1 = h_old[i];
+        p.nxy0 = h0[i];		
         sum = 0.0;
         
         for(int k=0;k<m;k++)
         {
-            sum += quad2d(Kernel,lrmin+(double)k*deltam,lrmin+(double)(k+1)*deltam);
+            sum += quad2d(Kernel,p,lrmin+(double)k*deltam,lrmin+(double)(k+1)*deltam);
         }
         h_new[i] = h0[i] +  KERCOFF * sum;
     }
 }
 //***************************************************************
+void *SliceWorker(void *closure)
+{
+    StepSlice *slice = (StepSlice *)closure;
+    slice->work(slice->first,slice->last);
+    return NULL;
+}
+//***************************************************************
+// call work(first,last) on slices covering 0 <= i < n, on NThreads threads
+void RunSlices(void (*work)(int,int),int n)
+{
+    int nthreads = NThreads < n ? NThreads : n;
+    if(nthreads < 1) nthreads = 1;
+    StepSlice *slices = new StepSlice[nthreads];
+    pthread_t *threads = new pthread_t[nthreads];
+    int started = 0;
+    
+    for(int t=0;t<nthreads;t++)
+    {
+        slices[t].work = work;
+        slices[t].first = (int)((long)n * t / nthreads);
+        slices[t].last = (int)((long)n * (t+1) / nthreads);
+    }
+    // the first slice is done on this thread
+    for(int t=1;t<nthreads;t++)
+    {
+        if(pthread_create(&threads[t],NULL,SliceWorker,&slices[t]) != 0) break;
+        started = t;
+    }
+    work(slices[0].first,slices[0].last);
+    for(int t=1;t<=started;t++)
+    {
+        pthread_join(threads[t],NULL);
+    }
+    // if a thread couldn't be started, do its slice here
+    for(int t=started+1;t<nthreads;t++)
+    {
+        work(slices[t].first,slices[t].last);
+    }
+    
+    delete [] threads;
+    delete [] slices;
+}
+//***************************************************************
+// call the integration routine, dividing the r grid among NThreads threads
+void SolveOneStep(int n)
+{
+    if(TabulatedRows>0&&startup==OLD)
+    {
+        // the first dipole only depends on the node
+        for(int q=0;q<NNodes;q++)
+        {
+            NodeN0[q] = inter(NodeLr[q],h0);
+            NodeN1[q] = inter(NodeLr[q],h_old);
+        }
+    }
+    RunSlices(SolveSlice,n);
+}
+//***************************************************************
+// the integral of the kernel for point i of the grid, from the table
+double TabulatedIntegral(int i)
+{
+    const KernelRow &row = KernelTable[i];
+    const double nxy0 = h0[i];
+    const double nxy1 = h_old[i];
+    double sum = 0.0;
+    
+    for(int e=0;e<row.size;e++)
+    {
+        const int q = row.node[e];
+        const int j = row.index[e];
+        const double t = row.t[e];
+        const double t1 = 1.0 - t;
+        const double nzx0 = NodeN0[q];
+        const double nzx1 = NodeN1[q];
+        const double nzy0 = t1 * h0[j] + t * h0[j+1];
+        const double nzy1 = t1 * h_old[j] + t * h_old[j+1];
+        switch(eqtype){
+            case BK:
+                sum += row.weight[e] *
+                ( 0.5 * ( nzx0 + nzx1 + nzy0 + nzy1 - nxy0 - nxy1 )  -
+                1.0/3.0 * ( nzx0 * nzy0 + nzx1 * nzy1 ) -
+                1.0/6.0 * ( nzx0 * nzy1 + nzx1 * nzy0 ));
+                break;
+            case BFKL:
+                sum += row.weight[e] *
+                0.5 * ( nzx0 + nzx1 + nzy0 + nzy1 - nxy0 - nxy1 );
+                break;
+        }
+    }
+    return sum;
+}
+//***************************************************************
+// the kernel without the amplitudes, i.e. kernelint in Kernel(),
+// for the dipole sizes r, rprim, rbis
+double KernelFactor(double r,double rprim,double rbis)
+{
+    switch (alphas) {
+        case FIX:
+            return alphastrong * r * r  / (rbis * rbis);
+        case RUNBAL:
+            return alphalo(r) * ((alphalo(rprim)/alphalo(rbis)-1.0) +
+            (rprim*rprim)/(rbis*rbis)*(alphalo(rbis)/alphalo(rprim)-1.0)+r*r/(rbis*rbis) );
+        case RUNPAR:
+            return alphalo(r) * r * r  / (rbis * rbis);
+        case RUNMIN:
+            return alphalo(dmin(r,dmin(rprim,rbis))) * r * r  / (rbis * rbis);
+    }
+    return 0.0;
+}
+//***************************************************************
+// the interpolation stencil used by inter() at params
+void InterStencil(double params,int *index,double *t)
+{
+    static double eps=1.0e-8;
+    if(params>=lrmax) params=lrmax-eps;
+    if(params<=lrmin) params=lrmin+eps;
+    *index = (int)((params-lrmin)/Deltar);
+    *t = (params-lrmin)/Deltar - (double)(*index);
+}
+//***************************************************************
+// the quadrature weights of the nodes, used only while building the table
+double *NodeWeight;
+//***************************************************************
+// fill in the rows first <= i < last of the kernel table
+void TabulateSlice(int first,int last)
+{
+    const int nangles = QGWEZLY;	// one entry per pair of angles
+    double *angles = new double[nangles];
+    double *angleweights = new double[nangles];
+    {
+        // the same points as qangle(), with m = 1
+        double a=0.0;
+        double b=2.0*M_PI;
+        double xm=0.5*(a+b);
+        double xr=0.5*(b-a);
+        for(int l=0;l<nangles;l++)
+        {
+            angles[l] = xm + xr*xwezly[l];
+            angleweights[l] = 2.0*wwezly[l]*xr;
+        }
+    }
+    
+    for(int i=first;i<last;i++)
+    {
+        KernelRow &row = KernelTable[i];
+        const double r = exp(lrmin + (double)i * Deltar);
+        int size = 0;
+        for(int q=0;q<NNodes;q++)
+        {
+            const double rprim = exp(NodeLr[q]);
+            for(int l=0;l<nangles;l++)
+            {
+                double rbis = sqrt(r * r + rprim * rprim + 2.0 * r * rprim * cos(angles[l])) ;
+                bool outside = false;
+                if(rbis<rmin) {rbis=rmin;outside=true;}
+                else if(rbis>rmax) {rbis=rmax;outside=true;}
+                if(Reg==CUTOFF&&outside) continue;
+                row.node[size] = q;
+                InterStencil(log(rbis),&row.index[size],&row.t[size]);
+                row.weight[size] = NodeWeight[q] * angleweights[l] * KernelFactor(r,rprim,rbis);
+                size++;
+            }
+        }
+        row.size = size;
+    }
+    delete [] angles;
+    delete [] angleweights;
+}
+//***************************************************************
+// Tabulate the kernel for as many points of the r grid as fit in the given
+// number of megabytes. The rest of the points are integrated directly.
+void BuildKernelTable(double megabytes)
+{
+    const int m = 5;		// as in SolveSlice
+    const double deltam=(lrmax-lrmin)/(double)m;
+    
+    NNodes = m * 2 * QGWEZLY;
+    NodeLr = new double[NNodes];
+    NodeWeight = new double[NNodes];
+    NodeN0 = new double[NNodes];
+    NodeN1 = new double[NNodes];
+    // the same points as quad2d() on each of the m divisions
+    int q = 0;
+    for(int k=0;k<m;k++)
+    {
+        double a=lrmin+(double)k*deltam;
+        double b=lrmin+(double)(k+1)*deltam;
+        double xm=0.5*(a+b);
+        double xr=0.5*(b-a);
+        for(int j=0;j<QGWEZLY;j++)
+        {
+            double dx=xr*xwezly[j];
+            NodeLr[q] = xm+dx;
+            NodeWeight[q++] = wwezly[j]*xr;
+            NodeLr[q] = xm-dx;
+            NodeWeight[q++] = wwezly[j]*xr;
+        }
+    }
+    
+    const long rowentries = (long)NNodes * QGWEZLY;
+    const double rowbytes = (double)rowentries * (2*sizeof(int) + 2*sizeof(double));
+    TabulatedRows = (int)dmin((double)NR, megabytes * 1024.0 * 1024.0 / rowbytes);
+    KernelTable = new KernelRow[NR];
+    for(int i=0;i<TabulatedRows;i++)
+    {
+        KernelTable[i].size = 0;
+        KernelTable[i].node = new int[rowentries];
+        KernelTable[i].index = new int[rowentries];
+        KernelTable[i].t = new double[rowentries];
+        KernelTable[i].weight = new double[rowentries];
+    }
+    RunSlices(TabulateSlice,TabulatedRows);
+    
+    delete [] NodeWeight;
+    NodeWeight = NULL;
+}
+//***************************************************************
+void FreeKernelTable()
+{
+    if(KernelTable==NULL) return;
+    for(int i=0;i<TabulatedRows;i++)
+    {
+        delete [] KernelTable[i].node;
+        delete [] KernelTable[i].index;
+        delete [] KernelTable[i].t;
+        delete [] KernelTable[i].weight;
+    }
+    delete [] KernelTable;
+    delete [] NodeLr;
+    delete [] NodeN0;
+    delete [] NodeN1;
+    KernelTable = NULL;
+    TabulatedRows = 0;
+}
+//***************************************************************
 double qgauss(double (*func)(double),double a,double b)
 {
     int j;
@@ -411,38 +906,52 @@ double qgauss24(double (*func)(double),double a,double b)
 }
 //***************************************************************
 /* this routine calculates double integral */
-/* together with the qgauss, w1,w2 functions */
-double quad2d(double (*func)(double,double),double lrlow,double lrhi)
+/* over log(r') from lrlow to lrhi and over the angle from 0 to 2 pi */
+/* with the same Gauss-Legendre points as QGAUSS on each */
+double quad2d(double (*func)(const KernelPoint&,double,double),const KernelPoint& p,double lrlow,double lrhi)
 {
-    ur2func=func;	
-    return QGAUSS(w1,lrlow,lrhi);
+    double xm=0.5*(lrlow+lrhi);
+    double xr=0.5*(lrhi-lrlow);
+    double s=0;
+    for(int j=0;j<QGWEZLY;j++)
+    {
+        double dx=xr*xwezly[j];
+        s+=wwezly[j]*(qangle(func,p,xm+dx)+qangle(func,p,xm-dx));
+    }
+    return s*=xr;
 }
 //***************************************************************
-/* this is the interface to the double integration */
-// in this function we actually compute the integral over the angle
-double w1(double lrprim)
+/* in this function we actually compute the integral over the angle */
+double qangle(double (*func)(const KernelPoint&,double,double),const KernelPoint& p,double lrprim)
 {
     int m = 1;
-    lrsav = lrprim;
     double deltam = 2.0* M_PI /(double)m;
     double sum = 0.0;
     
     for(int k=0;k<m;k++)
     {
-        sum+= QGAUSS(w2,(double)k*deltam,(double)(k+1)*deltam);
+        double a=(double)k*deltam;
+        double b=(double)(k+1)*deltam;
+        double xm=0.5*(a+b);
+        double xr=0.5*(b-a);
+        double s=0;
+        for(int j=0;j<QGWEZLY;j++)
+        {
+            double dx=xr*xwezly[j];
+            s+=wwezly[j]*((*func)(p,lrprim,xm+dx)+(*func)(p,lrprim,xm-dx));
+        }
+        sum+= s*xr;
     }
     return sum;
 }
-// **************************************************************
-double w2(double angle)
-{
-    return (*ur2func)(lrsav,angle);	
-}
 //***************************************************************
 // Main routine with the kernel
 // Last changes 14.11.2012 A.S.
-double Kernel(double lrprim,double phi)
+double Kernel(const KernelPoint& p,double lrprim,double phi)
 { 
+    const double rG = p.r;
+    const double nxy0 = p.nxy0;
+    const double nxy1 = p.nxy1;
     double kernelint;
     double nzx0,nzx1,nzy0,nzy1;
     enum stat_bound {YES,NO};
@@ -489,25 +998,7 @@ double Kernel(double lrprim,double phi)
     // K is the BFKL kernel
     // rprim *rprim comes from jacobian and the fact that we integrated over log(r)
     
-    switch (alphas) {
-        // fixed coupling constant
-        case FIX:
-            kernelint = alphastrong * rG * rG  / (rbis * rbis);
-            break;
-            // running coupling using Balitsky prescription
-        case RUNBAL:
-            kernelint = alphalo(rG) * ((alphalo(rprim)/alphalo(rbis)-1.0) +
-            (rprim*rprim)/(rbis*rbis)*(alphalo(rbis)/alphalo(rprim)-1.0)+rG*rG/(rbis*rbis) );
-            break;
-            // running coupling with argument of a parent dipole
-        case RUNPAR:
-            kernelint = alphalo(rG) * rG * rG  / (rbis * rbis);
-            break;
-            // running coupling with argument of a minimum size dipole
-        case RUNMIN:
-            kernelint = alphalo(dmin(rG,dmin(rprim,rbis))) * rG * rG  / (rbis * rbis);
-            break;	
-    }
+    kernelint = KernelFactor(rG,rprim,rbis);
     
     
     if(Reg==CUTOFF&&SetZero==YES) {
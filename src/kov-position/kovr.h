@@ -1,19 +1,22 @@
 extern void gauleg(double x1, double x2, double * x, double * w, int n);
-double Kernel(double lrprim,double phi);
+// the point of the r grid being evolved, with the amplitude there at Y and at Y+dY
+struct KernelPoint {
+    double r,logr;
+    double nxy0,nxy1;
+};
+double Kernel(const KernelPoint& p,double lrprim,double phi);
 double Kernel_Mass(double lrprim,double phi);
 double Kercar(double zx,double zy);
-double (*ur2func)(double,double);
 double (*Kerfun)(double,double);
 double qgauss24(double (*func)(double),double a,double b);
 double qgauss(double (*func)(double),double a,double b);
 double QGAUSS(double (*func)(double),double a,double b);
-double w2(double phi);
-double w1(double rprim);
 double Lim1(double a);
 double Lim2(double b);
 double Cc2(double zx);
 double Cc1(double zy);
-double quad2d(double (*func)(double,double),double rlow,double rhi);
+double quad2d(double (*func)(const KernelPoint&,double,double),const KernelPoint& p,double lrlow,double lrhi);
+double qangle(double (*func)(const KernelPoint&,double,double),const KernelPoint& p,double lrprim);
 double quad2d_car(double (*func)(double,double),double rlow,double rhi);
 double input(double pars,double x);
 double Qsat2(double);
@@ -26,7 +29,20 @@ void ZeroMatrix(double *h1,int n);
 void PrintMatrix(double *h1,int n);
 void CopyMatrix(double *h1,double *h2,int n);
 void WriteOutErrors(double *h1,double *h2,int n);
+void InitialiseEvolution(bool verbose);
+void EvolveOneStep(int iy);
+void Derivative(double *h,double *dh);
+void EvolveAdaptive(int nsteps,double *N,bool verbose);
+void FreeEvolution();
 void SolveOneStep(int n);
+void SolveSlice(int first,int last);
+void RunSlices(void (*work)(int,int),int n);
+double KernelFactor(double r,double rprim,double rbis);
+void InterStencil(double params,int *index,double *t);
+double TabulatedIntegral(int i);
+void TabulateSlice(int first,int last);
+void BuildKernelTable(double megabytes);
+void FreeKernelTable();
 void CheckIntegral(int *n);
 double dabs(double arg);
 double dmax(double arg1,double arg2);
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <set>
+#include <utility>
+#include <gsl/gsl_interp.h>
+#include <gsl/gsl_math.h>
+#include "../log.h"
+#include "gridrefinement.h"
+#include "resultscalculator.h"
+
+using std::endl;
+using std::make_pair;
+using std::map;
+using std::ostream;
+using std::pair;
+using std::set;
+using std::vector;
+
+/**
+ * The smallest interval that is split, as a fraction of the extent of its
+ * line, so that a discontinuity can't make the refinement go on forever
+ */
+static const double minimum_spacing = 1e-3;
+
+/** The sums of the totals and squared errors over the seeds at one (pT2, Y) */
+struct SeedSums {
+    double total, error2;
+    size_t count;
+    /** Whether every result of every seed is valid */
+    bool valid;
+};
+
+/** Orders points along their line */
+struct PointOrder {
+    template<typename P>
+    bool operator()(const P& a, const P& b) const { return a.x < b.x; }
+};
+
+GridRefinement::GridRefinement(ResultsCalculator& rc, const Axis axis, const double tolerance, const size_t max_points) :
+  rc(rc), axis(axis), tolerance(tolerance), max_points(max_points) {
+    assert(tolerance > 0);
+    if (max_points == 0) {
+        size_t points;
+        collect_lines(&points);
+        this->max_points = 4 * points;
+    }
+}
+
+GridRefinement::LineMap GridRefinement::collect_lines(size_t* points) const {
+    map<pair<double, double>, SeedSums> sums;
+    for (size_t ccindex = 0; ccindex < rc.cc.size(); ccindex++) {
+        const Context& ctx = rc.cc[ccindex];
+        const SeedSums empty = {0, 0, 0, true};
+        SeedSums& s = sums.insert(make_pair(make_pair(ctx.pT2, ctx.Y), empty)).first->second;
+        double total = 0, error2 = 0;
+        // only the configured gluon distribution and scales, not the variants
+        for (size_t hfindex = 0; hfindex < rc.columns(); hfindex += rc.variant_count()) {
+            double l_real, l_imag, l_error;
+            if (!rc.valid(ccindex, hfindex)) {
+                s.valid = false;
+                break;
+            }
+            rc.result(ccindex, hfindex, &l_real, &l_imag, &l_error);
+            total += l_real;
+            error2 += l_error * l_error;
+        }
+        s.total += total;
+        s.error2 += error2;
+        s.count++;
+    }
+    *points = sums.size();
+
+    LineMap lines;
+    for (map<pair<double, double>, SeedSums>::const_iterator it = sums.begin(); it != sums.end(); it++) {
+        const SeedSums& s = it->second;
+        if (!s.valid || !gsl_finite(s.total)) {
+            continue;
+        }
+        Point p;
+        p.pT = sqrt(it->first.first);
+        p.Y = it->first.second;
+        p.total = s.total / s.count;
+        p.error = sqrt(s.error2) / s.count;
+        p.x = axis == PT ? log(p.pT) : p.Y;
+        lines[axis == PT ? p.Y : p.pT].push_back(p);
+    }
+    // the map visits them in order of pT, which is already the order along the pT axis
+    if (axis == RAPIDITY) {
+        for (LineMap::iterator it = lines.begin(); it != lines.end(); it++) {
+            sort(it->second.begin(), it->second.end(), PointOrder());
+        }
+    }
+    return lines;
+}
+
+bool GridRefinement::logarithmic(const Line& line) {
+    for (Line::const_iterator it = line.begin(); it != line.end(); it++) {
+        if (!(it->total > 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Sets `values` to the interpolated variable at each point, ln(total) or
+ * the total, and `noise` to its statistical uncertainty
+ */
+static void interpolation_values(const vector<double>& totals, const vector<double>& errors, const bool log_scale, vector<double>& values, vector<double>& noise) {
+    values.resize(totals.size());
+    noise.resize(totals.size());
+    for (size_t i = 0; i < totals.size(); i++) {
+        values[i] = log_scale ? log(totals[i]) : totals[i];
+        noise[i] = log_scale ? errors[i] / totals[i] : errors[i];
+    }
+}
+
+void GridRefinement::find_candidates(const Line& line, vector<Candidate>& candidates) const {
+    // a cubic spline needs at least three points
+    if (line.size() < 3) {
+        return;
+    }
+    const bool log_scale = logarithmic(line);
+    vector<double> x, totals, errors, y, noise;
+    for (Line::const_iterator it = line.begin(); it != line.end(); it++) {
+        x.push_back(it->x);
+        totals.push_back(it->total);
+        errors.push_back(it->error);
+    }
+    interpolation_values(totals, errors, log_scale, y, noise);
+
+    gsl_interp* spline = gsl_interp_alloc(gsl_interp_cspline, x.size());
+    gsl_interp_init(spline, &x[0], &y[0], x.size());
+    const double extent = x.back() - x.front();
+    for (size_t i = 0; i + 1 < x.size(); i++) {
+        if (x[i + 1] - x[i] < minimum_spacing * extent) {
+            continue;
+        }
+        const double middle = 0.5 * (x[i] + x[i + 1]);
+        const double curved = gsl_interp_eval(spline, &x[0], &y[0], middle, NULL);
+        const double straight = 0.5 * (y[i] + y[i + 1]);
+        const double difference = fabs(curved - straight);
+        // in ln(total) the difference is already relative
+        const double allowed = log_scale ? tolerance : tolerance * fabs(curved);
+        const double uncertainty = 0.5 * (noise[i] + noise[i + 1]);
+        if (difference > allowed && difference > uncertainty) {
+            Candidate c;
+            c.pT = axis == PT ? exp(middle) : line[i].pT;
+            c.Y = axis == PT ? line[i].Y : middle;
+            c.excess = difference / std::max(allowed, uncertainty);
+            candidates.push_back(c);
+        }
+    }
+    gsl_interp_free(spline);
+}
+
+void GridRefinement::refine() {
+    size_t round = 0;
+    while (true) {
+        size_t points;
+        const LineMap lines = collect_lines(&points);
+        vector<Candidate> candidates;
+        for (LineMap::const_iterator it = lines.begin(); it != lines.end(); it++) {
+            find_candidates(it->second, candidates);
+        }
+        // leave out points that already exist, e.g. ones whose integration failed
+        set<pair<double, double> > existing;
+        for (size_t ccindex = 0; ccindex < rc.cc.size(); ccindex++) {
+            existing.insert(make_pair(rc.cc[ccindex].pT2, rc.cc[ccindex].Y));
+        }
+        vector<Candidate> new_candidates;
+        for (vector<Candidate>::const_iterator it = candidates.begin(); it != candidates.end(); it++) {
+            if (existing.count(make_pair(gsl_pow_2(it->pT), it->Y)) == 0) {
+                new_candidates.push_back(*it);
+            }
+        }
+        if (new_candidates.empty()) {
+            logger << "Grid refinement finished with " << points << " points" << endl;
+            break;
+        }
+        if (points >= max_points) {
+            logger << "Grid refinement stopped at the limit of " << max_points << " points, with " << new_candidates.size() << " intervals still above the tolerance" << endl;
+            break;
+        }
+        // the intervals furthest from the tolerance first
+        sort(new_candidates.begin(), new_candidates.end());
+        if (new_candidates.size() > max_points - points) {
+            new_candidates.resize(max_points - points);
+        }
+
+        round++;
+        logger << "Grid refinement round " << round << ": adding " << new_candidates.size() << " points" << endl;
+        size_t added = 0;
+        for (vector<Candidate>::const_iterator it = new_candidates.begin(); it != new_candidates.end(); it++) {
+            added += rc.add_contexts(it->pT, it->Y);
+        }
+        if (added == 0) {
+            logger << "Grid refinement stopped because none of the new points are valid" << endl;
+            break;
+        }
+        rc.calculate();
+    }
+}
+
+void GridRefinement::write(ostream& out, const size_t subdivisions) const {
+    size_t points;
+    const LineMap lines = collect_lines(&points);
+    for (LineMap::const_iterator it = lines.begin(); it != lines.end(); it++) {
+        const Line& line = it->second;
+        out << "# refined grid at " << (axis == PT ? "Y" : "pT") << " = " << it->first << endl;
+        out << "# pT Y total error" << endl;
+        vector<double> x, totals, errors, y, noise;
+        for (Line::const_iterator pit = line.begin(); pit != line.end(); pit++) {
+            out << pit->pT << " " << pit->Y << " " << pit->total << " " << pit->error << endl;
+            x.push_back(pit->x);
+            totals.push_back(pit->total);
+            errors.push_back(pit->error);
+        }
+        if (line.size() < 2) {
+            out << endl;
+            continue;
+        }
+        const bool log_scale = logarithmic(line);
+        interpolation_values(totals, errors, log_scale, y, noise);
+        const gsl_interp_type* type = line.size() < 3 ? gsl_interp_linear : gsl_interp_cspline;
+        gsl_interp* interpolant = gsl_interp_alloc(type, x.size());
+        gsl_interp_init(interpolant, &x[0], &y[0], x.size());
+        out << "# " << (line.size() < 3 ? "linear" : "cubic spline") << " interpolation in " << (axis == PT ? "ln(pT)" : "Y") << " of " << (log_scale ? "ln(total)" : "total") << endl;
+        out << "# pT Y total" << endl;
+        for (size_t i = 0; i + 1 < x.size(); i++) {
+            // the last interval includes its upper end
+            const size_t n = i + 2 < x.size() ? subdivisions : subdivisions + 1;
+            for (size_t k = 0; k < n; k++) {
+                const double xk = k == subdivisions ? x[i + 1] : x[i] + (x[i + 1] - x[i]) * k / subdivisions;
+                const double v = gsl_interp_eval(interpolant, &x[0], &y[0], xk, NULL);
+                const double pT = axis == PT ? exp(xk) : line[i].pT;
+                const double Y = axis == PT ? line[i].Y : xk;
+                out << pT << " " << Y << " " << (log_scale ? exp(v) : v) << endl;
+            }
+        }
+        gsl_interp_free(interpolant);
+        out << endl;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <vector>
+
+class ResultsCalculator;
+
+/**
+ * Refines the grid of (pT, Y) points of a calculation along one axis, for
+ * `--refine`, by adding points only where the cross section can't be
+ * interpolated accurately from the ones already computed.
+ *
+ * The points are grouped into lines along the axis, one for each value of
+ * the other coordinate. The total of each point (averaged over the seeds) is
+ * interpolated along its line with a cubic spline, in ln(total) when every
+ * total on the line is positive and in the total itself otherwise, and in
+ * ln(pT) along the pT axis. The difference between the spline and linear
+ * interpolation at the middle of an interval estimates how far the
+ * curvature there makes the interpolation off. A point is added at the
+ * middle of each interval where that estimate exceeds both the tolerance,
+ * relative to the total, and the statistical error of the neighbouring
+ * points, which it makes no sense to resolve below. This is repeated until
+ * no interval needs another point or the number of points reaches the limit.
+ */
+class GridRefinement {
+public:
+    typedef enum {PT, RAPIDITY} Axis;
+
+    /**
+     * Sets up the refinement of the results of `rc`, which calculate()
+     * should already have been called for, with at most `max_points`
+     * distinct (pT, Y) points in the end, or four times as many as there
+     * are to begin with if `max_points` is 0
+     */
+    GridRefinement(ResultsCalculator& rc, const Axis axis, const double tolerance, const size_t max_points);
+
+    /** Adds points and calculates them until the grid is fine enough */
+    void refine();
+
+    /**
+     * Writes each line of the refined grid, followed by the spline through
+     * it evaluated at `subdivisions` evenly spaced points in each interval
+     */
+    void write(std::ostream& out, const size_t subdivisions) const;
+
+private:
+    /** The total at one (pT, Y) point, averaged over the seeds */
+    struct Point {
+        double pT, Y;
+        double total, error;
+        /** The position of the point along the axis */
+        double x;
+    };
+    /** The valid points with the same value of the other coordinate, in order along the axis */
+    typedef std::vector<Point> Line;
+    typedef std::map<double, Line> LineMap;
+
+    /** A point to add, and how far its interval is from being fine enough */
+    struct Candidate {
+        double pT, Y;
+        double excess;
+        bool operator<(const Candidate& other) const { return excess > other.excess; }
+    };
+
+    ResultsCalculator& rc;
+    const Axis axis;
+    const double tolerance;
+    size_t max_points;
+
+    /** Groups the computed results of rc into lines */
+    LineMap collect_lines(size_t* points) const;
+    /** Appends the intervals of `line` that need another point to `candidates` */
+    void find_candidates(const Line& line, std::vector<Candidate>& candidates) const;
+    /** Whether `line` is interpolated in the logarithm of the total */
+    static bool logarithmic(const Line& line);
+};
@@ -25,19 +25,21 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
-#include <openssl/sha.h>
 #include "muParserError.h"
 #include "git_revision.h"
 #include "../exceptions.h"
 #include "../configuration/context.h"
 #include "../utils/utils.h"
 #include "../log.h"
+#include "gridrefinement.h"
 #include "programconfiguration.h"
+#include "resultcache.h"
 #include "resultscalculator.h"
 
 using namespace std;
@@ -46,13 +48,17 @@ using namespace std;
 ostream& logger = cerr;
 
 /**
- * The one instance of ResultsCalculator used for the program.
+ * The instance of ResultsCalculator used for the current calculation.
  *
  * This has to be a pointer, not a reference, because it's undefined
  * until the actual ResultsCalculator object is constructed in the
- * run() function.
+ * run_configuration() function, and with --batch it changes from one
+ * job to the next.
  */
-static ResultsCalculator* p_rc;
+static ResultsCalculator* p_rc = NULL;
+
+/** The number of interpolated points written in each interval with --refine-output */
+static const size_t refine_output_subdivisions = 8;
 
 /**
  * Takes care of finishing the program if it gets interrupted by a signal.
@@ -65,7 +71,9 @@ void termination_handler(int signal) {
     static bool terminated = false;
     if (!terminated) {
         terminated = true;
-        cout << *p_rc;
+        if (p_rc != NULL) {
+            cout << *p_rc;
+        }
 
         time_t rawtime;
         time(&rawtime);
@@ -74,37 +82,6 @@ void termination_handler(int signal) {
     exit(2);
 }
 
-// from http://stackoverflow.com/questions/3969047/is-there-a-standard-way-of-representing-an-sha1-hash-as-a-c-string-and-how-do-i
-string get_hex_representation(const unsigned char* bytes, size_t length) {
-    ostringstream os;
-    os.fill('0');
-    os << hex;
-    for(const unsigned char * ptr=bytes; ptr < bytes+length; ptr++) {
-        os << setw(2) << static_cast<unsigned int>(*ptr);
-    }
-    return os.str();
-}
-
-string sha1_file(string filename) {
-    char buffer[1024];
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    SHA_CTX c;
-    SHA1_Init(&c);
-    ifstream i(filename.c_str());
-    if (!i) {
-        ostringstream oss;
-        oss << "Error opening file for SHA checksum: " << filename;
-        throw ios_base::failure(oss.str());
-    }
-    while (i) {
-        i.read(buffer, sizeof(buffer));
-        SHA1_Update(&c, buffer, static_cast<size_t>(i.gcount()));
-    }
-    i.close();
-    SHA1_Final(hash, &c);
-    return get_hex_representation(hash, SHA_DIGEST_LENGTH);
-}
-
 /**
  * GSL error handler function that throws a GSLException.
  */
@@ -113,21 +90,13 @@ void gsl_error_throw(const char* reason, const char* file, int line, int gsl_err
 }
 
 /**
- * Runs the program.
+ * Runs the calculation of one configuration and writes out its results.
  *
- * This is like main() except that it can throw exceptions, which will
- * be caught in the real main().
+ * The resources in `shared`, if it is not NULL, are reused where they fit
+ * the configuration. If `append_stream` is true, the results are added to
+ * the end of the --stream file instead of replacing it.
  */
-int run(int argc, char** argv) {
-    time_t rawtime;
-
-    time(&rawtime);
-    logger << "Starting at " << ctime(&rawtime) << endl;
-
-    gsl_set_error_handler(&gsl_error_throw);
-
-    ProgramConfiguration pc(argc, argv);
-
+static int run_configuration(const ProgramConfiguration& pc, SharedResources* shared, const bool append_stream) {
     /* First write out all the configuration variables. Having the configuration written
      * out as part of the output file makes it easy to tell what parameters were used in
      * and given run, and is also useful in case we want to reproduce a run.
@@ -142,15 +111,38 @@ int run(int argc, char** argv) {
 #endif
     }
 
-    ResultsCalculator rc(pc);
+    ResultsCalculator rc(pc, shared);
 
     {
+        /* Everything the results depend on goes into the journal key, so that a
+         * journal is never resumed with results from a different calculation.
+         * The result cache keys use the same data, except that the configuration
+         * is covered by the Context of each result instead.
+         */
+        ostringstream shared_key_data;
+        // without cubature_regions_per_step, cubature takes a few regions per
+        // integration thread at each step, as in Integrator::integrate_impl()
+        const size_t configured_regions_per_step = rc.cc.empty() ? 0 : rc.cc[0].cubature_regions_per_step;
+        const size_t regions_per_step = configured_regions_per_step > 0 ? configured_regions_per_step
+                                      : rc.integration_threads == 1 ? 1 : 4 * rc.integration_threads;
+        shared_key_data << "separate = " << pc.separate() << endl
+                        << "batched = " << (rc.integration_threads > 1) << endl
+                        << "regions_per_step = " << regions_per_step << endl
+                        << "xg_min = " << pc.xg_min() << endl
+                        << "xg_max = " << pc.xg_max() << endl;
+        const bool need_hashes = pc.print_config() || !pc.journal_filename().empty() || !pc.result_cache_directory().empty();
+
         FileDataGluonDistribution* fgdist = dynamic_cast<FileDataGluonDistribution*>(rc.cc[0].gdist);
-        if (pc.print_config() && fgdist != NULL) {
-            // print hashes of the input files
+        if (need_hashes && fgdist != NULL) {
+            // hashes of the input files
             // TODO: make the gdist compute the hashes itself
-            cout << "# momentum gdist file hash: " << sha1_file(rc.cc.config().get("gdist_momentum_filename")) << endl;
-            cout << "# position gdist file hash: " << sha1_file(rc.cc.config().get("gdist_position_filename")) << endl;
+            string momentum_hash = sha1_file(rc.cc.config().get("gdist_momentum_filename"));
+            string position_hash = sha1_file(rc.cc.config().get("gdist_position_filename"));
+            if (pc.print_config()) {
+                cout << "# momentum gdist file hash: " << momentum_hash << endl;
+                cout << "# position gdist file hash: " << position_hash << endl;
+            }
+            shared_key_data << momentum_hash << endl << position_hash << endl;
         }
 
         vector<string> hfdefs = rc.cc[0].hardfactor_definitions;
@@ -166,10 +158,38 @@ int run(int argc, char** argv) {
                 cerr << "BEGIN hf definition file " << hf_definition_filename << endl << hfdefs.rdbuf() << "END hf definition file " << hf_definition_filename << endl;
                 hfdefs.close();
             }
-            if (pc.print_config()) {
-                cout << "# hard factor definition file hash: " << hf_definition_filename << ": " << sha1_file(hf_definition_filename) << endl;
+            if (need_hashes) {
+                string hf_definition_hash = sha1_file(hf_definition_filename);
+                if (pc.print_config()) {
+                    cout << "# hard factor definition file hash: " << hf_definition_filename << ": " << hf_definition_hash << endl;
+                }
+                shared_key_data << hf_definition_filename << ": " << hf_definition_hash << endl;
             }
         }
+
+        if (!pc.journal_filename().empty()) {
+            ostringstream journal_key_data;
+            journal_key_data << rc.cc.config() << shared_key_data.str();
+            string journal_key = sha1_string(journal_key_data.str());
+            logger << "Journaling results to " << pc.journal_filename() << " with key " << journal_key << endl;
+            rc.open_journal(pc.journal_filename(), journal_key, pc.resume());
+        }
+        if (!pc.result_cache_directory().empty()) {
+            logger << "Using the result cache in " << pc.result_cache_directory() << endl;
+            // the values of these are part of each result's Context or its hard factors
+            Configuration cache_config(rc.cc.config());
+            cache_config.erase("pT");
+            cache_config.erase("Y");
+            cache_config.erase("pseudorandom_generator_seed");
+            cache_config.erase("hardfactor_specifications");
+            ostringstream cache_key_data;
+            cache_key_data << cache_config << shared_key_data.str();
+            rc.open_result_cache(pc.result_cache_directory(), cache_key_data.str());
+        }
+        if (!pc.stream_filename().empty()) {
+            logger << "Streaming results to " << pc.stream_filename() << endl;
+            rc.open_result_stream(pc.stream_filename(), pc.stream_csv() ? ResultStream::CSV : ResultStream::JSON, append_stream);
+        }
     }
 
     if (pc.print_config()) {
@@ -201,16 +221,128 @@ int run(int argc, char** argv) {
     sigaction(SIGINT, &siga, &oldsiga);
     // Run the actual calculation
     rc.calculate();
+    if (pc.refine_tolerance() > 0) {
+        GridRefinement refinement(rc, pc.refine_rapidity() ? GridRefinement::RAPIDITY : GridRefinement::PT, pc.refine_tolerance(), pc.refine_max_points());
+        refinement.refine();
+        if (!pc.refine_filename().empty()) {
+            ofstream refine_output(pc.refine_filename().c_str());
+            refinement.write(refine_output, refine_output_subdivisions);
+            if (!refine_output) {
+                logger << "WARNING: unable to write the refined grid to " << pc.refine_filename() << endl;
+            }
+        }
+    }
     // Reset the signal handler
     sigaction(SIGTERM, &oldsiga, NULL);
     sigaction(SIGINT, &oldsiga, NULL);
     // And print out results
     cout << rc;
 
+    return 0;
+}
+
+/**
+ * Reads the lines of the next job for --batch into `lines`: configuration
+ * lines up to a blank line or the end of the input. Blank lines before the
+ * job and comment lines are skipped. Returns false if there are no more jobs.
+ */
+static bool read_batch_job(istream& in, vector<string>& lines) {
+    lines.clear();
+    string line;
+    while (getline(in, line)) {
+        line = trim(line, " \t\r");
+        if (line.empty()) {
+            if (lines.empty()) {
+                continue;
+            }
+            break;
+        }
+        if (line[0] != '#') {
+            lines.push_back(line);
+        }
+    }
+    return !lines.empty();
+}
+
+/**
+ * Runs the jobs read from the --batch input, one after another, each with
+ * its configuration lines applied on top of the configuration `pc` from the
+ * command line. The gluon distributions, PDF and FF data, and hard factor
+ * definitions are kept from one job to the next, so a job only sets up
+ * what its changes affect.
+ *
+ * The output of each job is bracketed by "# job N" and "# end of job N"
+ * lines. An error ends only the job it happens in.
+ */
+static int run_batch(const ProgramConfiguration& pc) {
+    istream* jobs = &cin;
+    ifstream job_file;
+    if (!pc.batch_filename().empty()) {
+        job_file.open(pc.batch_filename().c_str());
+        if (!job_file) {
+            throw ios_base::failure("Unable to open batch file " + pc.batch_filename());
+        }
+        jobs = &job_file;
+    }
+
+    SharedResources shared;
+    int status = 0;
+    size_t job = 0;
+    vector<string> lines;
+    while (read_batch_job(*jobs, lines)) {
+        logger << "Starting job " << job << endl;
+        cout << "# job " << job << endl;
+        try {
+            ProgramConfiguration job_pc(pc);
+            for (vector<string>::const_iterator it = lines.begin(); it != lines.end(); it++) {
+                job_pc.read_config_line(*it);
+            }
+            if (run_configuration(job_pc, &shared, job > 0) != 0) {
+                status = 1;
+            }
+        }
+        catch (const mu::ParserError& e) {
+            cerr << "Parser error in job " << job << ": " << e.GetMsg() << endl;
+            status = 1;
+        }
+        catch (const std::exception& e) {
+            cerr << "Caught exception in job " << job << ":" << endl << e.what() << endl;
+            status = 1;
+        }
+        catch (const char* c) {
+            cerr << "Caught error message in job " << job << ":" << endl << c << endl;
+            status = 1;
+        }
+        // the job's ResultsCalculator is gone, even if it ended with an error
+        p_rc = NULL;
+        cout << "# end of job " << job << endl << flush;
+        job++;
+    }
+    return status;
+}
+
+/**
+ * Runs the program.
+ *
+ * This is like main() except that it can throw exceptions, which will
+ * be caught in the real main().
+ */
+int run(int argc, char** argv) {
+    time_t rawtime;
+
+    time(&rawtime);
+    logger << "Starting at " << ctime(&rawtime) << endl;
+
+    gsl_set_error_handler(&gsl_error_throw);
+
+    ProgramConfiguration pc(argc, argv);
+
+    const int status = pc.batch() ? run_batch(pc) : run_configuration(pc, NULL, false);
+
     time(&rawtime);
     logger << "Ending at " << ctime(&rawtime) << endl;
 
-    return 0;
+    return status;
 }
 
 /**
@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include "../log.h"
@@ -13,13 +14,30 @@ using std::vector;
 using trace_variable::trace_vars;
 
 ProgramConfiguration::ProgramConfiguration(const int argc, char const * const * argv) :
+    m_print_config(true),
+    m_print_integration_progress(true),
+    m_print_hardfactor_definitions(true),
     m_trace(false),
+    m_trace_binary(false),
+    m_trace_sample(1),
+    m_trace_reservoir(0),
     m_trace_gdist(false),
     m_minmax(false),
     m_separate(false),
-    m_print_config(true),
-    m_print_integration_progress(true),
-    m_print_hardfactor_definitions(true),
+    m_profile(false),
+    m_threads(1),
+    m_integration_threads(1),
+    m_hardfactor_backend(PARSED),
+    m_resume(false),
+    m_stream_csv(false),
+    m_progress(false),
+    m_progress_interval(10),
+    m_shard_index(0),
+    m_shard_count(1),
+    m_refine_tolerance(0),
+    m_refine_rapidity(false),
+    m_refine_max_points(0),
+    m_batch(false),
     m_conf(canonicalize),
     m_xg_min(0),
     m_xg_max(1)
@@ -77,6 +95,223 @@ ProgramConfiguration::ProgramConfiguration(const int argc, char const * const *
                 m_trace = trace_vars.any();
             }
         }
+        else if (a.compare(0, 15, "--trace-format=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && v[1] == "text") {
+                m_trace_binary = false;
+            }
+            else if (v.size() == 2 && v[1] == "binary") {
+                m_trace_binary = true;
+            }
+            else {
+                cerr << "invalid trace format: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 15, "--trace-sample=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2) {
+                long int n = strtol(v[1].c_str(), NULL, 0);
+                if (n > 0) {
+                    m_trace_sample = static_cast<size_t>(n);
+                }
+                else {
+                    cerr << "invalid trace sampling interval: " << v[1] << endl;
+                }
+            }
+        }
+        else if (a.compare(0, 18, "--trace-reservoir=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2) {
+                long int n = strtol(v[1].c_str(), NULL, 0);
+                if (n >= 0) {
+                    m_trace_reservoir = static_cast<size_t>(n);
+                }
+                else {
+                    cerr << "invalid trace reservoir size: " << v[1] << endl;
+                }
+            }
+        }
+        else if (a.compare(0, 10, "--threads=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2) {
+                long int n = strtol(v[1].c_str(), NULL, 0);
+                if (n > 0) {
+                    m_threads = static_cast<size_t>(n);
+                }
+                else {
+                    cerr << "invalid number of threads: " << v[1] << endl;
+                }
+            }
+        }
+        else if (a.compare(0, 22, "--integration-threads=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2) {
+                long int n = strtol(v[1].c_str(), NULL, 0);
+                if (n > 0) {
+                    m_integration_threads = static_cast<size_t>(n);
+                }
+                else {
+                    cerr << "invalid number of integration threads: " << v[1] << endl;
+                }
+            }
+        }
+        else if (a.compare(0, 21, "--hardfactor-backend=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2) {
+                if (v[1] == "parsed") {
+                    m_hardfactor_backend = PARSED;
+                }
+                else if (v[1] == "compiled") {
+                    m_hardfactor_backend = COMPILED;
+                }
+                else if (v[1] == "check") {
+                    m_hardfactor_backend = CHECKED;
+                }
+                else {
+                    cerr << "unknown hard factor backend: " << v[1] << endl;
+                }
+            }
+        }
+        else if (a.compare(0, 10, "--journal=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && !v[1].empty()) {
+                m_journal_filename = v[1];
+            }
+            else {
+                cerr << "invalid journal filename: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 8, "--shard=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            vector<string> r;
+            if (v.size() == 2) {
+                r = split(v[1], "/", 2);
+            }
+            long int i = -1, n = 0;
+            if (r.size() == 2) {
+                i = strtol(r[0].c_str(), NULL, 0);
+                n = strtol(r[1].c_str(), NULL, 0);
+            }
+            if (n > 0 && i >= 0 && i < n) {
+                m_shard_index = static_cast<size_t>(i);
+                m_shard_count = static_cast<size_t>(n);
+            }
+            else {
+                cerr << "invalid shard specification: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 9, "--refine=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            double t = v.size() == 2 ? atof(v[1].c_str()) : 0;
+            if (t > 0) {
+                m_refine_tolerance = t;
+            }
+            else {
+                cerr << "invalid refinement tolerance: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 14, "--refine-axis=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && v[1] == "pT") {
+                m_refine_rapidity = false;
+            }
+            else if (v.size() == 2 && v[1] == "Y") {
+                m_refine_rapidity = true;
+            }
+            else {
+                cerr << "invalid refinement axis: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 20, "--refine-max-points=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2) {
+                long int n = strtol(v[1].c_str(), NULL, 0);
+                if (n >= 0) {
+                    m_refine_max_points = static_cast<size_t>(n);
+                }
+                else {
+                    cerr << "invalid maximum number of refinement points: " << v[1] << endl;
+                }
+            }
+        }
+        else if (a.compare(0, 16, "--refine-output=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && !v[1].empty()) {
+                m_refine_filename = v[1];
+            }
+            else {
+                cerr << "invalid refinement output filename: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 15, "--result-cache=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && !v[1].empty()) {
+                m_result_cache_directory = v[1];
+            }
+            else {
+                cerr << "invalid result cache directory: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 9, "--stream=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && !v[1].empty()) {
+                m_stream_filename = v[1];
+            }
+            else {
+                cerr << "invalid result stream filename: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 16, "--stream-format=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && v[1] == "csv") {
+                m_stream_csv = true;
+            }
+            else if (v.size() == 2 && v[1] == "json") {
+                m_stream_csv = false;
+            }
+            else {
+                cerr << "invalid result stream format: " << a << endl;
+            }
+        }
+        else if (a == "--progress") {
+            m_progress = true;
+        }
+        else if (a == "--batch") {
+            m_batch = true;
+        }
+        else if (a.compare(0, 8, "--batch=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && !v[1].empty()) {
+                m_batch = true;
+                m_batch_filename = v[1];
+            }
+            else {
+                cerr << "invalid batch filename: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 11, "--progress=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            if (v.size() == 2 && !v[1].empty()) {
+                m_progress = true;
+                m_progress_filename = v[1];
+            }
+            else {
+                cerr << "invalid progress filename: " << a << endl;
+            }
+        }
+        else if (a.compare(0, 20, "--progress-interval=") == 0) {
+            vector<string> v = split(a, "=", 2);
+            double t = v.size() == 2 ? atof(v[1].c_str()) : 0;
+            if (t > 0) {
+                m_progress_interval = t;
+            }
+            else {
+                cerr << "invalid progress interval: " << a << endl;
+            }
+        }
+        else if (a == "--resume") {
+            m_resume = true;
+        }
         else if (a == "--trace") {
             m_trace = true;
         }
@@ -117,6 +352,13 @@ ProgramConfiguration::ProgramConfiguration(const int argc, char const * const *
         else if (a == "--separate") {
             m_separate = true;
         }
+        else if (a == "--profile") {
+#ifdef SOLO_PROFILE
+            m_profile = true;
+#else
+            cerr << "WARNING: --profile has no effect unless SOLO is configured with -DSOLO_PROFILE=ON" << endl;
+#endif
+        }
         else if (a == "-o" || a == "--option") {
             current_arg_is_config_line = true;
         }
@@ -168,6 +410,21 @@ ProgramConfiguration::ProgramConfiguration(const int argc, char const * const *
         }
     }
 
+    if (m_resume && m_journal_filename.empty()) {
+        cerr << "WARNING: --resume has no effect without --journal" << endl;
+        m_resume = false;
+    }
+    if (m_refine_tolerance > 0 && m_shard_count > 1) {
+        cerr << "WARNING: --refine has no effect with --shard, because each shard only has part of the grid" << endl;
+        m_refine_tolerance = 0;
+    }
+    if (m_refine_tolerance == 0 && !m_refine_filename.empty()) {
+        cerr << "WARNING: --refine-output has no effect without --refine" << endl;
+    }
+    if (!m_trace_binary && (m_trace_sample != 1 || m_trace_reservoir != 0)) {
+        cerr << "WARNING: --trace-sample and --trace-reservoir have no effect without --trace-format=binary" << endl;
+    }
+
     if (!m_conf.contains("hardfactor_specifications")) {
         m_conf.add("hardfactor_specifications", "lo");
         m_conf.add("hardfactor_specifications", "nlo");
@@ -10,6 +10,9 @@
  */
 class ProgramConfiguration {
 public:
+    /** The ways hard factor terms read from definition files can be evaluated */
+    typedef enum {PARSED, COMPILED, CHECKED} HardFactorBackend;
+
                                       // char const * const * is one way to write the proper incantation to show that
                                       // this method won't modify the command-line arguments it gets passed
     ProgramConfiguration(const int argc, char const * const * argv);
@@ -23,12 +26,65 @@ public:
     bool print_hardfactor_definitions() const { return m_print_hardfactor_definitions; }
     /** Indicates whether the --trace option was specified */
     bool trace() const { return m_trace; }
+    /** Indicates whether --trace-format=binary was specified */
+    bool trace_binary() const { return m_trace_binary; }
+    /** The N given with the --trace-sample option, to keep one traced point in N, 1 by default */
+    size_t trace_sample() const { return m_trace_sample; }
+    /** The number of points per integration given with the --trace-reservoir option, 0 (all) by default */
+    size_t trace_reservoir() const { return m_trace_reservoir; }
     /** Indicates whether the --trace-gdist option was specified */
     bool trace_gdist() const { return m_trace_gdist; }
     /** Indicates whether the --minmax option was specified */
     bool minmax() const { return m_minmax; }
     /** Indicates whether the --separate option was specified */
     bool separate() const { return m_separate; }
+    /** Indicates whether the --profile option was specified, in a build that supports it */
+    bool profile() const { return m_profile; }
+    /** The number of worker threads given with the --threads option, 1 by default */
+    size_t threads() const { return m_threads; }
+    /** The number of threads per integration given with the --integration-threads option, 1 by default */
+    size_t integration_threads() const { return m_integration_threads; }
+    /** The hard factor backend given with the --hardfactor-backend option, PARSED by default */
+    HardFactorBackend hardfactor_backend() const { return m_hardfactor_backend; }
+    /** The journal file given with the --journal option, empty by default */
+    const std::string& journal_filename() const { return m_journal_filename; }
+    /** Indicates whether the --resume option was specified */
+    bool resume() const { return m_resume; }
+    /** The directory given with the --result-cache option, empty by default */
+    const std::string& result_cache_directory() const { return m_result_cache_directory; }
+    /** The file or pipe given with the --stream option, empty by default */
+    const std::string& stream_filename() const { return m_stream_filename; }
+    /** Indicates whether --stream-format=csv was specified; the default is JSON */
+    bool stream_csv() const { return m_stream_csv; }
+    /** Indicates whether the --progress option was specified */
+    bool progress() const { return m_progress; }
+    /** The file given with --progress=FILE, empty (for standard error) by default */
+    const std::string& progress_filename() const { return m_progress_filename; }
+    /** The number of seconds given with the --progress-interval option, 10 by default */
+    double progress_interval() const { return m_progress_interval; }
+    /** The index of the shard of the work to do, given with the --shard option, 0 by default */
+    size_t shard_index() const { return m_shard_index; }
+    /** The number of shards the work is split into, given with the --shard option, 1 by default */
+    size_t shard_count() const { return m_shard_count; }
+    /** The tolerance given with the --refine option, 0 (no refinement) by default */
+    double refine_tolerance() const { return m_refine_tolerance; }
+    /** Indicates whether --refine-axis=Y was specified; the default is to refine along pT */
+    bool refine_rapidity() const { return m_refine_rapidity; }
+    /** The number of points given with the --refine-max-points option, 0 (four times the initial number) by default */
+    size_t refine_max_points() const { return m_refine_max_points; }
+    /** The file given with the --refine-output option, empty by default */
+    const std::string& refine_filename() const { return m_refine_filename; }
+    /** Indicates whether the --batch option was specified */
+    bool batch() const { return m_batch; }
+    /** The file or pipe given with --batch=FILE, empty (for standard input) by default */
+    const std::string& batch_filename() const { return m_batch_filename; }
+
+    /**
+     * Applies one line of configuration, as given with the -o option, on top
+     * of the configuration from the command line. This is how the jobs of
+     * --batch change the settings.
+     */
+    void read_config_line(const std::string& line) { m_conf.read_config_line(line); }
 
     double xg_min() const { return m_xg_min; }
     double xg_max() const { return m_xg_max; }
@@ -43,12 +99,56 @@ private:
     bool m_print_hardfactor_definitions;
     /** Indicates whether the --trace option was specified */
     bool m_trace;
+    /** Indicates whether --trace-format=binary was specified */
+    bool m_trace_binary;
+    /** The interval given with the --trace-sample option */
+    size_t m_trace_sample;
+    /** The reservoir size given with the --trace-reservoir option */
+    size_t m_trace_reservoir;
     /** Indicates whether the --trace-gdist option was specified */
     bool m_trace_gdist;
     /** Indicates whether the --minmax option was specified */
     bool m_minmax;
     /** Indicates whether the --separate option was specified */
     bool m_separate;
+    /** Indicates whether the --profile option was specified */
+    bool m_profile;
+    /** The number of worker threads given with the --threads option */
+    size_t m_threads;
+    /** The number of threads per integration given with the --integration-threads option */
+    size_t m_integration_threads;
+    /** The hard factor backend given with the --hardfactor-backend option */
+    HardFactorBackend m_hardfactor_backend;
+    /** The journal file given with the --journal option */
+    std::string m_journal_filename;
+    /** The directory given with the --result-cache option */
+    std::string m_result_cache_directory;
+    /** Indicates whether the --resume option was specified */
+    bool m_resume;
+    /** The file or pipe given with the --stream option */
+    std::string m_stream_filename;
+    /** Indicates whether --stream-format=csv was specified */
+    bool m_stream_csv;
+    /** Indicates whether the --progress option was specified */
+    bool m_progress;
+    /** The file given with --progress=FILE */
+    std::string m_progress_filename;
+    /** The number of seconds given with the --progress-interval option */
+    double m_progress_interval;
+    /** The shard index and count given with the --shard option */
+    size_t m_shard_index, m_shard_count;
+    /** The tolerance given with the --refine option */
+    double m_refine_tolerance;
+    /** Indicates whether --refine-axis=Y was specified */
+    bool m_refine_rapidity;
+    /** The number of points given with the --refine-max-points option */
+    size_t m_refine_max_points;
+    /** The file given with the --refine-output option */
+    std::string m_refine_filename;
+    /** Indicates whether the --batch option was specified */
+    bool m_batch;
+    /** The file given with --batch=FILE */
+    std::string m_batch_filename;
     /**
      * The configuration parameters to be used in the calculation. Information
      * collected from the command line options and read from configuration files
@@ -0,0 +1,218 @@
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <ios>
+#include <sstream>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_sys.h>
+#include "../utils/profile.h"
+#include "progressmonitor.h"
+
+using std::cerr;
+using std::endl;
+using std::ofstream;
+using std::ostringstream;
+using std::setw;
+using std::string;
+using std::vector;
+
+/**
+ * The counters of one integration. `evaluations` is only changed with
+ * atomic additions. The estimate is guarded by `version`, which the owning
+ * thread makes odd while it writes the estimate and even again afterwards,
+ * so the reporter can tell when it has read a consistent set of values.
+ */
+struct ProgressMonitor::Task {
+    Task(const size_t index, const double pT, const double Y) :
+      index(index), pT(pT), Y(Y), start(profile::now()), evaluations(0), version(0), estimate(GSL_NAN), error(GSL_NAN), chisq(GSL_NAN), steps(0) {}
+
+    const size_t index;
+    const double pT, Y;
+    const double start;
+    unsigned long evaluations;
+    unsigned long version;
+    double estimate, error, chisq;
+    /** The number of estimates recorded so far */
+    unsigned long steps;
+};
+
+__thread ProgressMonitor::Task* ProgressMonitor::current_task = NULL;
+
+ProgressMonitor::ProgressMonitor(const string& filename, const double interval, const size_t total) :
+  filename(filename),
+  interval(interval),
+  total(total),
+  start(profile::now()),
+  done(0),
+  finished_evaluations(0),
+  last_evaluations(0),
+  last_time(start),
+  stopping(false) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&wake, NULL);
+    if (pthread_create(&reporter, NULL, reporter_main, this) != 0) {
+        pthread_cond_destroy(&wake);
+        pthread_mutex_destroy(&mutex);
+        throw "Unable to start the progress reporting thread";
+    }
+}
+
+ProgressMonitor::~ProgressMonitor() {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(reporter, NULL);
+    // any tasks still registered belong to threads that are gone
+    for (vector<Task*>::iterator it = running.begin(); it != running.end(); it++) {
+        delete *it;
+    }
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&mutex);
+}
+
+void ProgressMonitor::start_task(const size_t index, const double pT, const double Y) {
+    Task* t = new Task(index, pT, Y);
+    pthread_mutex_lock(&mutex);
+    running.push_back(t);
+    pthread_mutex_unlock(&mutex);
+    current_task = t;
+}
+
+void ProgressMonitor::finish_task() {
+    Task* t = current_task;
+    if (t == NULL) {
+        return;
+    }
+    current_task = NULL;
+    pthread_mutex_lock(&mutex);
+    for (vector<Task*>::iterator it = running.begin(); it != running.end(); it++) {
+        if (*it == t) {
+            running.erase(it);
+            break;
+        }
+    }
+    done++;
+    finished_evaluations += __sync_fetch_and_add(&t->evaluations, 0);
+    pthread_mutex_unlock(&mutex);
+    delete t;
+}
+
+unsigned long* ProgressMonitor::evaluation_counter() {
+    return current_task == NULL ? NULL : &current_task->evaluations;
+}
+
+void ProgressMonitor::record_estimate(const double estimate, const double error, const double chisq) {
+    Task* t = current_task;
+    if (t == NULL) {
+        return;
+    }
+    __sync_fetch_and_add(&t->version, 1);
+    t->estimate = estimate;
+    t->error = error;
+    t->chisq = chisq;
+    t->steps++;
+    __sync_fetch_and_add(&t->version, 1);
+}
+
+void* ProgressMonitor::reporter_main(void* closure) {
+    static_cast<ProgressMonitor*>(closure)->run_reporter();
+    return NULL;
+}
+
+void ProgressMonitor::run_reporter() {
+    pthread_mutex_lock(&mutex);
+    while (!stopping) {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        const double wait = interval > 0 ? interval : 1;
+        deadline.tv_sec += static_cast<time_t>(wait);
+        deadline.tv_nsec += static_cast<long>((wait - static_cast<time_t>(wait)) * 1e9);
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!stopping && pthread_cond_timedwait(&wake, &mutex, &deadline) != ETIMEDOUT) {
+        }
+        report();
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/** Writes `x` in a field of width `w`, or "-" if it is NaN */
+static void write_field(std::ostream& out, const int w, const double x) {
+    if (gsl_isnan(x)) {
+        out << setw(w) << "-";
+    }
+    else {
+        out << setw(w) << x;
+    }
+}
+
+void ProgressMonitor::report() {
+    const double now = profile::now();
+    const double elapsed = now - start;
+    unsigned long evaluations = finished_evaluations;
+    ostringstream out;
+    out.precision(4);
+    ostringstream table;
+    table.precision(4);
+    table << std::left << setw(8) << "result" << " " << setw(10) << "pT" << " " << setw(10) << "Y" << " " << setw(14) << "evaluations" << " "
+          << setw(12) << "estimate" << " " << setw(12) << "error" << " " << setw(8) << "chisq" << " " << setw(6) << "steps" << " " << "seconds" << endl;
+    for (vector<Task*>::const_iterator it = running.begin(); it != running.end(); it++) {
+        const Task* t = *it;
+        double estimate, error, chisq;
+        unsigned long steps, before, after;
+        do {
+            before = __sync_fetch_and_add(const_cast<unsigned long*>(&t->version), 0);
+            estimate = t->estimate;
+            error = t->error;
+            chisq = t->chisq;
+            steps = t->steps;
+            after = __sync_fetch_and_add(const_cast<unsigned long*>(&t->version), 0);
+        } while (before != after || before % 2 != 0);
+        const unsigned long t_evaluations = __sync_fetch_and_add(const_cast<unsigned long*>(&t->evaluations), 0);
+        evaluations += t_evaluations;
+        table << setw(8) << t->index << " " << setw(10) << t->pT << " " << setw(10) << t->Y << " " << setw(14) << t_evaluations << " ";
+        write_field(table, 12, estimate);
+        table << " ";
+        write_field(table, 12, error);
+        table << " ";
+        write_field(table, 8, chisq);
+        table << " " << setw(6) << steps << " " << now - t->start << endl;
+    }
+
+    const double rate = now > last_time ? (evaluations - last_evaluations) / (now - last_time) : 0;
+    out << "progress: " << done << "/" << total << " done, " << running.size() << " running, "
+        << evaluations << " evaluations, " << rate << " evaluations/s, " << elapsed << " s elapsed";
+    if (done > 0 && done < total) {
+        out << ", about " << elapsed * (total - done) / done << " s left";
+    }
+    out << endl;
+    if (!running.empty()) {
+        out << table.str();
+    }
+    last_evaluations = evaluations;
+    last_time = now;
+
+    if (filename.empty()) {
+        cerr << out.str() << std::flush;
+        return;
+    }
+    // written to a temporary file and renamed into place, so it is replaced all at once
+    const string temporary_filename = filename + ".tmp";
+    {
+        ofstream file(temporary_filename.c_str());
+        file << out.str();
+        if (!file) {
+            cerr << "WARNING: unable to write progress file " << temporary_filename << endl;
+            return;
+        }
+    }
+    if (rename(temporary_filename.c_str(), filename.c_str()) != 0) {
+        cerr << "WARNING: unable to replace progress file " << filename << endl;
+    }
+}
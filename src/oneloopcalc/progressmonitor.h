@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/**
+ * Reports the progress of the running integrations at a fixed interval,
+ * for `--progress`.
+ *
+ * Each thread that runs an integration registers it with start_task(), and
+ * the integration updates its counters as it goes: the number of integrand
+ * evaluations, through the counter from evaluation_counter(), and the
+ * latest estimate, error, and (for VEGAS) chi-square, through
+ * record_estimate(), which is meant to be called from the Integrator's end
+ * of step callbacks. Neither takes a lock. A background thread wakes up
+ * every `interval` seconds and writes a table of the running integrations,
+ * with the overall throughput and an estimate of the time left, either to
+ * standard error or, if a filename is given, to that file, which is replaced
+ * as a whole each time so that a reader never sees a partial table.
+ */
+class ProgressMonitor {
+public:
+    /**
+     * Starts the reporting thread. `filename` may be empty, for standard
+     * error. `total` is the number of integrations expected to run.
+     */
+    ProgressMonitor(const std::string& filename, const double interval, const size_t total);
+    /** Writes a final report and stops the reporting thread */
+    ~ProgressMonitor();
+
+    /** Starts reporting on the integration of result `index`, on the calling thread */
+    void start_task(const size_t index, const double pT, const double Y);
+    /** Stops reporting on the calling thread's integration, counting it as done */
+    void finish_task();
+    /** The evaluation counter of the calling thread's integration, for Integrator::set_evaluation_counter() */
+    unsigned long* evaluation_counter();
+
+    /**
+     * Records the current estimate of the calling thread's integration, if
+     * it has one. `chisq` is NaN when the method doesn't compute one.
+     */
+    static void record_estimate(const double estimate, const double error, const double chisq);
+
+private:
+    struct Task;
+    /** The integration running on the calling thread */
+    static __thread Task* current_task;
+
+    static void* reporter_main(void* closure);
+    void run_reporter();
+    /** Writes the report; called with `mutex` held */
+    void report();
+
+    const std::string filename;
+    const double interval;
+    const size_t total;
+    /** The time the monitor was started, from profile::now() */
+    const double start;
+
+    /** Protects all the fields below; the counters of each Task are not */
+    pthread_mutex_t mutex;
+    /** Signaled when the reporter should stop */
+    pthread_cond_t wake;
+    std::vector<Task*> running;
+    /** The number of integrations that have finished */
+    size_t done;
+    /** The evaluations of the integrations that have finished */
+    unsigned long finished_evaluations;
+    /** The total number of evaluations and the time at the previous report, for the rate */
+    unsigned long last_evaluations;
+    double last_time;
+    bool stopping;
+    pthread_t reporter;
+
+    // not copyable, because of the thread
+    ProgressMonitor(const ProgressMonitor&);
+    ProgressMonitor& operator=(const ProgressMonitor&);
+};
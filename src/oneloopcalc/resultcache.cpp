@@ -0,0 +1,107 @@
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <ios>
+#include <sstream>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "resultcache.h"
+
+using namespace std;
+
+// from http://stackoverflow.com/questions/3969047/is-there-a-standard-way-of-representing-an-sha1-hash-as-a-c-string-and-how-do-i
+static string get_hex_representation(const unsigned char* bytes, size_t length) {
+    ostringstream os;
+    os.fill('0');
+    os << hex;
+    for(const unsigned char * ptr=bytes; ptr < bytes+length; ptr++) {
+        os << setw(2) << static_cast<unsigned int>(*ptr);
+    }
+    return os.str();
+}
+
+// the EVP interface, since OpenSSL 3 deprecates the SHA1_* functions
+string sha1_file(string filename) {
+    char buffer[1024];
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    ifstream i(filename.c_str());
+    if (!i) {
+        ostringstream oss;
+        oss << "Error opening file for SHA checksum: " << filename;
+        throw ios_base::failure(oss.str());
+    }
+    EVP_MD_CTX* c = EVP_MD_CTX_create();
+    if (c == NULL || !EVP_DigestInit_ex(c, EVP_sha1(), NULL)) {
+        EVP_MD_CTX_destroy(c);
+        throw ios_base::failure("Unable to compute SHA checksum of " + filename);
+    }
+    while (i) {
+        i.read(buffer, sizeof(buffer));
+        EVP_DigestUpdate(c, buffer, static_cast<size_t>(i.gcount()));
+    }
+    i.close();
+    EVP_DigestFinal_ex(c, hash, &length);
+    EVP_MD_CTX_destroy(c);
+    return get_hex_representation(hash, length);
+}
+
+string sha1_string(const string& data) {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (!EVP_Digest(data.data(), data.size(), hash, &length, EVP_sha1(), NULL)) {
+        throw ios_base::failure("Unable to compute SHA checksum");
+    }
+    return get_hex_representation(hash, length);
+}
+
+ResultCache::ResultCache(const string& directory, const string& key_data) : directory(directory), key_data(key_data) {
+    if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw ios_base::failure("Unable to create result cache directory " + directory);
+    }
+}
+
+string ResultCache::key(const Context& ctx, const HardFactorList& hflist, const bool separately) const {
+    ostringstream s;
+    s.precision(17);
+    s << key_data << ctx << "separately = " << separately << endl;
+    for (HardFactorList::const_iterator it = hflist.begin(); it != hflist.end(); it++) {
+        s << "hard factor = " << (*it)->get_name() << endl;
+    }
+    return sha1_string(s.str());
+}
+
+bool ResultCache::load(const string& key, const size_t count, double* real, double* imag, double* error) const {
+    ifstream in(filename(key).c_str());
+    if (!in) {
+        return false;
+    }
+    // each line is: real imag error
+    for (size_t i = 0; i < count; i++) {
+        if (!(in >> real[i] >> imag[i] >> error[i])) {
+            cerr << "WARNING: ignoring unreadable result cache file " << filename(key) << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void ResultCache::store(const string& key, const size_t count, const double* real, const double* imag, const double* error, const size_t tag) const {
+    ostringstream s;
+    s << filename(key) << ".tmp" << getpid() << "." << tag;
+    string temporary_filename = s.str();
+
+    ofstream out(temporary_filename.c_str());
+    out.precision(17);
+    for (size_t i = 0; i < count; i++) {
+        out << real[i] << " " << imag[i] << " " << error[i] << "\n";
+    }
+    out.close();
+    if (!out || rename(temporary_filename.c_str(), filename(key).c_str()) != 0) {
+        cerr << "Unable to write result cache file " << filename(key) << endl;
+        remove(temporary_filename.c_str());
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include "../configuration/context.h"
+#include "../hardfactors/hardfactor.h"
+
+/** The SHA-1 hash of the contents of the file `filename`, in hexadecimal */
+std::string sha1_file(std::string filename);
+/** The SHA-1 hash of `data`, in hexadecimal */
+std::string sha1_string(const std::string& data);
+
+/**
+ * A directory of integration results, indexed by a hash of everything
+ * they depend on, which lets runs with overlapping parameters reuse each
+ * other's results, for `--result-cache`.
+ *
+ * The key of each result is the SHA-1 hash of the `key_data` given to the
+ * constructor, which should describe the inputs shared by every integration
+ * in the run (the hard factor definition and gluon distribution file hashes
+ * and the integration settings that aren't part of a Context), together with
+ * the Context, the names of the hard factors, and whether they were
+ * integrated separately. Each result is a small text file named after its
+ * key, written to a temporary file first and renamed into place, so several
+ * processes can share one directory: a reader sees either the whole file or
+ * none of it, and two processes computing the same result just both write it.
+ *
+ * The key doesn't cover the code itself, so the cache should be emptied
+ * when the program changes in a way that affects the results.
+ */
+class ResultCache {
+public:
+    /** Uses `directory`, creating it if it doesn't exist */
+    ResultCache(const std::string& directory, const std::string& key_data);
+
+    /** The key for integrating `hflist` in `ctx` */
+    std::string key(const Context& ctx, const HardFactorList& hflist, const bool separately) const;
+    /**
+     * Reads the `count` results stored under `key` into the arrays, returning
+     * false if there are none or they can't be read.
+     */
+    bool load(const std::string& key, const size_t count, double* real, double* imag, double* error) const;
+    /**
+     * Stores the `count` results from the arrays under `key`. `tag` has to
+     * be different for each call that may run at the same time in this
+     * process; it keeps their temporary files apart.
+     */
+    void store(const std::string& key, const size_t count, const double* real, const double* imag, const double* error, const size_t tag) const;
+
+private:
+    const std::string directory;
+    const std::string key_data;
+
+    std::string filename(const std::string& key) const { return directory + "/" + key; }
+};
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <iomanip>
 #include <ostream>
+#include <sstream>
 #include <vector>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_monte.h>
@@ -11,8 +13,11 @@
 #include "../integration/integrator.h"
 #include "../integration/integrationcontext.h"
 #include "quasimontecarlo.h"
+#include "progressmonitor.h"
+#include "resultcache.h"
 #include "resultscalculator.h"
 #include "trace.h"
+#include "tracewriter.h"
 
 using std::bitset;
 using std::ostream;
@@ -25,6 +30,20 @@ namespace trace_variable {
     bitset<trace_variable::COUNT> trace_vars;
 }
 
+/** Serializes the messages that the worker threads write to cerr */
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Writes `message` and a newline to cerr in one piece, so that the lines
+ * from different threads don't interleave
+ */
+static void print_line(const ostringstream& message) {
+    const string line = message.str() + "\n";
+    pthread_mutex_lock(&output_mutex);
+    cerr << line << std::flush;
+    pthread_mutex_unlock(&output_mutex);
+}
+
 /* The following functions are callback functions to be used with
  * Integrator.set_callback(). These would be invoked every time
  * the Monte Carlo routine evaluates the function.
@@ -55,6 +74,18 @@ void write_data_point(const IntegrationContext* ictx, const double real, const d
     trace_stream << endl;
 }
 
+/** The writer for --trace-format=binary, which ResultsCalculator creates */
+static TraceWriter* binary_trace = NULL;
+
+/**
+ * A callback function that records the same variables as write_data_point()
+ * with the binary trace writer, which can be called from any thread.
+ */
+void write_binary_data_point(const IntegrationContext* ictx, const double real, const double imag) {
+    assert(binary_trace != NULL);
+    binary_trace->write(ictx, real, imag);
+}
+
 #define process(property) double property;
 /** A version of IntegrationContext without the methods */
 struct IntegrationContextData {
@@ -108,42 +139,157 @@ void write_nonzero(const IntegrationContext* ictx, const double real, const doub
  * integration with its error bound.
  */
 void cubature_eprint_callback(double* p_result, double* p_abserr) {
-    cerr << "cubature output: " << *p_result << " err: " << *p_abserr << endl;
+    ostringstream s;
+    s << "cubature output: " << *p_result << " err: " << *p_abserr;
+    print_line(s);
 }
 /**
  * A callback for VEGAS integration that prints out the result of the
  * integration with its error bound and chi-squared value.
  */
 void vegas_eprint_callback(double* p_result, double* p_abserr, gsl_monte_vegas_state* s) {
-    cerr << "VEGAS output: " << *p_result << " err: " << *p_abserr << " chisq:" << gsl_monte_vegas_chisq(s) << endl;
+    ostringstream line;
+    line << "VEGAS output: " << *p_result << " err: " << *p_abserr << " chisq:" << gsl_monte_vegas_chisq(s);
+    print_line(line);
 }
 /**
  * A callback for MISER integration that prints out the result of the
  * integration with its error bound.
  */
 void miser_eprint_callback(double* p_result, double* p_abserr, gsl_monte_miser_state* s) {
-    cerr << "MISER output: " << *p_result << " err: " << *p_abserr << endl;
+    ostringstream line;
+    line << "MISER output: " << *p_result << " err: " << *p_abserr;
+    print_line(line);
 }
 /**
  * A callback for quasi Monte Carlo integration that prints out the result of the
  * integration with its error bound.
  */
 void quasi_eprint_callback(double* p_result, double* p_abserr, quasi_monte_state* s) {
-    cerr << "QUASI output: " << *p_result << " err: " << *p_abserr << endl;
+    ostringstream line;
+    line << "QUASI output: " << *p_result << " err: " << *p_abserr;
+    print_line(line);
+}
+/**
+ * A callback for the batched Monte Carlo integrations that prints out the
+ * result of the integration with its error bound.
+ */
+void batch_eprint_callback(double* p_result, double* p_abserr) {
+    ostringstream s;
+    s << "batched MC output: " << *p_result << " err: " << *p_abserr;
+    print_line(s);
+}
+
+/* These callbacks record the estimate in the ProgressMonitor instead of
+ * printing it, for --progress.
+ */
+void cubature_progress_callback(double* p_result, double* p_abserr) {
+    ProgressMonitor::record_estimate(*p_result, *p_abserr, GSL_NAN);
+}
+void vegas_progress_callback(double* p_result, double* p_abserr, gsl_monte_vegas_state* s) {
+    ProgressMonitor::record_estimate(*p_result, *p_abserr, gsl_monte_vegas_chisq(s));
+}
+void miser_progress_callback(double* p_result, double* p_abserr, gsl_monte_miser_state* s) {
+    ProgressMonitor::record_estimate(*p_result, *p_abserr, GSL_NAN);
+}
+void quasi_progress_callback(double* p_result, double* p_abserr, quasi_monte_state* s) {
+    ProgressMonitor::record_estimate(*p_result, *p_abserr, GSL_NAN);
+}
+void batch_progress_callback(double* p_result, double* p_abserr) {
+    ProgressMonitor::record_estimate(*p_result, *p_abserr, GSL_NAN);
+}
+
+/**
+ * Registers an integration with the progress monitor, if there is one,
+ * for as long as it exists
+ */
+struct ProgressScope {
+    ProgressMonitor* monitor;
+    ProgressScope(ProgressMonitor* monitor, const size_t index, const Context& ctx) : monitor(monitor) {
+        if (monitor != NULL) {
+            monitor->start_task(index, sqrt(ctx.pT2), ctx.Y);
+        }
+    }
+    ~ProgressScope() {
+        if (monitor != NULL) {
+            monitor->finish_task();
+        }
+    }
+};
+
+/**
+ * Parses the hard factor definition files `filenames` into `registry`, with
+ * the compiled hard factors unless `backend` is PARSED
+ */
+static void parse_hard_factor_definitions(HardFactorRegistry& registry, const vector<string>& filenames, const ProgramConfiguration::HardFactorBackend backend) {
+    HardFactorParser parser(registry);
+    if (backend != ProgramConfiguration::PARSED) {
+        parser.use_compiled_hard_factors(compiled_hard_factor_definitions, backend == ProgramConfiguration::CHECKED);
+    }
+    for (vector<string>::const_iterator it = filenames.begin(); it != filenames.end(); it++) {
+        parser.parse_file(*it);
+    }
+    parser.flush_groups();
+}
+
+SharedResources::~SharedResources() {
+    for (std::map<string, HardFactorRegistry*>::iterator it = registries.begin(); it != registries.end(); it++) {
+        delete it->second;
+    }
+    registries.clear();
 }
 
-ResultsCalculator::ResultsCalculator(const ProgramConfiguration& pc) :
-    cc(pc.config()),
-    tlctx(cc),
+const HardFactorRegistry& SharedResources::hard_factor_definitions(const vector<string>& filenames, const ProgramConfiguration::HardFactorBackend backend) {
+    std::ostringstream key;
+    key << backend;
+    for (vector<string>::const_iterator it = filenames.begin(); it != filenames.end(); it++) {
+        key << '\n' << *it;
+    }
+    std::map<string, HardFactorRegistry*>::iterator it = registries.find(key.str());
+    if (it == registries.end()) {
+        HardFactorRegistry* registry = new HardFactorRegistry();
+        try {
+            parse_hard_factor_definitions(*registry, filenames, backend);
+        }
+        catch (...) {
+            delete registry;
+            throw;
+        }
+        it = registries.insert(pair<string, HardFactorRegistry*>(key.str(), registry)).first;
+    }
+    return *it->second;
+}
+
+ResultsCalculator::ResultsCalculator(const ProgramConfiguration& pc, SharedResources* shared) :
+    shared(shared),
+    contexts(pc.config(), shared == NULL ? NULL : &shared->gdists),
+    cc(contexts),
+    tlctx(acquire_tlctx()),
     result_array_len(cc.size()),
     _hfglen(0),
     _hflen(0),
+    _slen(1),
+    _vlen(1),
     trace(pc.trace()),
     minmax(pc.minmax()),
     separate(pc.separate()),
+    profile(pc.profile()),
     print_integration_progress(pc.print_integration_progress()),
+    threads(((pc.trace() && !pc.trace_binary()) || pc.minmax() || pc.trace_gdist()) ? 1 : pc.threads()),
+    integration_threads((pc.trace() || pc.minmax() || pc.trace_gdist()) ? 1 : pc.integration_threads()),
+    shard_index(pc.shard_index()),
+    shard_count(pc.shard_count()),
+    progress_requested(pc.progress()),
+    progress_filename(pc.progress_filename()),
+    progress_interval(pc.progress_interval()),
+    next_task(0),
+    progress(NULL),
+    journal(NULL),
+    result_cache(NULL),
+    result_stream(NULL),
     xg_min(pc.xg_min()),
-    xg_max(pc.xg_max())
+    xg_max(pc.xg_max()),
+    profiles(pc.profile() ? cc.size() : 0)
 {
     assert(hfgroups.empty());
 
@@ -152,25 +298,51 @@ ResultsCalculator::ResultsCalculator(const ProgramConfiguration& pc) :
     for (Configuration::const_iterator it = hf_bounds.first; it != hf_bounds.second; it++) {
         hfspecs.push_back(it->second);
     }
-    parse_hf_specs(hfspecs);
+    try {
+        parse_hf_specs(hfspecs, pc.hardfactor_backend());
+    }
+    catch (...) {
+        // the destructor won't run to give it back
+        release_tlctx(tlctx);
+        throw;
+    }
     // done with hfspecs
 
     _hfglen = hfgroups.size();
     assert(_hfglen > 0);
-    if (separate) {
-        for (vector<const HardFactorGroup*>::iterator hfgit = hfgroups.begin(); hfgit != hfgroups.end(); hfgit++) {
-            _hflen += (*hfgit)->objects.size();
-        }
-        result_array_len *= _hflen;
+    for (vector<const HardFactorGroup*>::iterator hfgit = hfgroups.begin(); hfgit != hfgroups.end(); hfgit++) {
+        _hflen += (*hfgit)->objects.size();
     }
-    else {
-        result_array_len *= _hfglen;
+    if (!cc.empty()) {
+        _slen = 1 + cc[0].cpl_variants.size();
+        _vlen = (1 + cc[0].gdist_variants.size()) * _slen;
     }
+    result_array_len *= columns();
     _valid = new bool[result_array_len];
     real = new double[result_array_len];
     imag = new double[result_array_len];
     error = new double[result_array_len];
     fill(_valid, _valid + result_array_len, false);
+    calculated = false;
+
+    if (threads < pc.threads() || integration_threads < pc.integration_threads()) {
+        cerr << "WARNING: tracing and --minmax are not thread-safe; running on one thread" << endl;
+    }
+    if (_vlen > 1 && !callback_free()) {
+        cerr << "WARNING: with gdist_variants or scale_variants, the integrations are batched, so tracing and --minmax see no points" << endl;
+    }
+    if (trace && pc.trace_binary()) {
+        assert(binary_trace == NULL);
+        binary_trace = new TraceWriter("trace.bin", trace_vars, pc.trace_sample(), pc.trace_reservoir());
+    }
+    if (threads == 1) {
+        // the worker threads in calculate_parallel() make their own
+        for (size_t i = 1; i < integration_threads; i++) {
+            helper_tlctx.push_back(acquire_tlctx());
+        }
+    }
+    pthread_mutex_init(&task_mutex, NULL);
+    pthread_mutex_init(&journal_mutex, NULL);
 }
 
 ResultsCalculator::~ResultsCalculator() {
@@ -178,14 +350,50 @@ ResultsCalculator::~ResultsCalculator() {
     delete[] real;
     delete[] imag;
     delete[] error;
+    for (vector<ThreadLocalContext*>::iterator it = helper_tlctx.begin(); it != helper_tlctx.end(); it++) {
+        release_tlctx(*it);
+    }
+    release_tlctx(tlctx);
+    delete journal;
+    delete result_cache;
+    delete result_stream;
+    delete binary_trace;
+    binary_trace = NULL;
+    pthread_mutex_destroy(&task_mutex);
+    pthread_mutex_destroy(&journal_mutex);
+}
+ThreadLocalContext* ResultsCalculator::acquire_tlctx() {
+    if (shared == NULL) {
+        return new ThreadLocalContext(cc);
+    }
+    return shared->tlctxs.acquire(cc);
+}
+
+void ResultsCalculator::release_tlctx(ThreadLocalContext* tlctx) {
+    if (tlctx == NULL) {
+        return;
+    }
+    if (shared == NULL) {
+        delete tlctx;
+    }
+    else {
+        shared->tlctxs.release(tlctx);
+    }
 }
-void ResultsCalculator::parse_hf_specs(const vector<string>& hfspecs) {
-    // parse the hard factor definition files
+
+void ResultsCalculator::parse_hf_specs(const vector<string>& hfspecs, const ProgramConfiguration::HardFactorBackend backend) {
+    // parse the hard factor definition files, or copy the shared ones, which
+    // the shared resources keep ownership of
+    if (shared == NULL) {
+        parse_hard_factor_definitions(registry, cc[0].hardfactor_definitions, backend);
+    }
+    else {
+        registry = shared->hard_factor_definitions(cc[0].hardfactor_definitions, backend);
+    }
     HardFactorParser parser(registry);
-    for (vector<string>::const_iterator it = cc[0].hardfactor_definitions.begin(); it != cc[0].hardfactor_definitions.end(); it++) {
-        parser.parse_file(*it);
+    if (backend != ProgramConfiguration::PARSED) {
+        parser.use_compiled_hard_factors(compiled_hard_factor_definitions, backend == ProgramConfiguration::CHECKED);
     }
-    parser.flush_groups();
 
     // parse hard factor specifications given on the command line
     for (vector<string>::const_iterator it = hfspecs.begin(); it != hfspecs.end(); it++) {
@@ -222,7 +430,7 @@ void ResultsCalculator::parse_hf_specs(const vector<string>& hfspecs) {
 }
 
 size_t ResultsCalculator::index_from(size_t ccindex, size_t hfindex) {
-    size_t index = ccindex * (separate ? _hflen : _hfglen) + hfindex;
+    size_t index = ccindex * columns() + hfindex;
     assert(index < result_array_len);
     return index;
 }
@@ -244,8 +452,183 @@ void ResultsCalculator::result(size_t ccindex, size_t hfindex, double* real, dou
     }
 }
 
+void ResultsCalculator::open_journal(const string& filename, const string& key, bool resume) {
+    assert(journal == NULL);
+    journal_key = key;
+    if (resume) {
+        ifstream in(filename.c_str());
+        size_t width = columns();
+        size_t loaded = 0;
+        string line;
+        while (getline(in, line)) {
+            // each line is: key ccindex hfindex real imag error
+            istringstream fields(line);
+            string entry_key;
+            size_t ccindex, hfindex;
+            double l_real, l_imag, l_error;
+            if (!(fields >> entry_key >> ccindex >> hfindex >> l_real >> l_imag >> l_error) || entry_key != key) {
+                continue;
+            }
+            if (ccindex >= cc.size() || hfindex >= width) {
+                cerr << "WARNING: ignoring journal entry out of range: " << line << endl;
+                continue;
+            }
+            size_t index = index_from(ccindex, hfindex);
+            real[index] = l_real;
+            imag[index] = l_imag;
+            error[index] = l_error;
+            if (!_valid[index]) {
+                _valid[index] = true;
+                loaded++;
+            }
+        }
+        cerr << "Resuming with " << loaded << " of " << result_array_len << " results from journal " << filename << endl;
+    }
+    journal = new ofstream(filename.c_str(), ios_base::out | ios_base::app);
+    if (!*journal) {
+        delete journal;
+        journal = NULL;
+        throw ios_base::failure("Unable to open journal file " + filename);
+    }
+    journal->precision(17);
+}
+
+void ResultsCalculator::open_result_cache(const string& directory, const string& key_data) {
+    assert(result_cache == NULL);
+    result_cache = new ResultCache(directory, key_data);
+}
+
+string ResultsCalculator::variant_suffix(const size_t variant_index) const {
+    const size_t gdist_index = variant_index / _slen, scale_index = variant_index % _slen;
+    ostringstream s;
+    if (gdist_index > 0) {
+        s << "@gdist" << gdist_index;
+    }
+    if (scale_index > 0) {
+        s << "@scale" << scale_index;
+    }
+    return s.str();
+}
+
+void ResultsCalculator::open_result_stream(const string& filename, const ResultStream::Format format, const bool append) {
+    assert(result_stream == NULL);
+    result_stream = new ResultStream(filename, format, append);
+    column_labels.clear();
+    for (vector<const HardFactorGroup*>::const_iterator hfgit = hfgroups.begin(); hfgit != hfgroups.end(); hfgit++) {
+        if (separate) {
+            for (vector<string>::const_iterator it = (*hfgit)->specifications.begin(); it != (*hfgit)->specifications.end(); it++) {
+                for (size_t d = 0; d < _vlen; d++) {
+                    column_labels.push_back(make_pair((*hfgit)->label + variant_suffix(d), *it));
+                }
+            }
+        }
+        else {
+            for (size_t d = 0; d < _vlen; d++) {
+                column_labels.push_back(make_pair((*hfgit)->label + variant_suffix(d), string()));
+            }
+        }
+    }
+    assert(column_labels.size() == columns());
+}
+
+bool ResultsCalculator::completed(size_t index, size_t count) const {
+    for (size_t i = index; i < index + count; i++) {
+        if (!_valid[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ResultsCalculator::journal_results(size_t index, size_t count) {
+    if (journal == NULL) {
+        return;
+    }
+    size_t width = columns();
+    pthread_mutex_lock(&journal_mutex);
+    for (size_t i = index; i < index + count; i++) {
+        *journal << journal_key << " " << i / width << " " << i % width << " "
+                 << real[i] << " " << imag[i] << " " << error[i] << "\n";
+    }
+    // flush right away so the entries survive the process being killed
+    journal->flush();
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+void ResultsCalculator::stream_results(size_t index, size_t count) {
+    if (result_stream == NULL) {
+        return;
+    }
+    size_t width = columns();
+    for (size_t i = index; i < index + count; i++) {
+        const Context& ctx = cc[i / width];
+        const pair<string, string>& labels = column_labels[i % width];
+        result_stream->write(i, sqrt(ctx.pT2), ctx.Y, ctx.pseudorandom_generator_seed, labels.first, labels.second, real[i], imag[i], error[i]);
+    }
+}
+
 void ResultsCalculator::calculate() {
+    // the results loaded from the journal are done as far as the stream is concerned
+    for (size_t i = 0; i < result_array_len && !calculated; i++) {
+        if (_valid[i]) {
+            stream_results(i, 1);
+        }
+    }
+    calculated = true;
+    if (progress_requested) {
+        // the serial calculation doesn't use the task list, but it runs the same integrations
+        collect_tasks();
+        progress = new ProgressMonitor(progress_filename, progress_interval, tasks.size());
+    }
+    try {
+        if (threads > 1) {
+            calculate_parallel();
+        }
+        else {
+            calculate_serial();
+        }
+    }
+    catch (...) {
+        delete progress;
+        progress = NULL;
+        throw;
+    }
+    delete progress;
+    progress = NULL;
+}
+
+/** Copies `old_length` elements of `array` into a new array of `new_length`, and frees the old one */
+template<typename T>
+static T* grow_array(T* array, const size_t old_length, const size_t new_length) {
+    T* grown = new T[new_length];
+    std::copy(array, array + old_length, grown);
+    delete[] array;
+    return grown;
+}
+
+size_t ResultsCalculator::add_contexts(const double pT, const double Y) {
+    const size_t added = contexts.add_contexts(pT, Y);
+    const size_t new_length = cc.size() * columns();
+    real = grow_array(real, result_array_len, new_length);
+    imag = grow_array(imag, result_array_len, new_length);
+    error = grow_array(error, result_array_len, new_length);
+    _valid = grow_array(_valid, result_array_len, new_length);
+    fill(_valid + result_array_len, _valid + new_length, false);
+    result_array_len = new_length;
+    if (profile) {
+        profiles.resize(cc.size());
+    }
+    return added;
+}
+
+void ResultsCalculator::calculate_serial() {
     size_t cc_index = 0, hf_index = 0;
+    // the adapted VEGAS grids carried from one context to the next
+    VegasGridStore vegas_grids;
+    // the generators and integration states reused by each integration
+    IntegratorWorkspace workspace;
+    // the position of each integration in the order, for sharding
+    size_t position = 0;
     for (ContextCollection::const_iterator it = cc.begin(); it != cc.end(); it++) {
         const Context& ctx = *it;
         cerr << "Beginning calculation at pT = " << sqrt(ctx.pT2) << ", Y = " << ctx.Y << endl;
@@ -254,17 +637,31 @@ void ResultsCalculator::calculate() {
             // recall the definition
             // typedef HardFactorList std::vector<const HardFactor*>
             for (vector<const HardFactorGroup*>::iterator hgit = hfgroups.begin(); hgit != hfgroups.end(); hgit++) {
-                if (separate) {
+                if (separate && callback_free()) {
+                    // all the hard factors in the group at once, with separate results
+                    size_t index = index_from(cc_index, hf_index * _vlen);
+                    if (in_shard(position++) && !completed(index, (*hgit)->objects.size() * _vlen)) {
+                        integrate_hard_factor(ctx, *tlctx, helper_tlctx, &vegas_grids, &workspace, (*hgit)->objects, index, true);
+                    }
+                    hf_index += (*hgit)->objects.size();
+                }
+                else if (separate) {
                     // go through the hard factors in each group one at a time
                     HardFactorList one_hf;
                     for (HardFactorList::const_iterator hfit = (*hgit)->objects.begin(); hfit != (*hgit)->objects.end(); hfit++) {
-                        one_hf.assign(1, *hfit);
-                        integrate_hard_factor(ctx, tlctx, one_hf, index_from(cc_index, hf_index));
+                        size_t index = index_from(cc_index, hf_index * _vlen);
+                        if (in_shard(position++) && !completed(index, _vlen)) {
+                            one_hf.assign(1, *hfit);
+                            integrate_hard_factor(ctx, *tlctx, helper_tlctx, &vegas_grids, &workspace, one_hf, index, false);
+                        }
                         hf_index++;
                     }
                 }
                 else {
-                    integrate_hard_factor(ctx, tlctx, (*hgit)->objects, index_from(cc_index, hf_index));
+                    size_t index = index_from(cc_index, hf_index * _vlen);
+                    if (in_shard(position++) && !completed(index, _vlen)) {
+                        integrate_hard_factor(ctx, *tlctx, helper_tlctx, &vegas_grids, &workspace, (*hgit)->objects, index, false);
+                    }
                     hf_index++;
                 }
             }
@@ -277,26 +674,238 @@ void ResultsCalculator::calculate() {
     }
 }
 
-void ResultsCalculator::integrate_hard_factor(const Context& ctx, const ThreadLocalContext& tlctx, const HardFactorList& hflist, size_t index) {
-    double l_real, l_imag, l_error;
+/**
+ * The entry point for the worker threads started by
+ * ResultsCalculator::calculate_parallel().
+ */
+void* calculation_worker(void* closure) {
+    ResultsCalculator* rc = static_cast<ResultsCalculator*>(closure);
+    rc->run_tasks();
+    return NULL;
+}
+
+void ResultsCalculator::collect_tasks() {
+    // one task per entry in the results arrays, in the same order the serial
+    // calculation would run them, leaving out any loaded from the journal
+    // and any that belong to other shards
+    tasks.clear();
+    size_t position = 0;
+    for (size_t cc_index = 0; cc_index < cc.size(); cc_index++) {
+        size_t hf_index = 0;
+        for (vector<const HardFactorGroup*>::iterator hgit = hfgroups.begin(); hgit != hfgroups.end(); hgit++) {
+            CalculationTask task;
+            task.ccindex = cc_index;
+            task.separately = false;
+            if (separate && callback_free()) {
+                task.index = index_from(cc_index, hf_index * _vlen);
+                task.hflist = (*hgit)->objects;
+                task.separately = true;
+                hf_index += task.hflist.size();
+                if (in_shard(position++) && !completed(task.index, task.hflist.size() * _vlen)) {
+                    tasks.push_back(task);
+                }
+            }
+            else if (separate) {
+                for (HardFactorList::const_iterator hfit = (*hgit)->objects.begin(); hfit != (*hgit)->objects.end(); hfit++) {
+                    task.index = index_from(cc_index, _vlen * hf_index++);
+                    task.hflist.assign(1, *hfit);
+                    if (in_shard(position++) && !completed(task.index, _vlen)) {
+                        tasks.push_back(task);
+                    }
+                }
+            }
+            else {
+                task.index = index_from(cc_index, _vlen * hf_index++);
+                task.hflist = (*hgit)->objects;
+                if (in_shard(position++) && !completed(task.index, _vlen)) {
+                    tasks.push_back(task);
+                }
+            }
+        }
+    }
+}
+
+void ResultsCalculator::calculate_parallel() {
+    collect_tasks();
+    next_task = 0;
+
+    size_t nthreads = min(threads, tasks.size());
+    cerr << "Running " << tasks.size() << " integrations on " << nthreads << " threads" << endl;
+    pthread_t* workers = new pthread_t[nthreads];
+    size_t started;
+    for (started = 0; started < nthreads; started++) {
+        if (pthread_create(&workers[started], NULL, calculation_worker, this) != 0) {
+            cerr << "WARNING: unable to start worker thread " << started << endl;
+            break;
+        }
+    }
+    if (started == 0) {
+        // couldn't start any threads, so do the work here
+        run_tasks();
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    delete[] workers;
+}
+
+void ResultsCalculator::run_tasks() {
+    ThreadLocalContext* worker_tlctx = NULL;
+    // each worker carries the grids from one of its tasks to the next
+    VegasGridStore worker_vegas_grids;
+    // and reuses its generators and integration states
+    IntegratorWorkspace worker_workspace;
+    vector<ThreadLocalContext*> worker_helper_tlctx;
+    try {
+        worker_tlctx = acquire_tlctx();
+        for (size_t i = 1; i < integration_threads; i++) {
+            worker_helper_tlctx.push_back(acquire_tlctx());
+        }
+    }
+    catch (const char* c) {
+        ostringstream s;
+        s << "Unable to set up worker thread: " << c;
+        print_line(s);
+        release_tlctx(worker_tlctx);
+        for (vector<ThreadLocalContext*>::iterator it = worker_helper_tlctx.begin(); it != worker_helper_tlctx.end(); it++) {
+            release_tlctx(*it);
+        }
+        return;
+    }
+
+    while (true) {
+        pthread_mutex_lock(&task_mutex);
+        if (next_task >= tasks.size()) {
+            pthread_mutex_unlock(&task_mutex);
+            break;
+        }
+        const CalculationTask& task = tasks[next_task++];
+        pthread_mutex_unlock(&task_mutex);
+        const Context& ctx = cc[task.ccindex];
+        {
+            ostringstream s;
+            s << "Beginning calculation at pT = " << sqrt(ctx.pT2) << ", Y = " << ctx.Y << " (result " << task.index << ")";
+            print_line(s);
+        }
+
+        // an error only invalidates this one result; the other workers carry on
+        try {
+            integrate_hard_factor(ctx, *worker_tlctx, worker_helper_tlctx, &worker_vegas_grids, &worker_workspace, task.hflist, task.index, task.separately);
+        }
+        catch (const exception& e) {
+            ostringstream s;
+            s << "Error in result " << task.index << ": " << e.what();
+            print_line(s);
+        }
+        catch (const mu::ParserError& e) {
+            ostringstream s;
+            s << "Parser error in result " << task.index << ": " << e.GetMsg();
+            print_line(s);
+        }
+        catch (const char* c) {
+            ostringstream s;
+            s << "Error in result " << task.index << ": " << c;
+            print_line(s);
+        }
+    }
+    release_tlctx(worker_tlctx);
+    for (vector<ThreadLocalContext*>::iterator it = worker_helper_tlctx.begin(); it != worker_helper_tlctx.end(); it++) {
+        release_tlctx(*it);
+    }
+}
+
+void ResultsCalculator::integrate_hard_factor(const Context& ctx, const ThreadLocalContext& tlctx, const vector<ThreadLocalContext*>& helper_tlctx, VegasGridStore* vegas_grids, IntegratorWorkspace* workspace, const HardFactorList& hflist, size_t index, bool separately) {
+    assert(!separately || callback_free());
+    ProgressScope progress_scope(progress, index, ctx);
+    // one result for each gluon distribution of each sum that is integrated
+    const size_t count = (separately ? hflist.size() : 1) * _vlen;
+    string cache_key;
+    if (result_cache != NULL) {
+        cache_key = result_cache->key(ctx, hflist, separately);
+        // a traced integration has to actually run to produce the trace
+        if (callback_free() && result_cache->load(cache_key, count, real + index, imag + index, error + index)) {
+            ostringstream s;
+            s << "Using cached result " << index << " (" << cache_key << ")";
+            print_line(s);
+            fill(_valid + index, _valid + index + count, true);
+            journal_results(index, count);
+            stream_results(index, count);
+            return;
+        }
+    }
     Integrator integrator(ctx, tlctx, hflist, xg_min, xg_max);
+    vector<Integrator*> helpers;
+    try {
+        for (vector<ThreadLocalContext*>::const_iterator it = helper_tlctx.begin(); it != helper_tlctx.end(); it++) {
+            helpers.push_back(new Integrator(ctx, **it, hflist, xg_min, xg_max));
+        }
+    }
+    catch (...) {
+        for (vector<Integrator*>::iterator it = helpers.begin(); it != helpers.end(); it++) {
+            delete *it;
+        }
+        throw;
+    }
+    integrator.set_helpers(helpers);
+    // a warm grid depends on which integrations ran before on the same thread,
+    // so results that are saved for later runs start from a cold one
+    integrator.set_vegas_grids(result_cache == NULL && journal == NULL ? vegas_grids : NULL);
+    integrator.set_workspace(workspace);
+    profile::Profile integration_profile;
+    if (profile) {
+        integrator.set_profile(&integration_profile);
+    }
     if (trace) {
-        integrator.set_callback(write_data_point);
+        integrator.set_callback(binary_trace ? write_binary_data_point : write_data_point);
     }
     else if (minmax) {
         integrator.set_callback(store_minmax);
     }
-    if (print_integration_progress) {
+    if (progress != NULL) {
+        integrator.set_evaluation_counter(progress->evaluation_counter());
+        integrator.set_cubature_callback(cubature_progress_callback);
+        integrator.set_miser_callback(miser_progress_callback);
+        integrator.set_vegas_callback(vegas_progress_callback);
+        integrator.set_quasi_callback(quasi_progress_callback);
+        integrator.set_batch_callback(batch_progress_callback);
+    }
+    else if (print_integration_progress) {
         integrator.set_cubature_callback(cubature_eprint_callback);
         integrator.set_miser_callback(miser_eprint_callback);
         integrator.set_vegas_callback(vegas_eprint_callback);
         integrator.set_quasi_callback(quasi_eprint_callback);
+        integrator.set_batch_callback(batch_eprint_callback);
+    }
+    try {
+        // the results for the hard factors in hflist and the gluon distributions go in consecutive entries
+        assert(index + count <= result_array_len);
+        if (separately) {
+            integrator.integrate_separately(real + index, imag + index, error + index);
+        }
+        else {
+            integrator.integrate(real + index, imag + index, error + index);
+        }
+    }
+    catch (...) {
+        for (vector<Integrator*>::iterator it = helpers.begin(); it != helpers.end(); it++) {
+            delete *it;
+        }
+        throw;
+    }
+    for (vector<Integrator*>::iterator it = helpers.begin(); it != helpers.end(); it++) {
+        delete *it;
+    }
+    if (profile) {
+        pthread_mutex_lock(&task_mutex);
+        profile::merge(profiles[index / columns()], integration_profile);
+        pthread_mutex_unlock(&task_mutex);
+    }
+    fill(_valid + index, _valid + index + count, true);
+    journal_results(index, count);
+    stream_results(index, count);
+    if (result_cache != NULL) {
+        result_cache->store(cache_key, count, real + index, imag + index, error + index, index);
     }
-    integrator.integrate(&l_real, &l_imag, &l_error);
-    real[index] = l_real;
-    imag[index] = l_imag;
-    error[index] = l_error;
-    _valid[index] = true;
 }
 
 /**
@@ -329,23 +938,28 @@ ostream& operator<<(ostream& out, ResultsCalculator& rc) {
         for (size_t hfgindex = 0; hfgindex < rc._hfglen; hfgindex++) {
             out << setw(rw) << rc.hfgroups[hfgindex]->label << OFS;
             size_t hflen = rc.hfgroups[hfgindex]->objects.size();
-            for (size_t hfindex = 1; hfindex < 2 * hflen; hfindex++) {
+            for (size_t hfindex = 1; hfindex < 2 * hflen * rc._vlen; hfindex++) {
                 out << setw(rw) << BLANK << OFS;
             }
         }
-        out << setw(rw) << "total" << endl;
+        for (size_t d = 0; d < rc._vlen; d++) {
+            out << setw(rw) << "total" + rc.variant_suffix(d) << (d + 1 < rc._vlen ? OFS : "");
+        }
+        out << endl;
 
         out << setw(lw) << BLANK << OFS << setw(lw) << BLANK << OFS;
         if (multiseed_mode) {
             out << setw(lw) << "seed" << OFS;
         }
         for (vector<string>::iterator termname_iterator = rc.hfnames.begin(); termname_iterator != rc.hfnames.end(); termname_iterator++) {
-            ostringstream valstream;
-            valstream << *termname_iterator << "-val";
-            out << setw(rw) << valstream.str() << OFS;
-            ostringstream errstream;
-            errstream << *termname_iterator << "-err";
-            out << setw(rw) << errstream.str() << OFS;
+            for (size_t d = 0; d < rc._vlen; d++) {
+                ostringstream valstream;
+                valstream << *termname_iterator << rc.variant_suffix(d) << "-val";
+                out << setw(rw) << valstream.str() << OFS;
+                ostringstream errstream;
+                errstream << *termname_iterator << rc.variant_suffix(d) << "-err";
+                out << setw(rw) << errstream.str() << OFS;
+            }
         }
         out << endl;
     }
@@ -355,19 +969,24 @@ ostream& operator<<(ostream& out, ResultsCalculator& rc) {
             out << setw(lw) << "seed" << OFS;
         }
         for (vector<const HardFactorGroup*>::iterator it = rc.hfgroups.begin(); it != rc.hfgroups.end(); it++) {
-            ostringstream valstream;
-            valstream << (*it)->label << "-val";
-            out << setw(rw) << valstream.str() << OFS;
-            ostringstream errstream;
-            errstream << (*it)->label << "-err";
-            out << setw(rw) << errstream.str() << OFS;
+            for (size_t d = 0; d < rc._vlen; d++) {
+                ostringstream valstream;
+                valstream << (*it)->label << rc.variant_suffix(d) << "-val";
+                out << setw(rw) << valstream.str() << OFS;
+                ostringstream errstream;
+                errstream << (*it)->label << rc.variant_suffix(d) << "-err";
+                out << setw(rw) << errstream.str() << OFS;
+            }
+        }
+        for (size_t d = 0; d < rc._vlen; d++) {
+            out << setw(rw) << "total" + rc.variant_suffix(d) << (d + 1 < rc._vlen ? OFS : "");
         }
-        out << setw(rw) << "total" << endl;
+        out << endl;
     }
 
     // write data
     double l_real, l_imag, l_error;
-    size_t hfglen = rc.separate ? rc._hflen : rc._hfglen;
+    size_t hfglen = rc.columns();
     double* counts = NULL;
     double* means  = NULL;
     double* errors = NULL;
@@ -406,13 +1025,14 @@ ostream& operator<<(ostream& out, ResultsCalculator& rc) {
             out << setw(lw) << rc.cc[ccindex].pseudorandom_generator_seed << OFS;
         }
 
-        double total = 0;
-        bool row_valid = true;
+        // one total for each gluon distribution
+        vector<double> totals(rc._vlen, 0);
+        vector<bool> row_valid(rc._vlen, true);
         for (size_t hfgindex = 0; hfgindex < hfglen; hfgindex++) {
             if (rc.valid(ccindex, hfgindex)) {
                 rc.result(ccindex, hfgindex, &l_real, &l_imag, &l_error);
                 out << setw(rw) << l_real << OFS << setw(rw) << l_error << OFS;
-                total += l_real;
+                totals[hfgindex % rc._vlen] += l_real;
 
                 if (multiseed_mode) {
                     counts[hfgindex]++;
@@ -423,15 +1043,20 @@ ostream& operator<<(ostream& out, ResultsCalculator& rc) {
             }
             else {
                 out << setw(rw) << "---" << OFS << setw(rw) << "---" << OFS;
-                all_valid = row_valid = false;
+                all_valid = false;
+                row_valid[hfgindex % rc._vlen] = false;
             }
         }
-        if (row_valid) {
-            out << setw(rw) << total << endl;
-        }
-        else {
-            out << setw(rw) << "---" << endl;
+        for (size_t d = 0; d < rc._vlen; d++) {
+            if (row_valid[d]) {
+                out << setw(rw) << totals[d];
+            }
+            else {
+                out << setw(rw) << "---";
+            }
+            out << (d + 1 < rc._vlen ? OFS : "");
         }
+        out << endl;
     }
     if (multiseed_mode) {
         out << setw(lw) << "mean" << OFS << setw(lw) << BLANK << OFS << setw(lw) << BLANK << OFS;
@@ -460,6 +1085,23 @@ ostream& operator<<(ostream& out, ResultsCalculator& rc) {
         #include "../integration/ictx_var_list.inc"
         #undef process
     }
+    if (rc.profile) {
+        rc.write_profile(out);
+    }
     return out;
 }
 
+void ResultsCalculator::write_profile(ostream& out) const {
+    profile::Profile total;
+    for (size_t cc_index = 0; cc_index < profiles.size(); cc_index++) {
+        if (profiles[cc_index].empty()) {
+            continue;
+        }
+        out << "# profile at pT = " << sqrt(cc[cc_index].pT2) << ", Y = " << cc[cc_index].Y << " (seconds)" << endl;
+        profile::write(out, profiles[cc_index], "# ");
+        profile::merge(total, profiles[cc_index]);
+    }
+    out << "# profile total (seconds)" << endl;
+    profile::write(out, total, "# ");
+}
+
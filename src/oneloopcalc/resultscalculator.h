@@ -1,24 +1,80 @@
 #pragma once
 
+#include <fstream>
+#include <map>
 #include <ostream>
 #include <string>
 #include <vector>
+#include <pthread.h>
 #include "../configuration/context.h"
 #include "../hardfactors/hardfactor.h"
+#include "../utils/profile.h"
 #include "programconfiguration.h"
+#include "resultstream.h"
+
+class ProgressMonitor;
+class ResultCache;
+class IntegratorWorkspace;
+class VegasGridStore;
+
+/**
+ * The expensive parts of a calculation that don't change from one
+ * configuration to the next, kept for the ResultsCalculators constructed
+ * with it when several configurations are run in one process (see --batch):
+ * the gluon distributions, the PDF and FF data, and the parsed hard factor
+ * definition files. Each is reused only by a calculation with the same
+ * parameters, so the results are the same as those of separate runs.
+ *
+ * This has to outlive the ResultsCalculators that use it.
+ */
+class SharedResources {
+public:
+    SharedResources() {}
+    ~SharedResources();
+
+    /** The gluon distributions, for the ContextCollections */
+    GluonDistributionPool gdists;
+    /** The thread-local contexts not in use by a calculation */
+    ThreadLocalContextPool tlctxs;
+
+    /**
+     * The hard factors and groups defined in the files `filenames`, parsed
+     * with `backend` the first time they are asked for
+     */
+    const HardFactorRegistry& hard_factor_definitions(const std::vector<std::string>& filenames, const ProgramConfiguration::HardFactorBackend backend);
+private:
+    /** The parsed definitions, keyed by the backend and the filenames */
+    std::map<std::string, HardFactorRegistry*> registries;
+
+    // not copyable
+    SharedResources(const SharedResources&);
+    SharedResources& operator=(const SharedResources&);
+};
 
 /**
  * Stores the results of the integration and contains methods to run the calculation.
  */
 class ResultsCalculator {
+private:
+    /** The resources shared with other calculations, or NULL if there are none */
+    SharedResources* const shared;
+
+    // contexts needs to be before cc, tlctx, and result_array_len because of initializer dependencies
+    /** The contexts, which only add_contexts() changes */
+    ContextCollection contexts;
+
 public:
-    // cc needs to be before tlctx and result_array_len because of initializer dependencies
     /** Collection of the contexts to be used for the calculation */
-    const ContextCollection cc;
+    const ContextCollection& cc;
 
 private:
     /** The thread-local context to be used for the calculation */
-    ThreadLocalContext tlctx;
+    ThreadLocalContext* const tlctx;
+    /**
+     * The thread-local contexts for the helper threads of the integrations
+     * run by calculate_serial(), integration_threads - 1 of them
+     */
+    std::vector<ThreadLocalContext*> helper_tlctx;
 
     /**
      * Stores all the hard factors and groups
@@ -40,6 +96,13 @@ private:
     size_t _hfglen;
     /** The number of hard factors */
     size_t _hflen;
+    /** The number of scale settings, the configured one and its variants */
+    size_t _slen;
+    /**
+     * The number of variants, each combination of a gluon distribution and
+     * a scale setting, each of which gets its own copy of every column
+     */
+    size_t _vlen;
     /** The length of the results arrays */
     size_t result_array_len;
     /** Flags the indices of results which have been successfully computed so far */
@@ -50,6 +113,8 @@ private:
     double* imag;
     /** Array to hold the error bounds of the results */
     double* error;
+    /** Whether calculate() has been called before */
+    bool calculated;
 
     friend std::ostream& operator<<(std::ostream&, ResultsCalculator&);
 public:
@@ -59,10 +124,42 @@ public:
     const bool minmax;
     /** Whether to calculate individual hard factors separately */
     const bool separate;
+    /** Whether to collect and print the profile counters */
+    const bool profile;
     /** Whether to print integration progress updates */
     const bool print_integration_progress;
+    /**
+     * The number of worker threads to run the calculation on. This is forced
+     * to 1 when text tracing or min/max tracking is enabled, because the
+     * callbacks that implement those write to shared static storage. The
+     * binary trace writer keeps a buffer for each thread, so it doesn't need to.
+     */
+    const size_t threads;
+    /**
+     * The number of threads to spread each integration over. Like `threads`,
+     * this is forced to 1 when tracing or min/max tracking is enabled.
+     */
+    const size_t integration_threads;
+    /**
+     * This process computes only the integrations whose position in the
+     * overall order, counting from zero, is `shard_index` modulo `shard_count`.
+     */
+    const size_t shard_index;
+    /** The number of processes the integrations are split among */
+    const size_t shard_count;
+    /** Whether to run a ProgressMonitor during calculate() */
+    const bool progress_requested;
+    /** The file the ProgressMonitor writes to, or empty for standard error */
+    const std::string progress_filename;
+    /** The interval between progress reports, in seconds */
+    const double progress_interval;
 
-    ResultsCalculator(const ProgramConfiguration& pc);
+    /**
+     * Sets up the calculation of the configuration `pc`. If `shared` is not
+     * NULL, the resources in it are used where they fit the configuration,
+     * and the ones this creates are added to it.
+     */
+    ResultsCalculator(const ProgramConfiguration& pc, SharedResources* shared = NULL);
     ~ResultsCalculator();
 
     /**
@@ -83,9 +180,54 @@ public:
      */
     void result(size_t ccindex, size_t hfindex, double* real, double* imag, double* error);
     /**
-     * Runs the calculation.
+     * The number of results for each context. Each hard factor group (or
+     * hard factor, with --separate) has one column for each variant,
+     * starting with the configured gluon distribution and scales.
+     */
+    size_t columns() const { return (separate ? _hflen : _hfglen) * _vlen; }
+    /** The number of variants, whose columns are adjacent */
+    size_t variant_count() const { return _vlen; }
+    /**
+     * Runs the calculation, for all the results that haven't been computed
+     * yet, so after add_contexts() it only does the new contexts.
      */
     void calculate();
+    /**
+     * Adds contexts at the given pT and Y, one for each seed, as
+     * ContextCollection::add_contexts() does, with room for their results.
+     * Returns the number of contexts added.
+     */
+    size_t add_contexts(const double pT, const double Y);
+    /**
+     * Starts appending each result to the journal file `filename` as soon
+     * as it has been computed, tagged with `key`, which should identify the
+     * configuration and the hard factor definitions.
+     *
+     * If `resume` is true, the results already in the journal under the same
+     * key are loaded first, and calculate() skips the integrations that
+     * would produce them. Entries with other keys are ignored.
+     */
+    void open_journal(const std::string& filename, const std::string& key, bool resume);
+    /**
+     * Starts looking up each integration in the result cache in `directory`
+     * before running it, and storing the results of the ones that do run
+     * there. `key_data` describes everything the results depend on apart
+     * from their Context and hard factors; see ResultCache.
+     */
+    void open_result_cache(const std::string& directory, const std::string& key_data);
+    /**
+     * Starts writing each result to `filename` as a record in the given
+     * format as soon as it has been computed, including the ones loaded from
+     * the journal or the result cache; see ResultStream. If `append` is true,
+     * the records are added to what is already in the file.
+     */
+    void open_result_stream(const std::string& filename, const ResultStream::Format format, const bool append = false);
+    /**
+     * The suffix that tells the columns of variant `variant_index` apart from
+     * the others, such as "@gdist1@scale2", which is empty for the configured
+     * gluon distribution and scales
+     */
+    std::string variant_suffix(const size_t variant_index) const;
 private:
     /**
      * Parse the hard factor specifications collected in the constructor.
@@ -93,12 +235,122 @@ private:
      * This will force a ContextCollection to be constructed if it has not been
      * done already.
      */
-    void parse_hf_specs(const vector< string >& hfspecs);
+    void parse_hf_specs(const vector< string >& hfspecs, const ProgramConfiguration::HardFactorBackend backend);
+
+    /**
+     * A ThreadLocalContext for the contexts, from the shared resources if
+     * there are any
+     */
+    ThreadLocalContext* acquire_tlctx();
+    /** Deletes `tlctx`, from acquire_tlctx(), or returns it to the shared resources */
+    void release_tlctx(ThreadLocalContext* tlctx);
 
     /**
-     * Construct an Integrator and use it
+     * Construct an Integrator and use it. If `helper_tlctx` is not empty,
+     * a helper Integrator is constructed for each of its elements to share
+     * the evaluation of the integrand.
+     *
+     * VEGAS integrations start from the grids in `vegas_grids`, if the
+     * configuration asks for it and there is no journal or result cache,
+     * and leave their grids there for the next.
+     * The integrations take their generators and states from `workspace`.
+     *
+     * If `separately` is true, the hard factors in `hflist` are integrated in
+     * one pass with Integrator::integrate_separately(), and their results are
+     * stored at `index` and the entries following it. Otherwise the total
+     * is stored at `index`.
      */
-    void integrate_hard_factor(const Context& ctx, const ThreadLocalContext& tlctx, const HardFactorList& hflist, size_t index);
+    void integrate_hard_factor(const Context& ctx, const ThreadLocalContext& tlctx, const std::vector<ThreadLocalContext*>& helper_tlctx, VegasGridStore* vegas_grids, IntegratorWorkspace* workspace, const HardFactorList& hflist, size_t index, bool separately);
+
+    /**
+     * Whether the `count` results starting at `index` have all been computed,
+     * in which case their integration can be skipped
+     */
+    bool completed(size_t index, size_t count) const;
+    /**
+     * Whether the integration at position `position` in the overall order
+     * belongs to this process's shard
+     */
+    bool in_shard(size_t position) const { return position % shard_count == shard_index; }
+    /**
+     * Appends the `count` results starting at `index` to the journal, if
+     * there is one
+     */
+    void journal_results(size_t index, size_t count);
+    /**
+     * Writes the `count` results starting at `index` to the result stream,
+     * if there is one
+     */
+    void stream_results(size_t index, size_t count);
+
+    /**
+     * Whether no per-point integrand callback is needed, so that the hard
+     * factors of a group can be integrated together with `--separate`
+     */
+    bool callback_free() const { return !trace && !minmax; }
+
+    /**
+     * One unit of work for the thread pool: a single entry in the results
+     * arrays, identified by its context and the hard factors that make it up.
+     */
+    struct CalculationTask {
+        size_t ccindex;
+        size_t index;
+        HardFactorList hflist;
+        /** Whether the hard factors get separate results, starting at `index` */
+        bool separately;
+    };
+
+    /** Fills in `tasks` with the integrations that this process has left to run */
+    void collect_tasks();
+    /** Runs the calculation on the current thread, one context after another */
+    void calculate_serial();
+    /** Runs the calculation on a pool of `threads` worker threads */
+    void calculate_parallel();
+
+    /**
+     * Pulls tasks off the task list and integrates them until none are left.
+     * Each thread that calls this acquires its own ThreadLocalContext, and
+     * one for each of its integration helper threads.
+     */
+    void run_tasks();
+    friend void* calculation_worker(void*);
+
+    /** The tasks to be run by the thread pool, filled in by collect_tasks() */
+    std::vector<CalculationTask> tasks;
+    /** The index of the next task in `tasks` to be handed to a worker */
+    size_t next_task;
+    /** Protects next_task and the log output of the workers */
+    pthread_mutex_t task_mutex;
+
+    /** The monitor of the running integrations, or NULL; it exists only during calculate() */
+    ProgressMonitor* progress;
+
+    /** The journal that results are appended to, or NULL if there is none */
+    std::ofstream* journal;
+    /** The key that identifies this run's entries in the journal */
+    std::string journal_key;
+    /** Protects the journal, which the worker threads all write to */
+    pthread_mutex_t journal_mutex;
+
+    /** The result cache, or NULL if there is none */
+    ResultCache* result_cache;
+
+    /** The result stream, or NULL if there is none */
+    ResultStream* result_stream;
+    /**
+     * The group label and hard factor name of each column of the results,
+     * for the result stream; the name is empty without --separate
+     */
+    std::vector<std::pair<std::string, std::string> > column_labels;
 
     double xg_min, xg_max;
+
+    /**
+     * The profile counters of each context, by type of term, with --profile.
+     * The workers add to these under task_mutex.
+     */
+    std::vector<profile::Profile> profiles;
+    /** Writes the profile tables of each context and their total */
+    void write_profile(std::ostream& out) const;
 };
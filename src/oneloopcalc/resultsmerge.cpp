@@ -0,0 +1,258 @@
+/*
+ * Merges the output of several oneloopcalc processes run with --shard
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/** The field widths used by operator<<(ostream&, ResultsCalculator&) */
+static const int lw = 6;
+static const int rw = 14;
+/** How the output of a shard marks a result it didn't compute */
+static const string MISSING = "---";
+
+/**
+ * The output of one oneloopcalc process, split into the part before the
+ * results table (the configuration and the table headers), the rows of the
+ * table, and whatever comes after it (e.g. the --minmax output).
+ */
+struct ShardOutput {
+    string filename;
+    vector<string> preamble;
+    vector<vector<string> > rows;
+    vector<string> trailer;
+};
+
+static vector<string> tokenize(const string& line) {
+    vector<string> tokens;
+    istringstream s(line);
+    string token;
+    while (s >> token) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+static bool is_number(const string& token) {
+    const char* start = token.c_str();
+    char* end;
+    strtod(start, &end);
+    return end != start && *end == '\0';
+}
+
+static void read_shard(const string& filename, ShardOutput& shard) {
+    ifstream in(filename.c_str());
+    if (!in) {
+        throw ios_base::failure("Unable to read file " + filename);
+    }
+    shard.filename = filename;
+    string line;
+    while (getline(in, line)) {
+        vector<string> tokens = tokenize(line);
+        if (!tokens.empty() && is_number(tokens[0]) && shard.trailer.empty()) {
+            shard.rows.push_back(tokens);
+        }
+        else if (!tokens.empty() && (tokens[0] == "mean" || tokens[0] == "stddev") && !shard.rows.empty()) {
+            // recomputed from the merged rows
+        }
+        else if (line == "WARNING: some results were not computed") {
+            // added back if the merged results are still incomplete
+        }
+        else if (shard.rows.empty()) {
+            shard.preamble.push_back(line);
+        }
+        else {
+            shard.trailer.push_back(line);
+        }
+    }
+}
+
+/**
+ * Writes the rows of the multiseed statistics, in the same format as
+ * operator<<(ostream&, ResultsCalculator&)
+ */
+static void write_statistics(const vector<double>& counts, const vector<double>& means, const vector<double>& errors) {
+    const string OFS = " ";
+    const string BLANK = " ";
+    cout << setw(lw) << "mean" << OFS << setw(lw) << BLANK << OFS << setw(lw) << BLANK << OFS;
+    for (size_t i = 0; i < means.size(); i++) {
+        cout << setw(rw) << means[i] << OFS << setw(rw) << BLANK << OFS;
+    }
+    cout << endl;
+    cout << setw(lw) << "stddev" << OFS << setw(lw) << BLANK << OFS << setw(lw) << BLANK << OFS;
+    for (size_t i = 0; i < means.size(); i++) {
+        cout << setw(rw) << sqrt(errors[i])/counts[i] << OFS << setw(rw) << BLANK << OFS;
+    }
+    cout << endl;
+}
+
+/**
+ * A program to merge the outputs of oneloopcalc runs with --shard=i/N
+ * into the single table that one unsharded run would have printed.
+ *
+ * Each input must come from the same configuration. For each result, the
+ * value is taken from whichever shard computed it, and the totals (and the
+ * multiseed statistics, if any) are recomputed from the merged values.
+ */
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <shard output> [<shard output> ...]" << endl;
+        return 1;
+    }
+    vector<ShardOutput> shards(argc - 1);
+    try {
+        for (int i = 1; i < argc; i++) {
+            read_shard(argv[i], shards[i - 1]);
+        }
+    }
+    catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    const ShardOutput& first = shards[0];
+    bool multiseed_mode = false;
+    // one total for each gluon distribution, at the end of the header
+    size_t ntotals = 1;
+    for (vector<string>::const_iterator it = first.preamble.begin(); it != first.preamble.end(); it++) {
+        vector<string> tokens = tokenize(*it);
+        if (tokens.size() > 2 && tokens[0] == "pT" && tokens[1] == "Y") {
+            multiseed_mode = tokens[2] == "seed";
+            ntotals = 0;
+            for (vector<string>::reverse_iterator tit = tokens.rbegin(); tit != tokens.rend() && tit->compare(0, 5, "total") == 0; tit++) {
+                ntotals++;
+            }
+            if (ntotals == 0) {
+                ntotals = 1;
+            }
+        }
+    }
+    const size_t nkeys = multiseed_mode ? 3 : 2;
+
+    for (size_t s = 1; s < shards.size(); s++) {
+        if (shards[s].rows.size() != first.rows.size()) {
+            cerr << shards[s].filename << " has " << shards[s].rows.size() << " rows of results, but "
+                 << first.filename << " has " << first.rows.size() << endl;
+            return 1;
+        }
+        if (shards[s].preamble != first.preamble) {
+            cerr << "WARNING: the configuration or headers in " << shards[s].filename << " differ from those in " << first.filename << endl;
+        }
+    }
+
+    for (vector<string>::const_iterator it = first.preamble.begin(); it != first.preamble.end(); it++) {
+        cout << *it << endl;
+    }
+
+    const string OFS = " ";
+    cout << left;
+    bool all_valid = true;
+    string last_pt, last_Y;
+    vector<double> counts, means, errors;
+    for (size_t r = 0; r < first.rows.size(); r++) {
+        const vector<string>& row = first.rows[r];
+        if (row.size() < nkeys + ntotals || (row.size() - nkeys - ntotals) % 2 != 0) {
+            cerr << "Malformed row " << r << " in " << first.filename << endl;
+            return 1;
+        }
+        const size_t nresults = (row.size() - nkeys - ntotals) / 2;
+        vector<string> merged(row.begin(), row.begin() + nkeys + 2 * nresults);
+        for (size_t s = 1; s < shards.size(); s++) {
+            const vector<string>& other = shards[s].rows[r];
+            if (other.size() != row.size() || !equal(row.begin(), row.begin() + nkeys, other.begin())) {
+                cerr << "Row " << r << " of " << shards[s].filename << " doesn't match row " << r << " of " << first.filename << endl;
+                return 1;
+            }
+            for (size_t i = nkeys; i < nkeys + 2 * nresults; i++) {
+                if (merged[i] == MISSING) {
+                    merged[i] = other[i];
+                }
+                else if (other[i] != MISSING && other[i] != merged[i]) {
+                    cerr << "WARNING: conflicting values in row " << r << ", column " << i << "; using " << merged[i] << endl;
+                }
+            }
+        }
+
+        if (multiseed_mode && (last_pt != merged[0] || last_Y != merged[1])) {
+            if (r > 0) {
+                write_statistics(counts, means, errors);
+            }
+            counts.assign(nresults, 0);
+            means.assign(nresults, 0);
+            errors.assign(nresults, 0);
+            last_pt = merged[0];
+            last_Y = merged[1];
+        }
+
+        for (size_t i = 0; i < nkeys; i++) {
+            cout << setw(lw) << merged[i] << OFS;
+        }
+        // the results of the gluon distributions alternate within each column group
+        vector<double> totals(ntotals, 0);
+        vector<bool> row_valid(ntotals, true);
+        for (size_t i = 0; i < nresults; i++) {
+            const string& value = merged[nkeys + 2 * i];
+            const string& error = merged[nkeys + 2 * i + 1];
+            cout << setw(rw) << value << OFS << setw(rw) << error << OFS;
+            if (value == MISSING) {
+                all_valid = false;
+                row_valid[i % ntotals] = false;
+                continue;
+            }
+            double l_real = strtod(value.c_str(), NULL);
+            totals[i % ntotals] += l_real;
+            if (multiseed_mode) {
+                counts[i]++;
+                double old_mean = means[i];
+                means[i] += (l_real - old_mean) / counts[i];
+                errors[i] += (l_real - old_mean) * (l_real - means[i]);
+            }
+        }
+        for (size_t d = 0; d < ntotals; d++) {
+            if (row_valid[d]) {
+                cout << setw(rw) << totals[d];
+            }
+            else {
+                cout << setw(rw) << MISSING;
+            }
+            cout << (d + 1 < ntotals ? OFS : "");
+        }
+        cout << endl;
+    }
+    if (multiseed_mode && !first.rows.empty()) {
+        write_statistics(counts, means, errors);
+    }
+    if (!all_valid) {
+        cout << "WARNING: some results were not computed" << endl;
+    }
+
+    for (vector<string>::const_iterator it = first.trailer.begin(); it != first.trailer.end(); it++) {
+        cout << *it << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <cstdio>
+#include <ios>
+#include <gsl/gsl_sys.h>
+#include "resultstream.h"
+
+using std::ios_base;
+using std::ostream;
+using std::string;
+
+/** Writes `s` as a CSV field, quoted if it contains anything special */
+static void write_csv_string(ostream& out, const string& s) {
+    if (s.find_first_of(",\"\r\n") == string::npos) {
+        out << s;
+        return;
+    }
+    out << '"';
+    for (string::const_iterator it = s.begin(); it != s.end(); it++) {
+        if (*it == '"') {
+            out << '"';
+        }
+        out << *it;
+    }
+    out << '"';
+}
+
+/** Writes `s` as a JSON string */
+static void write_json_string(ostream& out, const string& s) {
+    out << '"';
+    for (string::const_iterator it = s.begin(); it != s.end(); it++) {
+        const unsigned char c = static_cast<unsigned char>(*it);
+        if (c == '"' || c == '\\') {
+            out << '\\' << *it;
+        }
+        else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out << escape;
+        }
+        else {
+            out << *it;
+        }
+    }
+    out << '"';
+}
+
+/** Writes `x` as a JSON number, or null if it is infinite or NaN, which JSON can't represent */
+static void write_json_number(ostream& out, const double x) {
+    if (gsl_finite(x)) {
+        out << x;
+    }
+    else {
+        out << "null";
+    }
+}
+
+ResultStream::ResultStream(const string& filename, const Format format, const bool append) :
+  out(filename.c_str(), append ? ios_base::out | ios_base::app : ios_base::out),
+  format(format) {
+    if (!out) {
+        throw ios_base::failure("Unable to open result stream " + filename);
+    }
+    out.precision(17);
+    if (format == CSV && !append) {
+        out << "index,pT,Y,seed,group,hardfactor,real,imag,error" << std::endl;
+    }
+    pthread_mutex_init(&mutex, NULL);
+}
+
+ResultStream::~ResultStream() {
+    pthread_mutex_destroy(&mutex);
+}
+
+void ResultStream::write(const size_t index, const double pT, const double Y, const unsigned long int seed, const string& group, const string& hard_factor,
+                         const double real, const double imag, const double error) {
+    pthread_mutex_lock(&mutex);
+    if (format == CSV) {
+        out << index << "," << pT << "," << Y << "," << seed << ",";
+        write_csv_string(out, group);
+        out << ",";
+        write_csv_string(out, hard_factor);
+        out << "," << real << "," << imag << "," << error << "\n";
+    }
+    else {
+        out << "{\"index\": " << index << ", \"pT\": ";
+        write_json_number(out, pT);
+        out << ", \"Y\": ";
+        write_json_number(out, Y);
+        out << ", \"seed\": " << seed << ", \"group\": ";
+        write_json_string(out, group);
+        out << ", \"hardfactor\": ";
+        write_json_string(out, hard_factor);
+        out << ", \"real\": ";
+        write_json_number(out, real);
+        out << ", \"imag\": ";
+        write_json_number(out, imag);
+        out << ", \"error\": ";
+        write_json_number(out, error);
+        out << "}\n";
+    }
+    // flush right away so a consumer on the other end of a pipe gets it now
+    out.flush();
+    pthread_mutex_unlock(&mutex);
+}
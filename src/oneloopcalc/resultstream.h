@@ -0,0 +1,46 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <pthread.h>
+
+/**
+ * Writes each result to a file or pipe as soon as it has been computed,
+ * as one self-describing record, for `--stream`.
+ *
+ * In the CSV format the first line names the fields, and each result is a
+ * line after it. In the JSON format each result is a JSON object on a line
+ * of its own, with the field names as keys. The fields are the index of the
+ * result in the output table, pT, Y, the random seed, the label of the hard
+ * factor group, the name of the hard factor (empty unless the hard factors
+ * are computed separately), and the real part, imaginary part, and error.
+ *
+ * Every record is flushed as soon as it is written, so a consumer reading
+ * the other end of a pipe sees it straight away. write() can be called from
+ * several threads at once.
+ */
+class ResultStream {
+public:
+    typedef enum {CSV, JSON} Format;
+
+    /**
+     * Opens `filename` for the records. If `append` is true, the records are
+     * added to the end of what is already in it, and a CSV file doesn't get
+     * another header line, as for the later configurations with --batch.
+     */
+    ResultStream(const std::string& filename, const Format format, const bool append = false);
+    ~ResultStream();
+
+    void write(const size_t index, const double pT, const double Y, const unsigned long int seed, const std::string& group, const std::string& hard_factor,
+               const double real, const double imag, const double error);
+
+private:
+    std::ofstream out;
+    const Format format;
+    /** Keeps the records of different threads from being interleaved */
+    pthread_mutex_t mutex;
+
+    // not copyable, because of the mutex
+    ResultStream(const ResultStream&);
+    ResultStream& operator=(const ResultStream&);
+};
@@ -0,0 +1,422 @@
+/*
+ * Benchmarks of the parts of the SOLO calculation
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gsl/gsl_rng.h>
+#include <muParser.h>
+#include "../configuration/configuration.h"
+#include "../configuration/context.h"
+#include "../dss_pinlo/dss_pinlo.h"
+#include "../gluondist/gluondist.h"
+#include "../hardfactors/hardfactor.h"
+#include "../hardfactors/hardfactor_parser.h"
+#include "../integration/integrationcontext.h"
+#include "../integration/integrationregion.h"
+#include "../utils/profile.h"
+#include "programconfiguration.h"
+#include "resultscalculator.h"
+
+using namespace std;
+
+ostream& logger = cerr;
+
+/** The number of sample points each microbenchmark cycles through */
+static const size_t sample_size = 256;
+
+/** Where the benchmarks put their results, so the compiler can't skip computing them */
+static volatile double sink;
+
+/** The time to spend on each microbenchmark, in seconds */
+static double budget = 0.5;
+/** If not empty, only the benchmarks whose names contain this are run */
+static string filter;
+
+static bool selected(const string& name) {
+    return filter.empty() || name.find(filter) != string::npos;
+}
+
+static void write_row(const string& name, const size_t calls, const double seconds) {
+    cout << name << "\t" << calls << "\t" << seconds << "\t" << 1e9 * seconds / calls << endl;
+}
+
+/**
+ * Calls `op(i)`, for i = 0, 1, 2, ..., until `budget` seconds have passed,
+ * and writes a row with the number of calls and the time per call.
+ */
+template<class Op>
+static void run(const string& name, Op& op) {
+    if (!selected(name)) {
+        return;
+    }
+    size_t calls = 0;
+    size_t batch = 1;
+    const double start = profile::now();
+    double elapsed = 0;
+    try {
+        while (elapsed < budget) {
+            for (size_t k = 0; k < batch; k++) {
+                op(calls++);
+            }
+            elapsed = profile::now() - start;
+            // check the clock less often as it becomes clear how fast op is
+            if (batch < 65536) {
+                batch *= 2;
+            }
+        }
+    }
+    catch (const exception& e) {
+        cerr << "Skipping " << name << ": " << e.what() << endl;
+        return;
+    }
+    catch (const mu::ParserError& e) {
+        cerr << "Skipping " << name << ": " << e.GetMsg() << endl;
+        return;
+    }
+    catch (const char* c) {
+        cerr << "Skipping " << name << ": " << c << endl;
+        return;
+    }
+    write_row(name, calls, elapsed);
+}
+
+/** Sample values of a transverse size or momentum and a rapidity */
+struct GluonSamples {
+    vector<double> u2, Y;
+};
+
+struct S2Op {
+    GluonDistribution* gdist;
+    const GluonSamples& samples;
+    S2Op(GluonDistribution* gdist, const GluonSamples& samples) : gdist(gdist), samples(samples) {}
+    void operator()(const size_t i) { sink = gdist->S2(samples.u2[i % sample_size], samples.Y[i % sample_size]); }
+};
+
+struct FOp {
+    GluonDistribution* gdist;
+    const GluonSamples& samples;
+    FOp(GluonDistribution* gdist, const GluonSamples& samples) : gdist(gdist), samples(samples) {}
+    void operator()(const size_t i) { sink = gdist->F(samples.u2[i % sample_size], samples.Y[i % sample_size]); }
+};
+
+struct Qs2Op {
+    GluonDistribution* gdist;
+    const GluonSamples& samples;
+    Qs2Op(GluonDistribution* gdist, const GluonSamples& samples) : gdist(gdist), samples(samples) {}
+    void operator()(const size_t i) { sink = gdist->Qs2(samples.Y[i % sample_size]); }
+};
+
+struct FFUpdateOp {
+    DSSpiNLO& ff;
+    vector<double> z, mu2;
+    FFUpdateOp(DSSpiNLO& ff, gsl_rng* rng) : ff(ff) {
+        for (size_t i = 0; i < sample_size; i++) {
+            z.push_back(0.05 + 0.9 * gsl_rng_uniform(rng));
+            mu2.push_back(exp(log(1.0) + log(1e3) * gsl_rng_uniform(rng)));
+        }
+    }
+    void operator()(const size_t i) { ff.update(z[i % sample_size], mu2[i % sample_size]); }
+};
+
+/** Random points in the integration region of one term */
+struct TermSamples {
+    const HardFactorTerm* term;
+    const IntegrationRegion* region;
+    size_t dimensions;
+    vector<double> points;
+};
+
+struct RegionUpdateOp {
+    IntegrationContext& ictx;
+    const TermSamples& samples;
+    RegionUpdateOp(IntegrationContext& ictx, const TermSamples& samples) : ictx(ictx), samples(samples) {}
+    void operator()(const size_t i) { samples.region->update(ictx, false, &samples.points[(i % sample_size) * samples.dimensions]); }
+};
+
+struct RecalculateOp {
+    IntegrationContext& ictx;
+    const Modifiers& modifiers;
+    RecalculateOp(IntegrationContext& ictx, const Modifiers& modifiers) : ictx(ictx), modifiers(modifiers) {}
+    void operator()(const size_t /*i*/) { ictx.recalculate_everything(modifiers); }
+};
+
+struct FdOp {
+    const BoundHardFactorTerm& bound;
+    FdOp(const BoundHardFactorTerm& bound) : bound(bound) {}
+    void operator()(const size_t /*i*/) {
+        double real, imag;
+        bound.Fd(&real, &imag);
+        sink = real + imag;
+    }
+};
+
+/**
+ * Benchmarks S2, F, and Qs2 of the gluon distribution `gdist_type`, with
+ * the rest of the configuration taken from `conf`, at sizes and momenta
+ * between 1e-3 and 1e2 and rapidities near those of the first context.
+ */
+static void benchmark_gluon_distribution(const Configuration& base, const string& gdist_type, gsl_rng* rng) {
+    Configuration conf(base);
+    conf.set("gdist_type", gdist_type);
+    ContextCollection cc(conf);
+    const Context& ctx = cc[0];
+    GluonDistribution* gdist = ctx.gdist;
+    // about the value of Yg at the edge of the phase space
+    const double Y0 = -log(sqrt(ctx.pT2) / ctx.sqs * exp(-ctx.Y));
+    GluonSamples samples;
+    for (size_t i = 0; i < sample_size; i++) {
+        samples.u2.push_back(exp(log(1e-3) + log(1e5) * gsl_rng_uniform(rng)));
+        samples.Y.push_back(Y0 + 2 * gsl_rng_uniform(rng));
+    }
+    S2Op s2(gdist, samples);
+    run("gdist/" + gdist_type + "/S2", s2);
+    FOp f(gdist, samples);
+    run("gdist/" + gdist_type + "/F", f);
+    Qs2Op qs2(gdist, samples);
+    run("gdist/" + gdist_type + "/Qs2", qs2);
+}
+
+/**
+ * Benchmarks IntegrationRegion::update(), recalculate_everything(), and the
+ * bound Fd of each term of `hf`, at random points in its region.
+ */
+static void benchmark_hard_factor(const Context& ctx, const ThreadLocalContext& tlctx, const HardFactor* hf, gsl_rng* rng) {
+    const HardFactorTerm* const* terms = hf->get_terms();
+    for (size_t t = 0; t < hf->get_term_count(); t++) {
+        ostringstream label;
+        label << hf->get_name() << ":" << t;
+        TermSamples samples;
+        samples.term = terms[t];
+        samples.region = terms[t]->get_integration();
+        samples.dimensions = samples.region->dimensions(false);
+        double min[10], max[10];
+        samples.region->fill_min(ctx, false, min);
+        samples.region->fill_max(ctx, false, max);
+        for (size_t i = 0; i < sample_size; i++) {
+            for (size_t j = 0; j < samples.dimensions; j++) {
+                samples.points.push_back(min[j] + (max[j] - min[j]) * gsl_rng_uniform(rng));
+            }
+        }
+
+        IntegrationContext ictx(ctx, tlctx);
+        RegionUpdateOp update(ictx, samples);
+        run("region_update/" + label.str(), update);
+
+        // away from the edges, where some terms are singular
+        vector<double> middle(samples.dimensions);
+        for (size_t j = 0; j < samples.dimensions; j++) {
+            middle[j] = 0.5 * (min[j] + max[j]);
+        }
+        samples.region->update(ictx, false, &middle[0]);
+        RecalculateOp recalculate(ictx, terms[t]->get_modifiers());
+        run("recalculate_everything/" + label.str(), recalculate);
+
+        BoundHardFactorTerm* bound = terms[t]->bind(ictx);
+        FdOp fd(*bound);
+        run("Fd/" + label.str(), fd);
+        delete bound;
+    }
+}
+
+/**
+ * Runs the whole calculation with `strategy`, using about `calls`
+ * function evaluations per integration, and writes its time.
+ */
+static void benchmark_end_to_end(const vector<string>& args, const string& strategy, const size_t calls, const size_t threads) {
+    const string name = "end_to_end/" + strategy;
+    if (!selected(name)) {
+        return;
+    }
+    ostringstream n, n10, nthreads;
+    n << calls;
+    n10 << max(calls / 10, static_cast<size_t>(1));
+    nthreads << threads;
+    vector<string> e2e_args(args);
+    e2e_args.push_back("--quiet");
+    e2e_args.push_back("--threads=" + nthreads.str());
+    e2e_args.push_back("-ointegration_strategy=" + strategy);
+    // no error target, so each integration uses its whole budget
+    e2e_args.push_back("-orelerr=0");
+    e2e_args.push_back("-oabserr=0");
+    e2e_args.push_back("-ocubature_iterations=" + n.str());
+    e2e_args.push_back("-omiser_iterations=" + n.str());
+    e2e_args.push_back("-oquasi_iterations=" + n.str());
+    e2e_args.push_back("-ovegas_initial_iterations=" + n10.str());
+    e2e_args.push_back("-ovegas_incremental_iterations=" + n10.str());
+    e2e_args.push_back("-ovegas_max_refinements=9");
+    vector<const char*> argv;
+    for (vector<string>::const_iterator it = e2e_args.begin(); it != e2e_args.end(); it++) {
+        argv.push_back(it->c_str());
+    }
+    ProgramConfiguration pc(static_cast<int>(argv.size()), &argv[0]);
+    ResultsCalculator rc(pc);
+    const double start = profile::now();
+    rc.calculate();
+    write_row(name, 1, profile::now() - start);
+}
+
+static void usage(const char* program) {
+    cerr << "Usage: " << program << " [--budget=SECONDS] [--filter=TEXT] [--e2e-calls=N] [--e2e-threads=N] [--no-end-to-end]" << endl
+         << "       [oneloopcalc options, configuration files, and hard factors]" << endl;
+}
+
+/**
+ * A program that times the parts of the calculation for the configuration
+ * given on its command line, the same way as for oneloopcalc, and writes a
+ * tab-separated table with one row per benchmark: its name, the number of
+ * calls, the total time in seconds, and the time per call in nanoseconds.
+ *
+ * The microbenchmarks cover S2, F, and Qs2 of the GBW, MV, and plateau-power
+ * gluon distributions, the configured one, and the file data distribution
+ * if the configuration names the files; the FF update; and, for each term
+ * of the hard factors being computed, IntegrationRegion::update(),
+ * IntegrationContext::recalculate_everything(), and Fd. Then the whole
+ * calculation is run with each integration strategy.
+ */
+int main(int argc, char** argv) {
+    size_t e2e_calls = 100000;
+    size_t e2e_threads = 1;
+    bool end_to_end = true;
+    // the options for this program are taken out; the rest go to ProgramConfiguration
+    vector<string> args;
+    args.push_back(argv[0]);
+    for (int i = 1; i < argc; i++) {
+        string a(argv[i]);
+        if (a.compare(0, 9, "--budget=") == 0) {
+            budget = atof(a.c_str() + 9);
+        }
+        else if (a.compare(0, 9, "--filter=") == 0) {
+            filter = a.substr(9);
+        }
+        else if (a.compare(0, 12, "--e2e-calls=") == 0) {
+            e2e_calls = strtoul(a.c_str() + 12, NULL, 10);
+        }
+        else if (a.compare(0, 14, "--e2e-threads=") == 0) {
+            e2e_threads = strtoul(a.c_str() + 14, NULL, 10);
+        }
+        else if (a == "--no-end-to-end") {
+            end_to_end = false;
+        }
+        else if (a == "--help" || a == "-h") {
+            usage(argv[0]);
+            return 0;
+        }
+        else {
+            args.push_back(a);
+        }
+    }
+    if (args.size() == 1 || budget <= 0 || e2e_calls == 0 || e2e_threads == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        vector<const char*> pc_argv;
+        for (vector<string>::const_iterator it = args.begin(); it != args.end(); it++) {
+            pc_argv.push_back(it->c_str());
+        }
+        ProgramConfiguration pc(static_cast<int>(pc_argv.size()), &pc_argv[0]);
+        ContextCollection cc(pc.config());
+        const Context& ctx = cc[0];
+        ThreadLocalContext tlctx(ctx);
+        gsl_rng* rng = gsl_rng_alloc(gsl_rng_mt19937);
+        gsl_rng_set(rng, 0);
+
+        cout << "# benchmark\tcalls\tseconds\tns_per_call" << endl;
+
+        vector<string> gdist_types;
+        gdist_types.push_back("gbw");
+        gdist_types.push_back("mv");
+        gdist_types.push_back("pp");
+        if (pc.config().contains("gdist_position_filename") && pc.config().contains("gdist_momentum_filename")) {
+            gdist_types.push_back("file");
+        }
+        Configuration::const_iterator configured = pc.config().find("gdist_type");
+        if (configured != pc.config().end() && find(gdist_types.begin(), gdist_types.end(), configured->second) == gdist_types.end()) {
+            gdist_types.push_back(configured->second);
+        }
+        for (vector<string>::const_iterator it = gdist_types.begin(); it != gdist_types.end(); it++) {
+            try {
+                benchmark_gluon_distribution(pc.config(), *it, rng);
+            }
+            catch (const exception& e) {
+                cerr << "Skipping gluon distribution " << *it << ": " << e.what() << endl;
+            }
+        }
+
+        DSSpiNLO ff(ctx.ff_filename.c_str());
+        ff.select_hadron(ctx.hadron);
+        FFUpdateOp ff_update(ff, rng);
+        run("ff/update", ff_update);
+
+        HardFactorRegistry registry;
+        HardFactorParser parser(registry);
+        for (vector<string>::const_iterator it = ctx.hardfactor_definitions.begin(); it != ctx.hardfactor_definitions.end(); it++) {
+            parser.parse_file(*it);
+        }
+        parser.flush_groups();
+        const pair<Configuration::const_iterator, Configuration::const_iterator> hf_bounds = pc.config().equal_range("hardfactor_specifications");
+        for (Configuration::const_iterator it = hf_bounds.first; it != hf_bounds.second; it++) {
+            // resolved the same way as in ResultsCalculator
+            const string& spec = it->second;
+            const HardFactorGroup* hfg = NULL;
+            if (spec.find(":") == string::npos) {
+                hfg = registry.get_hard_factor_group(spec);
+            }
+            if (hfg == NULL) {
+                hfg = parser.parse_hard_factor_group(spec);
+                if (hfg == NULL) {
+                    cerr << "Skipping hard factor " << spec << ": not found" << endl;
+                    continue;
+                }
+                registry.add_hard_factor_group(hfg, true);
+            }
+            for (HardFactorList::const_iterator hfit = hfg->objects.begin(); hfit != hfg->objects.end(); hfit++) {
+                benchmark_hard_factor(ctx, tlctx, *hfit, rng);
+            }
+        }
+        gsl_rng_free(rng);
+
+        if (end_to_end) {
+            benchmark_end_to_end(args, "plain", e2e_calls, e2e_threads);
+            benchmark_end_to_end(args, "miser", e2e_calls, e2e_threads);
+            benchmark_end_to_end(args, "vegas", e2e_calls, e2e_threads);
+            benchmark_end_to_end(args, "quasi", e2e_calls, e2e_threads);
+            benchmark_end_to_end(args, "cubature", e2e_calls, e2e_threads);
+        }
+    }
+    catch (const mu::ParserError& e) {
+        cerr << "Parser error: " << e.GetMsg() << endl;
+        return 1;
+    }
+    catch (const exception& e) {
+        cerr << "Caught exception:" << endl << e.what() << endl;
+        return 1;
+    }
+    catch (const char* c) {
+        cerr << "Caught error message:" << endl << c << endl;
+        return 1;
+    }
+    return 0;
+}
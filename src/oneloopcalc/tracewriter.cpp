@@ -0,0 +1,245 @@
+#include <cstring>
+#include <ios>
+#include "../integration/integrationcontext.h"
+#include "tracewriter.h"
+
+using std::bitset;
+using std::ios_base;
+using std::string;
+using std::vector;
+
+/** The number of blocks in the ring of each thread */
+static const size_t ring_size = 4;
+/** The approximate size of each block, in bytes */
+static const size_t block_bytes = 1 << 18;
+
+/**
+ * The ring of blocks one thread writes its records into, and its sampling
+ * state. Only the owning thread touches anything but `ready`, `used`, and
+ * `tail`, which are protected by TraceWriter::mutex.
+ */
+struct TraceWriter::ThreadBuffer {
+    ThreadBuffer(const size_t values, const unsigned long seed) :
+      head(0), tail(0), fill(0), integration(-1), evaluations(0), seen(0), rng_state(seed) {
+        for (size_t i = 0; i < ring_size; i++) {
+            blocks[i] = new double[values];
+            used[i] = 0;
+            ready[i] = false;
+        }
+    }
+    ~ThreadBuffer() {
+        for (size_t i = 0; i < ring_size; i++) {
+            delete[] blocks[i];
+        }
+    }
+    /** A random number in [0, n), from a xorshift generator */
+    size_t random(const size_t n) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        return static_cast<size_t>(rng_state % n);
+    }
+
+    double* blocks[ring_size];
+    /** The number of records in each block that has been submitted */
+    size_t used[ring_size];
+    /** Whether each block is waiting to be written */
+    bool ready[ring_size];
+    /** The block being filled */
+    size_t head;
+    /** The next block to be written */
+    size_t tail;
+    /** The number of records in the block being filled */
+    size_t fill;
+    /** The number of the current integration, or -1 between integrations */
+    double integration;
+    /** The number of points seen in this thread, for 1-in-N sampling */
+    unsigned long evaluations;
+    /** The number of points offered to the reservoir in the current integration */
+    unsigned long seen;
+    /** The records sampled so far in the current integration */
+    vector<double> reservoir;
+    unsigned long long rng_state;
+};
+
+__thread TraceWriter::ThreadBuffer* TraceWriter::current_buffer = NULL;
+__thread const TraceWriter* TraceWriter::current_owner = NULL;
+
+TraceWriter::TraceWriter(const string& filename, const bitset<trace_variable::COUNT>& variables, const size_t sample_interval, const size_t reservoir_size) :
+  file(NULL),
+  sample_interval(sample_interval > 0 ? sample_interval : 1),
+  reservoir_size(reservoir_size),
+  block_records(1 + block_bytes / (sizeof(double) * (variables.count() + 3))),
+  next_integration(0),
+  stopping(false) {
+    file = fopen(filename.c_str(), "wb");
+    if (file == NULL) {
+        throw ios_base::failure("Unable to open trace file " + filename);
+    }
+    fputs("SOLO binary trace\n", file);
+    fputs("integration\n", file);
+    #define process(v) if (variables[static_cast<size_t>(trace_variable::v)]) { members.push_back(&IntegrationContext::v); fputs(#v "\n", file); }
+    #include "../integration/ictx_var_list.inc"
+    #undef process
+    fputs("real\nimag\nend_header\n", file);
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&ready, NULL);
+    pthread_cond_init(&space, NULL);
+    if (pthread_create(&writer, NULL, writer_main, this) != 0) {
+        pthread_cond_destroy(&space);
+        pthread_cond_destroy(&ready);
+        pthread_mutex_destroy(&mutex);
+        fclose(file);
+        throw "Unable to start the trace writer thread";
+    }
+}
+
+TraceWriter::~TraceWriter() {
+    // the threads that wrote to the buffers have finished by now
+    for (vector<ThreadBuffer*>::iterator it = buffers.begin(); it != buffers.end(); it++) {
+        end_integration(*it);
+        if ((*it)->fill > 0) {
+            submit(*it);
+        }
+    }
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(writer, NULL);
+
+    for (vector<ThreadBuffer*>::iterator it = buffers.begin(); it != buffers.end(); it++) {
+        delete *it;
+    }
+    if (current_owner == this) {
+        current_buffer = NULL;
+        current_owner = NULL;
+    }
+    pthread_cond_destroy(&space);
+    pthread_cond_destroy(&ready);
+    pthread_mutex_destroy(&mutex);
+    fclose(file);
+}
+
+TraceWriter::ThreadBuffer* TraceWriter::thread_buffer() {
+    if (current_owner != this) {
+        pthread_mutex_lock(&mutex);
+        current_buffer = new ThreadBuffer(block_records * record_size(), 88172645463325252ull + buffers.size());
+        buffers.push_back(current_buffer);
+        pthread_mutex_unlock(&mutex);
+        current_owner = this;
+    }
+    return current_buffer;
+}
+
+void TraceWriter::write(const IntegrationContext* ictx, const double real, const double imag) {
+    ThreadBuffer* b = thread_buffer();
+    if (ictx == NULL) {
+        end_integration(b);
+        if (b->fill > 0) {
+            // so that a crash doesn't lose the points of finished integrations
+            submit(b);
+        }
+        return;
+    }
+    if (b->integration < 0) {
+        pthread_mutex_lock(&mutex);
+        b->integration = static_cast<double>(next_integration++);
+        pthread_mutex_unlock(&mutex);
+    }
+    if (++b->evaluations % sample_interval != 0) {
+        return;
+    }
+    double* record;
+    if (reservoir_size == 0) {
+        record = next_record(b);
+    }
+    else if (b->seen++ < reservoir_size) {
+        b->reservoir.resize(b->reservoir.size() + record_size());
+        record = &b->reservoir[b->reservoir.size() - record_size()];
+    }
+    else {
+        // keep this point with probability reservoir_size / seen
+        const size_t j = b->random(b->seen);
+        if (j >= reservoir_size) {
+            return;
+        }
+        record = &b->reservoir[j * record_size()];
+    }
+    fill_record(record, b, ictx, real, imag);
+}
+
+void TraceWriter::fill_record(double* record, const ThreadBuffer* b, const IntegrationContext* ictx, const double real, const double imag) const {
+    *record++ = b->integration;
+    for (vector<double IntegrationContext::*>::const_iterator it = members.begin(); it != members.end(); it++) {
+        *record++ = ictx->*(*it);
+    }
+    *record++ = real;
+    *record = imag;
+}
+
+double* TraceWriter::next_record(ThreadBuffer* b) {
+    if (b->fill == block_records) {
+        submit(b);
+    }
+    return b->blocks[b->head] + record_size() * b->fill++;
+}
+
+void TraceWriter::submit(ThreadBuffer* b) {
+    pthread_mutex_lock(&mutex);
+    b->used[b->head] = b->fill;
+    b->ready[b->head] = true;
+    pthread_cond_signal(&ready);
+    b->head = (b->head + 1) % ring_size;
+    while (b->ready[b->head]) {
+        pthread_cond_wait(&space, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+    b->fill = 0;
+}
+
+void TraceWriter::end_integration(ThreadBuffer* b) {
+    const size_t n = b->reservoir.size() / record_size();
+    for (size_t i = 0; i < n; i++) {
+        memcpy(next_record(b), &b->reservoir[i * record_size()], record_size() * sizeof(double));
+    }
+    b->reservoir.clear();
+    b->seen = 0;
+    b->integration = -1;
+}
+
+void* TraceWriter::writer_main(void* closure) {
+    static_cast<TraceWriter*>(closure)->run_writer();
+    return NULL;
+}
+
+void TraceWriter::run_writer() {
+    pthread_mutex_lock(&mutex);
+    while (true) {
+        bool wrote = false;
+        // by index, because threads can add buffers while the mutex is released
+        for (size_t i = 0; i < buffers.size(); i++) {
+            ThreadBuffer* b = buffers[i];
+            while (b->ready[b->tail]) {
+                const size_t t = b->tail;
+                // the owning thread won't touch this block until it is marked free
+                pthread_mutex_unlock(&mutex);
+                fwrite(b->blocks[t], sizeof(double) * record_size(), b->used[t], file);
+                pthread_mutex_lock(&mutex);
+                b->ready[t] = false;
+                b->tail = (t + 1) % ring_size;
+                pthread_cond_broadcast(&space);
+                wrote = true;
+            }
+        }
+        if (!wrote) {
+            if (stopping) {
+                break;
+            }
+            pthread_cond_wait(&ready, &mutex);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    fflush(file);
+}
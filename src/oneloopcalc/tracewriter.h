@@ -0,0 +1,84 @@
+#pragma once
+
+#include <bitset>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "trace.h"
+
+class IntegrationContext;
+
+/**
+ * Writes the trace of integrand evaluations requested by `--trace` as
+ * fixed-size binary records, for `--trace-format=binary`.
+ *
+ * The file starts with a text header, ending with the line `end_header`,
+ * which lists the fields of each record, one per line. Each record is then
+ * that many native-endian doubles: the number of the integration the point
+ * belongs to (numbered in the order the integrations start, across all
+ * threads), the selected variables from the IntegrationContext in the order
+ * of ictx_var_list.inc, and the real and imaginary parts of the value.
+ * Records from different integrations may be interleaved.
+ *
+ * Each thread that calls write() gets its own ring of buffers, so recording
+ * a point only copies the selected variables; a background thread writes
+ * the buffers to the file as they fill up, as well as at the end of each
+ * integration. Only one point in every `sample_interval` is kept, and if
+ * `reservoir_size` is nonzero, only a uniform random sample of that many
+ * of the points kept from each integration is written when it ends.
+ */
+class TraceWriter {
+public:
+    TraceWriter(const std::string& filename, const std::bitset<trace_variable::COUNT>& variables, const size_t sample_interval, const size_t reservoir_size);
+    /** Writes out everything that is still buffered and closes the file */
+    ~TraceWriter();
+
+    /**
+     * Records one evaluation of the integrand, or, if `ictx` is `NULL`, the
+     * end of the calling thread's current integration
+     */
+    void write(const IntegrationContext* ictx, const double real, const double imag);
+
+    /** The number of doubles in each record */
+    size_t record_size() const { return members.size() + 3; }
+
+private:
+    struct ThreadBuffer;
+    /** The buffer of the calling thread, and the TraceWriter it belongs to */
+    static __thread ThreadBuffer* current_buffer;
+    static __thread const TraceWriter* current_owner;
+
+    /** The buffer of the calling thread, which is created on first use */
+    ThreadBuffer* thread_buffer();
+    /** A place to put the next record in the current block of `b`, passing full blocks to the writer thread */
+    double* next_record(ThreadBuffer* b);
+    /** Passes the current block of `b` to the writer thread and waits until the next one is free */
+    void submit(ThreadBuffer* b);
+    /** Ends the current integration of `b`, moving its reservoir, if any, into the ring */
+    void end_integration(ThreadBuffer* b);
+    void fill_record(double* record, const ThreadBuffer* b, const IntegrationContext* ictx, const double real, const double imag) const;
+
+    static void* writer_main(void* closure);
+    void run_writer();
+
+    FILE* file;
+    /** The selected variables */
+    std::vector<double IntegrationContext::*> members;
+    const size_t sample_interval;
+    const size_t reservoir_size;
+    /** The number of records in each block of the ring buffers */
+    const size_t block_records;
+
+    /** Protects all the fields below, and the block states of the buffers */
+    pthread_mutex_t mutex;
+    /** Signaled when a block is ready to be written, or when the writer should stop */
+    pthread_cond_t ready;
+    /** Signaled when a block has been written and can be filled again */
+    pthread_cond_t space;
+    std::vector<ThreadBuffer*> buffers;
+    /** The number of the next integration to start */
+    size_t next_integration;
+    bool stopping;
+    pthread_t writer;
+};
@@ -0,0 +1,90 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include "profile.h"
+
+namespace profile {
+
+__thread Counters* thread_counters = NULL;
+
+const char* component_name(const component c) {
+    switch (c) {
+        case INTEGRATION:
+            return "integration";
+        case INTEGRAND:
+            return "integrand";
+        case REGION_UPDATE:
+            return "region";
+        case LONGITUDINAL:
+            return "longitudinal";
+        case COUPLING:
+            return "coupling";
+        case GLUON_DISTRIBUTION:
+            return "gdist";
+        case PARTON_FUNCTIONS:
+            return "pdf/ff";
+        case PARSER:
+            return "parser";
+        default:
+            return "?";
+    }
+}
+
+Counters::Counters() : evaluations(0) {
+    std::fill(calls, calls + COMPONENT_COUNT, 0ul);
+    std::fill(seconds, seconds + COMPONENT_COUNT, 0.0);
+}
+
+void Counters::merge(const Counters& other) {
+    evaluations += other.evaluations;
+    for (size_t c = 0; c < COMPONENT_COUNT; c++) {
+        calls[c] += other.calls[c];
+        seconds[c] += other.seconds[c];
+    }
+}
+
+void merge(Profile& profile, const Profile& other) {
+    for (Profile::const_iterator it = other.begin(); it != other.end(); it++) {
+        profile[it->first].merge(it->second);
+    }
+}
+
+void write(std::ostream& out, const Profile& profile, const std::string& prefix) {
+    using std::setw;
+    const int lw = 32;
+    const int rw = 13;
+    out << prefix << std::left << setw(lw) << "type" << std::right << setw(rw) << "evaluations";
+    for (size_t c = 0; c < COMPONENT_COUNT; c++) {
+        out << setw(rw) << component_name(static_cast<component>(c));
+    }
+    // the time the integration routines spend outside the integrand
+    out << setw(rw) << "overhead" << std::endl;
+    for (Profile::const_iterator it = profile.begin(); it != profile.end(); it++) {
+        const Counters& counters = it->second;
+        out << prefix << std::left << setw(lw) << it->first << std::right << setw(rw) << counters.evaluations;
+        for (size_t c = 0; c < COMPONENT_COUNT; c++) {
+            out << setw(rw) << counters.seconds[c];
+        }
+        out << setw(rw) << counters.seconds[INTEGRATION] - counters.seconds[INTEGRAND] << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,156 @@
+/*
+ * Part of SOLO
+ *
+ * Copyright 2014 David Zaslavsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <time.h>
+
+/*
+ * Timers for the parts of the evaluation of the integrand, used by the
+ * --profile option of oneloopcalc.
+ *
+ * Each thread adds to the Counters it has attached with profile::Attach,
+ * if any, so the timers need no locking; the owner of the Counters merges
+ * them once the work is done. The PROFILE_* macros only do anything when
+ * SOLO_PROFILE is defined (by configuring with -DSOLO_PROFILE=ON), so in a
+ * normal build they cost nothing at all.
+ */
+
+namespace profile {
+
+/** The parts of the calculation that are timed separately */
+typedef enum {
+    /** A whole integration, including the integration routine itself */
+    INTEGRATION,
+    /** Evaluations of the integrand, including everything below */
+    INTEGRAND,
+    /** IntegrationRegion::update() */
+    REGION_UPDATE,
+    /** IntegrationContext::recalculate_longitudinal() */
+    LONGITUDINAL,
+    /** IntegrationContext::recalculate_coupling() */
+    COUPLING,
+    /** Calls to the gluon distribution, S2, S4, F, and Qs2 */
+    GLUON_DISTRIBUTION,
+    /** Updates of the PDF and FF and the parton luminosity factors */
+    PARTON_FUNCTIONS,
+    /** Evaluations of parsed hard factor expressions */
+    PARSER,
+    COMPONENT_COUNT
+} component;
+
+/** The label used for a component in the profile table */
+const char* component_name(const component c);
+
+/**
+ * The number of calls to, and total time spent in, each component, and the
+ * number of points at which the integrand was evaluated. INTEGRATION and
+ * INTEGRAND are timed on the thread running the integration; the parts of
+ * the integrand are summed over all the threads that evaluated it.
+ */
+class Counters {
+public:
+    Counters();
+    void merge(const Counters& other);
+
+    unsigned long evaluations;
+    unsigned long calls[COMPONENT_COUNT];
+    double seconds[COMPONENT_COUNT];
+};
+
+/** Counters for each type of term, by a label describing the type */
+typedef std::map<std::string, Counters> Profile;
+
+/** Adds all the counters in `other` to those with the same labels in `profile` */
+void merge(Profile& profile, const Profile& other);
+
+/**
+ * Writes a table of `profile`, one line for each type of term, each line
+ * starting with `prefix`
+ */
+void write(std::ostream& out, const Profile& profile, const std::string& prefix);
+
+/** The Counters attached to the calling thread, or NULL */
+extern __thread Counters* thread_counters;
+
+/** The time since some fixed point in the past, in seconds */
+inline double now() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/**
+ * Adds the time from its construction to its destruction, and one call,
+ * to a component of the calling thread's counters.
+ */
+class Timer {
+public:
+    Timer(const component c) : counters(thread_counters), c(c), start(counters ? now() : 0) {}
+    ~Timer() {
+        if (counters) {
+            counters->calls[c]++;
+            counters->seconds[c] += now() - start;
+        }
+    }
+private:
+    Counters* const counters;
+    const component c;
+    const double start;
+};
+
+/**
+ * Attaches `counters` (which may be NULL, to stop counting) to the calling
+ * thread for as long as it exists, then restores whatever was attached before.
+ */
+class Attach {
+public:
+    Attach(Counters* counters) : previous(thread_counters) { thread_counters = counters; }
+    ~Attach() { thread_counters = previous; }
+private:
+    Counters* const previous;
+};
+
+/** Adds `n` to the number of integrand evaluations in the calling thread's counters */
+inline void count_evaluations(const unsigned long n) {
+    if (thread_counters) {
+        thread_counters->evaluations += n;
+    }
+}
+
+}
+
+#ifdef SOLO_PROFILE
+/** Times the rest of the enclosing block as the given profile::component */
+#define PROFILE_SCOPE(c) profile::Timer _profile_timer(profile::c)
+/** Counts `n` evaluations of the integrand */
+#define PROFILE_EVALUATIONS(n) profile::count_evaluations(n)
+/** Attaches profile::Counters* `counters` to this thread for the rest of the enclosing block */
+#define PROFILE_ATTACH(counters) profile::Attach _profile_attach(counters)
+#else
+#define PROFILE_SCOPE(c)
+#define PROFILE_EVALUATIONS(n)
+#define PROFILE_ATTACH(counters)
+#endif
+
+#endif // _PROFILE_H_